@@ -0,0 +1,115 @@
+/*
+ * Microbenchmark: object id hex <-> binary conversion.
+ *
+ * Converts a million random SHA-1 and SHA-256 ids with each kernel of
+ * hex.c and with the byte-at-a-time sscanf()/snprintf() idiom, and
+ * reports millions of ids per second.
+ *
+ *   make bench && ./bench_hex
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hex.h"
+#include "thread_pool.h"
+
+#define NR_IDS 1000000
+
+static unsigned char *raw;      /* NR_IDS * rawsz bytes */
+static char *text;              /* NR_IDS * hexsz digits */
+
+static size_t encode_printf(size_t rawsz)
+{
+    for (size_t i = 0; i < NR_IDS; i++) {
+        char *out = text + i * 2 * rawsz;
+        for (size_t j = 0; j < rawsz; j++) {
+            char tmp[3];
+            snprintf(tmp, sizeof(tmp), "%02x", raw[i * rawsz + j]);
+            memcpy(out + 2 * j, tmp, 2);
+        }
+    }
+    return NR_IDS;
+}
+
+static size_t decode_sscanf(size_t rawsz)
+{
+    size_t ok = 0;
+    for (size_t i = 0; i < NR_IDS; i++) {
+        const char *in = text + i * 2 * rawsz;
+        size_t j;
+        for (j = 0; j < rawsz; j++) {
+            char tmp[3] = { in[2 * j], in[2 * j + 1], 0 };
+            if (sscanf(tmp, "%2hhx", &raw[i * rawsz + j]) != 1)
+                break;
+        }
+        ok += j == rawsz;
+    }
+    return ok;
+}
+
+static size_t encode_kernel(size_t rawsz)
+{
+    for (size_t i = 0; i < NR_IDS; i++)
+        hex_encode(text + i * 2 * rawsz, raw + i * rawsz, rawsz);
+    return NR_IDS;
+}
+
+static size_t decode_kernel(size_t rawsz)
+{
+    size_t ok = 0;
+    for (size_t i = 0; i < NR_IDS; i++)
+        ok += hex_decode(raw + i * rawsz, text + i * 2 * rawsz, rawsz) == 0;
+    return ok;
+}
+
+/* Repeat [expr] for at least 0.2s and report ids per second. */
+#define TIME(label, expr)                                                   \
+    do {                                                                    \
+        size_t result = 0, rounds = 0;                                      \
+        double start = monotonic_seconds(), elapsed;                        \
+        do {                                                                \
+            result = (expr);                                                \
+            rounds++;                                                       \
+        } while ((elapsed = monotonic_seconds() - start) < 0.2);            \
+        printf("  %-24s %8zu ok %9.1f M ids/s\n", label, result,            \
+               (double)NR_IDS * rounds / elapsed / 1e6);                    \
+    } while (0)
+
+int main(void)
+{
+    const hash_algo_t algos[] = { HASH_SHA1, HASH_SHA256 };
+    enum scan_kernel best = hex_active_kernel();
+
+    raw = malloc((size_t)NR_IDS * MAX_RAW_OID_LENGTH);
+    text = malloc((size_t)NR_IDS * MAX_HEX_OID_LENGTH);
+    if (!raw || !text)
+        return 1;
+
+    srand(1);
+    for (size_t i = 0; i < (size_t)NR_IDS * MAX_RAW_OID_LENGTH; i++)
+        raw[i] = (unsigned char)rand();
+
+    for (int a = 0; a < 2; a++) {
+        size_t rawsz = hash_algo_rawsz(algos[a]);
+        char label[64];
+
+        printf("%s:\n", a ? "sha256" : "sha1");
+        TIME("encode snprintf", encode_printf(rawsz));
+        TIME("decode sscanf", decode_sscanf(rawsz));
+        for (int k = SCAN_KERNEL_SCALAR; k <= SCAN_KERNEL_AVX2; k++) {
+            if (hex_force_kernel(k) < 0)
+                continue;
+            snprintf(label, sizeof(label), "encode %s", scan_kernel_name(k));
+            TIME(label, encode_kernel(rawsz));
+            snprintf(label, sizeof(label), "decode %s", scan_kernel_name(k));
+            TIME(label, decode_kernel(rawsz));
+        }
+    }
+
+    hex_force_kernel(best);
+    free(raw);
+    free(text);
+    return 0;
+}
@@ -0,0 +1,280 @@
+/*
+ * Microbenchmark: tree and commit header scanning.
+ *
+ * Loads every tree and commit of a repository, loose and packed, into
+ * memory and compares the memchr()/strncmp() scanning that process()
+ * used to do with the byte_scanner kernels (scalar, SSE2, AVX2).
+ *
+ *   make bench && ./bench_scan path/to/repo/.git
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hex.h"
+#include "pack.h"
+#include "repository.h"
+#include "scan.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+struct buffers {
+    char **data;
+    size_t *len;
+    size_t nr, alloc;
+    size_t bytes;
+};
+
+static void buffers_add(struct buffers *b, char *data, size_t len)
+{
+    if (b->nr == b->alloc) {
+        b->alloc = b->alloc ? 2 * b->alloc : 256;
+        b->data = realloc(b->data, b->alloc * sizeof(*b->data));
+        b->len = realloc(b->len, b->alloc * sizeof(*b->len));
+    }
+    b->data[b->nr] = data;
+    b->len[b->nr++] = len;
+    b->bytes += len;
+}
+
+/* Keep [buf] if it is a tree or a commit, free it otherwise. */
+static void keep_object(struct buffers *trees, struct buffers *commits,
+                        enum object_type type, char *buf, size_t size)
+{
+    if (type == OBJ_TREE)
+        buffers_add(trees, buf, size);
+    else if (type == OBJ_COMMIT)
+        buffers_add(commits, buf, size);
+    else
+        free(buf);
+}
+
+/* The trees and commits of every pack, found through its index. */
+static void load_packed(struct repository *repo, struct buffers *trees,
+                        struct buffers *commits)
+{
+    struct delta_base_cache cache;
+    delta_base_cache_init(&cache, DELTA_CACHE_WORKER_BYTES);
+
+    for (struct packed_git *p = repo->packs; p; p = p->next) {
+        for (uint32_t i = 0; i < p->nr_objects; i++) {
+            uint64_t offset = pack_nth_offset(p, i);
+            enum object_type type;
+            size_t size;
+
+            /* blobs are skipped from their header, without inflating them */
+            if (pack_read_object_info(p, offset, &type, &size) < 0 ||
+                (type != OBJ_TREE && type != OBJ_COMMIT))
+                continue;
+            char *buf = pack_read_object(p, offset, &type, &size, &cache);
+            if (buf)
+                keep_object(trees, commits, type, buf, size);
+        }
+    }
+    delta_base_cache_clear(&cache);
+}
+
+static void load_objects(struct repository *repo, struct buffers *trees,
+                         struct buffers *commits)
+{
+    load_packed(repo, trees, commits);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/objects", repo->gitdir);
+
+    DIR *d = opendir(path);
+    if (!d)
+        return;
+
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        if (strlen(de->d_name) != 2)
+            continue;
+
+        char sub[4096 + 8];
+        snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+        DIR *d2 = opendir(sub);
+        if (!d2)
+            continue;
+
+        struct dirent *de2;
+        while ((de2 = readdir(d2))) {
+            if (de2->d_name[0] == '.')
+                continue;
+
+            char hex[600];
+            struct object_id oid;
+            snprintf(hex, sizeof(hex), "%s%s", de->d_name, de2->d_name);
+            if (oid_set_hex(&oid, hex, strlen(hex), repo->hash_algo) < 0)
+                continue;
+
+            enum object_type type;
+            size_t size;
+            char *buf = repo_read_object_data(repo, &oid, &type, &size);
+            if (buf)
+                keep_object(trees, commits, type, buf, size);
+        }
+        closedir(d2);
+    }
+    closedir(d);
+}
+
+/* ---- baselines: the per-entry / per-line scanning process() did ---- */
+
+static size_t trees_memchr(const struct buffers *b, size_t oid_len)
+{
+    size_t entries = 0;
+    for (size_t i = 0; i < b->nr; i++) {
+        const char *p = b->data[i], *end = p + b->len[i];
+        while (p < end) {
+            const char *sp = memchr(p, ' ', end - p);
+            const char *nul = sp ? memchr(sp + 1, '\0', end - sp - 1) : NULL;
+            if (!nul)
+                break;
+            p = nul + 1 + oid_len;
+            entries++;
+        }
+    }
+    return entries;
+}
+
+static size_t commits_strncmp(const struct buffers *b)
+{
+    static const char *prefixes[] = {
+        "tree ", "parent ", "author ", "committer ", "encoding ", "gpgsig "
+    };
+    size_t lines = 0;
+    for (size_t i = 0; i < b->nr; i++) {
+        const char *p = b->data[i], *end = p + b->len[i];
+        while (p < end && *p != '\n') {
+            const char *eol = memchr(p, '\n', end - p);
+            if (!eol)
+                break;
+            for (size_t k = 0; k < sizeof(prefixes) / sizeof(*prefixes); k++) {
+                if (strncmp(p, prefixes[k], strlen(prefixes[k])) == 0) {
+                    lines++;
+                    break;
+                }
+            }
+            p = eol + 1;
+        }
+    }
+    return lines;
+}
+
+/* ---- scanner versions ---- */
+
+static size_t trees_scanner(const struct buffers *b, size_t oid_len)
+{
+    size_t entries = 0;
+    for (size_t i = 0; i < b->nr; i++) {
+        struct byte_scanner s;
+        size_t pos = 0, len = b->len[i];
+        scanner_init(&s, b->data[i], len, ' ', '\0');
+        while (pos < len) {
+            size_t sp = scanner_next(&s, pos, 0);
+            size_t nul = scanner_next(&s, sp + 1, 1);
+            if (nul >= len)
+                break;
+            pos = nul + 1 + oid_len;
+            entries++;
+        }
+    }
+    return entries;
+}
+
+static size_t trees_tree_desc(const struct buffers *b, size_t oid_len)
+{
+    size_t entries = 0;
+    for (size_t i = 0; i < b->nr; i++) {
+        struct tree_desc desc;
+        struct name_entry entry;
+        init_tree_desc(&desc, b->data[i], b->len[i], oid_len, 0);
+        while (tree_desc_next(&desc, &entry) > 0)
+            entries++;
+    }
+    return entries;
+}
+
+static size_t commits_classify(const struct buffers *b)
+{
+    size_t lines = 0;
+    for (size_t i = 0; i < b->nr; i++) {
+        struct byte_scanner s;
+        size_t pos = 0, len = b->len[i], key_len;
+        scanner_init(&s, b->data[i], len, '\n', '\n');
+        while (pos < len) {
+            size_t eol = scanner_next(&s, pos, 0);
+            if (eol >= len)
+                break;
+            enum header_kind kind = classify_header_line(b->data[i] + pos, eol - pos, &key_len);
+            if (kind == HEADER_BLANK)
+                break;
+            if (kind != HEADER_OTHER && kind != HEADER_CONTINUATION)
+                lines++;
+            pos = eol + 1;
+        }
+    }
+    return lines;
+}
+
+/* Repeat [fn] for at least 0.2s and report MB/s over [bytes]. */
+#define TIME(label, bytes, expr)                                            \
+    do {                                                                    \
+        size_t result = 0, rounds = 0;                                      \
+        double start = monotonic_seconds(), elapsed;                        \
+        do {                                                                \
+            result = (expr);                                                \
+            rounds++;                                                       \
+        } while ((elapsed = monotonic_seconds() - start) < 0.2);            \
+        printf("  %-28s %10zu items %9.1f MB/s\n", label, result,           \
+               (double)(bytes) * rounds / elapsed / 1e6);                   \
+    } while (0)
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <gitdir>\n", argv[0]);
+        return 1;
+    }
+
+    struct repository repo = {0};
+    repo.gitdir = argv[1];
+    repo.hash_algo = detect_repo_hash(argv[1]);
+    repo_prepare_packs(&repo);
+    size_t oid_len = hash_algo_rawsz(repo.hash_algo);
+
+    struct buffers trees = {0}, commits = {0};
+    load_objects(&repo, &trees, &commits);
+    printf("%zu trees (%zu bytes), %zu commits (%zu bytes)\n",
+           trees.nr, trees.bytes, commits.nr, commits.bytes);
+
+    enum scan_kernel best = scan_active_kernel();
+
+    printf("trees:\n");
+    TIME("memchr (baseline)", trees.bytes, trees_memchr(&trees, oid_len));
+    for (int k = SCAN_KERNEL_SCALAR; k <= SCAN_KERNEL_AVX2; k++) {
+        char label[64];
+        if (scan_force_kernel(k) < 0)
+            continue;
+        snprintf(label, sizeof(label), "scanner %s", scan_kernel_name(k));
+        TIME(label, trees.bytes, trees_scanner(&trees, oid_len));
+        snprintf(label, sizeof(label), "tree_desc %s", scan_kernel_name(k));
+        TIME(label, trees.bytes, trees_tree_desc(&trees, oid_len));
+    }
+
+    printf("commit headers:\n");
+    TIME("memchr+strncmp (baseline)", commits.bytes, commits_strncmp(&commits));
+    for (int k = SCAN_KERNEL_SCALAR; k <= SCAN_KERNEL_AVX2; k++) {
+        char label[64];
+        if (scan_force_kernel(k) < 0)
+            continue;
+        snprintf(label, sizeof(label), "classify %s", scan_kernel_name(k));
+        TIME(label, commits.bytes, commits_classify(&commits));
+    }
+
+    scan_force_kernel(best);
+    return 0;
+}
@@ -0,0 +1,513 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "checkout.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log.h"
+#include "hash.h"
+#include "hex.h"
+#include "pack.h"
+#include "repository.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+/* Files handed to a worker at a time. */
+#define CHECKOUT_CHUNK 16
+
+/* Read size when hashing a file already in the worktree. */
+#define CHECKOUT_HASH_BUFFER (64u << 10)
+
+
+/* One blob to write. */
+struct checkout_item {
+    size_t path;                /* offset in checkout_state.paths */
+    unsigned mode;
+    struct object_id oid;
+};
+
+struct checkout_worker {
+    struct delta_base_cache cache;
+    struct hash_ctx ctx;
+    char *buf;                  /* CHECKOUT_HASH_BUFFER bytes */
+    size_t nr_written, bytes_written;
+    int failed;
+};
+
+struct checkout_state {
+    struct repository *repo;
+    size_t rawsz;
+
+    /* full paths, worktree included, NUL-terminated */
+    char *paths;
+    size_t paths_len, paths_alloc;
+
+    struct checkout_item *items;
+    size_t nr, alloc;
+    size_t *dirs;               /* offsets in paths, parents first */
+    size_t nr_dirs, alloc_dirs;
+
+    struct checkout_worker *workers;
+};
+
+
+/* ---- listing the tree ---- */
+
+/* Copy [path] into st->paths and return its offset, or -1. */
+static long add_path(struct checkout_state *st, const char *path, size_t len)
+{
+    if (st->paths_len + len + 1 > st->paths_alloc) {
+        size_t alloc = st->paths_alloc ? st->paths_alloc : 4096;
+        while (alloc < st->paths_len + len + 1)
+            alloc *= 2;
+        char *tmp = realloc(st->paths, alloc);
+        if (!tmp)
+            return -1;
+        st->paths = tmp;
+        st->paths_alloc = alloc;
+    }
+
+    long off = st->paths_len;
+    memcpy(st->paths + off, path, len);
+    st->paths[off + len] = '\0';
+    st->paths_len += len + 1;
+    return off;
+}
+
+static int add_dir(struct checkout_state *st, const char *path, size_t len)
+{
+    if (st->nr_dirs == st->alloc_dirs) {
+        size_t alloc = st->alloc_dirs ? 2 * st->alloc_dirs : 256;
+        size_t *tmp = realloc(st->dirs, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        st->dirs = tmp;
+        st->alloc_dirs = alloc;
+    }
+
+    long off = add_path(st, path, len);
+    if (off < 0)
+        return -1;
+    st->dirs[st->nr_dirs++] = off;
+    return 0;
+}
+
+static int add_item(struct checkout_state *st, const char *path, size_t len,
+                    const struct name_entry *entry)
+{
+    if (st->nr == st->alloc) {
+        size_t alloc = st->alloc ? 2 * st->alloc : 1024;
+        struct checkout_item *tmp = realloc(st->items, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        st->items = tmp;
+        st->alloc = alloc;
+    }
+
+    long off = add_path(st, path, len);
+    if (off < 0)
+        return -1;
+    struct checkout_item *item = &st->items[st->nr++];
+    item->path = off;
+    item->mode = entry->mode;
+    oid_set_raw(&item->oid, entry->oid, st->repo->hash_algo);
+    return 0;
+}
+
+/*
+ * List the directories and blobs of [oid], whose worktree path is the
+ * first [len] bytes of [path] (a buffer of [alloc] bytes).
+ */
+static int list_tree(struct checkout_state *st, const struct object_id *oid,
+                     char **path, size_t *alloc, size_t len)
+{
+    enum object_type type;
+    size_t size;
+    /* the pool is idle while the tree is listed */
+    char *buf = repo_read_object_cached(st->repo, oid, &type, &size,
+                                        &st->workers[0].cache);
+    if (!buf || type != OBJ_TREE) {
+        ERROR("cannot read tree %s", oid_to_hex(oid));
+        free(buf);
+        return -1;
+    }
+
+    struct tree_desc desc;
+    struct name_entry entry;
+    struct object_id child;
+    int ret;
+
+    init_tree_desc(&desc, buf, size, st->rawsz, 0);
+    while ((ret = tree_desc_next(&desc, &entry)) > 0) {
+        size_t n = len + 1 + entry.pathlen;
+
+        /* "..", ".git" or "a/b" would write outside the worktree or into a repository */
+        if (!verify_path_component(entry.path, entry.pathlen)) {
+            ERROR("invalid path '%.*s' in tree %s", (int)entry.pathlen, entry.path,
+                  oid_to_hex(oid));
+            ret = -1;
+            break;
+        }
+        if (n + 1 > *alloc) {
+            size_t a = 2 * *alloc;
+            while (a < n + 1)
+                a *= 2;
+            char *tmp = realloc(*path, a);
+            if (!tmp) {
+                ret = -1;
+                break;
+            }
+            *path = tmp;
+            *alloc = a;
+        }
+        (*path)[len] = '/';
+        memcpy(*path + len + 1, entry.path, entry.pathlen);
+        (*path)[n] = '\0';
+
+        if (S_ISDIR_MODE(entry.mode)) {
+            oid_set_raw(&child, entry.oid, st->repo->hash_algo);
+            if ((ret = add_dir(st, *path, n)) < 0 ||
+                (ret = list_tree(st, &child, path, alloc, n)) < 0)
+                break;
+        } else if (S_ISGITLINK_MODE(entry.mode)) {
+            if ((ret = add_dir(st, *path, n)) < 0)
+                break;
+        } else if ((ret = add_item(st, *path, n, &entry)) < 0) {
+            break;
+        }
+    }
+    if (ret < 0)
+        ERROR("cannot list tree %s", oid_to_hex(oid));
+    free(buf);
+    return ret < 0 ? -1 : 0;
+}
+
+
+/* ---- directories ---- */
+
+/* mkdir() [path], replacing a file or symlink in the way. Returns 1 if created. */
+static int make_dir(const char *path)
+{
+    struct stat sb;
+
+    if (!mkdir(path, 0777))
+        return 1;
+    if (errno == EEXIST && !lstat(path, &sb)) {
+        if (S_ISDIR(sb.st_mode))
+            return 0;
+        if (!unlink(path) && !mkdir(path, 0777))
+            return 1;
+    }
+    ERROR("cannot create directory %s: %s", path, strerror(errno));
+    return -1;
+}
+
+
+/* ---- files ---- */
+
+/* Whether the regular file [path] of [sb] holds the blob [oid]. */
+static int file_matches(struct checkout_state *st, struct checkout_worker *w,
+                        const char *path, const struct stat *sb,
+                        const struct object_id *oid)
+{
+    unsigned char digest[32];
+    char header[32];
+    size_t left = sb->st_size;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return 0;
+    if (hash_init(&w->ctx, st->repo->hash_algo) < 0 ||
+        hash_update(&w->ctx, header,
+                    snprintf(header, sizeof(header), "blob %zu", left) + 1) < 0) {
+        close(fd);
+        return 0;
+    }
+    while (left) {
+        ssize_t n = read(fd, w->buf, left < CHECKOUT_HASH_BUFFER ? left : CHECKOUT_HASH_BUFFER);
+        if (n <= 0 || hash_update(&w->ctx, w->buf, n) < 0)
+            break;
+        left -= n;
+    }
+    close(fd);
+    if (left || hash_final(&w->ctx, digest) < 0)
+        return 0;
+    return !memcmp(digest, oid->hash, st->rawsz);
+}
+
+/* Set or clear the executable bits of [path] to match [mode]. */
+static int fix_mode(const char *path, const struct stat *sb, unsigned mode)
+{
+    int want_exec = mode == 0100755;
+
+    if (!!(sb->st_mode & S_IXUSR) == want_exec)
+        return 0;
+    /* like git: executable wherever it is readable */
+    mode_t m = want_exec ? sb->st_mode | ((sb->st_mode & 0444) >> 2)
+                         : sb->st_mode & ~0111;
+    return chmod(path, m & 07777);
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Replace whatever is at [path] with [buf], as a symlink or a file of [mode]. */
+static int write_entry(const char *path, unsigned mode, const char *buf, size_t size)
+{
+    if (unlink(path) && errno != ENOENT) {
+        ERROR("cannot remove %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    if ((mode & 0170000) == 0120000) {
+        if (symlink(buf, path)) {
+            ERROR("cannot create symlink %s: %s", path, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, mode == 0100755 ? 0777 : 0666);
+    if (fd < 0) {
+        ERROR("cannot create %s: %s", path, strerror(errno));
+        return -1;
+    }
+    int err = write_all(fd, buf, size);
+    if (close(fd) < 0)
+        err = -1;
+    if (err) {
+        ERROR("cannot write %s: %s", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void checkout_one(void *data, size_t i, int worker)
+{
+    struct checkout_state *st = data;
+    struct checkout_worker *w = &st->workers[worker];
+    struct checkout_item *item = &st->items[i];
+    const char *path = st->paths + item->path;
+    int is_link = (item->mode & 0170000) == 0120000;
+    struct stat sb;
+    int exists = !lstat(path, &sb);
+
+    if (exists && S_ISDIR(sb.st_mode)) {
+        ERROR("%s is in the way: it is a directory", path);
+        w->failed = 1;
+        return;
+    }
+    if (exists && !is_link && S_ISREG(sb.st_mode) &&
+        file_matches(st, w, path, &sb, &item->oid)) {
+        if (fix_mode(path, &sb, item->mode) < 0) {
+            ERROR("cannot chmod %s: %s", path, strerror(errno));
+            w->failed = 1;
+        }
+        return;
+    }
+
+    enum object_type type;
+    size_t size;
+    char *buf = repo_read_object_cached(st->repo, &item->oid, &type, &size, &w->cache);
+    if (!buf || type != OBJ_BLOB) {
+        ERROR("cannot read blob %s for %s", oid_to_hex(&item->oid), path);
+        w->failed = 1;
+        free(buf);
+        return;
+    }
+
+    if (exists && is_link && S_ISLNK(sb.st_mode) && (size_t)sb.st_size == size) {
+        /* the blob is NUL-terminated, and so is the target read back */
+        char *target = malloc(size + 1);
+        int same = target && readlink(path, target, size + 1) == (ssize_t)size &&
+                   !memcmp(target, buf, size);
+        free(target);
+        if (same) {
+            free(buf);
+            return;
+        }
+    }
+
+    if (write_entry(path, item->mode, buf, size) < 0) {
+        w->failed = 1;
+    } else {
+        w->nr_written++;
+        w->bytes_written += size;
+    }
+    free(buf);
+}
+
+
+int checkout_tree(struct repository *repo, const struct object_id *tree,
+                  const struct checkout_options *opts, struct checkout_stats *stats)
+{
+    struct checkout_state st;
+    struct checkout_stats dummy;
+    struct thread_pool *pool = NULL;
+    int nr_workers = 0, ret = -1;
+    double start;
+
+    if (!stats)
+        stats = &dummy;
+    memset(stats, 0, sizeof(*stats));
+    memset(&st, 0, sizeof(st));
+    st.repo = repo;
+    st.rawsz = hash_algo_rawsz(repo->hash_algo);
+    if (!repo->worktree) {
+        ERROR("%s has no worktree", repo->gitdir);
+        return -1;
+    }
+
+    pool = thread_pool_create(opts->nr_threads);
+    if (!pool)
+        return -1;
+    nr_workers = thread_pool_nr_threads(pool);
+    st.workers = calloc(nr_workers, sizeof(*st.workers));
+    if (!st.workers)
+        goto out;
+    for (int i = 0; i < nr_workers; i++) {
+        delta_base_cache_init(&st.workers[i].cache, DELTA_CACHE_WORKER_BYTES);
+        if (!(st.workers[i].buf = malloc(CHECKOUT_HASH_BUFFER)))
+            goto out;
+    }
+
+    start = monotonic_seconds();
+    size_t len = strlen(repo->worktree), alloc = len + 256;
+    while (len > 1 && repo->worktree[len - 1] == '/')
+        len--;
+    char *path = malloc(alloc);
+    if (!path)
+        goto out;
+    memcpy(path, repo->worktree, len);
+    path[len] = '\0';
+    if (list_tree(&st, tree, &path, &alloc, len) < 0) {
+        free(path);
+        goto out;
+    }
+    path[len] = '\0';
+    stats->nr_files = st.nr;
+    stats->list_seconds = monotonic_seconds() - start;
+
+    start = monotonic_seconds();
+    int created = make_dir(path);
+    free(path);
+    if (created < 0)
+        goto out;
+    stats->nr_dirs = created;
+    for (size_t i = 0; i < st.nr_dirs; i++) {
+        if ((created = make_dir(st.paths + st.dirs[i])) < 0)
+            goto out;
+        stats->nr_dirs += created;
+    }
+    stats->mkdir_seconds = monotonic_seconds() - start;
+
+    start = monotonic_seconds();
+    thread_pool_for(pool, st.nr, CHECKOUT_CHUNK, checkout_one, &st);
+    stats->write_seconds = monotonic_seconds() - start;
+
+    ret = 0;
+    for (int i = 0; i < nr_workers; i++) {
+        stats->nr_written += st.workers[i].nr_written;
+        stats->bytes_written += st.workers[i].bytes_written;
+        if (st.workers[i].failed)
+            ret = -1;
+    }
+    stats->nr_uptodate = stats->nr_files - stats->nr_written;
+
+out:
+    thread_pool_destroy(pool);
+    for (int i = 0; st.workers && i < nr_workers; i++) {
+        delta_base_cache_clear(&st.workers[i].cache);
+        hash_ctx_release(&st.workers[i].ctx);
+        free(st.workers[i].buf);
+    }
+    free(st.workers);
+    free(st.items);
+    free(st.dirs);
+    free(st.paths);
+    return ret;
+}
+
+
+/* ---- command ---- */
+
+int cmd_checkout(int argc, char **argv)
+{
+    static const char usage[] =
+        "usage: checkout [-q] [-j <threads>] <gitdir> <tree-ish> [<worktree>]\n";
+    struct checkout_options opts = { 0 };
+    struct checkout_stats stats;
+    int quiet = 0, i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-q"))
+            quiet = 1;
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            opts.nr_threads = atoi(argv[++i]);
+        else
+            break;
+    }
+    if (argc - i < 2 || argc - i > 3) {
+        fprintf(stderr, "%s", usage);
+        return 128;
+    }
+
+    struct repository repo;
+    if (repo_open(&repo, argv[i]) < 0) {
+        ERROR("%s is not a git directory", argv[i]);
+        return 128;
+    }
+    repo.worktree = argc - i == 3 ? strdup(argv[i + 2]) : repo_default_worktree(argv[i]);
+    if (!repo.worktree) {
+        ERROR("no worktree given and %s is not called .git", argv[i]);
+        repo_clear(&repo);
+        return 128;
+    }
+
+    const char *name = argv[i + 1];
+    struct object_id oid, tree;
+    size_t size;
+    int ret = 128;
+
+    if (repo_resolve_ref(&repo, name, &oid) < 0) {
+        ERROR("unknown revision %s", name);
+    } else {
+        void *body = repo_read_object_peeled(&repo, oid_to_hex(&oid), OBJ_TREE,
+                                             &size, &tree);
+        if (!body) {
+            ERROR("%s is not a tree-ish", name);
+        } else {
+            free(body);
+            if (checkout_tree(&repo, &tree, &opts, &stats) == 0)
+                ret = 0;
+            if (!quiet)
+                fprintf(stderr,
+                        "%zu files: %zu written (%.1f MB), %zu up to date; %zu directories created\n"
+                        "  list   %.3fs\n"
+                        "  mkdir  %.3fs\n"
+                        "  write  %.3fs\n",
+                        stats.nr_files, stats.nr_written, stats.bytes_written / 1e6,
+                        stats.nr_uptodate, stats.nr_dirs,
+                        stats.list_seconds, stats.mkdir_seconds, stats.write_seconds);
+        }
+    }
+
+    repo_clear(&repo);
+    return ret;
+}
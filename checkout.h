@@ -0,0 +1,57 @@
+#ifndef CHECKOUT_H
+#define CHECKOUT_H
+
+#include <stddef.h>
+#include "object.h"
+
+struct repository;
+
+/*
+ * Writing a tree out into repo->worktree.
+ *
+ * The tree is walked first to list its directories and files in tree
+ * order. Every directory is then created from the calling thread,
+ * parents first, so that the workers never race on mkdir(). Finally a
+ * thread pool takes the files: each worker hashes what is already on
+ * disk and leaves it alone if it is the right blob (only fixing the
+ * executable bit if needed), and otherwise reads the blob with its own
+ * delta base cache and writes it out, replacing the old file.
+ *
+ * Files are created 0666 or 0777 (executables) and left to the umask,
+ * symlinks with symlink(), and submodules as empty directories, as git
+ * does. Paths in the worktree that the tree does not mention are not
+ * touched, except a file or symlink standing where a directory must
+ * go; a directory standing where a file must go is an error.
+ */
+struct checkout_options {
+    int nr_threads;             /* 0: one per online CPU */
+};
+
+struct checkout_stats {
+    size_t nr_files;            /* blobs in the tree, symlinks included */
+    size_t nr_written;
+    size_t nr_uptodate;         /* already there (nr_files - nr_written) */
+    size_t nr_dirs;             /* directories created */
+    size_t bytes_written;
+
+    /* wall-clock time of each phase */
+    double list_seconds, mkdir_seconds, write_seconds;
+};
+
+/*
+ * Check out [tree] into repo->worktree, creating it if it does not
+ * exist. [stats] may be NULL. Returns 0, or -1 if an object cannot be
+ * read or a path cannot be written (the rest are still written).
+ */
+int checkout_tree(struct repository *repo, const struct object_id *tree,
+                  const struct checkout_options *opts, struct checkout_stats *stats);
+
+/*
+ * "checkout [-q] [-j <threads>] <gitdir> <tree-ish> [<worktree>]": check
+ * out the tree into <worktree>, by default the directory holding a
+ * gitdir called .git, then print how long each phase took unless -q
+ * is given. Exits with 0, or 128 on error.
+ */
+int cmd_checkout(int argc, char **argv);
+
+#endif /* CHECKOUT_H */
@@ -0,0 +1,238 @@
+#include "commit.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "hex.h"
+#include "log.h"
+#include "scan.h"
+
+
+static int64_t parse_decimal(const char **cursor, const char *end)
+{
+    const char *p = *cursor;
+    int64_t value = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+        value = value * 10 + (*p++ - '0');
+    *cursor = p;
+    return value;
+}
+
+
+int parse_ident(const char *line, size_t len, struct ident *out)
+{
+    const char *end = line + len;
+
+    memset(out, 0, sizeof(*out));
+
+    const char *lt = memchr(line, '<', len);
+    if (!lt)
+        return -1;
+    const char *gt = memchr(lt, '>', end - lt);
+    if (!gt)
+        return -1;
+
+    const char *name_end = lt;
+    while (name_end > line && name_end[-1] == ' ')
+        name_end--;
+
+    out->name.ptr = line;
+    out->name.len = name_end - line;
+    out->email.ptr = lt + 1;
+    out->email.len = gt - (lt + 1);
+
+    /* " 1700000000 +0100" */
+    const char *p = gt + 1;
+    while (p < end && *p == ' ')
+        p++;
+    const char *digits = p;
+    out->timestamp = parse_decimal(&p, end);
+    if (p == digits)
+        return 0;
+
+    while (p < end && *p == ' ')
+        p++;
+    if (p < end && (*p == '+' || *p == '-')) {
+        int sign = (*p == '-') ? -1 : 1;
+        p++;
+        out->tz = sign * (int)parse_decimal(&p, end);
+    }
+    return 0;
+}
+
+
+/*
+ * Classify the header line starting at [pos] and find its end. The end
+ * of the buffer reads as a blank line; a line without '\n' is -1.
+ */
+static int next_header(struct byte_scanner *scan, size_t pos,
+                       size_t *eol, size_t *key_len)
+{
+    if (pos >= scan->len) {
+        *eol = scan->len;
+        *key_len = 0;
+        return HEADER_BLANK;
+    }
+
+    *eol = scanner_next(scan, pos, 0);
+    if (*eol >= scan->len)
+        return -1;
+    return classify_header_line((const char *)scan->buf + pos, *eol - pos, key_len);
+}
+
+
+int parse_commit_buffer(struct commit_object *c, const char *buf, size_t len,
+                        hash_algo_t algo)
+{
+    struct byte_scanner scan;
+    size_t pos = 0, eol, key_len;
+    int kind;
+
+    c->parents = NULL;
+    c->parent_count = 0;
+    c->encoding = (struct slice){ NULL, 0 };
+    c->gpgsig = (struct slice){ NULL, 0 };
+
+    /* every line end comes out of one forward pass over the buffer */
+    scanner_init(&scan, buf, len, '\n', '\n');
+
+    /* tree <hex> */
+    kind = next_header(&scan, pos, &eol, &key_len);
+    if (kind != HEADER_TREE ||
+        oid_set_hex(&c->tree, buf + pos + key_len, eol - pos - key_len, algo) < 0) {
+        ERROR("commit has no valid tree line");
+        return -1;
+    }
+    pos = eol + 1;
+
+    /* parent <hex>, zero or more: count them first, allocate once */
+    size_t nr = 0;
+    size_t parents_start = pos;
+    while (next_header(&scan, pos, &eol, &key_len) == HEADER_PARENT) {
+        nr++;
+        pos = eol + 1;
+    }
+
+    if (nr) {
+        c->parents = calloc(nr, sizeof(*c->parents));
+        if (!c->parents)
+            return -1;
+
+        pos = parents_start;
+        for (size_t i = 0; i < nr; i++) {
+            next_header(&scan, pos, &eol, &key_len);
+            if (oid_set_hex(&c->parents[i], buf + pos + key_len,
+                            eol - pos - key_len, algo) < 0) {
+                ERROR("commit has an invalid parent line");
+                goto fail;
+            }
+            pos = eol + 1;
+        }
+        c->parent_count = nr;
+    }
+
+    /* author and committer */
+    kind = next_header(&scan, pos, &eol, &key_len);
+    if (kind != HEADER_AUTHOR ||
+        parse_ident(buf + pos + key_len, eol - pos - key_len, &c->author) < 0) {
+        ERROR("commit has no valid author line");
+        goto fail;
+    }
+    pos = eol + 1;
+
+    kind = next_header(&scan, pos, &eol, &key_len);
+    if (kind != HEADER_COMMITTER ||
+        parse_ident(buf + pos + key_len, eol - pos - key_len, &c->committer) < 0) {
+        ERROR("commit has no valid committer line");
+        goto fail;
+    }
+    pos = eol + 1;
+
+    /*
+     * Remaining headers up to the blank line. A line starting with a
+     * space continues the previous header (gpgsig, mergetag).
+     */
+    size_t extra_start = pos;
+    struct slice *current = NULL;
+    while ((kind = next_header(&scan, pos, &eol, &key_len)) != HEADER_BLANK) {
+        const char *value = buf + pos + key_len;
+
+        switch (kind) {
+        case -1:
+            ERROR("commit has an unterminated header");
+            goto fail;
+        case HEADER_CONTINUATION:
+            if (current)
+                current->len = (buf + eol) - current->ptr;
+            break;
+        case HEADER_ENCODING:
+            current = &c->encoding;
+            *current = (struct slice){ value, (size_t)(buf + eol - value) };
+            break;
+        case HEADER_GPGSIG:
+            current = &c->gpgsig;
+            *current = (struct slice){ value, (size_t)(buf + eol - value) };
+            break;
+        default:
+            current = NULL;
+            break;
+        }
+        pos = eol + 1;
+    }
+    c->extra_headers.ptr = buf + extra_start;
+    c->extra_headers.len = pos - extra_start;
+
+    /* skip the blank line; the message is everything after it */
+    if (pos < len)
+        pos++;
+    c->message.ptr = buf + pos;
+    c->message.len = len - pos;
+
+    DEBUG("parsed commit: %zu parent(s), message %zu bytes",
+          c->parent_count, c->message.len);
+    return 0;
+
+fail:
+    free(c->parents);
+    c->parents = NULL;
+    c->parent_count = 0;
+    return -1;
+}
+
+
+struct commit_object *commit_clone(const struct commit_object *c)
+{
+    if (!c)
+        return NULL;
+
+    struct commit_object *dst = malloc(sizeof(*dst));
+    if (!dst)
+        return NULL;
+    *dst = *c;
+    dst->buffer = NULL;
+    dst->parents = NULL;
+
+    dst->buffer = malloc(c->buffer_len + 1);
+    if (!dst->buffer)
+        goto fail;
+    memcpy(dst->buffer, c->buffer, c->buffer_len + 1);
+
+    if (c->parent_count) {
+        dst->parents = malloc(c->parent_count * sizeof(*dst->parents));
+        if (!dst->parents)
+            goto fail;
+        memcpy(dst->parents, c->parents, c->parent_count * sizeof(*dst->parents));
+    }
+
+    ident_rebase(&dst->author, c->buffer, dst->buffer);
+    ident_rebase(&dst->committer, c->buffer, dst->buffer);
+    slice_rebase(&dst->encoding, c->buffer, dst->buffer);
+    slice_rebase(&dst->gpgsig, c->buffer, dst->buffer);
+    slice_rebase(&dst->extra_headers, c->buffer, dst->buffer);
+    slice_rebase(&dst->message, c->buffer, dst->buffer);
+    return dst;
+
+fail:
+    free(dst->buffer);
+    free(dst);
+    return NULL;
+}
@@ -0,0 +1,30 @@
+#ifndef COMMIT_H
+#define COMMIT_H
+
+#include <stddef.h>
+#include "hash.h"
+#include "object.h"
+
+/*
+ * Parse the body of a commit object (everything after the
+ * "commit <size>\0" header) into [c]. All text fields become slices of
+ * [buf], which must stay alive as long as [c] is used; normally the
+ * caller hands its buffer over via c->buffer. Any number of parents is
+ * accepted, and the message is kept whole.
+ *
+ * Returns 0 on success, -1 if the commit is malformed.
+ */
+int parse_commit_buffer(struct commit_object *c, const char *buf, size_t len,
+                        hash_algo_t algo);
+
+/*
+ * Split an identity line ("Name <email> 1700000000 +0100") into [out].
+ * A missing or garbled date leaves timestamp and tz at 0.
+ * Returns 0 on success, -1 if there is no <email> part.
+ */
+int parse_ident(const char *line, size_t len, struct ident *out);
+
+/* Deep copy: duplicates the buffer and rebases every slice onto it. */
+struct commit_object *commit_clone(const struct commit_object *c);
+
+#endif /* COMMIT_H */
@@ -0,0 +1,219 @@
+#include "commit_graph.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "log.h"
+#include "hex.h"
+#include "repository.h"
+#include "utl.h"
+
+#define GRAPH_SIGNATURE 0x43475048      /* "CGPH" */
+#define GRAPH_HEADER 8
+#define GRAPH_CHUNK_ENTRY 12
+
+#define CHUNK_OIDF 0x4f494446
+#define CHUNK_OIDL 0x4f49444c
+#define CHUNK_CDAT 0x43444154
+#define CHUNK_EDGE 0x45444745
+
+#define GRAPH_PARENT_NONE 0x70000000u
+#define GRAPH_EXTRA_EDGES 0x80000000u
+#define GRAPH_LAST_EDGE 0x80000000u
+
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+           (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+    return (uint64_t)get_be32(p) << 32 | get_be32(p + 4);
+}
+
+
+/* Point [g] at its chunks. Returns 0, or -1 if the file is malformed. */
+static int parse_graph(struct commit_graph *g, hash_algo_t repo_algo)
+{
+    const unsigned char *p = g->map;
+
+    if (g->len < GRAPH_HEADER || get_be32(p) != GRAPH_SIGNATURE || p[4] != 1)
+        return -1;
+    g->algo = p[5] == 1 ? HASH_SHA1 : p[5] == 2 ? HASH_SHA256 : 0;
+    if (g->algo != repo_algo) {
+        DEBUG("commit-graph hash version %d does not match the repository", p[5]);
+        return -1;
+    }
+    g->rawsz = hash_algo_rawsz(g->algo);
+    if (p[7] != 0) {
+        DEBUG("commit-graph has base graphs; not supported");
+        return -1;
+    }
+
+    size_t nr_chunks = p[6];
+    if (g->len < GRAPH_HEADER + (nr_chunks + 1) * GRAPH_CHUNK_ENTRY + g->rawsz)
+        return -1;
+
+    const unsigned char *table = p + GRAPH_HEADER;
+    size_t data_end = g->len - g->rawsz;     /* the trailing checksum */
+    size_t edges_len = 0, data_len = 0, oids_len = 0;
+
+    for (size_t i = 0; i < nr_chunks; i++) {
+        uint32_t id = get_be32(table + i * GRAPH_CHUNK_ENTRY);
+        uint64_t start = get_be64(table + i * GRAPH_CHUNK_ENTRY + 4);
+        uint64_t end = get_be64(table + (i + 1) * GRAPH_CHUNK_ENTRY + 4);
+
+        if (start > end || end > data_end)
+            return -1;
+        switch (id) {
+        case CHUNK_OIDF:
+            if (end - start != 256 * 4)
+                return -1;
+            g->fanout = p + start;
+            break;
+        case CHUNK_OIDL:
+            g->oids = p + start;
+            oids_len = end - start;
+            break;
+        case CHUNK_CDAT:
+            g->data = p + start;
+            data_len = end - start;
+            break;
+        case CHUNK_EDGE:
+            g->edges = p + start;
+            edges_len = end - start;
+            break;
+        default:
+            break;      /* optional chunks we do not use */
+        }
+    }
+    if (!g->fanout || !g->oids || !g->data)
+        return -1;
+
+    for (int i = 1; i < 256; i++) {
+        if (get_be32(g->fanout + 4 * i) < get_be32(g->fanout + 4 * (i - 1)))
+            return -1;
+    }
+    g->nr_commits = get_be32(g->fanout + 255 * 4);
+    g->nr_edges = edges_len / 4;
+    if (oids_len != (size_t)g->nr_commits * g->rawsz ||
+        data_len != (size_t)g->nr_commits * (g->rawsz + 16))
+        return -1;
+    return 0;
+}
+
+struct commit_graph *commit_graph_open(struct repository *repo)
+{
+    char *path = utl_path_join(repo->gitdir, "objects/info/commit-graph", 0);
+    if (!path)
+        return NULL;
+
+    struct commit_graph *g = calloc(1, sizeof(*g));
+    if (!g) {
+        free(path);
+        return NULL;
+    }
+
+    g->map = utl_map_file(path, &g->len);
+    if (!g->map || parse_graph(g, repo->hash_algo) < 0) {
+        if (g->map)
+            ERROR("%s: unusable commit graph, ignored", path);
+        commit_graph_free(g);
+        g = NULL;
+    }
+    free(path);
+    return g;
+}
+
+void commit_graph_free(struct commit_graph *g)
+{
+    if (!g)
+        return;
+    if (g->map)
+        munmap((void *)g->map, g->len);
+    free(g);
+}
+
+
+long commit_graph_find(const struct commit_graph *g, const struct object_id *oid)
+{
+    const unsigned char *hash = oid->hash;
+    uint32_t lo = hash[0] ? get_be32(g->fanout + 4 * (hash[0] - 1)) : 0;
+    uint32_t hi = get_be32(g->fanout + 4 * hash[0]);
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(hash, g->oids + (size_t)mid * g->rawsz, g->rawsz);
+        if (!cmp)
+            return mid;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+void commit_graph_oid(const struct commit_graph *g, uint32_t pos,
+                      struct object_id *oid)
+{
+    oid_set_raw(oid, g->oids + (size_t)pos * g->rawsz, g->algo);
+}
+
+int commit_graph_entry(const struct commit_graph *g, uint32_t pos,
+                       struct commit_graph_entry *entry)
+{
+    if (pos >= g->nr_commits)
+        return -1;
+
+    /* tree id, be32 parent1, be32 parent2, 30-bit generation | 34-bit date */
+    const unsigned char *p = g->data + (size_t)pos * (g->rawsz + 16);
+    oid_set_raw(&entry->tree, p, g->algo);
+    p += g->rawsz;
+
+    uint32_t hi = get_be32(p + 8);
+
+    entry->parent1 = get_be32(p);
+    entry->parent2 = get_be32(p + 4);
+    entry->generation = hi >> 2;
+    entry->date = (int64_t)(hi & 3) << 32 | get_be32(p + 12);
+
+    if (entry->parent1 == GRAPH_PARENT_NONE) {
+        entry->nr_parents = 0;
+    } else if (entry->parent2 == GRAPH_PARENT_NONE) {
+        entry->nr_parents = 1;
+    } else if (!(entry->parent2 & GRAPH_EXTRA_EDGES)) {
+        entry->nr_parents = 2;
+    } else {
+        /* octopus: the second and later parents are listed in EDGE */
+        size_t i = entry->parent2 & ~GRAPH_EXTRA_EDGES;
+        entry->nr_parents = 1;
+        for (;;) {
+            if (i >= g->nr_edges)
+                return -1;
+            entry->nr_parents++;
+            if (get_be32(g->edges + 4 * i++) & GRAPH_LAST_EDGE)
+                break;
+        }
+    }
+    return 0;
+}
+
+long commit_graph_parent(const struct commit_graph *g,
+                         const struct commit_graph_entry *entry, uint32_t n)
+{
+    uint32_t pos;
+
+    if (n >= entry->nr_parents)
+        return -1;
+    if (n == 0)
+        pos = entry->parent1;
+    else if (!(entry->parent2 & GRAPH_EXTRA_EDGES))
+        pos = entry->parent2;
+    else
+        pos = get_be32(g->edges + 4 * ((entry->parent2 & ~GRAPH_EXTRA_EDGES) + n - 1)) &
+              ~GRAPH_LAST_EDGE;
+    return pos < g->nr_commits ? (long)pos : -1;
+}
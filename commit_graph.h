@@ -0,0 +1,74 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hash.h"
+#include "object.h"
+
+struct repository;
+
+/*
+ * Read-only view of objects/info/commit-graph, as written by
+ * "git commit-graph write" (and by gc): for every commit it stores the
+ * parents, the commit date and the generation number (topological
+ * level: 1 for a root, else one more than the highest parent), so a
+ * history walk can order and expand commits without inflating them.
+ *
+ * Only the single-file layout is read; split graph chains
+ * (objects/info/commit-graphs/) are ignored.
+ */
+struct commit_graph {
+    hash_algo_t algo;
+    size_t rawsz;
+    uint32_t nr_commits;
+
+    const unsigned char *map;
+    size_t len;
+    const unsigned char *fanout;        /* OIDF: 256 big-endian counts */
+    const unsigned char *oids;          /* OIDL: sorted ids */
+    const unsigned char *data;          /* CDAT: tree, parents, gen, date */
+    const unsigned char *edges;         /* EDGE: octopus parents, or NULL */
+    size_t nr_edges;
+};
+
+/* Generation of a commit the graph does not know about. */
+#define GENERATION_INFINITY UINT32_MAX
+
+/* What the graph records about one commit. */
+struct commit_graph_entry {
+    struct object_id tree;
+    int64_t date;
+    uint32_t generation;
+    uint32_t nr_parents;
+    uint32_t parent1;                   /* graph position */
+    uint32_t parent2;                   /* position, or EDGE index | high bit */
+};
+
+/*
+ * Map [repo]'s commit graph. Returns NULL if there is none or it is
+ * unusable (corrupt, or written for another hash algorithm).
+ */
+struct commit_graph *commit_graph_open(struct repository *repo);
+
+void commit_graph_free(struct commit_graph *g);
+
+/* Position of [oid] in the graph, or -1 if it is not in it. */
+long commit_graph_find(const struct commit_graph *g, const struct object_id *oid);
+
+/* Id of the commit at position [pos]. */
+void commit_graph_oid(const struct commit_graph *g, uint32_t pos,
+                      struct object_id *oid);
+
+/* Read the entry at [pos]. Returns 0, or -1 if it is malformed. */
+int commit_graph_entry(const struct commit_graph *g, uint32_t pos,
+                       struct commit_graph_entry *entry);
+
+/*
+ * Graph position of parent [n] of [entry], for n < entry->nr_parents.
+ * Returns -1 if the graph is malformed.
+ */
+long commit_graph_parent(const struct commit_graph *g,
+                         const struct commit_graph_entry *entry, uint32_t n);
+
+#endif /* COMMIT_GRAPH_H */
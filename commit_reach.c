@@ -0,0 +1,779 @@
+#include "commit_reach.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "hex.h"
+#include "commit_graph.h"
+#include "repository.h"
+#include "tag.h"
+
+#define PAINT_FLAGS (OBJ_FLAG_PARENT1 | OBJ_FLAG_PARENT2 | OBJ_FLAG_STALE)
+#define REACH_FLAGS (PAINT_FLAGS | OBJ_FLAG_RESULT | OBJ_FLAG_QUEUED)
+
+
+/* Highest generation first; commits outside the graph by date. */
+static int compare_by_generation(const void *a_, const void *b_, void *cb_data)
+{
+    const struct rev_commit *a = a_, *b = b_;
+
+    if (a->generation != b->generation)
+        return a->generation > b->generation ? 1 : -1;
+    if (a->date != b->date)
+        return a->date > b->date ? 1 : -1;
+    return 0;
+}
+
+/* State of one query: its queue and every commit it has flagged. */
+struct reach_state {
+    struct rev_walk *walk;
+    struct prio_queue queue;
+    size_t nr_active;               /* queued and not stale (or not full) */
+
+    struct rev_commit **touched;
+    size_t nr_touched, alloc_touched;
+};
+
+static void reach_init(struct reach_state *st, struct rev_walk *walk)
+{
+    memset(st, 0, sizeof(*st));
+    st->walk = walk;
+    st->queue = (struct prio_queue)PRIO_QUEUE_INIT(compare_by_generation, NULL);
+}
+
+/* Record [c] for clearing, the first time the query flags it. */
+static int touch(struct reach_state *st, struct rev_commit *c)
+{
+    if ((c->flags & REACH_FLAGS) || c->util)
+        return 0;
+    if (st->nr_touched == st->alloc_touched) {
+        size_t alloc = st->alloc_touched ? 2 * st->alloc_touched : 256;
+        struct rev_commit **tmp = realloc(st->touched, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        st->touched = tmp;
+        st->alloc_touched = alloc;
+    }
+    st->touched[st->nr_touched++] = c;
+    return 0;
+}
+
+/* Clear every flag and scratch pointer the query left behind. */
+static void reach_clear(struct reach_state *st)
+{
+    for (size_t i = 0; i < st->nr_touched; i++) {
+        st->touched[i]->flags &= ~REACH_FLAGS;
+        free(st->touched[i]->util);
+        st->touched[i]->util = NULL;
+    }
+    st->nr_touched = 0;
+    st->nr_active = 0;
+    prio_queue_clear(&st->queue);
+}
+
+static void reach_release(struct reach_state *st)
+{
+    reach_clear(st);
+    free(st->touched);
+}
+
+
+/* ---- paint down to common ---- */
+
+/* Add [flags] to [c] and queue it unless it is queued already. */
+static int paint(struct reach_state *st, struct rev_commit *c, unsigned flags)
+{
+    if (touch(st, c) < 0)
+        return -1;
+
+    int was_active = (c->flags & (OBJ_FLAG_QUEUED | OBJ_FLAG_STALE)) == OBJ_FLAG_QUEUED;
+    c->flags |= flags;
+
+    if (c->flags & OBJ_FLAG_QUEUED) {
+        if (was_active && (c->flags & OBJ_FLAG_STALE))
+            st->nr_active--;
+        return 0;
+    }
+    if (prio_queue_put(&st->queue, c) < 0)
+        return -1;
+    c->flags |= OBJ_FLAG_QUEUED;
+    if (!(c->flags & OBJ_FLAG_STALE))
+        st->nr_active++;
+    return 0;
+}
+
+/*
+ * Paint [one] and [twos] down their ancestry until only stale commits
+ * are queued. Commits reached from both sides get OBJ_FLAG_RESULT and
+ * are added to [result] (a candidate is dropped later if it turns out
+ * stale). Commits below [min_generation] are not expanded.
+ */
+static int paint_down_to_common(struct reach_state *st, struct rev_commit *one,
+                                struct rev_commit **twos, size_t nr,
+                                uint32_t min_generation,
+                                struct rev_commit ***result, size_t *nr_result)
+{
+    size_t alloc = 0;
+    int ret = 0;
+
+    if (result)
+        *nr_result = 0;
+    ret = paint(st, one, OBJ_FLAG_PARENT1);
+    for (size_t i = 0; i < nr && !ret; i++)
+        ret = paint(st, twos[i], OBJ_FLAG_PARENT2);
+
+    while (!ret && st->nr_active) {
+        struct rev_commit *c = prio_queue_get(&st->queue);
+        unsigned flags = c->flags & PAINT_FLAGS;
+
+        c->flags &= ~OBJ_FLAG_QUEUED;
+        if (!(flags & OBJ_FLAG_STALE))
+            st->nr_active--;
+        if (c->generation < min_generation)
+            break;          /* so is everything still queued */
+
+        if (flags == (OBJ_FLAG_PARENT1 | OBJ_FLAG_PARENT2)) {
+            if (result && !(c->flags & OBJ_FLAG_RESULT)) {
+                if (*nr_result == alloc) {
+                    alloc = alloc ? 2 * alloc : 4;
+                    struct rev_commit **tmp = realloc(*result, alloc * sizeof(*tmp));
+                    if (!tmp) {
+                        ret = -1;
+                        break;
+                    }
+                    *result = tmp;
+                }
+                (*result)[(*nr_result)++] = c;
+            }
+            c->flags |= OBJ_FLAG_RESULT;
+            /* a base's ancestors are never better bases */
+            flags |= OBJ_FLAG_STALE;
+        }
+
+        for (size_t i = 0; i < c->nr_parents && !ret; i++) {
+            struct rev_commit *p = c->parents[i];
+            if (rev_walk_parse(st->walk, p) < 0)
+                ret = -1;
+            else if ((p->flags & flags) != flags)
+                ret = paint(st, p, flags);
+        }
+    }
+    return ret;
+}
+
+static int compare_by_date(const void *a_, const void *b_)
+{
+    const struct rev_commit *a = *(struct rev_commit *const *)a_;
+    const struct rev_commit *b = *(struct rev_commit *const *)b_;
+    return a->date < b->date ? 1 : a->date > b->date ? -1 : 0;
+}
+
+/*
+ * Drop the candidates that are ancestors of other candidates. Each
+ * remaining one is painted against the others, which shows both
+ * whether it is reachable from them and which of them it reaches.
+ */
+static long remove_redundant_no_gen(struct reach_state *st, struct rev_commit **array,
+                                    size_t nr)
+{
+    char *redundant = calloc(nr, 1);
+    struct rev_commit **others = malloc(nr * sizeof(*others));
+    long ret = 0;
+
+    if (!redundant || !others) {
+        ret = -1;
+        goto out;
+    }
+
+    for (size_t i = 0; i < nr && !ret; i++) {
+        uint32_t min_generation = array[i]->generation;
+        size_t n = 0;
+
+        if (redundant[i])
+            continue;
+        for (size_t j = 0; j < nr; j++) {
+            if (j == i || redundant[j])
+                continue;
+            others[n++] = array[j];
+            if (array[j]->generation < min_generation)
+                min_generation = array[j]->generation;
+        }
+        if (!n)
+            break;
+
+        ret = paint_down_to_common(st, array[i], others, n, min_generation, NULL, NULL);
+        if (array[i]->flags & OBJ_FLAG_PARENT2)
+            redundant[i] = 1;
+        for (size_t j = 0, k = 0; j < nr; j++) {
+            if (j == i || redundant[j])
+                continue;
+            if (others[k++]->flags & OBJ_FLAG_PARENT1)
+                redundant[j] = 1;
+        }
+        reach_clear(st);
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < nr; i++) {
+        if (!redundant[i])
+            array[kept++] = array[i];
+    }
+    if (!ret)
+        ret = kept;
+out:
+    free(redundant);
+    free(others);
+    return ret;
+}
+
+static int compare_by_generation_asc(const void *a_, const void *b_)
+{
+    const struct rev_commit *a = *(struct rev_commit *const *)a_;
+    const struct rev_commit *b = *(struct rev_commit *const *)b_;
+    return a->generation < b->generation ? -1 : a->generation > b->generation;
+}
+
+/*
+ * The same with generation numbers for every candidate: depth-first
+ * walks down from the candidates' parents, highest first, mark what
+ * they reach as stale; a candidate that gets marked is redundant. No
+ * walk goes below the lowest candidate still independent, and the
+ * walks end as soon as only one candidate is left.
+ */
+static long remove_redundant_with_gen(struct reach_state *st, struct rev_commit **array,
+                                      size_t nr)
+{
+    struct rev_commit **sorted = malloc(nr * sizeof(*sorted));
+    struct rev_commit **starts = NULL, **stack = NULL;
+    size_t nr_starts = 0, alloc_starts = 0, nr_stack = 0, alloc_stack = 0;
+    size_t independent = nr, min_pos = 0;
+    long ret = 0;
+
+    if (!sorted)
+        return -1;
+    memcpy(sorted, array, nr * sizeof(*sorted));
+    qsort(sorted, nr, sizeof(*sorted), compare_by_generation_asc);
+    uint32_t min_generation = sorted[0]->generation;
+
+#define PUSH(list, nr_, alloc_, c) do { \
+        if ((nr_) == (alloc_)) { \
+            size_t a_ = (alloc_) ? 2 * (alloc_) : 64; \
+            struct rev_commit **t_ = realloc((list), a_ * sizeof(*t_)); \
+            if (!t_) { ret = -1; goto out; } \
+            (list) = t_; (alloc_) = a_; \
+        } \
+        (list)[(nr_)++] = (c); \
+    } while (0)
+
+    /* OBJ_FLAG_RESULT: a candidate not yet found below another one */
+    for (size_t i = 0; i < nr; i++) {
+        if (touch(st, array[i]) < 0) {
+            ret = -1;
+            goto out;
+        }
+        array[i]->flags |= OBJ_FLAG_RESULT;
+    }
+    for (size_t i = 0; i < nr; i++) {
+        for (size_t j = 0; j < array[i]->nr_parents; j++) {
+            struct rev_commit *p = array[i]->parents[j];
+            if (rev_walk_parse(st->walk, p) < 0 || touch(st, p) < 0) {
+                ret = -1;
+                goto out;
+            }
+            if (!(p->flags & OBJ_FLAG_STALE)) {
+                p->flags |= OBJ_FLAG_STALE;
+                PUSH(starts, nr_starts, alloc_starts, p);
+            }
+        }
+    }
+    qsort(starts, nr_starts, sizeof(*starts), compare_by_generation_asc);
+    for (size_t i = 0; i < nr_starts; i++)
+        starts[i]->flags &= ~OBJ_FLAG_STALE;
+
+    for (size_t i = nr_starts; i && independent > 1; i--) {
+        nr_stack = 0;
+        starts[i - 1]->flags |= OBJ_FLAG_STALE;
+        PUSH(stack, nr_stack, alloc_stack, starts[i - 1]);
+
+        while (nr_stack) {
+            struct rev_commit *c = stack[nr_stack - 1];
+
+            if (c->flags & OBJ_FLAG_RESULT) {
+                c->flags &= ~OBJ_FLAG_RESULT;
+                if (--independent <= 1)
+                    break;
+                if (c == sorted[min_pos]) {
+                    while (min_pos < nr - 1 && (sorted[min_pos]->flags & OBJ_FLAG_STALE))
+                        min_pos++;
+                    min_generation = sorted[min_pos]->generation;
+                }
+            }
+            if (c->generation < min_generation) {
+                nr_stack--;
+                continue;
+            }
+
+            /* descend into the first parent not visited yet */
+            size_t j;
+            for (j = 0; j < c->nr_parents; j++) {
+                struct rev_commit *p = c->parents[j];
+                if (rev_walk_parse(st->walk, p) < 0 || touch(st, p) < 0) {
+                    ret = -1;
+                    goto out;
+                }
+                if (!(p->flags & OBJ_FLAG_STALE)) {
+                    p->flags |= OBJ_FLAG_STALE;
+                    PUSH(stack, nr_stack, alloc_stack, p);
+                    break;
+                }
+            }
+            if (j == c->nr_parents)
+                nr_stack--;
+        }
+    }
+#undef PUSH
+
+    size_t kept = 0;
+    for (size_t i = 0; i < nr; i++) {
+        if (!(array[i]->flags & OBJ_FLAG_STALE))
+            array[kept++] = array[i];
+    }
+    ret = kept;
+out:
+    reach_clear(st);
+    free(sorted);
+    free(starts);
+    free(stack);
+    return ret;
+}
+
+static long remove_redundant(struct reach_state *st, struct rev_commit **array, size_t nr)
+{
+    for (size_t i = 0; i < nr; i++) {
+        if (array[i]->generation == GENERATION_INFINITY)
+            return remove_redundant_no_gen(st, array, nr);
+    }
+    return remove_redundant_with_gen(st, array, nr);
+}
+
+long merge_bases(struct rev_walk *walk, struct rev_commit *one,
+                 struct rev_commit **twos, size_t nr, struct rev_commit ***bases)
+{
+    struct reach_state st;
+    struct rev_commit **result = NULL;
+    size_t nr_result = 0;
+    long ret;
+
+    *bases = NULL;
+    for (size_t i = 0; i < nr; i++) {
+        if (twos[i] == one) {
+            if (!(*bases = malloc(sizeof(**bases))))
+                return -1;
+            (*bases)[0] = one;
+            return 1;
+        }
+    }
+
+    reach_init(&st, walk);
+    ret = paint_down_to_common(&st, one, twos, nr, 0, &result, &nr_result);
+
+    /* candidates below another one are stale by now */
+    size_t kept = 0;
+    for (size_t i = 0; i < nr_result; i++) {
+        if (!(result[i]->flags & OBJ_FLAG_STALE))
+            result[kept++] = result[i];
+    }
+    reach_clear(&st);
+
+    if (!ret)
+        ret = kept > 1 ? remove_redundant(&st, result, kept) : (long)kept;
+    reach_release(&st);
+
+    if (ret < 0) {
+        free(result);
+        return -1;
+    }
+    if (ret)
+        qsort(result, ret, sizeof(*result), compare_by_date);
+    *bases = result;
+    return ret;
+}
+
+struct rev_commit *merge_base(struct rev_walk *walk, struct rev_commit *a,
+                              struct rev_commit *b)
+{
+    struct rev_commit **bases, *best = NULL;
+    long n = merge_bases(walk, a, &b, 1, &bases);
+
+    if (n > 0)
+        best = bases[0];
+    free(bases);
+    return best;
+}
+
+int is_ancestor(struct rev_walk *walk, struct rev_commit *ancestor,
+                struct rev_commit *commit)
+{
+    struct reach_state st;
+
+    if (ancestor == commit)
+        return 1;
+    if (commit->generation < ancestor->generation)
+        return 0;           /* also true of everything below [commit] */
+
+    reach_init(&st, walk);
+    int ret = paint_down_to_common(&st, ancestor, &commit, 1,
+                                   ancestor->generation, NULL, NULL);
+    if (!ret)
+        ret = !!(ancestor->flags & OBJ_FLAG_PARENT2);
+    reach_release(&st);
+    return ret;
+}
+
+
+/* ---- ahead / behind ---- */
+
+/*
+ * Every commit reached carries a bitmap of the tips (bits 0 .. nr-1)
+ * and the base (bit nr) it is reachable from. The queue is in
+ * generation order, with the commits outside the graph numbered first
+ * (see ensure_generations()), so a commit is popped only after every
+ * descendant the walk reaches: its bitmap is final then, and it is
+ * counted once. Dates would not do: with clock skew or equal dates, a
+ * commit counted for one side could still be reached from the other
+ * through a commit left in the queue when the walk ends.
+ */
+struct ab_state {
+    struct reach_state reach;
+    size_t nr;                      /* tips */
+    size_t words;                   /* 64-bit words per bitmap */
+};
+
+/*
+ * Number the commits reachable from [commits] that the commit graph
+ * does not know (all of them, without a graph) one above their highest
+ * parent, as git's ensure_generations_valid() does, so that generation
+ * order is topological everywhere. The numbers stay on the walk's
+ * commits for later queries. Without a graph this reads the history
+ * down to its roots once. Returns 0, or -1 if a commit cannot be read.
+ */
+static int ensure_generations(struct rev_walk *walk, struct rev_commit **commits,
+                              size_t nr)
+{
+    struct rev_commit **stack = NULL;
+    size_t nr_stack = 0, alloc = 0;
+    int ret = 0;
+
+    for (size_t i = 0; i < nr && !ret; i++) {
+        if (commits[i]->generation != GENERATION_INFINITY)
+            continue;
+        nr_stack = 0;
+        if (!alloc && !(stack = malloc((alloc = 64) * sizeof(*stack)))) {
+            ret = -1;
+            break;
+        }
+        stack[nr_stack++] = commits[i];
+
+        /* the stack is a path down the history, so nothing is on it twice */
+        while (nr_stack && !ret) {
+            struct rev_commit *c = stack[nr_stack - 1], *next = NULL;
+            uint32_t generation = 0;
+
+            if (rev_walk_parse(walk, c) < 0) {
+                ret = -1;
+                break;
+            }
+            for (size_t j = 0; j < c->nr_parents && !next; j++) {
+                struct rev_commit *p = c->parents[j];
+                if (rev_walk_parse(walk, p) < 0)
+                    ret = -1;
+                else if (p->generation == GENERATION_INFINITY)
+                    next = p;
+                else if (p->generation > generation)
+                    generation = p->generation;
+            }
+            if (ret)
+                break;
+            if (!next) {
+                c->generation = generation + 1;
+                nr_stack--;
+                continue;
+            }
+            if (nr_stack == alloc) {
+                struct rev_commit **tmp = realloc(stack, 2 * alloc * sizeof(*tmp));
+                if (!tmp) {
+                    ret = -1;
+                    break;
+                }
+                stack = tmp;
+                alloc *= 2;
+            }
+            stack[nr_stack++] = next;
+        }
+    }
+    free(stack);
+    return ret;
+}
+
+static int bit(const uint64_t *bits, size_t i)
+{
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+static int is_full(const struct ab_state *ab, const uint64_t *bits)
+{
+    size_t nr_bits = ab->nr + 1;
+    for (size_t w = 0; w < ab->words; w++) {
+        uint64_t want = w + 1 < ab->words || !(nr_bits % 64) ?
+                        UINT64_MAX : (UINT64_C(1) << (nr_bits % 64)) - 1;
+        if (bits[w] != want)
+            return 0;
+    }
+    return 1;
+}
+
+static uint64_t *ab_bits(struct ab_state *ab, struct rev_commit *c)
+{
+    if (!c->util) {
+        if (touch(&ab->reach, c) < 0)
+            return NULL;
+        c->util = calloc(ab->words, sizeof(uint64_t));
+    }
+    return c->util;
+}
+
+/* Add [from] to [c]'s bitmap and queue it if that changed anything. */
+static int ab_push(struct ab_state *ab, struct rev_commit *c, const uint64_t *from)
+{
+    uint64_t *bits = ab_bits(ab, c);
+    int changed = 0;
+
+    if (!bits)
+        return -1;
+    int was_full = is_full(ab, bits);
+    for (size_t w = 0; w < ab->words; w++) {
+        changed |= (bits[w] | from[w]) != bits[w];
+        bits[w] |= from[w];
+    }
+    if (!changed)
+        return 0;
+
+    if (c->flags & OBJ_FLAG_QUEUED) {
+        if (!was_full && is_full(ab, bits))
+            ab->reach.nr_active--;
+        return 0;
+    }
+    if (prio_queue_put(&ab->reach.queue, c) < 0)
+        return -1;
+    c->flags |= OBJ_FLAG_QUEUED;
+    if (!is_full(ab, bits))
+        ab->reach.nr_active++;
+    return 0;
+}
+
+/* Count a commit reachable from [bits] in [counts]. */
+static void ab_count(const struct ab_state *ab, const uint64_t *bits,
+                     struct ahead_behind *counts)
+{
+    int in_base = bit(bits, ab->nr);
+
+    for (size_t i = 0; i < ab->nr; i++) {
+        int in_tip = bit(bits, i);
+        if (in_tip && !in_base)
+            counts[i].ahead++;
+        else if (in_base && !in_tip)
+            counts[i].behind++;
+    }
+}
+
+int ahead_behind(struct rev_walk *walk, struct rev_commit *base,
+                 struct rev_commit **tips, size_t nr,
+                 struct ahead_behind *counts)
+{
+    struct ab_state ab = { .nr = nr, .words = (nr + 1 + 63) / 64 };
+    uint64_t *seed = calloc(ab.words, sizeof(*seed));
+    int ret = seed ? 0 : -1;
+
+    reach_init(&ab.reach, walk);
+    memset(counts, 0, nr * sizeof(*counts));
+    if (!ret)
+        ret = ensure_generations(walk, tips, nr);
+    if (!ret)
+        ret = ensure_generations(walk, &base, 1);
+
+    for (size_t i = 0; i <= nr && !ret; i++) {
+        memset(seed, 0, ab.words * sizeof(*seed));
+        seed[i / 64] |= UINT64_C(1) << (i % 64);
+        ret = ab_push(&ab, i < nr ? tips[i] : base, seed);
+    }
+
+    /* a commit every side reaches counts for nobody, nor do its parents */
+    while (!ret && ab.reach.nr_active) {
+        struct rev_commit *c = prio_queue_get(&ab.reach.queue);
+        uint64_t *bits = c->util;
+
+        c->flags &= ~OBJ_FLAG_QUEUED;
+        if (!is_full(&ab, bits))
+            ab.reach.nr_active--;
+
+        ab_count(&ab, bits, counts);
+
+        for (size_t i = 0; i < c->nr_parents && !ret; i++) {
+            if (rev_walk_parse(walk, c->parents[i]) < 0)
+                ret = -1;
+            else
+                ret = ab_push(&ab, c->parents[i], bits);
+        }
+    }
+
+    reach_release(&ab.reach);
+    free(seed);
+    return ret;
+}
+
+
+/* ---- commands ---- */
+
+static struct rev_commit *lookup_name(struct rev_walk *walk, const char *name)
+{
+    struct object_id oid;
+    enum object_type type;
+
+    if (repo_resolve_ref(walk->repo, name, &oid) < 0) {
+        ERROR("unknown revision %s", name);
+        return NULL;
+    }
+    if (peel_object(walk->repo, &oid, &oid, &type) < 0 || type != OBJ_COMMIT) {
+        ERROR("%s is not a commit", name);
+        return NULL;
+    }
+    return rev_walk_lookup(walk, &oid);
+}
+
+/* Best merge base of each "<a> <b>" line of stdin. */
+static int merge_base_stdin(struct rev_walk *walk)
+{
+    char *line = NULL, a[1024], b[1024];
+    size_t alloc = 0;
+    int ret = 0;
+
+    while (getline(&line, &alloc, stdin) > 0) {
+        struct rev_commit *ca, *cb, *base = NULL;
+
+        if (sscanf(line, "%1023s %1023s", a, b) != 2) {
+            ERROR("expected \"<commit> <commit>\": %s", line);
+            ret = 128;
+            break;
+        }
+        if ((ca = lookup_name(walk, a)) && (cb = lookup_name(walk, b)))
+            base = merge_base(walk, ca, cb);
+        else
+            ret = 128;
+        printf("%s\n", base ? oid_to_hex(&base->oid) : "");
+    }
+    free(line);
+    return ret;
+}
+
+int cmd_merge_base(int argc, char **argv)
+{
+    static const char usage[] =
+        "usage: merge-base [--all] <gitdir> <commit> <commit>...\n"
+        "       merge-base --is-ancestor <gitdir> <commit> <commit>\n"
+        "       merge-base --stdin <gitdir>\n";
+    int all = 0, ancestor = 0, from_stdin = 0, i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "--all"))
+            all = 1;
+        else if (!strcmp(argv[i], "--is-ancestor"))
+            ancestor = 1;
+        else if (!strcmp(argv[i], "--stdin"))
+            from_stdin = 1;
+        else
+            break;
+    }
+    int nr_commits = argc - i - 1;
+    if (i >= argc || (from_stdin ? nr_commits != 0 :
+                      ancestor ? nr_commits != 2 : nr_commits < 2)) {
+        fprintf(stderr, "%s", usage);
+        return 128;
+    }
+
+    struct repository repo;
+    if (repo_open(&repo, argv[i]) < 0) {
+        ERROR("%s is not a git directory", argv[i]);
+        return 128;
+    }
+
+    struct rev_walk walk;
+    struct rev_commit **commits = calloc(nr_commits + 1, sizeof(*commits));
+    int ret = commits ? 0 : 128;
+
+    rev_walk_init(&walk, &repo);
+    for (int j = 0; j < nr_commits && !ret; j++) {
+        if (!(commits[j] = lookup_name(&walk, argv[i + 1 + j])))
+            ret = 128;
+    }
+
+    if (ret) {
+        /* reported */
+    } else if (from_stdin) {
+        ret = merge_base_stdin(&walk);
+    } else if (ancestor) {
+        int r = is_ancestor(&walk, commits[0], commits[1]);
+        ret = r < 0 ? 128 : !r;
+    } else {
+        struct rev_commit **bases;
+        long n = merge_bases(&walk, commits[0], commits + 1, nr_commits - 1, &bases);
+        for (long j = 0; j < n && (all || j == 0); j++)
+            printf("%s\n", oid_to_hex(&bases[j]->oid));
+        ret = n < 0 ? 128 : n == 0;
+        free(bases);
+    }
+
+    free(commits);
+    rev_walk_release(&walk);
+    repo_clear(&repo);
+    return ret;
+}
+
+int cmd_ahead_behind(int argc, char **argv)
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: ahead-behind <gitdir> <base> <tip>...\n");
+        return 128;
+    }
+
+    struct repository repo;
+    if (repo_open(&repo, argv[1]) < 0) {
+        ERROR("%s is not a git directory", argv[1]);
+        return 128;
+    }
+
+    size_t nr = argc - 3;
+    struct rev_walk walk;
+    struct rev_commit *base = NULL, **tips = calloc(nr, sizeof(*tips));
+    struct ahead_behind *counts = calloc(nr, sizeof(*counts));
+    int ret = tips && counts ? 0 : 128;
+
+    rev_walk_init(&walk, &repo);
+    if (!ret && !(base = lookup_name(&walk, argv[2])))
+        ret = 128;
+    for (size_t j = 0; j < nr && !ret; j++) {
+        if (!(tips[j] = lookup_name(&walk, argv[3 + j])))
+            ret = 128;
+    }
+
+    if (!ret && ahead_behind(&walk, base, tips, nr, counts) < 0)
+        ret = 128;
+    for (size_t j = 0; j < nr && !ret; j++)
+        printf("%s %zu %zu\n", argv[3 + j], counts[j].ahead, counts[j].behind);
+
+    free(tips);
+    free(counts);
+    rev_walk_release(&walk);
+    repo_clear(&repo);
+    return ret;
+}
@@ -0,0 +1,70 @@
+#ifndef COMMIT_REACH_H
+#define COMMIT_REACH_H
+
+#include <stddef.h>
+#include "revision.h"
+
+/*
+ * Ancestry queries over the commits of a rev_walk (which caches the
+ * parsed commits and the commit graph, so many queries can share it;
+ * do not run them while the walk itself is in progress).
+ *
+ * Merge bases use paint-down-to-common: both sides are painted down
+ * their ancestry from one queue, highest generation first, and a commit
+ * reached from both is a base whose own ancestors are stale. The walk
+ * ends as soon as only stale commits are queued, so its cost follows
+ * the divergence of the two sides rather than the length of history.
+ * Generation numbers come from the commit graph; commits that are not
+ * in it fall back to date order.
+ */
+
+/*
+ * All merge bases of [one] and [twos] (a base of [one] and any of them,
+ * as for an octopus merge), none an ancestor of another, newest first.
+ * Returns the number found and sets *[bases] (caller frees the array),
+ * or -1 on error.
+ */
+long merge_bases(struct rev_walk *walk, struct rev_commit *one,
+                 struct rev_commit **twos, size_t nr, struct rev_commit ***bases);
+
+/* The best merge base of [a] and [b] (the newest), or NULL if none. */
+struct rev_commit *merge_base(struct rev_walk *walk, struct rev_commit *a,
+                              struct rev_commit *b);
+
+/*
+ * 1 if [ancestor] is reachable from (or is) [commit], 0 if not, -1 on
+ * error. Commits with a lower generation than [ancestor] are not
+ * searched.
+ */
+int is_ancestor(struct rev_walk *walk, struct rev_commit *ancestor,
+                struct rev_commit *commit);
+
+struct ahead_behind {
+    size_t ahead;       /* commits reachable from the tip only */
+    size_t behind;      /* commits reachable from the base only */
+};
+
+/*
+ * Count, for each of [nr] tips, the commits it is ahead of and behind
+ * [base], in a single walk shared by all of them. The walk stops once
+ * every queued commit is reachable from all tips and the base. It goes
+ * by generation, so commits outside the commit graph get one first:
+ * without a graph that reads their history once per rev_walk. Returns
+ * 0 and fills [counts], or -1 on error.
+ */
+int ahead_behind(struct rev_walk *walk, struct rev_commit *base,
+                 struct rev_commit **tips, size_t nr,
+                 struct ahead_behind *counts);
+
+/*
+ * "merge-base [--all] <gitdir> <commit> <commit>...",
+ * "merge-base --is-ancestor <gitdir> <a> <b>" (exit status 0 if a is an
+ * ancestor of b, else 1) and "merge-base --stdin <gitdir>" (one
+ * "<a> <b>" pair per line, prints its best base or an empty line).
+ */
+int cmd_merge_base(int argc, char **argv);
+
+/* "ahead-behind <gitdir> <base> <tip>...": print "<tip> <ahead> <behind>". */
+int cmd_ahead_behind(int argc, char **argv);
+
+#endif /* COMMIT_REACH_H */
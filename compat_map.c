@@ -0,0 +1,774 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "compat_map.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "hex.h"
+#include "pack.h"
+#include "repository.h"
+#include "tree.h"
+#include "utl.h"
+
+#define COMPAT_MAP_SIGNATURE 0x434d4150    /* "CMAP" */
+#define COMPAT_MAP_VERSION 1
+#define COMPAT_MAP_HEADER 20
+
+/* Blobs read before they are hashed together in the conversion pass. */
+#define CONVERT_BATCH 256
+#define CONVERT_BATCH_BYTES (8u << 20)
+
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+           (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static char *compat_map_path(struct repository *repo)
+{
+    return utl_path_join(repo->gitdir, "objects/info/compat-map", 0);
+}
+
+
+/* ---- loading ---- */
+
+static int parse_map(struct compat_map *map)
+{
+    const unsigned char *p = map->map;
+    size_t need = COMPAT_MAP_HEADER;
+
+    if (map->len < COMPAT_MAP_HEADER || get_be32(p) != COMPAT_MAP_SIGNATURE ||
+        get_be32(p + 4) != COMPAT_MAP_VERSION)
+        return -1;
+    if (get_be32(p + 8) != map->algo[0] || get_be32(p + 12) != map->algo[1])
+        return -1;
+    map->nr = get_be32(p + 16);
+
+    for (int s = 0; s < 2; s++) {
+        size_t rawsz = hash_algo_rawsz(map->algo[s]);
+
+        if (map->len < need + 256 * 4)
+            return -1;
+        map->fanout[s] = p + need;
+        for (int i = 1; i < 256; i++) {
+            if (get_be32(map->fanout[s] + 4 * i) < get_be32(map->fanout[s] + 4 * (i - 1)))
+                return -1;
+        }
+        if (get_be32(map->fanout[s] + 255 * 4) != map->nr)
+            return -1;
+
+        map->oids[s] = map->fanout[s] + 256 * 4;
+        map->partner[s] = map->oids[s] + (size_t)map->nr * rawsz;
+        need += 256 * 4 + (size_t)map->nr * (rawsz + 4);
+    }
+
+    need += hash_algo_rawsz(map->algo[0]);
+    return map->len == need ? 0 : -1;
+}
+
+int compat_map_load(struct repository *repo)
+{
+    if (repo->compat_map)
+        return 0;
+
+    struct compat_map *map = calloc(1, sizeof(*map));
+    if (!map)
+        return -1;
+    map->algo[0] = repo->hash_algo;
+    map->algo[1] = compat_hash_algo(repo->hash_algo);
+
+    char *path = compat_map_path(repo);
+    if (path)
+        map->map = utl_map_file(path, &map->len);
+    if (map->map && parse_map(map) < 0) {
+        ERROR("%s: corrupt object id translation table", path);
+        free(path);
+        compat_map_free(map);
+        return -1;
+    }
+    free(path);
+
+    repo->compat_map = map;
+    return 0;
+}
+
+void compat_map_free(struct compat_map *map)
+{
+    if (!map)
+        return;
+    if (map->map)
+        munmap((void *)map->map, map->len);
+    /* both sides point at the same pairs; free them once */
+    oidmap_clear(&map->added[0], 1);
+    oidmap_clear(&map->added[1], 0);
+    free(map);
+}
+
+
+/* ---- lookup ---- */
+
+/* Position of raw [oid] in side [s] of the file, or -1. */
+static long find_in_file(const struct compat_map *map, int s,
+                         const unsigned char *oid)
+{
+    if (!map->map)
+        return -1;
+
+    size_t rawsz = hash_algo_rawsz(map->algo[s]);
+    uint32_t lo = oid[0] ? get_be32(map->fanout[s] + 4 * (oid[0] - 1)) : 0;
+    uint32_t hi = get_be32(map->fanout[s] + 4 * oid[0]);
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(oid, map->oids[s] + (size_t)mid * rawsz, rawsz);
+        if (!cmp)
+            return mid;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+int repo_oid_to_algop(struct repository *repo, const struct object_id *src,
+                      hash_algo_t to, struct object_id *dest)
+{
+    hash_algo_t from = src->algo ? (hash_algo_t)src->algo : repo->hash_algo;
+
+    if (from == to) {
+        *dest = *src;
+        dest->algo = to;
+        return 0;
+    }
+    if (compat_map_load(repo) < 0)
+        return -1;
+
+    struct compat_map *map = repo->compat_map;
+    int s = from == map->algo[0] ? 0 : 1;
+    if (from != map->algo[s] || to != map->algo[!s])
+        return -1;
+
+    long pos = find_in_file(map, s, src->hash);
+    if (pos >= 0) {
+        uint32_t other = get_be32(map->partner[s] + (size_t)pos * 4);
+        if (other >= map->nr)
+            return -1;
+        oid_set_raw(dest, map->oids[!s] + (size_t)other * hash_algo_rawsz(to), to);
+        return 0;
+    }
+
+    struct compat_pair *pair = oidmap_get(&map->added[s], src);
+    if (!pair)
+        return -1;
+    *dest = pair->oid[!s];
+    return 0;
+}
+
+int compat_map_add(struct repository *repo, const struct object_id *oid,
+                   const struct object_id *compat)
+{
+    if (compat_map_load(repo) < 0)
+        return -1;
+
+    struct compat_map *map = repo->compat_map;
+    if (find_in_file(map, 0, oid->hash) >= 0 || oidmap_get(&map->added[0], oid))
+        return 0;
+
+    struct compat_pair *pair = malloc(sizeof(*pair));
+    if (!pair)
+        return -1;
+    pair->oid[0] = *oid;
+    pair->oid[1] = *compat;
+
+    if (oidmap_put(&map->added[0], oid, pair) == pair) {
+        free(pair);
+        return -1;
+    }
+    map->nr_added++;
+    if (oidmap_put(&map->added[1], compat, pair) == pair)
+        return -1;      /* findable one way; the write still has it */
+    return 0;
+}
+
+
+/* ---- writing ---- */
+
+/* One id of the table being written, and the pair it belongs to. */
+struct sort_entry {
+    unsigned char hash[MAX_RAW_OID_LENGTH];     /* zero padded */
+    uint32_t pair;
+};
+
+static int compare_entries(const void *a, const void *b)
+{
+    return memcmp(a, b, MAX_RAW_OID_LENGTH);
+}
+
+int compat_map_write(struct repository *repo)
+{
+    if (compat_map_load(repo) < 0)
+        return -1;
+
+    struct compat_map *map = repo->compat_map;
+    size_t nr = map->nr + map->nr_added, n = 0;
+    size_t rawsz[2] = { hash_algo_rawsz(map->algo[0]), hash_algo_rawsz(map->algo[1]) };
+    struct sort_entry *sorted[2] = { NULL, NULL };
+    uint32_t *position[2] = { NULL, NULL };
+    unsigned char *buf = NULL;
+    char *path = NULL, *tmp = NULL;
+    int ret = -1;
+
+    if (nr > UINT32_MAX)
+        return -1;
+    for (int s = 0; s < 2; s++) {
+        sorted[s] = malloc((nr ? nr : 1) * sizeof(*sorted[s]));
+        position[s] = malloc((nr ? nr : 1) * sizeof(*position[s]));
+        if (!sorted[s] || !position[s])
+            goto out;
+    }
+
+    /* pair i is (sorted[0][i], sorted[1][i]) until the sort */
+    for (uint32_t i = 0; i < map->nr; i++) {
+        uint32_t other = get_be32(map->partner[0] + (size_t)i * 4);
+        if (other >= map->nr)
+            goto out;
+        memset(&sorted[0][n], 0, sizeof(sorted[0][n]));
+        memset(&sorted[1][n], 0, sizeof(sorted[1][n]));
+        memcpy(sorted[0][n].hash, map->oids[0] + (size_t)i * rawsz[0], rawsz[0]);
+        memcpy(sorted[1][n].hash, map->oids[1] + (size_t)other * rawsz[1], rawsz[1]);
+        sorted[0][n].pair = sorted[1][n].pair = n;
+        n++;
+    }
+    for (size_t i = 0; i < map->added[0].alloc; i++) {
+        struct compat_pair *pair = map->added[0].entries[i].data;
+        if (!pair)
+            continue;
+        memcpy(sorted[0][n].hash, pair->oid[0].hash, MAX_RAW_OID_LENGTH);
+        memcpy(sorted[1][n].hash, pair->oid[1].hash, MAX_RAW_OID_LENGTH);
+        sorted[0][n].pair = sorted[1][n].pair = n;
+        n++;
+    }
+    nr = n;
+
+    for (int s = 0; s < 2; s++) {
+        qsort(sorted[s], nr, sizeof(*sorted[s]), compare_entries);
+        for (size_t i = 0; i < nr; i++)
+            position[s][sorted[s][i].pair] = i;
+    }
+
+    size_t len = COMPAT_MAP_HEADER + 2 * 256 * 4 +
+                 nr * (rawsz[0] + 4) + nr * (rawsz[1] + 4) + rawsz[0];
+    buf = malloc(len);
+    if (!buf)
+        goto out;
+
+    unsigned char *p = buf;
+    put_be32(p, COMPAT_MAP_SIGNATURE);
+    put_be32(p + 4, COMPAT_MAP_VERSION);
+    put_be32(p + 8, map->algo[0]);
+    put_be32(p + 12, map->algo[1]);
+    put_be32(p + 16, nr);
+    p += COMPAT_MAP_HEADER;
+
+    for (int s = 0; s < 2; s++) {
+        uint32_t count = 0;
+        size_t i = 0;
+        for (int b = 0; b < 256; b++) {
+            while (i < nr && sorted[s][i].hash[0] == b)
+                i++, count++;
+            put_be32(p + 4 * b, count);
+        }
+        p += 256 * 4;
+        for (i = 0; i < nr; i++, p += rawsz[s])
+            memcpy(p, sorted[s][i].hash, rawsz[s]);
+        for (i = 0; i < nr; i++, p += 4)
+            put_be32(p, position[!s][sorted[s][i].pair]);
+    }
+
+    struct hash_ctx ctx = HASH_CTX_INIT;
+    int hashed = hash_init(&ctx, map->algo[0]) == 0 &&
+                 hash_update(&ctx, buf, p - buf) == 0 &&
+                 hash_final(&ctx, p) == 0;
+    hash_ctx_release(&ctx);
+    if (!hashed)
+        goto out;
+
+    /* objects/info may not exist yet; write aside, then rename over */
+    char *info = utl_path_join(repo->gitdir, "objects/info", 0);
+    if (info) {
+        mkdir(info, 0777);
+        free(info);
+    }
+    path = compat_map_path(repo);
+    tmp = path ? utl_path_join(path, ".tmp", 1) : NULL;
+    if (!tmp)
+        goto out;
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        ERROR("cannot create %s", tmp);
+        goto out;
+    }
+    int written = fwrite(buf, 1, len, f) == len;
+    if (fclose(f) != 0 || !written || rename(tmp, path) != 0) {
+        ERROR("cannot write %s", path);
+        remove(tmp);
+        goto out;
+    }
+
+    /* start over from the new file */
+    compat_map_free(map);
+    repo->compat_map = NULL;
+    ret = compat_map_load(repo);
+
+out:
+    for (int s = 0; s < 2; s++) {
+        free(sorted[s]);
+        free(position[s]);
+    }
+    free(buf);
+    free(path);
+    free(tmp);
+    return ret;
+}
+
+
+/* ---- content conversion ---- */
+
+static int translate(struct repository *repo, const struct object_id *src,
+                     hash_algo_t to, struct object_id *dest,
+                     struct object_id *missing)
+{
+    if (repo_oid_to_algop(repo, src, to, dest) == 0)
+        return 0;
+    if (missing)
+        *missing = *src;
+    return -1;
+}
+
+static char *convert_tree(struct repository *repo, const char *buf, size_t len,
+                          hash_algo_t from, hash_algo_t to, size_t *out_len,
+                          struct object_id *missing)
+{
+    size_t from_sz = hash_algo_rawsz(from), to_sz = hash_algo_rawsz(to);
+    /* the shortest entry is "1 a\0" and an id */
+    char *out = malloc(len + (len / (from_sz + 4) + 1) * to_sz);
+    struct tree_desc desc;
+    struct name_entry entry;
+    struct object_id src, dest;
+    size_t n = 0;
+    int ret;
+
+    if (!out)
+        return NULL;
+
+    init_tree_desc(&desc, buf, len, from_sz, 0);
+    for (;;) {
+        const char *start = desc.buffer;
+
+        if ((ret = tree_desc_next(&desc, &entry)) <= 0)
+            break;
+        oid_set_raw(&src, entry.oid, from);
+        if (translate(repo, &src, to, &dest, missing) < 0) {
+            free(out);
+            return NULL;
+        }
+        memcpy(out + n, start, (const char *)entry.oid - start);
+        n += (const char *)entry.oid - start;
+        memcpy(out + n, dest.hash, to_sz);
+        n += to_sz;
+    }
+    if (ret < 0) {
+        if (missing)
+            memset(missing, 0, sizeof(*missing));
+        free(out);
+        return NULL;
+    }
+    *out_len = n;
+    return out;
+}
+
+/* Header lines of a commit or tag that name another object. */
+static int names_object(enum object_type type, const char *line, size_t len,
+                        size_t *key_len)
+{
+    static const char *commit_keys[] = { "tree ", "parent ", NULL };
+    static const char *tag_keys[] = { "object ", NULL };
+    const char **keys = type == OBJ_COMMIT ? commit_keys : tag_keys;
+
+    for (; *keys; keys++) {
+        size_t k = strlen(*keys);
+        if (len > k && !memcmp(line, *keys, k)) {
+            *key_len = k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static char *convert_headers(struct repository *repo, enum object_type type,
+                             const char *buf, size_t len, hash_algo_t from,
+                             hash_algo_t to, size_t *out_len,
+                             struct object_id *missing)
+{
+    size_t from_hex = hash_algo_hexsz(from), to_hex = hash_algo_hexsz(to);
+    char *out = malloc(len + (len / (from_hex + 6) + 1) * to_hex);
+    const char *p = buf, *end = buf + len;
+    struct object_id src, dest;
+    size_t n = 0, key_len;
+
+    if (!out)
+        return NULL;
+
+    /* only the header is rewritten; it ends at the first empty line */
+    while (p < end && *p != '\n') {
+        const char *eol = memchr(p, '\n', end - p);
+        size_t line_len = eol ? (size_t)(eol - p) : (size_t)(end - p);
+
+        if (names_object(type, p, line_len, &key_len) &&
+            line_len == key_len + from_hex) {
+            if (oid_set_hex(&src, p + key_len, from_hex, from) < 0 ||
+                translate(repo, &src, to, &dest, missing) < 0) {
+                free(out);
+                return NULL;
+            }
+            memcpy(out + n, p, key_len);
+            n += key_len;
+            oid_to_hex_r(out + n, &dest);
+            n += to_hex;
+        } else {
+            memcpy(out + n, p, line_len);
+            n += line_len;
+        }
+        p += line_len;
+        if (p < end)
+            out[n++] = *p++;        /* the newline */
+    }
+    memcpy(out + n, p, end - p);
+    *out_len = n + (end - p);
+    return out;
+}
+
+char *convert_object_buffer(struct repository *repo, enum object_type type,
+                            const char *buf, size_t len, hash_algo_t from,
+                            hash_algo_t to, size_t *out_len,
+                            struct object_id *missing)
+{
+    char *out;
+
+    switch (type) {
+    case OBJ_TREE:
+        return convert_tree(repo, buf, len, from, to, out_len, missing);
+    case OBJ_COMMIT:
+    case OBJ_TAG:
+        return convert_headers(repo, type, buf, len, from, to, out_len, missing);
+    default:
+        out = malloc(len + 1);
+        if (!out)
+            return NULL;
+        memcpy(out, buf, len);
+        out[len] = '\0';
+        *out_len = len;
+        return out;
+    }
+}
+
+
+/* ---- conversion pass ---- */
+
+struct convert_state {
+    struct repository *repo;
+    hash_algo_t compat;
+
+    struct object_id *ids;          /* every object in the repository */
+    size_t nr, alloc;
+
+    /* blobs waiting to be hashed */
+    struct object_id blob_oid[CONVERT_BATCH];
+    char *blob_buf[CONVERT_BATCH];
+    size_t blob_size[CONVERT_BATCH];
+    size_t nr_blobs, blob_bytes;
+
+    struct oidmap failed;           /* ids that cannot be converted */
+    size_t nr_failed;
+};
+
+static int push_id(struct object_id **ids, size_t *nr, size_t *alloc,
+                   const struct object_id *oid)
+{
+    if (*nr == *alloc) {
+        size_t n = *alloc ? 2 * *alloc : 1024;
+        struct object_id *tmp = realloc(*ids, n * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        *ids = tmp;
+        *alloc = n;
+    }
+    (*ids)[(*nr)++] = *oid;
+    return 0;
+}
+
+static int collect_loose_id(const struct object_id *oid, const char *path,
+                            void *data)
+{
+    struct convert_state *st = data;
+    return push_id(&st->ids, &st->nr, &st->alloc, oid);
+}
+
+static int is_mapped(struct convert_state *st, const struct object_id *oid)
+{
+    struct object_id dest;
+    return repo_oid_to_algop(st->repo, oid, st->compat, &dest) == 0;
+}
+
+static void mark_failed(struct convert_state *st, const struct object_id *oid,
+                        const char *why)
+{
+    if (oidmap_get(&st->failed, oid))
+        return;
+    ERROR("cannot convert %s: %s", oid_to_hex(oid), why);
+    oidmap_put(&st->failed, oid, (void *)1);
+    st->nr_failed++;
+}
+
+/* Hash [body] as an object of [type] in the compat algorithm and record it. */
+static int add_converted(struct convert_state *st, const struct object_id *oid,
+                         enum object_type type, const char *body, size_t size)
+{
+    char header[32];
+    unsigned char digest[MAX_RAW_OID_LENGTH];
+    struct hash_batch_item item = {
+        header, snprintf(header, sizeof(header), "%s %zu", type_name(type), size) + 1,
+        body, size, digest,
+    };
+    struct object_id compat;
+
+    if (hash_batch(st->compat, &item, 1) < 0)
+        return -1;
+    oid_set_raw(&compat, digest, st->compat);
+    return compat_map_add(st->repo, oid, &compat);
+}
+
+static int flush_blobs(struct convert_state *st)
+{
+    struct hash_batch_item items[CONVERT_BATCH];
+    unsigned char digests[CONVERT_BATCH][MAX_RAW_OID_LENGTH];
+    char headers[CONVERT_BATCH][32];
+    int ret = 0;
+
+    for (size_t i = 0; i < st->nr_blobs; i++) {
+        items[i].prefix = headers[i];
+        items[i].prefix_len = snprintf(headers[i], sizeof(headers[i]), "blob %zu",
+                                       st->blob_size[i]) + 1;
+        items[i].data = st->blob_buf[i];
+        items[i].len = st->blob_size[i];
+        items[i].out = digests[i];
+    }
+    if (hash_batch(st->compat, items, st->nr_blobs) < 0)
+        ret = -1;
+
+    for (size_t i = 0; i < st->nr_blobs; i++) {
+        struct object_id compat;
+        oid_set_raw(&compat, digests[i], st->compat);
+        if (!ret && compat_map_add(st->repo, &st->blob_oid[i], &compat) < 0)
+            ret = -1;
+        free(st->blob_buf[i]);
+    }
+    st->nr_blobs = st->blob_bytes = 0;
+    return ret;
+}
+
+/*
+ * Convert [oid] after everything it refers to. Objects whose
+ * dependencies are not mapped yet stay on the stack while the first
+ * missing one is pushed above them.
+ */
+static int convert_with_deps(struct convert_state *st, const struct object_id *oid)
+{
+    struct object_id *stack = NULL;
+    size_t nr = 0, alloc = 0;
+    int ret = 0;
+
+    if (push_id(&stack, &nr, &alloc, oid) < 0)
+        return -1;
+
+    while (nr) {
+        struct object_id top = stack[nr - 1];
+        struct object_id missing;
+        enum object_type type;
+        size_t size, out_len;
+
+        if (oidmap_get(&st->failed, &top) || is_mapped(st, &top)) {
+            nr--;
+            continue;
+        }
+
+        char *body = repo_read_object_data(st->repo, &top, &type, &size);
+        if (!body) {
+            mark_failed(st, &top, "unreadable");
+            nr--;
+            continue;
+        }
+
+        char *out = convert_object_buffer(st->repo, type, body, size,
+                                          st->repo->hash_algo, st->compat,
+                                          &out_len, &missing);
+        free(body);
+        if (out) {
+            if (add_converted(st, &top, type, out, out_len) < 0)
+                ret = -1;
+            free(out);
+            nr--;
+        } else if (!missing.algo || oidmap_get(&st->failed, &missing)) {
+            mark_failed(st, &top, missing.algo ? "refers to an object that cannot be converted"
+                                               : "malformed");
+            nr--;
+        } else if (push_id(&stack, &nr, &alloc, &missing) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    free(stack);
+    return ret;
+}
+
+long repo_convert_objects(struct repository *repo)
+{
+    struct convert_state *st = calloc(1, sizeof(*st));
+    long ret = -1;
+
+    if (!st || compat_map_load(repo) < 0) {
+        free(st);
+        return -1;
+    }
+    st->repo = repo;
+    st->compat = compat_hash_algo(repo->hash_algo);
+
+    if (for_each_loose_object(repo, collect_loose_id, st) < 0 && !repo->packs)
+        goto out;
+    for (struct packed_git *p = repo->packs; p; p = p->next) {
+        struct object_id oid;
+        for (uint32_t i = 0; i < p->nr_objects; i++) {
+            oid_set_raw(&oid, pack_nth_oid(p, i), p->algo);
+            if (push_id(&st->ids, &st->nr, &st->alloc, &oid) < 0)
+                goto out;
+        }
+    }
+
+    /* blobs depend on nothing: hash them in batches on the first read */
+    size_t nr_rest = 0;
+    for (size_t i = 0; i < st->nr; i++) {
+        enum object_type type;
+        size_t size;
+
+        if (is_mapped(st, &st->ids[i]))
+            continue;
+
+        char *body = repo_read_object_data(repo, &st->ids[i], &type, &size);
+        if (!body) {
+            mark_failed(st, &st->ids[i], "unreadable");
+            continue;
+        }
+        if (type != OBJ_BLOB) {
+            free(body);
+            st->ids[nr_rest++] = st->ids[i];    /* i >= nr_rest */
+            continue;
+        }
+
+        st->blob_oid[st->nr_blobs] = st->ids[i];
+        st->blob_buf[st->nr_blobs] = body;
+        st->blob_size[st->nr_blobs] = size;
+        st->blob_bytes += size;
+        if (++st->nr_blobs == CONVERT_BATCH || st->blob_bytes >= CONVERT_BATCH_BYTES) {
+            if (flush_blobs(st) < 0)
+                goto out;
+        }
+    }
+    if (flush_blobs(st) < 0)
+        goto out;
+
+    for (size_t i = 0; i < nr_rest; i++) {
+        if (convert_with_deps(st, &st->ids[i]) < 0)
+            goto out;
+    }
+
+    if (compat_map_write(repo) < 0)
+        goto out;
+    ret = st->nr_failed ? -1 : (long)repo->compat_map->nr;
+
+out:
+    for (size_t i = 0; i < st->nr_blobs; i++)
+        free(st->blob_buf[i]);
+    free(st->ids);
+    oidmap_clear(&st->failed, 0);
+    free(st);
+    return ret;
+}
+
+
+/* ---- commands ---- */
+
+int cmd_convert_objects(int argc, char **argv)
+{
+    struct repository repo;
+    const char *gitdir = argc > 1 ? argv[1] : ".git";
+
+    if (repo_open(&repo, gitdir) < 0) {
+        fprintf(stderr, "not a git repository: %s\n", gitdir);
+        return 128;
+    }
+
+    long n = repo_convert_objects(&repo);
+    if (n >= 0)
+        printf("%ld objects mapped to %s\n", n,
+               compat_hash_algo(repo.hash_algo) == HASH_SHA256 ? "sha256" : "sha1");
+    repo_clear(&repo);
+    return n >= 0 ? 0 : 1;
+}
+
+int cmd_translate_oid(int argc, char **argv)
+{
+    struct repository repo;
+    int ret = 0;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: translate-oid <gitdir> <oid>...\n");
+        return 128;
+    }
+    if (repo_open(&repo, argv[1]) < 0) {
+        fprintf(stderr, "not a git repository: %s\n", argv[1]);
+        return 128;
+    }
+
+    for (int i = 2; i < argc; i++) {
+        size_t len = strlen(argv[i]);
+        hash_algo_t from = len == hash_algo_hexsz(HASH_SHA256) ? HASH_SHA256 : HASH_SHA1;
+        struct object_id src, dest;
+
+        if (oid_set_hex(&src, argv[i], len, from) < 0) {
+            fprintf(stderr, "not an object id: %s\n", argv[i]);
+            ret = 1;
+        } else if (repo_oid_to_algop(&repo, &src, compat_hash_algo(from), &dest) < 0) {
+            fprintf(stderr, "no mapping for %s\n", argv[i]);
+            ret = 1;
+        } else {
+            printf("%s %s\n", argv[i], oid_to_hex(&dest));
+        }
+    }
+    repo_clear(&repo);
+    return ret;
+}
@@ -0,0 +1,110 @@
+#ifndef COMPAT_MAP_H
+#define COMPAT_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hash.h"
+#include "object.h"
+#include "oidmap.h"
+
+struct repository;
+
+/*
+ * Object id translation between a repository's hash algorithm and its
+ * compatibility algorithm (the other one of SHA-1 and SHA-256), for
+ * repositories that are being migrated and need both names.
+ *
+ * The pairs are computed once, by repo_convert_objects(), and kept in
+ * objects/info/compat-map. The file is mmapped and holds every id twice,
+ * once sorted in each algorithm, each copy followed by the position of
+ * its partner in the other copy; a translation in either direction is a
+ * fanout lookup plus a binary search and never touches object content:
+ *
+ *   "CMAP", be32 version (1), be32 algo, be32 compat algo, be32 count
+ *   per side (algo first): be32 fanout[256], ids (count x rawsz),
+ *                          be32 partner position (count)
+ *   checksum of everything above, in the repository's algorithm
+ *
+ * Pairs added after the file was loaded live in memory until the next
+ * compat_map_write().
+ */
+struct compat_map {
+    hash_algo_t algo[2];            /* [0]: the repository's, [1]: compat */
+    uint32_t nr;
+
+    const unsigned char *map;       /* NULL if there is no file yet */
+    size_t len;
+    const unsigned char *fanout[2];
+    const unsigned char *oids[2];
+    const unsigned char *partner[2];
+
+    struct oidmap added[2];         /* id -> struct compat_pair */
+    size_t nr_added;
+};
+
+/* Two names of one object; oid[0] is in the repository's algorithm. */
+struct compat_pair {
+    struct object_id oid[2];
+};
+
+/* The algorithm ids of [repo] are translated to. */
+static inline hash_algo_t compat_hash_algo(hash_algo_t algo)
+{
+    return algo == HASH_SHA1 ? HASH_SHA256 : HASH_SHA1;
+}
+
+/*
+ * Load objects/info/compat-map, if not done yet. Returns 0 (also when
+ * there is no file), or -1 if the file is corrupt.
+ */
+int compat_map_load(struct repository *repo);
+
+void compat_map_free(struct compat_map *map);
+
+/*
+ * Translate [src] into algorithm [to]. An id already in [to] is copied.
+ * Returns 0, or -1 if the object has no known name in [to].
+ */
+int repo_oid_to_algop(struct repository *repo, const struct object_id *src,
+                      hash_algo_t to, struct object_id *dest);
+
+/*
+ * Record that [oid] (repository algorithm) and [compat] (compat
+ * algorithm) name the same object. Returns 0, or -1 on failure.
+ */
+int compat_map_add(struct repository *repo, const struct object_id *oid,
+                   const struct object_id *compat);
+
+/* Write every known pair to objects/info/compat-map. Returns 0 or -1. */
+int compat_map_write(struct repository *repo);
+
+/*
+ * Rewrite the body of a tree, commit or tag from algorithm [from] to
+ * [to] by translating the ids it refers to (tree entries, "tree" and
+ * "parent" lines, a tag's "object" line); signatures and every other
+ * byte are kept as they are. Blobs are returned unchanged. Returns a
+ * new buffer (caller frees) and its length, or NULL if some id has no
+ * translation yet; then *[missing] names it, when non-NULL.
+ */
+char *convert_object_buffer(struct repository *repo, enum object_type type,
+                            const char *buf, size_t len, hash_algo_t from,
+                            hash_algo_t to, size_t *out_len,
+                            struct object_id *missing);
+
+/*
+ * The conversion pass: give every object of [repo] (loose and packed)
+ * its name in the compat algorithm and write the table. Blobs are hashed
+ * in batches; trees, commits and tags after everything they refer to.
+ * Returns the number of objects now mapped, or -1 if some object could
+ * not be converted (the others are still written).
+ */
+long repo_convert_objects(struct repository *repo);
+
+/*
+ * "convert-objects [<gitdir>]": run the conversion pass.
+ * "translate-oid <gitdir> <oid>...": print the other name of each id.
+ */
+int cmd_convert_objects(int argc, char **argv);
+int cmd_translate_oid(int argc, char **argv);
+
+#endif /* COMPAT_MAP_H */
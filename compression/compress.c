@@ -3,6 +3,8 @@
 #include <string.h>
 #include <time.h>
 #include <zlib.h>
+#include "compress.h"
+#include "../hash.h"
 
 #define CHUNK 16384
 
@@ -25,11 +27,16 @@ static void dump_raw(const char *hash, const char *data, size_t len)
  * @return: A heap-allocated buffer (must be freed by caller), or NULL on error.
  */
 char *decompress_file(const char *path, size_t *out_size) {
+    return decompress_file_hashed(path, out_size, NULL);
+}
+
+char *decompress_file_hashed(const char *path, size_t *out_size,
+                             struct hash_ctx *hash) {
 
     FILE *source = fopen(path, "rb");
     if (!source) return NULL;
 
-    int ret;
+    int ret = Z_OK;
     z_stream strm = {0};
     unsigned char in[CHUNK];
     unsigned char out[CHUNK];
@@ -62,6 +69,8 @@ char *decompress_file(const char *path, size_t *out_size) {
                 goto fail;
 
             size_t have = CHUNK - strm.avail_out;
+            if (hash && hash_update(hash, out, have) < 0)
+                goto fail;
 
             if (total_out + have >= capacity) {
                 capacity *= 2;
@@ -77,6 +86,10 @@ char *decompress_file(const char *path, size_t *out_size) {
 
     } while (ret != Z_STREAM_END);
 
+    /* a truncated stream is as corrupt as a bad one */
+    if (ret != Z_STREAM_END)
+        goto fail;
+
     inflateEnd(&strm);
     fclose(source);
 
@@ -96,3 +109,39 @@ fail:
     free(result);
     return NULL;
 }
+
+long decompress_file_head(const char *path, char *buf, size_t len) {
+
+    FILE *source = fopen(path, "rb");
+    if (!source) return -1;
+
+    z_stream strm = {0};
+    unsigned char in[512];
+    int ret = Z_OK;
+
+    if (inflateInit(&strm) != Z_OK) {
+        fclose(source);
+        return -1;
+    }
+
+    strm.next_out = (unsigned char *)buf;
+    strm.avail_out = len;
+
+    /* the header is in the first few compressed bytes */
+    while (strm.avail_out && ret != Z_STREAM_END) {
+        strm.avail_in = fread(in, 1, sizeof(in), source);
+        if (ferror(source) || strm.avail_in == 0) break;
+        strm.next_in = in;
+
+        ret = inflate(&strm, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            inflateEnd(&strm);
+            fclose(source);
+            return -1;
+        }
+    }
+
+    inflateEnd(&strm);
+    fclose(source);
+    return (long)(len - strm.avail_out);
+}
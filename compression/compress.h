@@ -18,4 +18,21 @@ char *compress_file(const char *path, size_t *out_size);
  */
 char *decompress_file(const char *path, size_t *out_size);
 
+struct hash_ctx;
+
+/**
+ * Like decompress_file(), but also feeds every inflated chunk to [hash]
+ * (already initialized by the caller) while it is still in cache, so
+ * the content can be verified without a second pass over it.
+ */
+char *decompress_file_hashed(const char *path, size_t *out_size,
+                             struct hash_ctx *hash);
+
+/**
+ * Inflates only the first [len] bytes of a git object file into [buf],
+ * e.g. to read its "<type> <size>" header without the body.
+ * @return: The number of bytes written to [buf], or -1 on error.
+ */
+long decompress_file_head(const char *path, char *buf, size_t len);
+
 #endif /* COMPRESS_H */
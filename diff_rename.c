@@ -0,0 +1,731 @@
+#define _GNU_SOURCE
+#include "diff_rename.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hex.h"
+#include "log.h"
+#include "pack.h"
+#include "repository.h"
+#include "thread_pool.h"
+
+/* git's constants: same chunks, same scores */
+#define SPAN_HASHBASE       107927
+#define SPAN_MAX_LEN        64
+#define CANDIDATES_PER_DST  4
+#define EXACT_MAX_TRIES     100
+#define BINARY_PEEK         8000
+
+#define S_ISREG_MODE(m) (((m) & 0170000) == 0100000)
+
+/* ---- queue ---- */
+
+int diff_queue_add(const struct diff_change *change, void *queue)
+{
+    struct diff_queue *q = queue;
+
+    if (q->nr == q->alloc) {
+        size_t alloc = q->alloc ? q->alloc * 2 : 64;
+        struct diff_change *tmp = realloc(q->changes, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        q->changes = tmp;
+        q->alloc = alloc;
+    }
+
+    struct diff_change *c = &q->changes[q->nr];
+    *c = *change;
+    c->path = strdup(change->path);
+    c->old_path = change->old_path ? strdup(change->old_path) : NULL;
+    if (!c->path || (change->old_path && !c->old_path)) {
+        free((char *)c->path);
+        free((char *)c->old_path);
+        return -1;
+    }
+    q->nr++;
+    return 0;
+}
+
+void diff_queue_clear(struct diff_queue *q)
+{
+    for (size_t i = 0; i < q->nr; i++) {
+        free((char *)q->changes[i].path);
+        free((char *)q->changes[i].old_path);
+    }
+    free(q->changes);
+    memset(q, 0, sizeof(*q));
+}
+
+
+/* ---- fingerprints ---- */
+
+struct span {
+    uint32_t hash;
+    uint32_t len;               /* bytes in chunks with this hash */
+};
+
+/* One side of a candidate pair. */
+struct rename_blob {
+    size_t change;              /* index in the queue */
+    const char *path;
+    unsigned mode;
+    const struct object_id *oid;
+    int used;                   /* pairs it is the source of (+1 if it stays) */
+    int uses_left;              /* while printing them */
+    int culled;                 /* source no longer considered */
+
+    int has_fp;
+    size_t size;
+    struct span *spans;         /* sorted by hash */
+    size_t nr_spans;
+
+    /* destinations */
+    int is_rename;
+    long src;
+    int score;
+};
+
+struct rename_worker {
+    struct delta_base_cache cache;
+    uint32_t *len;              /* SPAN_HASHBASE counters, zero between blobs */
+    uint32_t *touched;
+    size_t nr_touched, alloc_touched;
+};
+
+struct rename_state {
+    struct repository *repo;
+    const struct rename_options *opts;
+    struct thread_pool *pool;
+    struct rename_worker *workers;
+    int nr_workers;
+
+    struct rename_blob *src, *dst;
+    size_t nr_src, nr_dst;
+
+    struct rename_blob **todo;  /* blobs to fingerprint */
+    size_t nr_todo;
+    int failed;
+
+    struct candidate *mx;       /* CANDIDATES_PER_DST per remaining destination */
+    long *mx_dst;               /* remaining destinations, in order */
+    size_t nr_mx_dst;
+};
+
+static int add_span(struct rename_worker *w, uint32_t hash, uint32_t len)
+{
+    if (!w->len[hash]) {
+        if (w->nr_touched == w->alloc_touched) {
+            size_t alloc = w->alloc_touched ? w->alloc_touched * 2 : 1024;
+            uint32_t *tmp = realloc(w->touched, alloc * sizeof(*tmp));
+            if (!tmp)
+                return -1;
+            w->touched = tmp;
+            w->alloc_touched = alloc;
+        }
+        w->touched[w->nr_touched++] = hash;
+    }
+    w->len[hash] += len;
+    return 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * git's spanhash: a chunk ends at '\n' or after 64 bytes; in text, the
+ * '\r' of "\r\n" is skipped.
+ */
+static int fingerprint(struct rename_worker *w, struct rename_blob *b,
+                       const unsigned char *buf, size_t size)
+{
+    size_t peek = size < BINARY_PEEK ? size : BINARY_PEEK;
+    int is_text = !memchr(buf, '\0', peek);
+    uint32_t accum1 = 0, accum2 = 0, n = 0;
+    int ret = 0;
+
+    w->nr_touched = 0;
+    for (size_t i = 0; i < size && !ret; i++) {
+        uint32_t c = buf[i], old_1 = accum1;
+
+        if (is_text && c == '\r' && i + 1 < size && buf[i + 1] == '\n')
+            continue;
+        accum1 = (accum1 << 7) ^ (accum2 >> 25);
+        accum2 = (accum2 << 7) ^ (old_1 >> 25);
+        accum1 += c;
+        if (++n < SPAN_MAX_LEN && c != '\n')
+            continue;
+        ret = add_span(w, (accum1 + accum2 * 0x61) % SPAN_HASHBASE, n);
+        n = 0;
+        accum1 = accum2 = 0;
+    }
+    if (n > 0 && !ret)
+        ret = add_span(w, (accum1 + accum2 * 0x61) % SPAN_HASHBASE, n);
+
+    if (!ret) {
+        qsort(w->touched, w->nr_touched, sizeof(*w->touched), cmp_u32);
+        b->spans = malloc((w->nr_touched + 1) * sizeof(*b->spans));
+        if (!b->spans)
+            ret = -1;
+    }
+    for (size_t i = 0; i < w->nr_touched; i++) {
+        if (!ret)
+            b->spans[i] = (struct span){ w->touched[i], w->len[w->touched[i]] };
+        w->len[w->touched[i]] = 0;
+    }
+    b->nr_spans = ret ? 0 : w->nr_touched;
+    return ret;
+}
+
+static void fingerprint_one(void *data, size_t i, int worker)
+{
+    struct rename_state *st = data;
+    struct rename_worker *w = &st->workers[worker];
+    struct rename_blob *b = st->todo[i];
+    enum object_type type;
+    size_t size;
+
+    unsigned char *buf = repo_read_object_cached(st->repo, b->oid, &type, &size, &w->cache);
+    if (!buf || type != OBJ_BLOB || fingerprint(w, b, buf, size) < 0) {
+        ERROR("cannot read blob %s", oid_to_hex(b->oid));
+        __atomic_store_n(&st->failed, 1, __ATOMIC_RELAXED);
+    } else {
+        b->size = size;
+        b->has_fp = 1;
+    }
+    free(buf);
+}
+
+/* Only regular files are compared by content. */
+static void queue_fingerprint(struct rename_state *st, struct rename_blob *b)
+{
+    if (!b->has_fp && S_ISREG_MODE(b->mode))
+        st->todo[st->nr_todo++] = b;
+}
+
+/* Fingerprint the queued blobs in parallel. */
+static int run_fingerprints(struct rename_state *st)
+{
+    if (st->nr_todo)
+        thread_pool_for(st->pool, st->nr_todo, 4, fingerprint_one, st);
+    st->nr_todo = 0;
+    return st->failed ? -1 : 0;
+}
+
+/* Bytes of [dst] also found in [src], chunk by chunk. */
+static uint64_t copied_bytes(const struct rename_blob *src, const struct rename_blob *dst)
+{
+    const struct span *s = src->spans, *s_end = s + src->nr_spans;
+    const struct span *d = dst->spans, *d_end = d + dst->nr_spans;
+    uint64_t copied = 0;
+
+    while (s < s_end && d < d_end) {
+        if (s->hash < d->hash) {
+            s++;
+        } else if (s->hash > d->hash) {
+            d++;
+        } else {
+            copied += s->len < d->len ? s->len : d->len;
+            s++;
+            d++;
+        }
+    }
+    return copied;
+}
+
+static int estimate_similarity(const struct rename_blob *src, const struct rename_blob *dst,
+                               int min_score)
+{
+    if (!S_ISREG_MODE(src->mode) || !S_ISREG_MODE(dst->mode) ||
+        !src->has_fp || !dst->has_fp)
+        return 0;
+
+    /* too different in size to reach the threshold whatever the content */
+    uint64_t max_size = src->size > dst->size ? src->size : dst->size;
+    uint64_t base_size = src->size < dst->size ? src->size : dst->size;
+    if (max_size * (RENAME_MAX_SCORE - min_score) < (max_size - base_size) * RENAME_MAX_SCORE)
+        return 0;
+    if (!dst->size)
+        return 0;
+    return (int)(copied_bytes(src, dst) * RENAME_MAX_SCORE / max_size);
+}
+
+/* Do the two paths end with the same file name? */
+static int basename_same(const char *src, const char *dst)
+{
+    size_t src_len = strlen(src), dst_len = strlen(dst);
+
+    while (src_len && dst_len) {
+        char c1 = src[--src_len], c2 = dst[--dst_len];
+        if (c1 != c2)
+            return 0;
+        if (c1 == '/')
+            return 1;
+    }
+    return (!src_len || src[src_len - 1] == '/') && (!dst_len || dst[dst_len - 1] == '/');
+}
+
+static const char *basename_of(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static void record_pair(struct rename_state *st, size_t dst, size_t src, int score)
+{
+    st->dst[dst].is_rename = 1;
+    st->dst[dst].src = src;
+    st->dst[dst].score = score;
+    st->src[src].used++;
+}
+
+
+/* ---- exact renames ---- */
+
+static int cmp_src_oid(const void *a, const void *b, void *data)
+{
+    const struct rename_blob *src = data;
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    int cmp = memcmp(src[x].oid->hash, src[y].oid->hash, sizeof(src[x].oid->hash));
+    return cmp ? cmp : x < y ? -1 : x > y;
+}
+
+static int find_exact_renames(struct rename_state *st)
+{
+    size_t *order = malloc((st->nr_src + 1) * sizeof(*order));
+    int copies = st->opts->detect == RENAME_DETECT_COPIES;
+
+    if (!order)
+        return -1;
+    for (size_t i = 0; i < st->nr_src; i++)
+        order[i] = i;
+    qsort_r(order, st->nr_src, sizeof(*order), cmp_src_oid, st->src);
+
+    for (size_t d = 0; d < st->nr_dst; d++) {
+        struct rename_blob *dst = &st->dst[d];
+        size_t lo = 0, hi = st->nr_src;
+
+        /* first source with this id */
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (memcmp(st->src[order[mid]].oid->hash, dst->oid->hash,
+                       sizeof(dst->oid->hash)) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        long best = -1;
+        int best_score = -1, tries = EXACT_MAX_TRIES;
+        for (; lo < st->nr_src && oideq(st->src[order[lo]].oid, dst->oid); lo++) {
+            struct rename_blob *src = &st->src[order[lo]];
+
+            /* a symlink or submodule only matches its own kind */
+            if ((!S_ISREG_MODE(src->mode) || !S_ISREG_MODE(dst->mode)) &&
+                src->mode != dst->mode)
+                continue;
+            if (src->used && !copies)
+                continue;
+            int score = !src->used + basename_same(src->path, dst->path);
+            if (score > best_score) {
+                best = order[lo];
+                best_score = score;
+                if (score == 2)
+                    break;
+            }
+            if (!--tries)
+                break;
+        }
+        if (best >= 0)
+            record_pair(st, d, best, RENAME_MAX_SCORE);
+    }
+    free(order);
+    return 0;
+}
+
+
+/* ---- basename matches ---- */
+
+static int cmp_basename(const void *a, const void *b, void *data)
+{
+    const struct rename_blob *blobs = data;
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    int cmp = strcmp(basename_of(blobs[x].path), basename_of(blobs[y].path));
+    return cmp ? cmp : x < y ? -1 : x > y;
+}
+
+/* Indices of [blobs] whose basename no other one has, sorted by it. */
+static size_t *unique_basenames(struct rename_blob *blobs, size_t nr, int want_src,
+                                size_t *nr_out)
+{
+    size_t *all = malloc((nr + 1) * sizeof(*all)), n = 0, out = 0;
+
+    if (!all)
+        return NULL;
+    for (size_t i = 0; i < nr; i++)
+        if (want_src ? !blobs[i].culled : !blobs[i].is_rename)
+            all[n++] = i;
+    qsort_r(all, n, sizeof(*all), cmp_basename, blobs);
+
+    for (size_t i = 0; i < n;) {
+        const char *base = basename_of(blobs[all[i]].path);
+        size_t j = i + 1;
+        while (j < n && !strcmp(base, basename_of(blobs[all[j]].path)))
+            j++;
+        if (j == i + 1)
+            all[out++] = all[i];
+        i = j;
+    }
+    *nr_out = out;
+    return all;
+}
+
+/*
+ * Most renames move a file and keep its name: try the pairs whose
+ * basename is unique among sources and among destinations first, at a
+ * higher bar, before any matrix.
+ */
+static int find_basename_matches(struct rename_state *st, int min_score)
+{
+    size_t nr_s, nr_d, i = 0, j = 0;
+    size_t *s = unique_basenames(st->src, st->nr_src, 1, &nr_s);
+    size_t *d = unique_basenames(st->dst, st->nr_dst, 0, &nr_d);
+    size_t *pairs = NULL, nr_pairs = 0;
+    int ret = -1;
+
+    if (!s || !d || !(pairs = malloc((nr_s + 1) * 2 * sizeof(*pairs))))
+        goto out;
+    while (i < nr_s && j < nr_d) {
+        int cmp = strcmp(basename_of(st->src[s[i]].path), basename_of(st->dst[d[j]].path));
+        if (cmp < 0) {
+            i++;
+        } else if (cmp > 0) {
+            j++;
+        } else {
+            pairs[2 * nr_pairs] = s[i++];
+            pairs[2 * nr_pairs++ + 1] = d[j++];
+        }
+    }
+
+    st->nr_todo = 0;
+    for (i = 0; i < nr_pairs; i++) {
+        queue_fingerprint(st, &st->src[pairs[2 * i]]);
+        queue_fingerprint(st, &st->dst[pairs[2 * i + 1]]);
+    }
+    if (run_fingerprints(st) < 0)
+        goto out;
+
+    for (i = 0; i < nr_pairs; i++) {
+        size_t src = pairs[2 * i], dst = pairs[2 * i + 1];
+        int score = estimate_similarity(&st->src[src], &st->dst[dst], min_score);
+        if (score >= min_score)
+            record_pair(st, dst, src, score);
+    }
+    ret = 0;
+out:
+    free(s);
+    free(d);
+    free(pairs);
+    return ret;
+}
+
+
+/* ---- similarity matrix ---- */
+
+struct candidate {
+    long dst, src;              /* dst < 0: empty slot */
+    int score, name_score;
+    size_t pos;                 /* position in the matrix, for a stable sort */
+};
+
+/* > 0 if [a] is a worse candidate than [b]; empty slots are worst. */
+static int candidate_compare(const struct candidate *a, const struct candidate *b)
+{
+    if (a->dst < 0)
+        return b->dst >= 0;
+    if (b->dst < 0)
+        return -1;
+    if (a->score != b->score)
+        return b->score - a->score;
+    return b->name_score - a->name_score;
+}
+
+static int cmp_candidate(const void *a, const void *b)
+{
+    const struct candidate *x = a, *y = b;
+    int cmp = candidate_compare(x, y);
+    return cmp ? cmp : x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+/* Score one destination against every source, keeping the best few. */
+static void score_dst(void *data, size_t i, int worker)
+{
+    struct rename_state *st = data;
+    long d = st->mx_dst[i];
+    const struct rename_blob *dst = &st->dst[d];
+    struct candidate *m = &st->mx[i * CANDIDATES_PER_DST];
+
+    for (int k = 0; k < CANDIDATES_PER_DST; k++)
+        m[k] = (struct candidate){ -1, -1, 0, 0, i * CANDIDATES_PER_DST + k };
+
+    for (size_t s = 0; s < st->nr_src; s++) {
+        const struct rename_blob *src = &st->src[s];
+        if (src->culled)
+            continue;
+
+        struct candidate c = {
+            d, (long)s, estimate_similarity(src, dst, st->opts->min_score),
+            basename_same(src->path, dst->path), 0
+        };
+        int worst = 0;
+        for (int k = 1; k < CANDIDATES_PER_DST; k++)
+            if (candidate_compare(&m[k], &m[worst]) > 0)
+                worst = k;
+        if (candidate_compare(&m[worst], &c) > 0) {
+            c.pos = m[worst].pos;
+            m[worst] = c;
+        }
+    }
+}
+
+static size_t pick_pairs(struct rename_state *st, int copies)
+{
+    size_t count = 0, nr = st->nr_mx_dst * CANDIDATES_PER_DST;
+
+    for (size_t i = 0; i < nr; i++) {
+        const struct candidate *c = &st->mx[i];
+        if (c->dst < 0 || c->score < st->opts->min_score)
+            break;
+        if (st->dst[c->dst].is_rename)
+            continue;
+        if (!copies && st->src[c->src].used)
+            continue;
+        record_pair(st, c->dst, c->src, c->score);
+        count++;
+    }
+    return count;
+}
+
+static int score_matrix(struct rename_state *st, int *needed_limit)
+{
+    size_t nr_src = 0;
+
+    for (size_t s = 0; s < st->nr_src; s++)
+        nr_src += !st->src[s].culled;
+    st->nr_mx_dst = 0;
+    for (size_t d = 0; d < st->nr_dst; d++)
+        if (!st->dst[d].is_rename)
+            st->mx_dst[st->nr_mx_dst++] = d;
+    if (!nr_src || !st->nr_mx_dst)
+        return 0;
+
+    uint64_t limit = st->opts->limit;
+    if (limit && (uint64_t)nr_src * st->nr_mx_dst > limit * limit) {
+        if (needed_limit)
+            *needed_limit = nr_src > st->nr_mx_dst ? nr_src : st->nr_mx_dst;
+        return 0;
+    }
+
+    st->nr_todo = 0;
+    for (size_t s = 0; s < st->nr_src; s++)
+        if (!st->src[s].culled)
+            queue_fingerprint(st, &st->src[s]);
+    for (size_t i = 0; i < st->nr_mx_dst; i++)
+        queue_fingerprint(st, &st->dst[st->mx_dst[i]]);
+    if (run_fingerprints(st) < 0)
+        return -1;
+
+    st->mx = malloc(st->nr_mx_dst * CANDIDATES_PER_DST * sizeof(*st->mx));
+    if (!st->mx)
+        return -1;
+    thread_pool_for(st->pool, st->nr_mx_dst, 1, score_dst, st);
+
+    qsort(st->mx, st->nr_mx_dst * CANDIDATES_PER_DST, sizeof(*st->mx), cmp_candidate);
+    pick_pairs(st, 0);
+    if (st->opts->detect == RENAME_DETECT_COPIES)
+        pick_pairs(st, 1);
+    return 0;
+}
+
+
+/* ---- driver ---- */
+
+static void rename_state_clear(struct rename_state *st)
+{
+    thread_pool_destroy(st->pool);
+    for (int i = 0; st->workers && i < st->nr_workers; i++) {
+        delta_base_cache_clear(&st->workers[i].cache);
+        free(st->workers[i].len);
+        free(st->workers[i].touched);
+    }
+    free(st->workers);
+    for (size_t i = 0; i < st->nr_src; i++)
+        free(st->src[i].spans);
+    for (size_t i = 0; i < st->nr_dst; i++)
+        free(st->dst[i].spans);
+    free(st->src);
+    free(st->dst);
+    free(st->todo);
+    free(st->mx);
+    free(st->mx_dst);
+}
+
+static int rename_state_init(struct rename_state *st)
+{
+    st->pool = thread_pool_create(st->opts->nr_threads);
+    if (!st->pool)
+        return -1;
+    st->nr_workers = thread_pool_nr_threads(st->pool);
+    st->workers = calloc(st->nr_workers, sizeof(*st->workers));
+    if (!st->workers)
+        return -1;
+    for (int i = 0; i < st->nr_workers; i++) {
+        delta_base_cache_init(&st->workers[i].cache, DELTA_CACHE_WORKER_BYTES);
+        if (!(st->workers[i].len = calloc(SPAN_HASHBASE, sizeof(uint32_t))))
+            return -1;
+    }
+    return 0;
+}
+
+/* Rebuild the queue with the pairs found, in the original order. */
+static int apply_renames(struct rename_state *st, struct diff_queue *q)
+{
+    struct diff_queue out = { NULL, 0, 0 };
+    long *dst_of = malloc((q->nr + 1) * sizeof(*dst_of));
+    long *src_of = malloc((q->nr + 1) * sizeof(*src_of));
+    int ret = -1;
+
+    if (!dst_of || !src_of)
+        goto out;
+    for (size_t i = 0; i < q->nr; i++)
+        dst_of[i] = src_of[i] = -1;
+    for (size_t d = 0; d < st->nr_dst; d++)
+        dst_of[st->dst[d].change] = d;
+    for (size_t s = 0; s < st->nr_src; s++) {
+        src_of[st->src[s].change] = s;
+        st->src[s].uses_left = st->src[s].used;
+    }
+
+    for (size_t i = 0; i < q->nr; i++) {
+        struct diff_change c = q->changes[i];
+        long d = dst_of[i], s = src_of[i];
+
+        if (c.status == 'D' && s >= 0 && st->src[s].used)
+            continue;
+        if (d >= 0 && st->dst[d].is_rename) {
+            struct rename_blob *src = &st->src[st->dst[d].src];
+            const struct diff_change *from = &q->changes[src->change];
+
+            /* every use of a source but its last is a copy */
+            c.status = --src->uses_left > 0 ? 'C' : 'R';
+            c.old_path = from->path;
+            c.old_mode = from->old_mode;
+            c.old_oid = from->old_oid;
+            c.similarity = (int)((long)st->dst[d].score * 100 / RENAME_MAX_SCORE);
+        }
+        if (diff_queue_add(&c, &out) < 0)
+            goto out;
+    }
+
+    diff_queue_clear(q);
+    *q = out;
+    memset(&out, 0, sizeof(out));
+    ret = 0;
+out:
+    diff_queue_clear(&out);
+    free(dst_of);
+    free(src_of);
+    return ret;
+}
+
+int diff_detect_renames(struct repository *repo, struct diff_queue *q,
+                        const struct rename_options *opts, int *needed_limit)
+{
+    struct rename_state st;
+    int copies = opts->detect == RENAME_DETECT_COPIES, ret = -1;
+
+    if (needed_limit)
+        *needed_limit = 0;
+    memset(&st, 0, sizeof(st));
+    st.repo = repo;
+    st.opts = opts;
+
+    st.src = calloc(q->nr + 1, sizeof(*st.src));
+    st.dst = calloc(q->nr + 1, sizeof(*st.dst));
+    st.todo = malloc((2 * q->nr + 1) * sizeof(*st.todo));
+    st.mx_dst = malloc((q->nr + 1) * sizeof(*st.mx_dst));
+    if (!st.src || !st.dst || !st.todo || !st.mx_dst)
+        goto out;
+
+    for (size_t i = 0; i < q->nr; i++) {
+        const struct diff_change *c = &q->changes[i];
+        if (c->status == 'A')
+            st.dst[st.nr_dst++] = (struct rename_blob){
+                .change = i, .path = c->path, .mode = c->new_mode, .oid = &c->new_oid, .src = -1
+            };
+        else if (c->status == 'D' || (copies && (c->status == 'M' || c->status == 'T')))
+            /* a modified file stays: it is never renamed away */
+            st.src[st.nr_src++] = (struct rename_blob){
+                .change = i, .path = c->path, .mode = c->old_mode, .oid = &c->old_oid,
+                .used = c->status != 'D'
+            };
+    }
+    if (!st.nr_src || !st.nr_dst) {
+        ret = 0;
+        goto out;
+    }
+
+    if (find_exact_renames(&st) < 0)
+        goto out;
+
+    if (opts->min_score < RENAME_MAX_SCORE) {
+        if (rename_state_init(&st) < 0)
+            goto out;
+        if (!copies) {
+            for (size_t s = 0; s < st.nr_src; s++)
+                st.src[s].culled = st.src[s].used > 0;
+            if (find_basename_matches(&st, opts->min_score +
+                                      (RENAME_MAX_SCORE - opts->min_score) / 2) < 0)
+                goto out;
+            for (size_t s = 0; s < st.nr_src; s++)
+                st.src[s].culled = st.src[s].used > 0;
+        }
+        if (score_matrix(&st, needed_limit) < 0)
+            goto out;
+    }
+
+    ret = apply_renames(&st, q);
+out:
+    rename_state_clear(&st);
+    return ret;
+}
+
+int parse_rename_score(const char *arg)
+{
+    unsigned long num = 0, scale = 1;
+    int dot = 0;
+
+    for (; *arg; arg++) {
+        if (!dot && *arg == '.') {
+            scale = 1;
+            dot = 1;
+        } else if (*arg == '%') {
+            scale = dot ? scale * 100 : 100;
+            arg++;
+            break;
+        } else if (*arg >= '0' && *arg <= '9') {
+            if (scale < 100000) {
+                scale *= 10;
+                num = num * 10 + (*arg - '0');
+            }
+        } else {
+            break;
+        }
+    }
+    if (*arg)
+        return -1;
+    return num >= scale ? RENAME_MAX_SCORE : (int)(RENAME_MAX_SCORE * num / scale);
+}
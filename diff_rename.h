@@ -0,0 +1,76 @@
+#ifndef DIFF_RENAME_H
+#define DIFF_RENAME_H
+
+#include <stddef.h>
+#include "tree_diff.h"
+
+struct repository;
+
+/*
+ * Rename and copy detection over the changes of a tree diff, after
+ * git's diffcore-rename.
+ *
+ * Additions are paired with deletions (and, for copies, with modified
+ * files too) in stages, each only looking at what is left:
+ *
+ *  1. same blob id: exact renames, no content read;
+ *  2. for renames, a source and destination whose basename is unique
+ *     on both sides, if they are similar enough (halfway between the
+ *     threshold and 100%);
+ *  3. every remaining source against every remaining destination,
+ *     unless that matrix is larger than limit x limit.
+ *
+ * Similarity compares fingerprints: a blob is cut at line ends (or
+ * every 64 bytes) and each chunk's hash is counted with its length, in
+ * a sorted array. The score is how many bytes of the destination are
+ * found in the source, over the larger size. Fingerprints are computed
+ * once per blob and the matrix is scored by a thread pool, keeping the
+ * best four sources per destination; pairs are then picked best score
+ * first.
+ */
+#define RENAME_MAX_SCORE 60000
+#define RENAME_DEFAULT_SCORE 30000      /* 50% */
+
+enum rename_detect {
+    RENAME_DETECT_RENAMES = 1,          /* -M */
+    RENAME_DETECT_COPIES,               /* -C */
+};
+
+struct rename_options {
+    enum rename_detect detect;
+    int min_score;              /* out of RENAME_MAX_SCORE */
+    int limit;                  /* cap on sources and destinations; 0: none */
+    int nr_threads;             /* 0: one per online CPU */
+};
+
+#define RENAME_OPTIONS_INIT { RENAME_DETECT_RENAMES, RENAME_DEFAULT_SCORE, 1000, 0 }
+
+/* Changes collected from diff_trees(), with their own copies of the paths. */
+struct diff_queue {
+    struct diff_change *changes;
+    size_t nr, alloc;
+};
+
+/* A diff_change_fn appending to the diff_queue [queue]. */
+int diff_queue_add(const struct diff_change *change, void *queue);
+void diff_queue_clear(struct diff_queue *q);
+
+/*
+ * Replace paired additions in [q] with 'R' and 'C' entries and drop
+ * the deletions they consumed, keeping tree order. Each use of a
+ * deleted file but the last is a copy, as in git. If the matrix went
+ * over the limit, the inexact stage is skipped and *[needed_limit]
+ * (may be NULL) says what limit would have done; it is 0 otherwise.
+ * Returns 0, or -1 if a blob cannot be read.
+ */
+int diff_detect_renames(struct repository *repo, struct diff_queue *q,
+                        const struct rename_options *opts, int *needed_limit);
+
+/*
+ * Parse the number after -M or -C the way git does ("5" and "50" are
+ * 50%, "5%" is 5%, "0.5" is 50%) into a score. Returns -1 if [arg]
+ * has anything after the number.
+ */
+int parse_rename_score(const char *arg);
+
+#endif /* DIFF_RENAME_H */
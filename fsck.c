@@ -0,0 +1,617 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "fsck.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "commit.h"
+#include "compression/compress.h"
+#include "hex.h"
+#include "oidmap.h"
+#include "pack.h"
+#include "repository.h"
+#include "tag.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+/*
+ * Objects handed to a worker at a time: consecutive ones share delta
+ * bases, and the packed ones are hashed as one batch.
+ */
+#define FSCK_CHUNK 256
+
+/* Inflated bytes a worker holds before hashing what it has read. */
+#define FSCK_BATCH_BYTES (8u << 20)
+
+
+/* An object to check: loose when [pack] is NULL. */
+struct fsck_item {
+    struct object_id oid;
+    struct packed_git *pack;
+    uint64_t offset;
+};
+
+struct problem_list {
+    struct fsck_problem *items;
+    size_t nr, alloc;
+};
+
+struct fsck_worker {
+    struct hash_ctx hash;
+    struct delta_base_cache cache;
+    struct problem_list bad, missing, warnings;
+    size_t nr_by_type[OBJ_TAG + 1];
+    uint64_t bytes;
+};
+
+/* Whole-pack checksum verification, run as a pool task of its own. */
+struct pack_check {
+    struct packed_git *pack;
+    const char *result;         /* NULL, or why the pack is bad */
+};
+
+struct fsck_state {
+    struct repository *repo;
+    const struct fsck_options *opts;
+
+    struct fsck_item *items;
+    size_t nr, alloc;
+    struct oidmap present;      /* every enumerated id -> (void *)1 */
+
+    struct fsck_worker *workers;
+
+    struct pack_check *packs;
+    size_t nr_packs;
+};
+
+
+static void add_problem(struct problem_list *list, const struct object_id *oid,
+                        const struct object_id *from, const char *reason)
+{
+    if (list->nr == list->alloc) {
+        size_t alloc = list->alloc ? 2 * list->alloc : 16;
+        struct fsck_problem *tmp = realloc(list->items, alloc * sizeof(*tmp));
+        if (!tmp)
+            return;     /* the count stays right; the entry is lost */
+        list->items = tmp;
+        list->alloc = alloc;
+    }
+
+    struct fsck_problem *p = &list->items[list->nr++];
+    p->oid = *oid;
+    if (from)
+        p->referenced_by = *from;
+    else
+        memset(&p->referenced_by, 0, sizeof(p->referenced_by));
+    p->reason = reason;
+}
+
+static int add_item(struct fsck_state *st, const struct object_id *oid,
+                    struct packed_git *pack, uint64_t offset)
+{
+    if (st->nr == st->alloc) {
+        size_t alloc = st->alloc ? 2 * st->alloc : 1024;
+        struct fsck_item *tmp = realloc(st->items, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        st->items = tmp;
+        st->alloc = alloc;
+    }
+
+    struct fsck_item *item = &st->items[st->nr++];
+    item->oid = *oid;
+    item->pack = pack;
+    item->offset = offset;
+
+    /* oidmap_put() returns NULL for a new id, or [data] if it failed */
+    if (!oidmap_get(&st->present, oid) &&
+        oidmap_put(&st->present, oid, (void *)1) != NULL)
+        return -1;
+    return 0;
+}
+
+
+/* ---- enumeration ---- */
+
+static int collect_loose(const struct object_id *oid, const char *path,
+                         void *data)
+{
+    return add_item(data, oid, NULL, 0);
+}
+
+static int compare_offsets(const void *a, const void *b)
+{
+    uint64_t x = ((const struct fsck_item *)a)->offset;
+    uint64_t y = ((const struct fsck_item *)b)->offset;
+    return x < y ? -1 : x > y;
+}
+
+static int collect_packed(struct fsck_state *st, struct packed_git *p)
+{
+    size_t first = st->nr;
+    struct object_id oid;
+
+    for (uint32_t i = 0; i < p->nr_objects; i++) {
+        oid_set_raw(&oid, pack_nth_oid(p, i), p->algo);
+        if (add_item(st, &oid, p, pack_nth_offset(p, i)) < 0)
+            return -1;
+    }
+
+    /* pack order, so that delta bases are read just before their deltas */
+    qsort(st->items + first, st->nr - first, sizeof(*st->items), compare_offsets);
+    return 0;
+}
+
+
+/* ---- per-object checks ---- */
+
+static void check_link(struct fsck_state *st, struct fsck_worker *w,
+                       const struct object_id *from, const struct object_id *to)
+{
+    if (st->opts->check_connectivity && !oidmap_get(&st->present, to))
+        add_problem(&w->missing, to, from, "missing object");
+}
+
+/* git fsck's warnings about entry names, each given once per tree. */
+static const char *const name_warnings[] = {
+    "emptyName: contains empty pathname",
+    "fullPathname: contains full pathnames",
+    "hasDot: contains '.'",
+    "hasDotdot: contains '..'",
+    "hasDotgit: contains '.git'",
+};
+
+/* The index in name_warnings[] of what is wrong with [name], or -1. */
+static int name_warning(const char *name, size_t len)
+{
+    if (verify_path_component(name, len))
+        return -1;
+    if (!len)
+        return 0;
+    if (memchr(name, '/', len))
+        return 1;
+    if (len == 1)
+        return 2;
+    if (len == 2)
+        return 3;
+    return 4;
+}
+
+static const char *check_tree(struct fsck_state *st, struct fsck_worker *w,
+                              const struct object_id *oid,
+                              const char *buf, size_t len)
+{
+    struct tree_desc desc;
+    struct name_entry entry;
+    struct object_id target;
+    unsigned warned = 0;
+    int ret, warning;
+
+    init_tree_desc(&desc, buf, len, hash_algo_rawsz(st->repo->hash_algo),
+                   TREE_DESC_STRICT);
+    while ((ret = tree_desc_next(&desc, &entry)) > 0) {
+        if ((warning = name_warning(entry.path, entry.pathlen)) >= 0 &&
+            !(warned & (1u << warning))) {
+            warned |= 1u << warning;
+            add_problem(&w->warnings, oid, NULL, name_warnings[warning]);
+        }
+        if (S_ISGITLINK_MODE(entry.mode))
+            continue;   /* submodule commits live in another repository */
+        oid_set_raw(&target, entry.oid, st->repo->hash_algo);
+        check_link(st, w, oid, &target);
+    }
+    return ret < 0 ? "malformed tree" : NULL;
+}
+
+static const char *check_commit(struct fsck_state *st, struct fsck_worker *w,
+                                const struct object_id *oid,
+                                const char *buf, size_t len)
+{
+    struct commit_object c = {0};
+
+    if (parse_commit_buffer(&c, buf, len, st->repo->hash_algo) < 0)
+        return "malformed commit";
+
+    check_link(st, w, oid, &c.tree);
+    for (size_t i = 0; i < c.parent_count; i++)
+        check_link(st, w, oid, &c.parents[i]);
+    free(c.parents);
+    return NULL;
+}
+
+static const char *check_tag(struct fsck_state *st, struct fsck_worker *w,
+                             const struct object_id *oid,
+                             const char *buf, size_t len)
+{
+    struct tag_object t = {0};
+
+    if (parse_tag_buffer(&t, buf, len, st->repo->hash_algo) < 0)
+        return "malformed tag";
+
+    check_link(st, w, oid, &t.target);
+    return NULL;
+}
+
+/* Count a verified object and run the checks for its type. */
+static void check_body(struct fsck_state *st, struct fsck_worker *w,
+                       const struct object_id *oid, enum object_type type,
+                       const char *body, size_t size)
+{
+    const char *reason = NULL;
+
+    w->bytes += size;
+    w->nr_by_type[type]++;
+
+    switch (type) {
+    case OBJ_TREE:
+        reason = check_tree(st, w, oid, body, size);
+        break;
+    case OBJ_COMMIT:
+        reason = check_commit(st, w, oid, body, size);
+        break;
+    case OBJ_TAG:
+        reason = check_tag(st, w, oid, body, size);
+        break;
+    default:
+        break;
+    }
+
+    if (reason)
+        add_problem(&w->bad, oid, NULL, reason);
+}
+
+/* Loose objects are hashed while they are inflated. */
+static void check_loose(struct fsck_state *st, struct fsck_worker *w,
+                        const struct fsck_item *item)
+{
+    hash_algo_t algo = st->repo->hash_algo;
+    unsigned char digest[MAX_RAW_OID_LENGTH];
+    enum object_type type;
+
+    if (hash_init(&w->hash, algo) < 0) {
+        add_problem(&w->bad, &item->oid, NULL, "out of memory");
+        return;
+    }
+
+    char *path = repo_loose_object_path(st->repo, &item->oid);
+    size_t total = 0;
+    char *buf = path ? decompress_file_hashed(path, &total, &w->hash) : NULL;
+    free(path);
+    if (!buf) {
+        add_problem(&w->bad, &item->oid, NULL, "unreadable loose object");
+        return;
+    }
+
+    size_t body_off = parse_object_header(buf, total, &type);
+    if (!body_off) {
+        add_problem(&w->bad, &item->oid, NULL, "malformed object header");
+    } else {
+        hash_final(&w->hash, digest);
+        if (memcmp(digest, item->oid.hash, hash_algo_rawsz(algo)) != 0)
+            add_problem(&w->bad, &item->oid, NULL, "hash mismatch");
+        else
+            check_body(st, w, &item->oid, type, buf + body_off, total - body_off);
+    }
+    free(buf);
+}
+
+/* A packed object that has been read and waits for its hash. */
+struct fsck_pending {
+    const struct fsck_item *item;
+    enum object_type type;
+    char *buf;
+    size_t size;
+    char header[32];
+    unsigned char digest[MAX_RAW_OID_LENGTH];
+};
+
+/* Hash [pending] objects in one batch, then check the ones that match. */
+static void check_pending(struct fsck_state *st, struct fsck_worker *w,
+                          struct fsck_pending *pending, size_t nr)
+{
+    hash_algo_t algo = st->repo->hash_algo;
+    struct hash_batch_item batch[FSCK_CHUNK];
+    int ok;
+
+    for (size_t i = 0; i < nr; i++) {
+        struct fsck_pending *p = &pending[i];
+        batch[i].prefix = p->header;
+        batch[i].prefix_len = snprintf(p->header, sizeof(p->header), "%s %zu",
+                                       type_name(p->type), p->size) + 1;
+        batch[i].data = p->buf;
+        batch[i].len = p->size;
+        batch[i].out = p->digest;
+    }
+    ok = hash_batch(algo, batch, nr) == 0;
+
+    for (size_t i = 0; i < nr; i++) {
+        struct fsck_pending *p = &pending[i];
+        const struct object_id *oid = &p->item->oid;
+
+        if (!ok)
+            add_problem(&w->bad, oid, NULL, "out of memory");
+        else if (memcmp(p->digest, oid->hash, hash_algo_rawsz(algo)) != 0)
+            add_problem(&w->bad, oid, NULL, "hash mismatch");
+        else
+            check_body(st, w, oid, p->type, p->buf, p->size);
+        free(p->buf);
+    }
+}
+
+/*
+ * Check items [c * FSCK_CHUNK, (c + 1) * FSCK_CHUNK). Packed objects are
+ * read first and hashed together, up to FSCK_BATCH_BYTES at a time.
+ */
+static void check_chunk(void *data, size_t c, int worker)
+{
+    struct fsck_state *st = data;
+    struct fsck_worker *w = &st->workers[worker];
+    struct fsck_pending pending[FSCK_CHUNK];
+    size_t end = (c + 1) * FSCK_CHUNK < st->nr ? (c + 1) * FSCK_CHUNK : st->nr;
+    size_t nr = 0, bytes = 0;
+
+    for (size_t i = c * FSCK_CHUNK; i < end; i++) {
+        const struct fsck_item *item = &st->items[i];
+
+        if (!item->pack) {
+            check_loose(st, w, item);
+            continue;
+        }
+
+        struct fsck_pending *p = &pending[nr];
+        p->item = item;
+        p->buf = pack_read_object(item->pack, item->offset, &p->type, &p->size,
+                                  &w->cache);
+        if (!p->buf) {
+            add_problem(&w->bad, &item->oid, NULL, "corrupt pack entry");
+            continue;
+        }
+
+        nr++;
+        bytes += p->size;
+        if (bytes >= FSCK_BATCH_BYTES) {
+            check_pending(st, w, pending, nr);
+            nr = bytes = 0;
+        }
+    }
+    check_pending(st, w, pending, nr);
+}
+
+static void check_pack(void *data, int worker)
+{
+    struct pack_check *check = data;
+
+    if (pack_verify_checksums(check->pack) < 0)
+        check->result = "checksum mismatch";
+}
+
+
+/* ---- driver ---- */
+
+/* Append [list] to (*out, *nr) and release it. */
+static void take_problems(struct fsck_problem **out, size_t *nr,
+                          struct problem_list *list)
+{
+    if (list->nr) {
+        struct fsck_problem *tmp = realloc(*out, (*nr + list->nr) * sizeof(*tmp));
+        if (tmp) {
+            memcpy(tmp + *nr, list->items, list->nr * sizeof(*tmp));
+            *out = tmp;
+            *nr += list->nr;
+        }
+    }
+    free(list->items);
+}
+
+int fsck_repository(struct repository *repo, const struct fsck_options *opts,
+                    struct fsck_report *report)
+{
+    struct fsck_state st = {0};
+    struct thread_pool *pool = NULL;
+    int ret = -1;
+    double start = monotonic_seconds();
+
+    memset(report, 0, sizeof(*report));
+    st.repo = repo;
+    st.opts = opts;
+
+    if (for_each_loose_object(repo, collect_loose, &st) < 0 && st.nr == 0 &&
+        !repo->packs) {
+        ERROR("cannot read the objects of %s", repo->gitdir);
+        goto out;
+    }
+    report->nr_loose = st.nr;
+
+    for (struct packed_git *p = repo->packs; p; p = p->next)
+        st.nr_packs++;
+    st.packs = calloc(st.nr_packs ? st.nr_packs : 1, sizeof(*st.packs));
+    if (!st.packs)
+        goto out;
+
+    size_t n = 0;
+    for (struct packed_git *p = repo->packs; p; p = p->next) {
+        st.packs[n++].pack = p;
+        if (collect_packed(&st, p) < 0)
+            goto out;
+    }
+    report->nr_packs = st.nr_packs;
+    report->nr_packed = st.nr - report->nr_loose;
+    report->nr_objects = st.nr;
+
+    pool = thread_pool_create(opts->nr_threads);
+    if (!pool)
+        goto out;
+    report->nr_threads = thread_pool_nr_threads(pool);
+
+    st.workers = calloc(report->nr_threads, sizeof(*st.workers));
+    if (!st.workers)
+        goto out;
+    for (int i = 0; i < report->nr_threads; i++)
+        delta_base_cache_init(&st.workers[i].cache, DELTA_CACHE_WORKER_BYTES);
+
+    /* pack checksums are queued first and run next to the object checks */
+    for (size_t i = 0; i < st.nr_packs; i++) {
+        if (thread_pool_submit(pool, check_pack, &st.packs[i]) < 0)
+            check_pack(&st.packs[i], 0);
+    }
+    thread_pool_for(pool, (st.nr + FSCK_CHUNK - 1) / FSCK_CHUNK, 1, check_chunk, &st);
+
+    for (int i = 0; i < report->nr_threads; i++) {
+        struct fsck_worker *w = &st.workers[i];
+        report->bytes += w->bytes;
+        for (int t = 0; t <= OBJ_TAG; t++)
+            report->nr_by_type[t] += w->nr_by_type[t];
+        take_problems(&report->bad, &report->nr_bad, &w->bad);
+        take_problems(&report->missing, &report->nr_missing, &w->missing);
+        take_problems(&report->warnings, &report->nr_warnings, &w->warnings);
+        delta_base_cache_clear(&w->cache);
+        hash_ctx_release(&w->hash);
+    }
+
+    for (size_t i = 0; i < st.nr_packs; i++) {
+        if (!st.packs[i].result)
+            continue;
+        struct fsck_pack_problem *tmp = realloc(report->bad_packs,
+                                                (report->nr_bad_packs + 1) * sizeof(*tmp));
+        if (!tmp)
+            break;
+        report->bad_packs = tmp;
+        tmp[report->nr_bad_packs].pack = strdup(st.packs[i].pack->pack_path);
+        tmp[report->nr_bad_packs].reason = st.packs[i].result;
+        report->nr_bad_packs++;
+    }
+
+    ret = report->nr_bad || report->nr_missing || report->nr_bad_packs ? 1 : 0;
+
+out:
+    thread_pool_destroy(pool);
+    report->seconds = monotonic_seconds() - start;
+    free(st.workers);
+    free(st.items);
+    free(st.packs);
+    oidmap_clear(&st.present, 0);
+    return ret;
+}
+
+void fsck_report_clear(struct fsck_report *report)
+{
+    for (size_t i = 0; i < report->nr_bad_packs; i++)
+        free(report->bad_packs[i].pack);
+    free(report->bad_packs);
+    free(report->bad);
+    free(report->missing);
+    free(report->warnings);
+    memset(report, 0, sizeof(*report));
+}
+
+
+/* ---- output ---- */
+
+static void json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+void fsck_report_json(const struct fsck_report *report, FILE *out)
+{
+    double secs = report->seconds > 0 ? report->seconds : 1e-9;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"threads\": %d,\n", report->nr_threads);
+    fprintf(out, "  \"objects\": %zu,\n", report->nr_objects);
+    fprintf(out, "  \"loose\": %zu,\n", report->nr_loose);
+    fprintf(out, "  \"packed\": %zu,\n", report->nr_packed);
+    fprintf(out, "  \"packs\": %zu,\n", report->nr_packs);
+    fprintf(out, "  \"types\": {\"commit\": %zu, \"tree\": %zu, \"blob\": %zu, \"tag\": %zu},\n",
+            report->nr_by_type[OBJ_COMMIT], report->nr_by_type[OBJ_TREE],
+            report->nr_by_type[OBJ_BLOB], report->nr_by_type[OBJ_TAG]);
+    fprintf(out, "  \"bytes\": %llu,\n", (unsigned long long)report->bytes);
+    fprintf(out, "  \"seconds\": %.6f,\n", report->seconds);
+    fprintf(out, "  \"objects_per_sec\": %.1f,\n", report->nr_objects / secs);
+    fprintf(out, "  \"mb_per_sec\": %.2f,\n", report->bytes / secs / 1e6);
+
+    fprintf(out, "  \"bad_objects\": [");
+    for (size_t i = 0; i < report->nr_bad; i++) {
+        fprintf(out, "%s\n    {\"oid\": \"%s\", \"reason\": ", i ? "," : "",
+                oid_to_hex(&report->bad[i].oid));
+        json_string(out, report->bad[i].reason);
+        fputc('}', out);
+    }
+    fprintf(out, "%s],\n", report->nr_bad ? "\n  " : "");
+
+    fprintf(out, "  \"missing_links\": [");
+    for (size_t i = 0; i < report->nr_missing; i++) {
+        fprintf(out, "%s\n    {\"oid\": \"%s\", \"referenced_by\": \"%s\"}",
+                i ? "," : "", oid_to_hex(&report->missing[i].oid),
+                oid_to_hex(&report->missing[i].referenced_by));
+    }
+    fprintf(out, "%s],\n", report->nr_missing ? "\n  " : "");
+
+    fprintf(out, "  \"bad_packs\": [");
+    for (size_t i = 0; i < report->nr_bad_packs; i++) {
+        fprintf(out, "%s\n    {\"pack\": ", i ? "," : "");
+        json_string(out, report->bad_packs[i].pack);
+        fprintf(out, ", \"reason\": ");
+        json_string(out, report->bad_packs[i].reason);
+        fputc('}', out);
+    }
+    fprintf(out, "%s],\n", report->nr_bad_packs ? "\n  " : "");
+
+    fprintf(out, "  \"warnings\": [");
+    for (size_t i = 0; i < report->nr_warnings; i++) {
+        fprintf(out, "%s\n    {\"oid\": \"%s\", \"reason\": ", i ? "," : "",
+                oid_to_hex(&report->warnings[i].oid));
+        json_string(out, report->warnings[i].reason);
+        fputc('}', out);
+    }
+    fprintf(out, "%s]\n", report->nr_warnings ? "\n  " : "");
+    fprintf(out, "}\n");
+}
+
+
+int cmd_fsck(int argc, char **argv)
+{
+    struct fsck_options opts = FSCK_OPTIONS_INIT;
+    const char *gitdir = ".git";
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            opts.nr_threads = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--threads=", 10)) {
+            opts.nr_threads = atoi(argv[i] + 10);
+        } else if (!strcmp(argv[i], "--no-connectivity")) {
+            opts.check_connectivity = 0;
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: fsck [-j <threads>] [--no-connectivity] [<gitdir>]\n");
+            return 128;
+        } else {
+            gitdir = argv[i];
+        }
+    }
+
+    struct repository repo;
+    if (repo_open(&repo, gitdir) < 0) {
+        ERROR("%s is not a git directory", gitdir);
+        return 128;
+    }
+
+    struct fsck_report report;
+    int ret = fsck_repository(&repo, &opts, &report);
+    if (ret >= 0)
+        fsck_report_json(&report, stdout);
+
+    fsck_report_clear(&report);
+    repo_clear(&repo);
+    return ret < 0 ? 128 : ret;
+}
@@ -0,0 +1,82 @@
+#ifndef FSCK_H
+#define FSCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "object.h"
+
+struct repository;
+
+/*
+ * Object database integrity check.
+ *
+ * Every loose and packed object is read and re-hashed; trees, commits
+ * and tags are parsed strictly; and every id they reference (except
+ * gitlinks) must name an object present in the repository. Packs also
+ * get their trailing checksums verified. The work is spread over a
+ * thread pool: objects are handed out in pack order so that each
+ * worker's delta base cache stays warm, and the packed objects a worker
+ * has read are hashed together with hash_batch().
+ *
+ * Tree entries named ".", ".." or ".git", empty or containing a '/' get
+ * the warnings git fsck gives them. As in git, warnings are reported
+ * but do not make the repository fail the check.
+ */
+struct fsck_options {
+    int nr_threads;             /* 0: one per online CPU */
+    int check_connectivity;     /* report references to missing objects */
+};
+
+#define FSCK_OPTIONS_INIT { 0, 1 }
+
+/* One bad object, or one reference to a missing object. */
+struct fsck_problem {
+    struct object_id oid;
+    struct object_id referenced_by;     /* missing links only */
+    const char *reason;                 /* static string */
+};
+
+struct fsck_pack_problem {
+    char *pack;
+    const char *reason;
+};
+
+struct fsck_report {
+    int nr_threads;
+    size_t nr_objects, nr_loose, nr_packed, nr_packs;
+    size_t nr_by_type[OBJ_TAG + 1];
+    uint64_t bytes;                 /* inflated object bytes verified */
+    double seconds;
+
+    struct fsck_problem *bad;       /* unreadable, mismatched, malformed */
+    size_t nr_bad;
+    struct fsck_problem *missing;   /* broken links */
+    size_t nr_missing;
+    struct fsck_pack_problem *bad_packs;
+    size_t nr_bad_packs;
+    struct fsck_problem *warnings;  /* suspicious tree entry names */
+    size_t nr_warnings;
+};
+
+/*
+ * Check [repo] and fill [report]. Returns 0 if no problem was found, 1
+ * if some were (see the report), or -1 if the check could not run.
+ * Warnings alone leave the result at 0.
+ */
+int fsck_repository(struct repository *repo, const struct fsck_options *opts,
+                    struct fsck_report *report);
+
+/* Write [report] as one JSON object, with throughput figures. */
+void fsck_report_json(const struct fsck_report *report, FILE *out);
+
+void fsck_report_clear(struct fsck_report *report);
+
+/*
+ * "fsck [-j <threads>] [--no-connectivity] [<gitdir>]": check the
+ * repository (default ".git") and print the JSON report on stdout.
+ * Exits with 0 if it is clean, 1 if problems were found, 128 on error.
+ */
+int cmd_fsck(int argc, char **argv);
+
+#endif /* FSCK_H */
@@ -0,0 +1,545 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "grep.h"
+
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "hex.h"
+#include "pack.h"
+#include "pathspec.h"
+#include "repository.h"
+#include "scan.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+/* Blobs searched before their matches are reported. */
+#define GREP_WINDOW 1024
+
+/* Like git: a NUL in this many leading bytes makes a blob binary. */
+#define GREP_BINARY_PEEK 8000
+
+
+/* One blob to search, and what was found in it. */
+struct grep_item {
+    size_t path;                /* offset in grep_state.paths */
+    struct object_id oid;
+
+    /* matches, as struct match_record each followed by its line */
+    char *out;
+    size_t out_len, out_alloc;
+    int failed;
+};
+
+struct match_record {
+    size_t lineno;              /* 0: binary blob */
+    size_t len;
+};
+
+struct grep_worker {
+    struct delta_base_cache cache;
+    regex_t re;
+    int has_re;
+};
+
+struct grep_state {
+    struct repository *repo;
+    const struct grep_options *opts;
+    size_t rawsz;
+
+    /* literal search, or NULL for regex */
+    const char *literal;
+    size_t literal_len;
+
+    struct grep_item *items;
+    size_t nr, alloc;
+    char *paths;                /* NUL-terminated paths of the items */
+    size_t paths_len, paths_alloc;
+
+    struct grep_worker *workers;
+    size_t window;              /* first item of the current window */
+};
+
+
+/* ---- pattern ---- */
+
+static int is_literal(const char *pattern, enum grep_pattern_type type)
+{
+    if (type == GREP_PATTERN_FIXED)
+        return 1;
+    return !strpbrk(pattern, type == GREP_PATTERN_EXTENDED ?
+                    "\\.[]*^$+?(){}|" : "\\.[]*^$");
+}
+
+/* A basic regex that matches [literal] as is, for -F -i. */
+static char *quote_literal(const char *literal)
+{
+    char *out = malloc(2 * strlen(literal) + 1), *p = out;
+    if (!out)
+        return NULL;
+    for (; *literal; literal++) {
+        if (strchr("\\.[]*^$", *literal))
+            *p++ = '\\';
+        *p++ = *literal;
+    }
+    *p = '\0';
+    return out;
+}
+
+static int compile(regex_t *re, const struct grep_options *opts)
+{
+    int flags = REG_NEWLINE;
+    char *quoted = NULL;
+    const char *pattern = opts->pattern;
+
+    if (opts->type == GREP_PATTERN_EXTENDED)
+        flags |= REG_EXTENDED;
+    if (opts->ignore_case)
+        flags |= REG_ICASE;
+    if (opts->type == GREP_PATTERN_FIXED && !(pattern = quoted = quote_literal(pattern)))
+        return -1;
+
+    int ret = regcomp(re, pattern, flags);
+    if (ret) {
+        char msg[256];
+        regerror(ret, re, msg, sizeof(msg));
+        ERROR("invalid pattern '%s': %s", opts->pattern, msg);
+    }
+    free(quoted);
+    return ret ? -1 : 0;
+}
+
+/*
+ * Offset of the first match at or after [pos] (a line start), or -1.
+ * regexec() stops at a NUL, so a text blob with one later on is
+ * searched a NUL-separated piece at a time.
+ */
+static long find_match(struct grep_state *st, struct grep_worker *w,
+                       const char *buf, size_t size, size_t pos)
+{
+    if (st->literal) {
+        const char *hit = scan_memmem(buf + pos, size - pos, st->literal, st->literal_len);
+        return hit ? hit - buf : -1;
+    }
+
+    while (pos < size) {
+        regmatch_t m;
+        int notbol = pos && buf[pos - 1] != '\n';
+        if (!regexec(&w->re, buf + pos, 1, &m, notbol ? REG_NOTBOL : 0))
+            return (long)(pos + m.rm_so);
+        pos += strlen(buf + pos) + 1;
+    }
+    return -1;
+}
+
+
+/* ---- searching ---- */
+
+static int add_record(struct grep_item *item, size_t lineno,
+                      const char *line, size_t len)
+{
+    struct match_record rec = { lineno, len };
+    size_t need = item->out_len + sizeof(rec) + len;
+
+    if (need > item->out_alloc) {
+        size_t alloc = item->out_alloc ? item->out_alloc : 256;
+        while (alloc < need)
+            alloc *= 2;
+        char *tmp = realloc(item->out, alloc);
+        if (!tmp)
+            return -1;
+        item->out = tmp;
+        item->out_alloc = alloc;
+    }
+    memcpy(item->out + item->out_len, &rec, sizeof(rec));
+    if (len)    /* a binary blob's record has no line */
+        memcpy(item->out + item->out_len + sizeof(rec), line, len);
+    item->out_len = need;
+    return 0;
+}
+
+static void grep_buffer(struct grep_state *st, struct grep_worker *w,
+                        struct grep_item *item, const char *buf, size_t size)
+{
+    size_t peek = size < GREP_BINARY_PEEK ? size : GREP_BINARY_PEEK;
+    int binary = memchr(buf, '\0', peek) != NULL;
+    size_t pos = 0, counted = 0, lineno = 1;
+    long off;
+
+    while (pos < size && (off = find_match(st, w, buf, size, pos)) >= 0) {
+        if (binary) {
+            if (add_record(item, 0, NULL, 0) < 0)
+                item->failed = 1;
+            return;
+        }
+
+        size_t start = off, end;
+        while (start > pos && buf[start - 1] != '\n')
+            start--;
+        const char *nl = memchr(buf + off, '\n', size - off);
+        end = nl ? (size_t)(nl - buf) : size;
+
+        for (; counted < start; counted++)
+            lineno += buf[counted] == '\n';
+        if (add_record(item, lineno, buf + start, end - start) < 0) {
+            item->failed = 1;
+            return;
+        }
+        if (st->opts->first_match_only)
+            return;
+        pos = end + 1;
+    }
+}
+
+static void grep_one(void *data, size_t i, int worker)
+{
+    struct grep_state *st = data;
+    struct grep_worker *w = &st->workers[worker];
+    struct grep_item *item = &st->items[st->window + i];
+    enum object_type type;
+    size_t size;
+
+    char *buf = repo_read_object_cached(st->repo, &item->oid, &type, &size, &w->cache);
+    if (!buf || type != OBJ_BLOB) {
+        ERROR("cannot read blob %s", oid_to_hex(&item->oid));
+        item->failed = 1;
+    } else {
+        grep_buffer(st, w, item, buf, size);
+    }
+    free(buf);
+}
+
+
+/* ---- listing blobs ---- */
+
+static int add_item(struct grep_state *st, const char *path, size_t len,
+                    const unsigned char *raw)
+{
+    if (st->nr == st->alloc) {
+        size_t alloc = st->alloc ? 2 * st->alloc : 1024;
+        struct grep_item *tmp = realloc(st->items, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        st->items = tmp;
+        st->alloc = alloc;
+    }
+    if (st->paths_len + len + 1 > st->paths_alloc) {
+        size_t alloc = st->paths_alloc ? st->paths_alloc : 4096;
+        while (alloc < st->paths_len + len + 1)
+            alloc *= 2;
+        char *tmp = realloc(st->paths, alloc);
+        if (!tmp)
+            return -1;
+        st->paths = tmp;
+        st->paths_alloc = alloc;
+    }
+
+    struct grep_item *item = &st->items[st->nr++];
+    memset(item, 0, sizeof(*item));
+    item->path = st->paths_len;
+    oid_set_raw(&item->oid, raw, st->repo->hash_algo);
+    memcpy(st->paths + st->paths_len, path, len);
+    st->paths[st->paths_len + len] = '\0';
+    st->paths_len += len + 1;
+    return 0;
+}
+
+/*
+ * List the blobs of [oid] found at [path] (a buffer of [alloc] bytes
+ * holding [len] of them) that the pathspec selects.
+ */
+static int list_tree(struct grep_state *st, const struct object_id *oid,
+                     char **path, size_t *alloc, size_t len, int match_all)
+{
+    enum object_type type;
+    size_t size;
+    /* the pool is idle while the blobs are listed */
+    char *buf = repo_read_object_cached(st->repo, oid, &type, &size,
+                                        &st->workers[0].cache);
+    if (!buf || type != OBJ_TREE) {
+        ERROR("cannot read tree %s", oid_to_hex(oid));
+        free(buf);
+        return -1;
+    }
+
+    struct tree_desc desc;
+    struct name_entry entry;
+    struct object_id child;
+    int ret;
+
+    init_tree_desc(&desc, buf, size, st->rawsz, 0);
+    while ((ret = tree_desc_next(&desc, &entry)) > 0) {
+        if ((entry.mode & 0170000) != 0100000 && !S_ISDIR_MODE(entry.mode))
+            continue;           /* symlinks and submodules are not searched */
+
+        size_t n = len + !!len + entry.pathlen;
+        if (n + 1 > *alloc) {
+            size_t a = 2 * *alloc;
+            while (a < n + 1)
+                a *= 2;
+            char *tmp = realloc(*path, a);
+            if (!tmp) {
+                ret = -1;
+                break;
+            }
+            *path = tmp;
+            *alloc = a;
+        }
+        if (len)
+            (*path)[len] = '/';
+        memcpy(*path + len + !!len, entry.path, entry.pathlen);
+        (*path)[n] = '\0';
+
+        if (S_ISDIR_MODE(entry.mode)) {
+            enum pathspec_dir_match m = match_all ? PATHSPEC_DIR_ALL :
+                pathspec_match_dir(st->opts->pathspec, *path, n);
+            if (m == PATHSPEC_DIR_NONE)
+                continue;
+            oid_set_raw(&child, entry.oid, st->repo->hash_algo);
+            if ((ret = list_tree(st, &child, path, alloc, n, m == PATHSPEC_DIR_ALL)) < 0)
+                break;
+        } else if (match_all || pathspec_match(st->opts->pathspec, *path, n)) {
+            if ((ret = add_item(st, *path, n, entry.oid)) < 0)
+                break;
+        }
+    }
+    if (ret < 0)
+        ERROR("cannot list tree %s", oid_to_hex(oid));
+    free(buf);
+    return ret < 0 ? -1 : 0;
+}
+
+
+/* ---- reporting ---- */
+
+/* Hand the matches of items [from, to) to the callback, then drop them. */
+static int report(struct grep_state *st, size_t from, size_t to)
+{
+    int ret = 0;
+
+    for (size_t i = from; i < to; i++) {
+        struct grep_item *item = &st->items[i];
+        struct grep_match m;
+        size_t pos = 0;
+
+        if (item->failed && !ret)
+            ret = -1;
+        m.path = st->paths + item->path;
+        m.oid = &item->oid;
+        while (!ret && pos < item->out_len) {
+            struct match_record rec;
+            memcpy(&rec, item->out + pos, sizeof(rec));
+            m.binary = rec.lineno == 0;
+            m.lineno = rec.lineno;
+            m.line = item->out + pos + sizeof(rec);
+            m.len = rec.len;
+            pos += sizeof(rec) + rec.len;
+            ret = st->opts->fn(&m, st->opts->data);
+        }
+        free(item->out);
+        item->out = NULL;
+    }
+    return ret;
+}
+
+
+int grep_tree(struct repository *repo, const struct object_id *tree,
+              const struct grep_options *opts)
+{
+    struct grep_state st;
+    struct thread_pool *pool = NULL;
+    int nr_workers = 0, ret = 0;
+
+    memset(&st, 0, sizeof(st));
+    st.repo = repo;
+    st.opts = opts;
+    st.rawsz = hash_algo_rawsz(repo->hash_algo);
+    if (is_literal(opts->pattern, opts->type) && !opts->ignore_case) {
+        st.literal = opts->pattern;
+        st.literal_len = strlen(opts->pattern);
+    }
+
+    pool = thread_pool_create(opts->nr_threads);
+    if (!pool)
+        return -1;
+    nr_workers = thread_pool_nr_threads(pool);
+    st.workers = calloc(nr_workers, sizeof(*st.workers));
+    if (!st.workers) {
+        ret = -1;
+        goto out;
+    }
+    for (int i = 0; i < nr_workers; i++) {
+        delta_base_cache_init(&st.workers[i].cache, DELTA_CACHE_WORKER_BYTES);
+        if (!st.literal) {
+            if (compile(&st.workers[i].re, opts) < 0) {
+                ret = -1;
+                goto out;
+            }
+            st.workers[i].has_re = 1;
+        }
+    }
+
+    size_t alloc = 256;
+    char *path = malloc(alloc);
+    if (!path || list_tree(&st, tree, &path, &alloc, 0,
+                           !opts->pathspec || !opts->pathspec->nr) < 0) {
+        free(path);
+        ret = -1;
+        goto out;
+    }
+    free(path);
+
+    for (st.window = 0; st.window < st.nr && !ret; st.window += GREP_WINDOW) {
+        size_t n = st.nr - st.window < GREP_WINDOW ? st.nr - st.window : GREP_WINDOW;
+        thread_pool_for(pool, n, 4, grep_one, &st);
+        ret = report(&st, st.window, st.window + n);
+    }
+
+out:
+    thread_pool_destroy(pool);
+    for (size_t i = 0; i < st.nr; i++)
+        free(st.items[i].out);
+    for (int i = 0; st.workers && i < nr_workers; i++) {
+        delta_base_cache_clear(&st.workers[i].cache);
+        if (st.workers[i].has_re)
+            regfree(&st.workers[i].re);
+    }
+    free(st.workers);
+    free(st.items);
+    free(st.paths);
+    return ret;
+}
+
+
+/* ---- command ---- */
+
+enum grep_output { GREP_OUTPUT_LINES, GREP_OUTPUT_NAMES, GREP_OUTPUT_COUNT };
+
+struct grep_printer {
+    const char *name;           /* the tree-ish as given */
+    enum grep_output output;
+    int line_number;
+    size_t nr_matches;
+
+    char *count_path;           /* -c: the path being counted */
+    size_t count;
+};
+
+static void print_count(struct grep_printer *pr)
+{
+    if (pr->count_path)
+        printf("%s:%s:%zu\n", pr->name, pr->count_path, pr->count);
+    free(pr->count_path);
+    pr->count_path = NULL;
+}
+
+static int print_match(const struct grep_match *m, void *data)
+{
+    struct grep_printer *pr = data;
+
+    pr->nr_matches++;
+    switch (pr->output) {
+    case GREP_OUTPUT_NAMES:
+        printf("%s:%s\n", pr->name, m->path);
+        break;
+    case GREP_OUTPUT_COUNT:
+        /* the matches of one path are reported together */
+        if (!pr->count_path || strcmp(pr->count_path, m->path)) {
+            print_count(pr);
+            pr->count_path = strdup(m->path);
+            pr->count = 0;
+        }
+        pr->count++;
+        break;
+    default:
+        if (m->binary) {
+            printf("Binary file %s:%s matches\n", pr->name, m->path);
+            break;
+        }
+        if (pr->line_number)
+            printf("%s:%s:%zu:", pr->name, m->path, m->lineno);
+        else
+            printf("%s:%s:", pr->name, m->path);
+        fwrite(m->line, 1, m->len, stdout);     /* may hold a NUL */
+        putchar('\n');
+        break;
+    }
+    return 0;
+}
+
+int cmd_grep(int argc, char **argv)
+{
+    static const char usage[] =
+        "usage: grep [-n] [-i] [-l | -c] [-E | -F] [-j <threads>] <gitdir> <pattern>"
+        " <tree-ish> [-- <path>...]\n";
+    struct grep_printer pr = { NULL, GREP_OUTPUT_LINES, 0, 0, NULL, 0 };
+    struct grep_options opts = { NULL, GREP_PATTERN_BASIC, 0, 0, 0, NULL, print_match, &pr };
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-n"))
+            pr.line_number = 1;
+        else if (!strcmp(argv[i], "-i"))
+            opts.ignore_case = 1;
+        else if (!strcmp(argv[i], "-l"))
+            pr.output = GREP_OUTPUT_NAMES;
+        else if (!strcmp(argv[i], "-c"))
+            pr.output = GREP_OUTPUT_COUNT;
+        else if (!strcmp(argv[i], "-E"))
+            opts.type = GREP_PATTERN_EXTENDED;
+        else if (!strcmp(argv[i], "-F"))
+            opts.type = GREP_PATTERN_FIXED;
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            opts.nr_threads = atoi(argv[++i]);
+        else
+            break;
+    }
+    if (argc - i < 3 || (argc - i > 3 && strcmp(argv[i + 3], "--"))) {
+        fprintf(stderr, "%s", usage);
+        return 128;
+    }
+    opts.pattern = argv[i + 1];
+    opts.first_match_only = pr.output == GREP_OUTPUT_NAMES;
+    pr.name = argv[i + 2];
+
+    struct repository repo;
+    if (repo_open(&repo, argv[i]) < 0) {
+        ERROR("%s is not a git directory", argv[i]);
+        return 128;
+    }
+
+    struct pathspec ps;
+    struct object_id oid, tree;
+    size_t size;
+    int ret = 128;
+    int nr_paths = argc - i > 3 ? argc - i - 4 : 0;
+
+    if (pathspec_init(&ps, (const char *const *)argv + i + 4, nr_paths) < 0) {
+        repo_clear(&repo);
+        return 128;
+    }
+    opts.pathspec = &ps;
+
+    if (repo_resolve_ref(&repo, pr.name, &oid) < 0) {
+        ERROR("unknown revision %s", pr.name);
+    } else {
+        void *body = repo_read_object_peeled(&repo, oid_to_hex(&oid), OBJ_TREE,
+                                             &size, &tree);
+        if (!body) {
+            ERROR("%s is not a tree-ish", pr.name);
+        } else {
+            free(body);
+            if (grep_tree(&repo, &tree, &opts) == 0) {
+                if (pr.output == GREP_OUTPUT_COUNT)
+                    print_count(&pr);
+                ret = pr.nr_matches ? 0 : 1;
+            }
+        }
+    }
+
+    pathspec_clear(&ps);
+    repo_clear(&repo);
+    return ret;
+}
@@ -0,0 +1,73 @@
+#ifndef GREP_H
+#define GREP_H
+
+#include <stddef.h>
+#include "object.h"
+
+struct repository;
+struct pathspec;
+
+/*
+ * Content search over the blobs of one tree.
+ *
+ * The tree is walked first, pruned by the pathspec, to list its
+ * regular files in tree order. They are then searched by a thread pool
+ * a window at a time: each worker reads a blob with its own delta base
+ * cache, scans it and keeps only the lines that matched, and once the
+ * window is done its matches are reported in order. Output is
+ * therefore the same whatever the number of threads, and memory is
+ * bounded by the window and the blobs being scanned.
+ *
+ * A pattern without metacharacters (or any pattern with -F) is found
+ * with scan_memmem(); anything else goes to regcomp()/regexec(), one
+ * compiled copy per worker since glibc serializes regexec() on a
+ * shared one. A blob with a NUL in its first 8000 bytes is binary, as
+ * in git: it is reported once, without lines, if it matches at all.
+ */
+enum grep_pattern_type {
+    GREP_PATTERN_BASIC,         /* POSIX basic regex (the default) */
+    GREP_PATTERN_EXTENDED,      /* -E */
+    GREP_PATTERN_FIXED,         /* -F */
+};
+
+struct grep_match {
+    const char *path;           /* full path in the tree */
+    const struct object_id *oid;
+    int binary;                 /* binary blob: no line, just "it matches" */
+    size_t lineno;              /* 1-based */
+    const char *line;           /* without its '\n'; not NUL-terminated */
+    size_t len;
+};
+
+/* Return non-zero to stop; grep_tree() then returns that value. */
+typedef int (*grep_match_fn)(const struct grep_match *match, void *data);
+
+struct grep_options {
+    const char *pattern;
+    enum grep_pattern_type type;
+    int ignore_case;
+    int first_match_only;       /* one match per blob is enough (-l) */
+    int nr_threads;             /* 0: one per online CPU */
+    const struct pathspec *pathspec;    /* NULL: every path */
+    grep_match_fn fn;
+    void *data;
+};
+
+/*
+ * Search the blobs of [tree] and report every matching line, in tree
+ * order and line order, from the calling thread. Returns 0, the
+ * callback's value, or -1 if the pattern is invalid or an object
+ * cannot be read.
+ */
+int grep_tree(struct repository *repo, const struct object_id *tree,
+              const struct grep_options *opts);
+
+/*
+ * "grep [-n] [-i] [-l | -c] [-E | -F] [-j <threads>] <gitdir> <pattern>
+ *  <tree-ish> [-- <path>...]": print matches like "git grep <pattern>
+ * <tree-ish>", each prefixed with "<tree-ish>:<path>:".
+ * Exits with 0 if something matched, 1 if not, 128 on error.
+ */
+int cmd_grep(int argc, char **argv);
+
+#endif /* GREP_H */
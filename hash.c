@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <openssl/evp.h>
 #include <openssl/sha.h>
 
 
@@ -134,4 +135,56 @@ void generate_sha1(const void *data, size_t len,
                      unsigned char out[SHA_DIGEST_LENGTH])
 {
     SHA1((const unsigned char *)data, len, out);
-}
\ No newline at end of file
+}
+
+/*
+ * EVP_sha1() and EVP_sha256() make OpenSSL 3 look the implementation up
+ * again on every EVP_DigestInit_ex(), which costs as much as hashing a
+ * few hundred bytes. Fetch each once instead.
+ */
+static EVP_MD *fetched_sha1, *fetched_sha256;
+
+__attribute__((constructor))
+static void hash_fetch_digests(void)
+{
+    fetched_sha1 = EVP_MD_fetch(NULL, "SHA1", NULL);
+    fetched_sha256 = EVP_MD_fetch(NULL, "SHA256", NULL);
+}
+
+__attribute__((destructor))
+static void hash_free_digests(void)
+{
+    EVP_MD_free(fetched_sha1);
+    EVP_MD_free(fetched_sha256);
+}
+
+int hash_init(struct hash_ctx *ctx, hash_algo_t algo)
+{
+    const EVP_MD *md = algo == HASH_SHA256 ? fetched_sha256 : fetched_sha1;
+
+    if (!md)
+        md = algo == HASH_SHA256 ? EVP_sha256() : EVP_sha1();
+
+    if (!ctx->md && !(ctx->md = EVP_MD_CTX_new()))
+        return -1;
+    if (EVP_DigestInit_ex(ctx->md, md, NULL) != 1)
+        return -1;
+    ctx->algo = algo;
+    return 0;
+}
+
+int hash_update(struct hash_ctx *ctx, const void *data, size_t len)
+{
+    return EVP_DigestUpdate(ctx->md, data, len) == 1 ? 0 : -1;
+}
+
+int hash_final(struct hash_ctx *ctx, unsigned char *out)
+{
+    return EVP_DigestFinal_ex(ctx->md, out, NULL) == 1 ? 0 : -1;
+}
+
+void hash_ctx_release(struct hash_ctx *ctx)
+{
+    EVP_MD_CTX_free(ctx->md);
+    ctx->md = NULL;
+}
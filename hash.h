@@ -11,8 +11,82 @@ typedef enum {
 
 #define DEFAULT_HASH_ALGO HASH_SHA1
 
+/* Raw and hex widths of an object id; the enum value is the raw width. */
+static inline size_t hash_algo_rawsz(hash_algo_t algo)
+{
+    return (size_t)algo;
+}
+
+static inline size_t hash_algo_hexsz(hash_algo_t algo)
+{
+    return 2 * (size_t)algo;
+}
+
 hash_algo_t detect_repo_hash(const char *gitdir);
 
+/*
+ * Incremental hashing, for content that arrives in pieces (e.g. while
+ * an object is being inflated). The digest is hash_algo_rawsz() bytes.
+ *
+ *   struct hash_ctx ctx = HASH_CTX_INIT;
+ *   hash_init(&ctx, repo->hash_algo);
+ *   hash_update(&ctx, chunk, len);   (any number of times)
+ *   hash_final(&ctx, digest);
+ *   hash_ctx_release(&ctx);
+ *
+ * A context can be re-initialized with hash_init() after hash_final()
+ * without releasing it in between. The functions return 0 or -1.
+ */
+struct hash_ctx {
+    hash_algo_t algo;
+    struct evp_md_ctx_st *md;   /* OpenSSL's EVP_MD_CTX */
+};
+
+#define HASH_CTX_INIT { 0, NULL }
+
+int hash_init(struct hash_ctx *ctx, hash_algo_t algo);
+int hash_update(struct hash_ctx *ctx, const void *data, size_t len);
+int hash_final(struct hash_ctx *ctx, unsigned char *out);
+void hash_ctx_release(struct hash_ctx *ctx);
+
+/*
+ * Batch hashing: the digests of many independent messages in one call.
+ *
+ * Each message is [prefix] followed by [data]; the prefix may be empty
+ * and exists so that object ids can be computed without gluing the
+ * "<type> <size>\0" header onto the body. Where the CPU allows (AVX2
+ * for SHA-1, AVX-512 for both), the messages are hashed 16 at a time,
+ * one per 32-bit SIMD lane, longest first; a lane that finishes its
+ * message picks up the next one, so mixed sizes keep every lane busy.
+ * Otherwise, and for the odd message much longer than the rest, they go
+ * through a single reused EVP context in turn.
+ */
+struct hash_batch_item {
+    const void *prefix;
+    size_t prefix_len;
+    const void *data;
+    size_t len;
+    unsigned char *out;         /* hash_algo_rawsz() bytes */
+};
+
+/* Fill items[i].out for every item. Returns 0, or -1 if hashing failed. */
+int hash_batch(hash_algo_t algo, struct hash_batch_item *items, size_t nr);
+
+enum hash_batch_kernel {
+    HASH_BATCH_EVP,         /* OpenSSL, one message at a time */
+    HASH_BATCH_GENERIC,     /* 16 lanes in the baseline vector unit */
+    HASH_BATCH_AVX2,
+    HASH_BATCH_AVX512,
+};
+
+/* The kernel selected at startup (or by hash_batch_force_kernel). */
+enum hash_batch_kernel hash_batch_active_kernel(void);
+const char *hash_batch_kernel_name(enum hash_batch_kernel kernel);
+int hash_batch_kernel_supported(enum hash_batch_kernel kernel);
+
+/* Returns 0, or -1 if this CPU or build cannot run [kernel]. */
+int hash_batch_force_kernel(enum hash_batch_kernel kernel);
+
 void generate_sha1(const void *data, size_t len,
                    unsigned char out[SHA_DIGEST_LENGTH]);
 
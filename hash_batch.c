@@ -0,0 +1,560 @@
+#include "hash.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include "log.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HASH_BATCH_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Multi-buffer SHA: LANES messages are compressed side by side, one per
+ * 32-bit lane of a vector. The kernels only see one 64-byte block per
+ * lane at a time, already split into big-endian words and transposed
+ * (word t of lane l at words[t * LANES + l]); the lane bookkeeping and
+ * the padding live in the scalar driver below.
+ */
+#define LANES 16
+
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+typedef uint32_t u32x16 __attribute__((vector_size(64)));
+
+/* One block for every lane; idle lanes point at a dummy block. */
+typedef void (*blocks_fn)(uint32_t *state, const unsigned char *const *blocks);
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define LOAD(v, p) memcpy(&(v), (p), sizeof(v))
+#define STORE(p, v) memcpy((p), &(v), sizeof(v))
+
+static const uint32_t sha1_iv[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/*
+ * One block of SHA-1 and of SHA-256 for all LANES lanes, written once
+ * for a vector type [vec] and run over the lanes in groups of its width:
+ * four groups of SSE2 registers, two of AVX2 or one of AVX-512. A group
+ * keeps its whole state and message schedule in registers.
+ */
+#define DEFINE_SHA_LANES(name, vec)                                         \
+static inline __attribute__((always_inline))                                \
+void sha1_##name(uint32_t *state, const uint32_t *words)                    \
+{                                                                           \
+    const int width = sizeof(vec) / 4;                                      \
+                                                                            \
+    for (int g = 0; g < LANES; g += width) {                                \
+        vec a, b, c, d, e, w[16];                                           \
+                                                                            \
+        LOAD(a, state + 0 * LANES + g);                                     \
+        LOAD(b, state + 1 * LANES + g);                                     \
+        LOAD(c, state + 2 * LANES + g);                                     \
+        LOAD(d, state + 3 * LANES + g);                                     \
+        LOAD(e, state + 4 * LANES + g);                                     \
+        vec a0 = a, b0 = b, c0 = c, d0 = d, e0 = e;                         \
+                                                                            \
+        _Pragma("GCC unroll 80")                                            \
+        for (int t = 0; t < 80; t++) {                                      \
+            vec f, wt;                                                      \
+            uint32_t k;                                                     \
+                                                                            \
+            if (t < 16) {                                                   \
+                LOAD(w[t], words + t * LANES + g);                          \
+                wt = w[t];                                                  \
+            } else {                                                        \
+                wt = w[t & 15] ^ w[(t + 2) & 15] ^                          \
+                     w[(t + 8) & 15] ^ w[(t + 13) & 15];                    \
+                wt = w[t & 15] = ROTL(wt, 1);                               \
+            }                                                               \
+                                                                            \
+            if (t < 20) {                                                   \
+                f = d ^ (b & (c ^ d));                                      \
+                k = 0x5a827999;                                             \
+            } else if (t < 40) {                                            \
+                f = b ^ c ^ d;                                              \
+                k = 0x6ed9eba1;                                             \
+            } else if (t < 60) {                                            \
+                f = (b & c) | (d & (b | c));                                \
+                k = 0x8f1bbcdc;                                             \
+            } else {                                                        \
+                f = b ^ c ^ d;                                              \
+                k = 0xca62c1d6;                                             \
+            }                                                               \
+                                                                            \
+            vec tmp = ROTL(a, 5) + f + e + k + wt;                          \
+            e = d;                                                          \
+            d = c;                                                          \
+            c = ROTL(b, 30);                                                \
+            b = a;                                                          \
+            a = tmp;                                                        \
+        }                                                                   \
+                                                                            \
+        a += a0, b += b0, c += c0, d += d0, e += e0;                        \
+        STORE(state + 0 * LANES + g, a);                                    \
+        STORE(state + 1 * LANES + g, b);                                    \
+        STORE(state + 2 * LANES + g, c);                                    \
+        STORE(state + 3 * LANES + g, d);                                    \
+        STORE(state + 4 * LANES + g, e);                                    \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static inline __attribute__((always_inline))                                \
+void sha256_##name(uint32_t *state, const uint32_t *words)                  \
+{                                                                           \
+    const int width = sizeof(vec) / 4;                                      \
+                                                                            \
+    for (int g = 0; g < LANES; g += width) {                                \
+        vec s[8], v[8], w[16];                                              \
+                                                                            \
+        for (int i = 0; i < 8; i++) {                                       \
+            LOAD(s[i], state + i * LANES + g);                              \
+            v[i] = s[i];                                                    \
+        }                                                                   \
+                                                                            \
+        _Pragma("GCC unroll 64")                                            \
+        for (int t = 0; t < 64; t++) {                                      \
+            vec wt;                                                         \
+                                                                            \
+            if (t < 16) {                                                   \
+                LOAD(w[t], words + t * LANES + g);                          \
+                wt = w[t];                                                  \
+            } else {                                                        \
+                vec w15 = w[(t + 1) & 15], w2 = w[(t + 14) & 15];           \
+                vec s0 = ROTR(w15, 7) ^ ROTR(w15, 18) ^ (w15 >> 3);         \
+                vec s1 = ROTR(w2, 17) ^ ROTR(w2, 19) ^ (w2 >> 10);          \
+                wt = w[t & 15] = w[t & 15] + s0 + w[(t + 9) & 15] + s1;     \
+            }                                                               \
+                                                                            \
+            vec a = v[0], b = v[1], c = v[2], e = v[4];                     \
+            vec S1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);                \
+            vec ch = v[6] ^ (e & (v[5] ^ v[6]));                            \
+            vec t1 = v[7] + S1 + ch + sha256_k[t] + wt;                     \
+            vec S0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);                \
+            vec maj = (a & b) | (c & (a | b));                              \
+                                                                            \
+            v[7] = v[6];                                                    \
+            v[6] = v[5];                                                    \
+            v[5] = e;                                                       \
+            v[4] = v[3] + t1;                                               \
+            v[3] = c;                                                       \
+            v[2] = b;                                                       \
+            v[1] = a;                                                       \
+            v[0] = t1 + S0 + maj;                                           \
+        }                                                                   \
+                                                                            \
+        for (int i = 0; i < 8; i++) {                                       \
+            s[i] += v[i];                                                   \
+            STORE(state + i * LANES + g, s[i]);                             \
+        }                                                                   \
+    }                                                                       \
+}
+
+static inline uint32_t get_be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* Split each lane's block into big-endian words, word-major. */
+static void transpose_scalar(uint32_t *words, const unsigned char *const *blocks)
+{
+    for (int l = 0; l < LANES; l++)
+        for (int t = 0; t < 16; t++)
+            words[t * LANES + l] = get_be32(blocks[l] + 4 * t);
+}
+
+DEFINE_SHA_LANES(x4, u32x4)
+
+static void sha1_blocks_generic(uint32_t *state, const unsigned char *const *blocks)
+{
+    uint32_t words[16 * LANES];
+
+    transpose_scalar(words, blocks);
+    sha1_x4(state, words);
+}
+
+static void sha256_blocks_generic(uint32_t *state, const unsigned char *const *blocks)
+{
+    uint32_t words[16 * LANES];
+
+    transpose_scalar(words, blocks);
+    sha256_x4(state, words);
+}
+
+#ifdef HASH_BATCH_X86
+/*
+ * The same with AVX2: eight lanes' half-blocks are loaded as rows,
+ * byte-swapped, and turned into columns with an 8x8 transpose of 32-bit
+ * words (unpack 32, unpack 64, swap 128-bit halves).
+ */
+static inline __attribute__((always_inline, target("avx2")))
+void transpose_avx2(uint32_t *words, const unsigned char *const *blocks)
+{
+    const __m256i bswap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                           3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    for (int g = 0; g < LANES; g += 8) {
+        for (int h = 0; h < 2; h++) {
+            __m256i r[8], t[8], u[8];
+
+            for (int j = 0; j < 8; j++)
+                r[j] = _mm256_shuffle_epi8(
+                    _mm256_loadu_si256((const __m256i *)(blocks[g + j] + 32 * h)), bswap);
+            for (int j = 0; j < 8; j += 2) {
+                t[j] = _mm256_unpacklo_epi32(r[j], r[j + 1]);
+                t[j + 1] = _mm256_unpackhi_epi32(r[j], r[j + 1]);
+            }
+            for (int j = 0; j < 8; j += 4) {
+                u[j] = _mm256_unpacklo_epi64(t[j], t[j + 2]);
+                u[j + 1] = _mm256_unpackhi_epi64(t[j], t[j + 2]);
+                u[j + 2] = _mm256_unpacklo_epi64(t[j + 1], t[j + 3]);
+                u[j + 3] = _mm256_unpackhi_epi64(t[j + 1], t[j + 3]);
+            }
+            for (int j = 0; j < 4; j++) {
+                _mm256_storeu_si256((__m256i *)(words + (8 * h + j) * LANES + g),
+                                    _mm256_permute2x128_si256(u[j], u[j + 4], 0x20));
+                _mm256_storeu_si256((__m256i *)(words + (8 * h + j + 4) * LANES + g),
+                                    _mm256_permute2x128_si256(u[j], u[j + 4], 0x31));
+            }
+        }
+    }
+}
+
+DEFINE_SHA_LANES(x8, u32x8)
+DEFINE_SHA_LANES(x16, u32x16)
+
+__attribute__((target("avx2")))
+static void sha1_blocks_avx2(uint32_t *state, const unsigned char *const *blocks)
+{
+    uint32_t words[16 * LANES] __attribute__((aligned(32)));
+
+    transpose_avx2(words, blocks);
+    sha1_x8(state, words);
+}
+
+__attribute__((target("avx2")))
+static void sha256_blocks_avx2(uint32_t *state, const unsigned char *const *blocks)
+{
+    uint32_t words[16 * LANES] __attribute__((aligned(32)));
+
+    transpose_avx2(words, blocks);
+    sha256_x8(state, words);
+}
+
+__attribute__((target("avx512f")))
+static void sha1_blocks_avx512(uint32_t *state, const unsigned char *const *blocks)
+{
+    uint32_t words[16 * LANES] __attribute__((aligned(64)));
+
+    transpose_avx2(words, blocks);
+    sha1_x16(state, words);
+}
+
+__attribute__((target("avx512f")))
+static void sha256_blocks_avx512(uint32_t *state, const unsigned char *const *blocks)
+{
+    uint32_t words[16 * LANES] __attribute__((aligned(64)));
+
+    transpose_avx2(words, blocks);
+    sha256_x16(state, words);
+}
+#endif
+
+
+/* ---- lane driver ---- */
+
+/* Blocks in the padded message: data, 0x80, zeros, 64-bit bit length. */
+static size_t nr_blocks(const struct hash_batch_item *item)
+{
+    return (item->prefix_len + item->len + 8) / 64 + 1;
+}
+
+/*
+ * Block [n] of [item]'s padded message, for the blocks that do not lie
+ * entirely within [data]: the ones holding the prefix or the padding.
+ */
+static const unsigned char *assemble_block(const struct hash_batch_item *item,
+                                           size_t n, unsigned char *tmp)
+{
+    const unsigned char *prefix = item->prefix, *data = item->data;
+    size_t total = item->prefix_len + item->len;
+    size_t off = n * 64, filled = 0;
+
+    if (off < item->prefix_len) {
+        filled = item->prefix_len - off < 64 ? item->prefix_len - off : 64;
+        memcpy(tmp, prefix + off, filled);
+    }
+    if (filled < 64 && off + filled < total) {
+        size_t from = off + filled - item->prefix_len;
+        size_t k = total - (off + filled) < 64 - filled ? total - (off + filled) : 64 - filled;
+        memcpy(tmp + filled, data + from, k);
+        filled += k;
+    }
+    if (filled < 64)
+        memset(tmp + filled, 0, 64 - filled);
+    if (total >= off && total < off + 64)
+        tmp[total - off] = 0x80;
+    if (n + 1 == nr_blocks(item)) {
+        uint64_t bits = (uint64_t)total * 8;
+        put_be32(tmp + 56, (uint32_t)(bits >> 32));
+        put_be32(tmp + 60, (uint32_t)bits);
+    }
+    return tmp;
+}
+
+struct lane {
+    struct hash_batch_item *item;   /* NULL when idle */
+    size_t block, nr_blocks;
+};
+
+/* Hash [nr] messages, taking them in the order of [order]. */
+static void hash_lanes(hash_algo_t algo, struct hash_batch_item **order,
+                       size_t nr, blocks_fn blocks)
+{
+    const uint32_t *iv = algo == HASH_SHA256 ? sha256_iv : sha1_iv;
+    int nr_words = algo == HASH_SHA256 ? 8 : 5;
+    static const unsigned char idle[64];
+    uint32_t state[8 * LANES] __attribute__((aligned(64)));
+    const unsigned char *ptrs[LANES];
+    unsigned char tmp[LANES][64];
+    struct lane lanes[LANES] = {{0}};
+    size_t next = 0;
+
+    memset(state, 0, sizeof(state));
+
+    for (;;) {
+        int active = 0;
+
+        for (int l = 0; l < LANES; l++) {
+            struct lane *lane = &lanes[l];
+
+            if (!lane->item && next < nr) {
+                lane->item = order[next++];
+                lane->block = 0;
+                lane->nr_blocks = nr_blocks(lane->item);
+                for (int i = 0; i < nr_words; i++)
+                    state[i * LANES + l] = iv[i];
+            }
+            if (!lane->item) {
+                ptrs[l] = idle;     /* hashed along, result ignored */
+                continue;
+            }
+            /* most blocks are read in place */
+            size_t off = lane->block * 64, prefix_len = lane->item->prefix_len;
+            if (off >= prefix_len && off + 64 <= prefix_len + lane->item->len)
+                ptrs[l] = (const unsigned char *)lane->item->data + (off - prefix_len);
+            else
+                ptrs[l] = assemble_block(lane->item, lane->block, tmp[l]);
+            active++;
+        }
+        if (!active)
+            break;
+
+        blocks(state, ptrs);
+
+        for (int l = 0; l < LANES; l++) {
+            struct lane *lane = &lanes[l];
+
+            if (!lane->item || ++lane->block < lane->nr_blocks)
+                continue;
+            for (int i = 0; i < nr_words; i++)
+                put_be32(lane->item->out + 4 * i, state[i * LANES + l]);
+            lane->item = NULL;
+        }
+    }
+}
+
+
+/* ---- EVP fallback ---- */
+
+static int hash_evp(struct hash_ctx *ctx, hash_algo_t algo,
+                    struct hash_batch_item *item)
+{
+    if (hash_init(ctx, algo) < 0 ||
+        (item->prefix_len && hash_update(ctx, item->prefix, item->prefix_len) < 0) ||
+        hash_update(ctx, item->data, item->len) < 0 ||
+        hash_final(ctx, item->out) < 0)
+        return -1;
+    return 0;
+}
+
+static int hash_evp_all(hash_algo_t algo, struct hash_batch_item *items, size_t nr)
+{
+    struct hash_ctx ctx = HASH_CTX_INIT;
+    int ret = 0;
+
+    for (size_t i = 0; i < nr && !ret; i++)
+        ret = hash_evp(&ctx, algo, &items[i]);
+    hash_ctx_release(&ctx);
+    return ret;
+}
+
+
+/* ---- dispatch ---- */
+
+static enum hash_batch_kernel active_kernel = HASH_BATCH_EVP;
+static blocks_fn sha1_blocks, sha256_blocks;   /* NULL: use EVP */
+
+int hash_batch_kernel_supported(enum hash_batch_kernel kernel)
+{
+    switch (kernel) {
+    case HASH_BATCH_EVP:
+    case HASH_BATCH_GENERIC:
+        return 1;
+#ifdef HASH_BATCH_X86
+    case HASH_BATCH_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case HASH_BATCH_AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return 0;
+    }
+}
+
+int hash_batch_force_kernel(enum hash_batch_kernel kernel)
+{
+    if (!hash_batch_kernel_supported(kernel))
+        return -1;
+
+    switch (kernel) {
+#ifdef HASH_BATCH_X86
+    case HASH_BATCH_AVX2:
+        sha1_blocks = sha1_blocks_avx2;
+        sha256_blocks = sha256_blocks_avx2;
+        break;
+    case HASH_BATCH_AVX512:
+        sha1_blocks = sha1_blocks_avx512;
+        sha256_blocks = sha256_blocks_avx512;
+        break;
+#endif
+    case HASH_BATCH_GENERIC:
+        sha1_blocks = sha1_blocks_generic;
+        sha256_blocks = sha256_blocks_generic;
+        break;
+    default:
+        sha1_blocks = sha256_blocks = NULL;
+        break;
+    }
+    active_kernel = kernel;
+    return 0;
+}
+
+enum hash_batch_kernel hash_batch_active_kernel(void)
+{
+    return active_kernel;
+}
+
+const char *hash_batch_kernel_name(enum hash_batch_kernel kernel)
+{
+    switch (kernel) {
+    case HASH_BATCH_GENERIC: return "generic";
+    case HASH_BATCH_AVX2:    return "avx2";
+    case HASH_BATCH_AVX512:  return "avx512";
+    default:                 return "evp";
+    }
+}
+
+__attribute__((constructor))
+static void hash_batch_setup(void)
+{
+#ifdef HASH_BATCH_X86
+    /*
+     * Four SSE2 lanes only beat OpenSSL on tiny messages, so without
+     * AVX2 the batch goes through EVP; "generic" stays available for
+     * forcing and for testing the lane driver. Eight-lane SHA-256 also
+     * loses to OpenSSL, which uses the SHA extensions of CPUs that have
+     * them; it takes AVX-512 for the lanes to win there.
+     */
+    __builtin_cpu_init();
+    if (hash_batch_force_kernel(HASH_BATCH_AVX512) < 0 &&
+        hash_batch_force_kernel(HASH_BATCH_AVX2) == 0)
+        sha256_blocks = NULL;
+#endif
+}
+
+
+static size_t message_len(const struct hash_batch_item *item)
+{
+    return item->prefix_len + item->len;
+}
+
+static int compare_longest_first(const void *a, const void *b)
+{
+    size_t x = message_len(*(struct hash_batch_item *const *)a);
+    size_t y = message_len(*(struct hash_batch_item *const *)b);
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+int hash_batch(hash_algo_t algo, struct hash_batch_item *items, size_t nr)
+{
+    blocks_fn blocks = algo == HASH_SHA256 ? sha256_blocks : sha1_blocks;
+    struct hash_batch_item **order;
+    struct hash_ctx ctx = HASH_CTX_INIT;
+    size_t first = 0, remaining = 0;
+    int ret = 0;
+
+    /* a few messages would leave most lanes idle: one at a time is faster */
+    if (!blocks || nr < LANES / 2)
+        return hash_evp_all(algo, items, nr);
+
+    order = malloc(nr * sizeof(*order));
+    if (!order)
+        return hash_evp_all(algo, items, nr);
+    for (size_t i = 0; i < nr; i++) {
+        order[i] = &items[i];
+        remaining += message_len(&items[i]);
+    }
+
+    /*
+     * Longest first, so that lanes run out of work at about the same
+     * time. A message that would still be running long after the rest
+     * are done (longer than what half the lanes share of everything
+     * left) goes through EVP instead of hashing next to idle lanes.
+     */
+    qsort(order, nr, sizeof(*order), compare_longest_first);
+    while (first < nr && message_len(order[first]) > 2 * remaining / LANES) {
+        remaining -= message_len(order[first]);
+        if (hash_evp(&ctx, algo, order[first++]) < 0)
+            ret = -1;
+    }
+
+    if (nr - first >= LANES / 2) {
+        hash_lanes(algo, order + first, nr - first, blocks);
+    } else {
+        while (first < nr && !ret)
+            ret = hash_evp(&ctx, algo, order[first++]);
+    }
+    hash_ctx_release(&ctx);
+    free(order);
+    return ret;
+}
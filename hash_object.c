@@ -0,0 +1,454 @@
+#define _GNU_SOURCE
+
+#include "hash_object.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log.h"
+#include "commit.h"
+#include "hash.h"
+#include "hex.h"
+#include "repository.h"
+#include "tag.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+/* Paths hashed before their ids are printed, by cmd_hash_object(). */
+#define HASH_OBJECT_WINDOW 4096
+
+/*
+ * Files up to this size are read rather than mapped, as in git: for a
+ * small file, setting up and tearing down a mapping costs more than
+ * the copy.
+ */
+#define HASH_OBJECT_SMALL_FILE (32u << 10)
+
+
+struct hash_object_worker {
+    char *small;                /* HASH_OBJECT_CHUNK small files or symlink targets */
+    size_t nr_files, nr_failed;
+    uint64_t bytes;
+};
+
+struct hash_object_state {
+    struct repository *repo;
+    const struct hash_object_options *opts;
+    const char *const *paths;
+    size_t nr;
+    struct object_id *oids;
+    struct hash_object_worker *workers;
+};
+
+
+/* ---- hashing ---- */
+
+/*
+ * Point *[data] at the content of [path]: mapped (*[map] is then set),
+ * or read into [small] (HASH_OBJECT_SMALL_FILE bytes) if it is a small
+ * file or a symlink hashed as such. Returns 0, or -1 after reporting
+ * why not.
+ */
+static int map_file(const struct hash_object_state *st, const char *path, char *small,
+                    const void **data, size_t *len, void **map)
+{
+    struct stat sb;
+    int fd;
+
+    *map = NULL;
+    if (st->opts->literal_symlinks && !lstat(path, &sb) && S_ISLNK(sb.st_mode)) {
+        ssize_t n = readlink(path, small, HASH_OBJECT_SMALL_FILE);
+        if (n < 0 || n == HASH_OBJECT_SMALL_FILE) {
+            ERROR("cannot read link %s: %s", path, n < 0 ? strerror(errno) : "too long");
+            return -1;
+        }
+        *data = small;
+        *len = n;
+        return 0;
+    }
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &sb)) {
+        ERROR("cannot open %s: %s", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if (!S_ISREG(sb.st_mode)) {
+        ERROR("%s is not a regular file", path);
+        close(fd);
+        return -1;
+    }
+    *len = sb.st_size;
+    *data = small;
+    if (*len <= HASH_OBJECT_SMALL_FILE) {
+        size_t done = 0;
+        while (done < *len) {
+            ssize_t n = read(fd, small + done, *len - done);
+            if (n <= 0) {
+                ERROR("cannot read %s: %s", path, n < 0 ? strerror(errno) : "file shrank");
+                close(fd);
+                return -1;
+            }
+            done += n;
+        }
+    } else {
+        void *m = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) {
+            ERROR("cannot map %s: %s", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        *data = *map = m;
+    }
+    close(fd);
+    return 0;
+}
+
+/*
+ * Whether [data] is a well-formed object of [type]: like git
+ * hash-object without --literally, trees (in strict order), commits
+ * and tags are parsed before they are hashed. Returns 0 or -1.
+ */
+static int check_object(hash_algo_t algo, enum object_type type,
+                        const void *data, size_t len)
+{
+    switch (type) {
+    case OBJ_TREE: {
+        struct tree_object *tree = parse_tree_buffer(data, len, hash_algo_rawsz(algo),
+                                                      TREE_DESC_STRICT);
+        int ok = tree != NULL;
+        tree_free(tree);
+        return ok ? 0 : -1;
+    }
+    case OBJ_COMMIT: {
+        struct commit_object commit = { 0 };
+        int ret = parse_commit_buffer(&commit, data, len, algo);
+        free(commit.parents);
+        return ret;
+    }
+    case OBJ_TAG: {
+        struct tag_object tag = { 0 };
+        return parse_tag_buffer(&tag, data, len, algo);
+    }
+    default:
+        return 0;
+    }
+}
+
+/* Hash (and write) the paths of chunk [c], HASH_OBJECT_CHUNK from c * HASH_OBJECT_CHUNK. */
+static void hash_chunk(void *data, size_t c, int worker)
+{
+    struct hash_object_state *st = data;
+    struct hash_object_worker *w = &st->workers[worker];
+    hash_algo_t algo = st->repo->hash_algo;
+    enum object_type type = st->opts->type ? st->opts->type : OBJ_BLOB;
+    size_t first = c * HASH_OBJECT_CHUNK;
+    size_t n = st->nr - first < HASH_OBJECT_CHUNK ? st->nr - first : HASH_OBJECT_CHUNK;
+
+    struct hash_batch_item items[HASH_OBJECT_CHUNK];
+    unsigned char digests[HASH_OBJECT_CHUNK][MAX_RAW_OID_LENGTH];
+    char headers[HASH_OBJECT_CHUNK][32];
+    void *maps[HASH_OBJECT_CHUNK];
+    size_t pos[HASH_OBJECT_CHUNK], nr_items = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        struct hash_batch_item *item = &items[nr_items];
+
+        memset(&st->oids[first + i], 0, sizeof(st->oids[first + i]));
+        w->nr_files++;
+        if (map_file(st, st->paths[first + i], w->small + i * HASH_OBJECT_SMALL_FILE,
+                     &item->data, &item->len, &maps[nr_items]) < 0) {
+            w->nr_failed++;
+            continue;
+        }
+        if (check_object(algo, type, item->data, item->len) < 0) {
+            ERROR("%s is not a valid %s", st->paths[first + i], type_name(type));
+            if (maps[nr_items])
+                munmap(maps[nr_items], item->len);
+            w->nr_failed++;
+            continue;
+        }
+        item->prefix = headers[nr_items];
+        item->prefix_len = snprintf(headers[nr_items], sizeof(headers[nr_items]),
+                                    "%s %zu", type_name(type), item->len) + 1;
+        item->out = digests[nr_items];
+        w->bytes += item->len;
+        pos[nr_items++] = first + i;
+    }
+
+    int hashed = hash_batch(algo, items, nr_items) == 0;
+    for (size_t i = 0; i < nr_items; i++) {
+        const char *path = st->paths[pos[i]];
+        struct object_id *oid = &st->oids[pos[i]];
+
+        if (!hashed) {
+            ERROR("cannot hash %s", path);
+            w->nr_failed++;
+        } else {
+            oid_set_raw(oid, digests[i], algo);
+            if (st->opts->write &&
+                repo_write_loose_object(st->repo, oid, type, items[i].data, items[i].len) < 0) {
+                ERROR("cannot write the object for %s", path);
+                memset(oid, 0, sizeof(*oid));
+                w->nr_failed++;
+            }
+        }
+        if (maps[i])
+            munmap(maps[i], items[i].len);
+    }
+}
+
+long hash_object_files(struct repository *repo, struct thread_pool *pool,
+                       const struct hash_object_options *opts,
+                       const char *const *paths, size_t nr,
+                       struct object_id *oids, struct hash_object_stats *stats)
+{
+    struct hash_object_state st = { repo, opts, paths, nr, oids, NULL };
+    int nr_workers = thread_pool_nr_threads(pool);
+    long failed = 0;
+
+    if (!(st.workers = calloc(nr_workers, sizeof(*st.workers))))
+        return -1;
+    for (int i = 0; i < nr_workers; i++) {
+        if (!(st.workers[i].small = malloc(HASH_OBJECT_CHUNK * HASH_OBJECT_SMALL_FILE))) {
+            memset(oids, 0, nr * sizeof(*oids));
+            failed = -1;
+            goto out;
+        }
+    }
+
+    thread_pool_for(pool, (nr + HASH_OBJECT_CHUNK - 1) / HASH_OBJECT_CHUNK, 1,
+                    hash_chunk, &st);
+
+    for (int i = 0; i < nr_workers; i++) {
+        failed += st.workers[i].nr_failed;
+        if (stats) {
+            stats->nr_files += st.workers[i].nr_files;
+            stats->nr_failed += st.workers[i].nr_failed;
+            stats->bytes += st.workers[i].bytes;
+        }
+    }
+out:
+    for (int i = 0; i < nr_workers; i++)
+        free(st.workers[i].small);
+    free(st.workers);
+    return failed;
+}
+
+
+/* ---- command ---- */
+
+/* Paths waiting to be hashed, and how to print them. */
+struct hash_object_window {
+    struct repository *repo;
+    struct thread_pool *pool;
+    struct hash_object_options opts;
+    struct hash_object_stats stats;
+    char *paths[HASH_OBJECT_WINDOW];
+    struct object_id oids[HASH_OBJECT_WINDOW];
+    int show_path;              /* print "<id>\t<path>" */
+    size_t nr;
+    int failed;
+};
+
+static void flush_window(struct hash_object_window *win)
+{
+    char hex[MAX_HEX_OID_LENGTH + 1];
+
+    if (!win->nr)
+        return;
+    if (hash_object_files(win->repo, win->pool, &win->opts,
+                          (const char *const *)win->paths, win->nr, win->oids,
+                          &win->stats) != 0)
+        win->failed = 1;
+    for (size_t i = 0; i < win->nr; i++) {
+        if (win->oids[i].algo) {
+            oid_to_hex_r(hex, &win->oids[i]);
+            if (win->show_path)
+                printf("%s\t%s\n", hex, win->paths[i]);
+            else
+                printf("%s\n", hex);
+        }
+        free(win->paths[i]);
+    }
+    fflush(stdout);
+    win->nr = 0;
+}
+
+/* Queue [path] (taken over), from a directory walk if [walked]. */
+static void queue_path(struct hash_object_window *win, char *path, int walked)
+{
+    if (win->nr && (win->show_path != walked || win->nr == HASH_OBJECT_WINDOW))
+        flush_window(win);
+    win->show_path = walked;
+    win->opts.literal_symlinks = walked;
+    win->paths[win->nr++] = path;
+}
+
+static int name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Queue the files under [dir] in path order, skipping .git. */
+static void walk_dir(struct hash_object_window *win, const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    char **names = NULL;
+    size_t nr = 0, alloc = 0;
+
+    if (!d) {
+        ERROR("cannot open %s: %s", dir, strerror(errno));
+        win->failed = 1;
+        return;
+    }
+    while ((de = readdir(d))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") ||
+            !strcmp(de->d_name, ".git"))
+            continue;
+        if (nr == alloc) {
+            alloc = alloc ? 2 * alloc : 64;
+            char **tmp = realloc(names, alloc * sizeof(*tmp));
+            if (!tmp)
+                break;
+            names = tmp;
+        }
+        if (!(names[nr] = strdup(de->d_name)))
+            break;
+        nr++;
+    }
+    closedir(d);
+    if (nr)
+        qsort(names, nr, sizeof(*names), name_cmp);
+
+    for (size_t i = 0; i < nr; i++) {
+        char *path = NULL;
+        struct stat sb;
+
+        if (asprintf(&path, "%s/%s", dir, names[i]) < 0) {
+            win->failed = 1;
+        } else if (lstat(path, &sb)) {
+            ERROR("cannot stat %s: %s", path, strerror(errno));
+            win->failed = 1;
+            free(path);
+        } else if (S_ISDIR(sb.st_mode)) {
+            walk_dir(win, path);
+            free(path);
+        } else if (S_ISREG(sb.st_mode) || S_ISLNK(sb.st_mode)) {
+            queue_path(win, path, 1);
+        } else {
+            free(path);
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+/* A command-line [path]: a file, or a directory to walk. */
+static void add_arg(struct hash_object_window *win, const char *path)
+{
+    struct stat sb;
+    char *copy;
+
+    if (!stat(path, &sb) && S_ISDIR(sb.st_mode)) {
+        size_t len = strlen(path);
+        while (len > 1 && path[len - 1] == '/')
+            len--;
+        if ((copy = strndup(path, len)))
+            walk_dir(win, copy);
+        free(copy);
+        return;
+    }
+    if (!(copy = strdup(path))) {
+        win->failed = 1;
+        return;
+    }
+    queue_path(win, copy, 0);
+}
+
+int cmd_hash_object(int argc, char **argv)
+{
+    static const char usage[] =
+        "usage: hash-object [-w] [-q] [-t <type>] [-j <threads>] <gitdir>\n"
+        "                   (--stdin-paths | <path>...)\n";
+    struct hash_object_window *win;
+    int quiet = 0, nr_threads = 0, stdin_paths = 0, i;
+    enum object_type type = OBJ_BLOB;
+    int write_objects = 0;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-w"))
+            write_objects = 1;
+        else if (!strcmp(argv[i], "-q"))
+            quiet = 1;
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            i++;
+            type = type_from_string(argv[i], strlen(argv[i]));
+        }
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            nr_threads = atoi(argv[++i]);
+        else
+            break;
+    }
+    if (i < argc - 1 && !strcmp(argv[i + 1], "--stdin-paths"))
+        stdin_paths = 1;
+    if (argc - i < 2 || (stdin_paths && argc - i != 2) || type == OBJ_NONE) {
+        fprintf(stderr, "%s", usage);
+        return 128;
+    }
+
+    struct repository repo;
+    if (repo_open(&repo, argv[i]) < 0) {
+        ERROR("%s is not a git directory", argv[i]);
+        return 128;
+    }
+    if (!(win = calloc(1, sizeof(*win))) || !(win->pool = thread_pool_create(nr_threads))) {
+        free(win);
+        repo_clear(&repo);
+        return 128;
+    }
+    win->repo = &repo;
+    win->opts.type = type;
+    win->opts.write = write_objects;
+
+    double start = monotonic_seconds();
+    if (stdin_paths) {
+        char *line = NULL;
+        size_t alloc = 0;
+        ssize_t len;
+        while ((len = getline(&line, &alloc, stdin)) > 0) {
+            if (line[len - 1] == '\n')
+                line[--len] = '\0';
+            /* files only, as in git */
+            char *copy = len ? strdup(line) : NULL;
+            if (copy)
+                queue_path(win, copy, 0);
+        }
+        free(line);
+    } else {
+        for (i++; i < argc; i++)
+            add_arg(win, argv[i]);
+    }
+    flush_window(win);
+    double elapsed = monotonic_seconds() - start;
+
+    if (!quiet)
+        fprintf(stderr, "%zu files, %.1f MB in %.3fs: %.1f MB/s, %.0f files/s%s\n",
+                win->stats.nr_files, win->stats.bytes / 1e6, elapsed,
+                elapsed > 0 ? win->stats.bytes / 1e6 / elapsed : 0.0,
+                elapsed > 0 ? win->stats.nr_files / elapsed : 0.0,
+                write_objects ? " (written)" : "");
+
+    int ret = win->failed ? 128 : 0;
+    thread_pool_destroy(win->pool);
+    free(win);
+    repo_clear(&repo);
+    return ret;
+}
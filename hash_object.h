@@ -0,0 +1,63 @@
+#ifndef HASH_OBJECT_H
+#define HASH_OBJECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "object.h"
+
+struct repository;
+struct thread_pool;
+
+/*
+ * Object ids of many files at once, as "git hash-object" computes them
+ * one at a time.
+ *
+ * The paths are cut into chunks of HASH_OBJECT_CHUNK, which a thread
+ * pool hands to its workers. A worker maps every file of its chunk (or
+ * reads it, if small) and hashes them all in one hash_batch() call,
+ * each with its "<type> <size>\0" header as the prefix, so that small
+ * files share the SIMD lanes. With [write], it then deflates those the
+ * repository does not have into loose objects. The ids land in the
+ * caller's array in input order, so a caller streaming a long list
+ * hashes it a window at a time and prints each window as it completes.
+ */
+#define HASH_OBJECT_CHUNK 16
+
+struct hash_object_options {
+    enum object_type type;      /* OBJ_NONE: blob; a tree, commit or tag
+                                   must parse, or the file fails */
+    int write;                  /* also store them as loose objects */
+    int literal_symlinks;       /* hash a symlink's target path, as git add
+                                   does, instead of the file it points at */
+};
+
+struct hash_object_stats {
+    size_t nr_files;
+    size_t nr_failed;
+    uint64_t bytes;
+};
+
+/*
+ * Compute the ids of the [nr] files [paths] into [oids] on [pool],
+ * writing them too if asked, and add to [stats] (may be NULL). A path
+ * that cannot be read or written is reported and gets an all-zero id.
+ * Returns the number of such paths, or -1 if [oids] could not be
+ * computed at all.
+ */
+long hash_object_files(struct repository *repo, struct thread_pool *pool,
+                       const struct hash_object_options *opts,
+                       const char *const *paths, size_t nr,
+                       struct object_id *oids, struct hash_object_stats *stats);
+
+/*
+ * "hash-object [-w] [-q] [-t <type>] [-j <threads>] <gitdir>
+ *  (--stdin-paths | <path>...)": print the id of every file in input
+ * order, one per line as git does. A directory argument is walked in
+ * path order (skipping .git) and each of its files printed as
+ * "<id>\t<path>", with symlinks hashed as links; --stdin-paths takes
+ * files only. Unless -q is given, the throughput goes to stderr.
+ * Exits with 0, or 128 if a file could not be hashed.
+ */
+int cmd_hash_object(int argc, char **argv);
+
+#endif /* HASH_OBJECT_H */
@@ -0,0 +1,289 @@
+#include "hex.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HEX_X86 1
+#include <immintrin.h>
+#endif
+
+
+/* hex digit value + 1, so that 0 marks everything that is not a digit */
+static const unsigned char hexval1[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+static const char hexdigits[] = "0123456789abcdef";
+
+
+typedef int (*decode_fn)(unsigned char *out, const char *hex, size_t rawsz);
+typedef void (*encode_fn)(char *out, const unsigned char *raw, size_t rawsz);
+
+static int decode_scalar(unsigned char *out, const char *hex, size_t rawsz)
+{
+    unsigned bad = 0;
+    for (size_t i = 0; i < rawsz; i++) {
+        unsigned hi = hexval1[(unsigned char)hex[2 * i]];
+        unsigned lo = hexval1[(unsigned char)hex[2 * i + 1]];
+        bad |= !hi | !lo;
+        out[i] = (unsigned char)(((hi - 1) << 4) | ((lo - 1) & 0x0f));
+    }
+    return bad ? -1 : 0;
+}
+
+static void encode_scalar(char *out, const unsigned char *raw, size_t rawsz)
+{
+    for (size_t i = 0; i < rawsz; i++) {
+        out[2 * i] = hexdigits[raw[i] >> 4];
+        out[2 * i + 1] = hexdigits[raw[i] & 0x0f];
+    }
+}
+
+#ifdef HEX_X86
+/*
+ * Digits are validated and converted to nibbles with two range checks
+ * ('0'..'9' and, case-folded, 'a'..'f'); every 16-bit lane then holds
+ * (low nibble << 8) | high nibble and is folded into one byte.
+ */
+__attribute__((target("sse2")))
+static int decode16_sse2(unsigned char *out, const char *hex)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *)hex);
+    __m128i d = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+    __m128i l = _mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)),
+                             _mm_set1_epi8('a'));
+    __m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i is_l = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+
+    if (_mm_movemask_epi8(_mm_or_si128(is_d, is_l)) != 0xffff)
+        return -1;
+
+    __m128i v = _mm_or_si128(_mm_and_si128(is_d, d),
+                             _mm_and_si128(is_l, _mm_add_epi8(l, _mm_set1_epi8(10))));
+    __m128i hi = _mm_and_si128(_mm_slli_epi16(v, 4), _mm_set1_epi16(0x00f0));
+    __m128i lo = _mm_srli_epi16(v, 8);
+    _mm_storel_epi64((__m128i *)out,
+                     _mm_packus_epi16(_mm_or_si128(hi, lo), _mm_setzero_si128()));
+    return 0;
+}
+
+__attribute__((target("sse2")))
+static void encode8_sse2(char *out, const unsigned char *raw)
+{
+    __m128i x = _mm_loadl_epi64((const __m128i *)raw);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), _mm_set1_epi8(0x0f));
+    __m128i lo = _mm_and_si128(x, _mm_set1_epi8(0x0f));
+    __m128i n = _mm_unpacklo_epi8(hi, lo);
+    __m128i c = _mm_add_epi8(n, _mm_set1_epi8('0'));
+
+    c = _mm_add_epi8(c, _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)),
+                                      _mm_set1_epi8('a' - '0' - 10)));
+    _mm_storeu_si128((__m128i *)out, c);
+}
+
+/*
+ * A partial last step (the 4 trailing bytes of a SHA-1) is done as one
+ * more full step that overlaps the previous one, rather than by a
+ * scalar tail.
+ */
+__attribute__((target("sse2")))
+static int decode_sse2(unsigned char *out, const char *hex, size_t rawsz)
+{
+    if (rawsz < 8)
+        return decode_scalar(out, hex, rawsz);
+
+    for (size_t i = 0; i < rawsz; i += 8) {
+        if (i + 8 > rawsz)
+            i = rawsz - 8;
+        if (decode16_sse2(out + i, hex + 2 * i) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+__attribute__((target("sse2")))
+static void encode_sse2(char *out, const unsigned char *raw, size_t rawsz)
+{
+    if (rawsz < 8) {
+        encode_scalar(out, raw, rawsz);
+        return;
+    }
+
+    for (size_t i = 0; i < rawsz; i += 8) {
+        if (i + 8 > rawsz)
+            i = rawsz - 8;
+        encode8_sse2(out + 2 * i, raw + i);
+    }
+}
+
+__attribute__((target("avx2")))
+static int decode32_avx2(unsigned char *out, const char *hex)
+{
+    __m256i x = _mm256_loadu_si256((const __m256i *)hex);
+    __m256i d = _mm256_sub_epi8(x, _mm256_set1_epi8('0'));
+    __m256i l = _mm256_sub_epi8(_mm256_or_si256(x, _mm256_set1_epi8(0x20)),
+                                _mm256_set1_epi8('a'));
+    __m256i is_d = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    __m256i is_l = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+
+    if (_mm256_movemask_epi8(_mm256_or_si256(is_d, is_l)) != -1)
+        return -1;
+
+    __m256i v = _mm256_or_si256(_mm256_and_si256(is_d, d),
+                                _mm256_and_si256(is_l, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+    __m256i hi = _mm256_and_si256(_mm256_slli_epi16(v, 4), _mm256_set1_epi16(0x00f0));
+    __m256i lo = _mm256_srli_epi16(v, 8);
+    __m256i packed = _mm256_packus_epi16(_mm256_or_si256(hi, lo), _mm256_setzero_si256());
+
+    /* packus works per 128-bit lane: gather the two 8-byte halves */
+    packed = _mm256_permute4x64_epi64(packed, 0x08);
+    _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(packed));
+    return 0;
+}
+
+__attribute__((target("avx2")))
+static void encode16_avx2(char *out, const unsigned char *raw)
+{
+    __m256i x = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)raw));
+    __m256i n = _mm256_or_si256(_mm256_srli_epi16(x, 4),
+                                _mm256_slli_epi16(_mm256_and_si256(x, _mm256_set1_epi16(0x0f)), 8));
+    __m256i c = _mm256_add_epi8(n, _mm256_set1_epi8('0'));
+
+    c = _mm256_add_epi8(c, _mm256_and_si256(_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9)),
+                                            _mm256_set1_epi8('a' - '0' - 10)));
+    _mm256_storeu_si256((__m256i *)out, c);
+}
+
+__attribute__((target("avx2")))
+static int decode_avx2(unsigned char *out, const char *hex, size_t rawsz)
+{
+    if (rawsz < 16)
+        return decode_sse2(out, hex, rawsz);
+
+    for (size_t i = 0; i < rawsz; i += 16) {
+        if (i + 16 > rawsz)
+            i = rawsz - 16;
+        if (decode32_avx2(out + i, hex + 2 * i) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+__attribute__((target("avx2")))
+static void encode_avx2(char *out, const unsigned char *raw, size_t rawsz)
+{
+    if (rawsz < 16) {
+        encode_sse2(out, raw, rawsz);
+        return;
+    }
+
+    for (size_t i = 0; i < rawsz; i += 16) {
+        if (i + 16 > rawsz)
+            i = rawsz - 16;
+        encode16_avx2(out + 2 * i, raw + i);
+    }
+}
+#endif
+
+static enum scan_kernel active_kernel = SCAN_KERNEL_SCALAR;
+static decode_fn decode = decode_scalar;
+static encode_fn encode = encode_scalar;
+
+
+int hex_force_kernel(enum scan_kernel kernel)
+{
+    if (!scan_kernel_supported(kernel))
+        return -1;
+
+    switch (kernel) {
+#ifdef HEX_X86
+    case SCAN_KERNEL_SSE2:
+        decode = decode_sse2;
+        encode = encode_sse2;
+        break;
+    case SCAN_KERNEL_AVX2:
+        decode = decode_avx2;
+        encode = encode_avx2;
+        break;
+#endif
+    default:
+        decode = decode_scalar;
+        encode = encode_scalar;
+        break;
+    }
+    active_kernel = kernel;
+    return 0;
+}
+
+enum scan_kernel hex_active_kernel(void)
+{
+    return active_kernel;
+}
+
+__attribute__((constructor))
+static void hex_setup(void)
+{
+#ifdef HEX_X86
+    __builtin_cpu_init();
+    if (hex_force_kernel(SCAN_KERNEL_AVX2) < 0)
+        hex_force_kernel(SCAN_KERNEL_SSE2);
+#endif
+}
+
+
+int hex_decode(unsigned char *out, const char *hex, size_t rawsz)
+{
+    return decode(out, hex, rawsz);
+}
+
+void hex_encode(char *out, const unsigned char *raw, size_t rawsz)
+{
+    encode(out, raw, rawsz);
+}
+
+
+int oid_set_hex(struct object_id *oid, const char *hex, size_t len,
+                hash_algo_t algo)
+{
+    size_t rawsz = hash_algo_rawsz(algo);
+
+    memset(oid, 0, sizeof(*oid));
+    if (len != hash_algo_hexsz(algo) || rawsz > MAX_RAW_OID_LENGTH)
+        return -1;
+    if (decode(oid->hash, hex, rawsz) < 0) {
+        memset(oid->hash, 0, sizeof(oid->hash));
+        return -1;
+    }
+    oid->algo = algo;
+    return 0;
+}
+
+void oid_set_raw(struct object_id *oid, const unsigned char *raw,
+                 hash_algo_t algo)
+{
+    memset(oid, 0, sizeof(*oid));
+    memcpy(oid->hash, raw, hash_algo_rawsz(algo));
+    oid->algo = algo;
+}
+
+char *oid_to_hex_r(char *out, const struct object_id *oid)
+{
+    size_t rawsz = hash_algo_rawsz(oid->algo);
+
+    if (rawsz > MAX_RAW_OID_LENGTH)
+        rawsz = 0;
+    encode(out, oid->hash, rawsz);
+    out[2 * rawsz] = '\0';
+    return out;
+}
+
+const char *oid_to_hex(const struct object_id *oid)
+{
+    static _Thread_local char bufs[4][MAX_HEX_OID_LENGTH + 1];
+    static _Thread_local unsigned next;
+
+    return oid_to_hex_r(bufs[next++ & 3], oid);
+}
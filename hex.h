@@ -0,0 +1,55 @@
+#ifndef HEX_H
+#define HEX_H
+
+#include <stddef.h>
+#include "hash.h"
+#include "object.h"
+#include "scan.h"
+
+/*
+ * Hex <-> binary conversion of object ids.
+ *
+ * This is the single path for object id text: loose object file names,
+ * "tree"/"parent"/"object" header lines and log output all go through
+ * it. Conversion runs 16 or 32 hex digits per step with SSE2 or AVX2
+ * (the kernels of scan.h, chosen at startup) and validates the digits
+ * in the same pass.
+ */
+
+/* Hex digits of the widest object id, without the NUL */
+#define MAX_HEX_OID_LENGTH (2 * MAX_RAW_OID_LENGTH)
+
+/*
+ * Decode the 2 * [rawsz] hex digits at [hex] into [out]. Upper- and
+ * lowercase digits are accepted. Returns 0, or -1 on a non-hex digit.
+ */
+int hex_decode(unsigned char *out, const char *hex, size_t rawsz);
+
+/* Encode [rawsz] bytes as 2 * [rawsz] lowercase hex digits (no NUL). */
+void hex_encode(char *out, const unsigned char *raw, size_t rawsz);
+
+/*
+ * Parse the [len]-byte string [hex] into [oid]. [len] must be exactly
+ * the hex width of [algo]. Returns 0, or -1 if it is not a valid id.
+ */
+int oid_set_hex(struct object_id *oid, const char *hex, size_t len,
+                hash_algo_t algo);
+
+/* Fill [oid] from a raw id, e.g. a tree entry's. */
+void oid_set_raw(struct object_id *oid, const unsigned char *raw,
+                 hash_algo_t algo);
+
+/* Write [oid] as NUL-terminated hex into [out] and return [out]. */
+char *oid_to_hex_r(char *out, const struct object_id *oid);
+
+/*
+ * Like oid_to_hex_r(), into one of a few rotating per-thread buffers so
+ * that several ids can appear in one printf()-style call.
+ */
+const char *oid_to_hex(const struct object_id *oid);
+
+/* Override the conversion kernel (see scan_force_kernel()). */
+int hex_force_kernel(enum scan_kernel kernel);
+enum scan_kernel hex_active_kernel(void);
+
+#endif /* HEX_H */
@@ -0,0 +1,1094 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "log.h"
+#include "hex.h"
+#include "repository.h"
+#include "tree.h"
+#include "utl.h"
+
+#define INDEX_SIGNATURE "DIRC"
+#define INDEX_HEADER_SIZE 12
+
+/* Path length field of the on-disk flags; longer paths store 0xfff. */
+#define INDEX_NAME_MASK 0x0fffu
+
+/* Output is hashed and written in pieces of this size. */
+#define INDEX_WRITE_BUFFER (128u << 10)
+
+
+/* ---- cache-tree ---- */
+
+/*
+ * One directory of the TREE extension: how many entries it covers and
+ * the id of the tree they make, or entry_count -1 if that is not known.
+ * Subtrees are kept in the order they were read.
+ */
+struct cache_tree {
+    char *name;
+    size_t namelen;
+    long entry_count;
+    struct object_id oid;
+    struct cache_tree **down;
+    size_t nr;
+};
+
+static void cache_tree_free(struct cache_tree *it)
+{
+    if (!it)
+        return;
+    for (size_t i = 0; i < it->nr; i++)
+        cache_tree_free(it->down[i]);
+    free(it->down);
+    free(it->name);
+    free(it);
+}
+
+/* Parse "<name>\0<entry_count> <subtree_nr>\n[<id>]" and the subtrees after it. */
+static struct cache_tree *cache_tree_parse(const unsigned char **buf, size_t *left,
+                                           hash_algo_t algo)
+{
+    const unsigned char *p = *buf, *end = p + *left;
+    const unsigned char *nul = memchr(p, '\0', end - p);
+    struct cache_tree *it;
+    char *num_end;
+    long nr;
+
+    if (!nul || !(it = calloc(1, sizeof(*it))))
+        return NULL;
+    it->namelen = nul - p;
+    it->name = malloc(it->namelen + 1);
+    if (!it->name)
+        goto fail;
+    memcpy(it->name, p, it->namelen + 1);
+    p = nul + 1;
+
+    /* the numbers end with a '\n' well before the data does */
+    const unsigned char *nl = memchr(p, '\n', end - p);
+    if (!nl || (*p != '-' && (*p < '0' || *p > '9')))
+        goto fail;
+    it->entry_count = strtol((const char *)p, &num_end, 10);
+    if ((const unsigned char *)num_end >= nl || *num_end != ' ')
+        goto fail;
+    nr = strtol(num_end + 1, &num_end, 10);
+    if ((const unsigned char *)num_end != nl || nr < 0 || it->entry_count < -1)
+        goto fail;
+    p = nl + 1;
+
+    if (it->entry_count >= 0) {
+        if ((size_t)(end - p) < hash_algo_rawsz(algo))
+            goto fail;
+        oid_set_raw(&it->oid, p, algo);
+        p += hash_algo_rawsz(algo);
+    }
+
+    if (nr && !(it->down = calloc(nr, sizeof(*it->down))))
+        goto fail;
+    for (; it->nr < (size_t)nr; it->nr++) {
+        size_t rest = end - p;
+        if (!(it->down[it->nr] = cache_tree_parse(&p, &rest, algo)))
+            goto fail;
+    }
+
+    *left -= p - *buf;
+    *buf = p;
+    return it;
+fail:
+    cache_tree_free(it);
+    return NULL;
+}
+
+/*
+ * Forget the ids of the directories holding [path], and drop a subtree
+ * that [path] now replaces, as git's cache_tree_invalidate_path() does.
+ */
+static void cache_tree_invalidate(struct cache_tree *it, const char *path)
+{
+    while (it) {
+        const char *slash = strchr(path, '/');
+        size_t len = slash ? (size_t)(slash - path) : strlen(path);
+        struct cache_tree *next = NULL;
+        size_t i;
+
+        it->entry_count = -1;
+        for (i = 0; i < it->nr; i++)
+            if (it->down[i]->namelen == len && !memcmp(it->down[i]->name, path, len))
+                break;
+        if (i == it->nr)
+            return;
+        if (!slash) {
+            cache_tree_free(it->down[i]);
+            memmove(it->down + i, it->down + i + 1, (it->nr - i - 1) * sizeof(*it->down));
+            it->nr--;
+            return;
+        }
+        next = it->down[i];
+        path = slash + 1;
+        it = next;
+    }
+}
+
+struct strbuf_lite {
+    unsigned char *buf;
+    size_t len, alloc;
+};
+
+static int buf_add(struct strbuf_lite *sb, const void *data, size_t len)
+{
+    if (sb->len + len > sb->alloc) {
+        size_t alloc = sb->alloc ? sb->alloc : 1024;
+        while (alloc < sb->len + len)
+            alloc *= 2;
+        unsigned char *tmp = realloc(sb->buf, alloc);
+        if (!tmp)
+            return -1;
+        sb->buf = tmp;
+        sb->alloc = alloc;
+    }
+    memcpy(sb->buf + sb->len, data, len);
+    sb->len += len;
+    return 0;
+}
+
+static int cache_tree_write(const struct cache_tree *it, struct strbuf_lite *sb,
+                            hash_algo_t algo)
+{
+    char counts[64];
+    int n = snprintf(counts, sizeof(counts), "%ld %zu\n", it->entry_count, it->nr);
+
+    if (buf_add(sb, it->name, it->namelen + 1) < 0 || buf_add(sb, counts, n) < 0)
+        return -1;
+    if (it->entry_count >= 0 && buf_add(sb, it->oid.hash, hash_algo_rawsz(algo)) < 0)
+        return -1;
+    for (size_t i = 0; i < it->nr; i++)
+        if (cache_tree_write(it->down[i], sb, algo) < 0)
+            return -1;
+    return 0;
+}
+
+static struct index_extension *find_extension(struct index_state *istate, const char *sig)
+{
+    for (size_t i = 0; i < istate->nr_extensions; i++)
+        if (!memcmp(istate->extensions[i].sig, sig, 4))
+            return &istate->extensions[i];
+    return NULL;
+}
+
+/* Parse the TREE extension if not done yet. Returns NULL if there is none. */
+static struct cache_tree *load_cache_tree(struct index_state *istate)
+{
+    struct index_extension *ext = find_extension(istate, "TREE");
+
+    if (!ext || istate->cache_tree)
+        return istate->cache_tree;
+
+    const unsigned char *p = ext->data;
+    size_t left = ext->size;
+    istate->cache_tree = cache_tree_parse(&p, &left, istate->algo);
+    if (!istate->cache_tree || left) {
+        /* unusable: drop the extension rather than write it back wrong */
+        WARN("ignoring a malformed cache-tree");
+        cache_tree_free(istate->cache_tree);
+        istate->cache_tree = NULL;
+        *ext = istate->extensions[--istate->nr_extensions];
+    }
+    return istate->cache_tree;
+}
+
+/* An entry at [path] is about to change: invalidate the cache-tree. */
+static void invalidate_path(struct index_state *istate, const char *path)
+{
+    struct cache_tree *it = load_cache_tree(istate);
+
+    if (it)
+        cache_tree_invalidate(it, path);
+}
+
+int index_cache_tree_lookup(struct index_state *istate, const char *path, size_t len,
+                            struct object_id *oid, size_t *nr)
+{
+    struct cache_tree *it = load_cache_tree(istate);
+
+    while (it && len) {
+        const char *slash = memchr(path, '/', len);
+        size_t n = slash ? (size_t)(slash - path) : len;
+        size_t i;
+
+        for (i = 0; i < it->nr; i++)
+            if (it->down[i]->namelen == n && !memcmp(it->down[i]->name, path, n))
+                break;
+        it = i < it->nr ? it->down[i] : NULL;
+        n += !!slash;
+        path += n;
+        len -= n;
+    }
+    if (!it || it->entry_count < 0)
+        return 0;
+    *oid = it->oid;
+    *nr = it->entry_count;
+    return 1;
+}
+
+
+/* ---- entries ---- */
+
+static inline unsigned get_be16(const unsigned char *p)
+{
+    return (unsigned)p[0] << 8 | p[1];
+}
+
+static inline void put_be16(unsigned char *p, unsigned v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* Order of entries: by path bytes, then length, then stage. */
+static int entry_compare(const char *a, size_t alen, unsigned astage,
+                         const char *b, size_t blen, unsigned bstage)
+{
+    int cmp = memcmp(a, b, alen < blen ? alen : blen);
+    if (cmp)
+        return cmp;
+    if (alen != blen)
+        return alen < blen ? -1 : 1;
+    return astage < bstage ? -1 : astage > bstage;
+}
+
+void index_entry_stat(const struct index_entry *e, struct index_stat *st)
+{
+    const unsigned char *p = e->ondisk;
+
+    st->ctime_sec = index_get_be32(p);
+    st->ctime_nsec = index_get_be32(p + 4);
+    st->mtime_sec = index_get_be32(p + 8);
+    st->mtime_nsec = index_get_be32(p + 12);
+    st->dev = index_get_be32(p + 16);
+    st->ino = index_get_be32(p + 20);
+    st->uid = index_get_be32(p + 28);
+    st->gid = index_get_be32(p + 32);
+    st->size = index_get_be32(p + 36);
+}
+
+static void put_stat(unsigned char *p, const struct index_stat *st)
+{
+    put_be32(p, st->ctime_sec);
+    put_be32(p + 4, st->ctime_nsec);
+    put_be32(p + 8, st->mtime_sec);
+    put_be32(p + 12, st->mtime_nsec);
+    put_be32(p + 16, st->dev);
+    put_be32(p + 20, st->ino);
+    put_be32(p + 28, st->uid);
+    put_be32(p + 32, st->gid);
+    put_be32(p + 36, st->size);
+}
+
+void index_entry_oid(const struct index_state *istate, const struct index_entry *e,
+                     struct object_id *oid)
+{
+    oid_set_raw(oid, e->ondisk + INDEX_STAT_SIZE, istate->algo);
+}
+
+void index_stat_from(struct index_stat *out, const struct stat *st)
+{
+    out->ctime_sec = st->st_ctim.tv_sec;
+    out->ctime_nsec = st->st_ctim.tv_nsec;
+    out->mtime_sec = st->st_mtim.tv_sec;
+    out->mtime_nsec = st->st_mtim.tv_nsec;
+    out->dev = st->st_dev;
+    out->ino = st->st_ino;
+    out->uid = st->st_uid;
+    out->gid = st->st_gid;
+    out->size = st->st_size;
+}
+
+unsigned index_mode_from_stat(mode_t mode)
+{
+    if (S_ISLNK(mode))
+        return 0120000;
+    if (S_ISDIR(mode))
+        return 0160000;
+    return mode & S_IXUSR ? 0100755 : 0100644;
+}
+
+int index_entry_is_racy(const struct index_state *istate, const struct index_entry *e)
+{
+    /* whole seconds, as git does unless built with USE_NSEC */
+    return istate->mtime_sec && istate->mtime_sec <= index_get_be32(e->ondisk + 8);
+}
+
+long index_pos(const struct index_state *istate, const char *path, size_t len,
+               int stage)
+{
+    size_t lo = 0, hi = istate->nr;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const struct index_entry *e = &istate->entries[mid];
+        int cmp = entry_compare(path, len, stage, e->path, e->pathlen, index_entry_stage(e));
+        if (!cmp)
+            return mid;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return -(long)lo - 1;
+}
+
+
+/* ---- reading ---- */
+
+/* git's varint: 7 bits a byte, each continuation adding one. */
+static int decode_varint(const unsigned char **bufp, const unsigned char *end, size_t *out)
+{
+    const unsigned char *p = *bufp;
+    size_t val;
+
+    if (p >= end)
+        return -1;
+    val = *p & 127;
+    while (*p++ & 128) {
+        if (p >= end || val >> (8 * sizeof(val) - 8))
+            return -1;
+        val = ((val + 1) << 7) | (*p & 127);
+    }
+    *bufp = p;
+    *out = val;
+    return 0;
+}
+
+static int encode_varint(size_t value, unsigned char *buf)
+{
+    unsigned char varint[16];
+    unsigned pos = sizeof(varint) - 1;
+
+    varint[pos] = value & 127;
+    while (value >>= 7)
+        varint[--pos] = 128 | (--value & 127);
+    memcpy(buf, varint + pos, sizeof(varint) - pos);
+    return sizeof(varint) - pos;
+}
+
+/*
+ * Walk the [nr] entries from [p], filling istate->entries. Version 4
+ * paths are rebuilt into [paths], or with [paths] NULL only measured
+ * into *[paths_size]. Returns the end of the entries, or NULL.
+ */
+static const unsigned char *parse_entries(struct index_state *istate,
+                                          const unsigned char *p, const unsigned char *end,
+                                          size_t nr, char *paths, size_t *paths_size)
+{
+    size_t rawsz = hash_algo_rawsz(istate->algo);
+    size_t fixed = INDEX_STAT_SIZE + rawsz + 2;
+    const char *prev = "";
+    size_t prevlen = 0, used = 0;
+    unsigned prevstage = 0;
+
+    for (size_t i = 0; i < nr; i++) {
+        struct index_entry *e = &istate->entries[i];
+        const unsigned char *q = p + fixed;
+        size_t len;
+
+        if ((size_t)(end - p) < fixed)
+            return NULL;
+        unsigned flags = get_be16(p + INDEX_STAT_SIZE + rawsz);
+        e->ondisk = (unsigned char *)p;
+        e->flags = flags & ~INDEX_NAME_MASK;
+        if (flags & INDEX_ENTRY_EXTENDED) {
+            if (istate->version < 3 || end - q < 2)
+                return NULL;
+            unsigned ext = get_be16(q);
+            if (ext & ~(INDEX_ENTRY_EXTENDED_FLAGS >> 16))
+                return NULL;
+            e->flags |= ext << 16;
+            q += 2;
+        }
+
+        if (istate->version == 4) {
+            size_t strip;
+            if (decode_varint(&q, end, &strip) < 0 || strip > prevlen)
+                return NULL;
+            const unsigned char *nul = memchr(q, '\0', end - q);
+            if (!nul)
+                return NULL;
+            len = prevlen - strip + (nul - q);
+            if (paths) {
+                char *path = paths + used;
+                memcpy(path, prev, prevlen - strip);
+                memcpy(path + prevlen - strip, q, nul - q + 1);
+                e->path = path;
+            }
+            used += len + 1;
+            p = nul + 1;
+        } else {
+            len = flags & INDEX_NAME_MASK;
+            if (len == INDEX_NAME_MASK) {
+                const unsigned char *nul = (size_t)(end - q) > len ?
+                    memchr(q + len, '\0', end - q - len) : NULL;
+                if (!nul)
+                    return NULL;
+                len = nul - q;
+            } else if ((size_t)(end - q) <= len || q[len]) {
+                return NULL;
+            }
+            e->path = (const char *)q;
+            p += (q - p + len + 8) & ~(size_t)7;
+            if (p > end)
+                return NULL;
+        }
+
+        if (!paths && istate->version == 4) {
+            /* measuring: paths are not there yet to be checked */
+            prevlen = len;
+            continue;
+        }
+        if (!len || ((flags & INDEX_NAME_MASK) != INDEX_NAME_MASK &&
+                     (flags & INDEX_NAME_MASK) != len))
+            return NULL;
+        e->pathlen = len;
+        if (i && entry_compare(prev, prevlen, prevstage,
+                                  e->path, len, index_entry_stage(e)) >= 0) {
+            ERROR("index entries out of order at %s", e->path);
+            return NULL;
+        }
+        prev = e->path;
+        prevlen = len;
+        prevstage = index_entry_stage(e);
+    }
+    if (paths_size)
+        *paths_size = used;
+    return p;
+}
+
+static int parse_index(struct index_state *istate, unsigned flags)
+{
+    size_t rawsz = hash_algo_rawsz(istate->algo);
+    const unsigned char *map = istate->map, *end, *p;
+
+    if (istate->map_size < INDEX_HEADER_SIZE + rawsz ||
+        memcmp(map, INDEX_SIGNATURE, 4)) {
+        ERROR("bad index signature");
+        return -1;
+    }
+    istate->version = index_get_be32(map + 4);
+    if (istate->version < 2 || istate->version > 4) {
+        ERROR("index version %u is not supported", istate->version);
+        return -1;
+    }
+    end = map + istate->map_size - rawsz;
+
+    if (flags & INDEX_READ_VERIFY) {
+        static const unsigned char zero[MAX_RAW_OID_LENGTH];
+        unsigned char digest[MAX_RAW_OID_LENGTH];
+        struct hash_ctx ctx = HASH_CTX_INIT;
+        int ok = hash_init(&ctx, istate->algo) == 0 &&
+                 hash_update(&ctx, map, end - map) == 0 &&
+                 hash_final(&ctx, digest) == 0;
+        hash_ctx_release(&ctx);
+        /* an all-zero trailer means it was written without (index.skipHash) */
+        if (!ok || (memcmp(digest, end, rawsz) && memcmp(zero, end, rawsz))) {
+            ERROR("index checksum mismatch");
+            return -1;
+        }
+    }
+
+    size_t nr = index_get_be32(map + 8);
+    /* every entry takes at least its fixed part and a NUL */
+    if (nr > (size_t)(end - map) / (INDEX_STAT_SIZE + rawsz + 3))
+        goto corrupt;
+    istate->entries = malloc((nr ? nr : 1) * sizeof(*istate->entries));
+    if (!istate->entries)
+        return -1;
+    istate->alloc = nr;
+
+    p = map + INDEX_HEADER_SIZE;
+    if (istate->version == 4) {
+        size_t size;
+        if (!parse_entries(istate, p, end, nr, NULL, &size) ||
+            !(istate->v4_paths = malloc(size ? size : 1)))
+            goto corrupt;
+    }
+    if (!(p = parse_entries(istate, p, end, nr, istate->v4_paths, NULL)))
+        goto corrupt;
+    istate->nr = nr;
+
+    while (p < end) {
+        if (end - p < 8 || index_get_be32(p + 4) > (size_t)(end - p - 8))
+            goto corrupt;
+        if (p[0] < 'A' || p[0] > 'Z') {
+            ERROR("index uses extension '%.4s', which is not supported", (const char *)p);
+            return -1;
+        }
+        struct index_extension *tmp = realloc(istate->extensions,
+                                              (istate->nr_extensions + 1) * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        istate->extensions = tmp;
+        struct index_extension *ext = &tmp[istate->nr_extensions++];
+        memcpy(ext->sig, p, 4);
+        ext->size = index_get_be32(p + 4);
+        ext->data = p + 8;
+        p += 8 + ext->size;
+    }
+    return 0;
+
+corrupt:
+    ERROR("index file corrupt");
+    return -1;
+}
+
+int index_read(struct index_state *istate, const char *path, hash_algo_t algo,
+               unsigned flags)
+{
+    struct stat st;
+    int fd;
+
+    memset(istate, 0, sizeof(*istate));
+    istate->version = 2;
+    istate->algo = algo;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return 0;
+        ERROR("cannot open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        ERROR("cannot stat %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    istate->map_size = st.st_size;
+    /* private and writable: refreshed stat data only copies its pages */
+    istate->map = istate->map_size ?
+        mmap(NULL, istate->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (istate->map == MAP_FAILED) {
+        ERROR("cannot map %s", path);
+        istate->map = NULL;
+        return -1;
+    }
+    istate->mtime_sec = st.st_mtim.tv_sec;
+    istate->mtime_nsec = st.st_mtim.tv_nsec;
+
+    if (parse_index(istate, flags) < 0) {
+        ERROR("cannot read the index %s", path);
+        index_clear(istate);
+        istate->algo = algo;
+        return -1;
+    }
+    return 0;
+}
+
+int repo_read_index(struct repository *repo, struct index_state *istate,
+                    unsigned flags)
+{
+    char *path = utl_path_join(repo->gitdir, "index", 0);
+    if (!path)
+        return -1;
+    int ret = index_read(istate, path, repo->hash_algo, flags);
+    free(path);
+    return ret;
+}
+
+void index_clear(struct index_state *istate)
+{
+    for (size_t i = 0; i < istate->nr; i++)
+        if (istate->entries[i].flags & INDEX_ENTRY_ALLOCATED)
+            free(istate->entries[i].ondisk);
+    free(istate->entries);
+    free(istate->extensions);
+    cache_tree_free(istate->cache_tree);
+    if (istate->map)
+        munmap(istate->map, istate->map_size);
+    free(istate->v4_paths);
+    memset(istate, 0, sizeof(*istate));
+    istate->version = 2;
+}
+
+
+/* ---- changing ---- */
+
+/* git's verify_path(), less the case-folding checks: every component must pass verify_path_component(). */
+static int valid_path(const char *path)
+{
+    const char *c = path;
+
+    for (;;) {
+        const char *slash = strchr(c, '/');
+        size_t len = slash ? (size_t)(slash - c) : strlen(c);
+        if (!verify_path_component(c, len))
+            return 0;
+        if (!slash)
+            return 1;
+        c = slash + 1;
+    }
+}
+
+/* Whether [path] would be a file where a directory is, or the reverse. */
+static int df_conflict(const struct index_state *istate, const char *path, size_t len)
+{
+    for (const char *slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+        long pos = index_pos(istate, path, slash - path, 0);
+        if (pos < 0)
+            pos = -pos - 1;
+        if ((size_t)pos < istate->nr && istate->entries[pos].pathlen == (size_t)(slash - path) &&
+            !memcmp(istate->entries[pos].path, path, slash - path))
+            return 1;
+    }
+
+    char *dir = malloc(len + 2);
+    if (!dir)
+        return 1;
+    memcpy(dir, path, len);
+    dir[len] = '/';
+    dir[len + 1] = '\0';
+    long pos = -index_pos(istate, dir, len + 1, 0) - 1;
+    int found = (size_t)pos < istate->nr && istate->entries[pos].pathlen > len &&
+                !memcmp(istate->entries[pos].path, dir, len + 1);
+    free(dir);
+    return found;
+}
+
+static struct index_entry *make_entry(const struct index_state *istate, const char *path,
+                                      size_t len, unsigned mode, const struct object_id *oid,
+                                      const struct index_stat *st, struct index_entry *e)
+{
+    size_t rawsz = hash_algo_rawsz(istate->algo);
+    unsigned char *ondisk = calloc(1, INDEX_STAT_SIZE + rawsz + len + 1);
+
+    if (!ondisk)
+        return NULL;
+    if (st)
+        put_stat(ondisk, st);
+    put_be32(ondisk + 24, mode);
+    memcpy(ondisk + INDEX_STAT_SIZE, oid->hash, rawsz);
+    memcpy(ondisk + INDEX_STAT_SIZE + rawsz, path, len);
+    e->ondisk = ondisk;
+    e->path = (const char *)ondisk + INDEX_STAT_SIZE + rawsz;
+    e->pathlen = len;
+    e->flags = INDEX_ENTRY_ALLOCATED;
+    return e;
+}
+
+int index_add(struct index_state *istate, const char *path, unsigned mode,
+              const struct object_id *oid, const struct index_stat *st)
+{
+    size_t len = strlen(path), rawsz = hash_algo_rawsz(istate->algo);
+    long pos = index_pos(istate, path, len, 0);
+    struct index_entry e;
+
+    if (!valid_path(path)) {
+        ERROR("invalid path '%s'", path);
+        return -1;
+    }
+
+    if (pos >= 0) {
+        struct index_entry *old = &istate->entries[pos];
+        if (index_entry_mode(old) == mode &&
+            !memcmp(old->ondisk + INDEX_STAT_SIZE, oid->hash, rawsz)) {
+            if (st)
+                put_stat(old->ondisk, st);
+            return 0;
+        }
+        if (!make_entry(istate, path, len, mode, oid, st, &e))
+            return -1;
+        invalidate_path(istate, path);
+        if (old->flags & INDEX_ENTRY_ALLOCATED)
+            free(old->ondisk);
+        *old = e;
+        return 0;
+    }
+
+    if (df_conflict(istate, path, len)) {
+        ERROR("'%s' appears as both a file and as a directory", path);
+        return -1;
+    }
+    if (istate->nr == istate->alloc) {
+        size_t alloc = istate->alloc ? 2 * istate->alloc : 64;
+        struct index_entry *tmp = realloc(istate->entries, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        istate->entries = tmp;
+        istate->alloc = alloc;
+    }
+    if (!make_entry(istate, path, len, mode, oid, st, &e))
+        return -1;
+
+    /* a resolved conflict: the higher stages go */
+    pos = -pos - 1;
+    while ((size_t)pos < istate->nr && istate->entries[pos].pathlen == len &&
+           !memcmp(istate->entries[pos].path, path, len))
+        index_remove(istate, pos);
+
+    invalidate_path(istate, path);
+    memmove(istate->entries + pos + 1, istate->entries + pos,
+            (istate->nr - pos) * sizeof(*istate->entries));
+    istate->entries[pos] = e;
+    istate->nr++;
+    istate->paths_changed = 1;
+    return 0;
+}
+
+void index_remove(struct index_state *istate, size_t pos)
+{
+    struct index_entry *e = &istate->entries[pos];
+
+    invalidate_path(istate, e->path);
+    if (e->flags & INDEX_ENTRY_ALLOCATED)
+        free(e->ondisk);
+    memmove(e, e + 1, (istate->nr - pos - 1) * sizeof(*e));
+    istate->nr--;
+    istate->paths_changed = 1;
+}
+
+void index_set_stat(struct index_state *istate, size_t pos, const struct index_stat *st)
+{
+    put_stat(istate->entries[pos].ondisk, st);
+}
+
+
+/* ---- writing ---- */
+
+struct index_writer {
+    int fd;
+    struct hash_ctx ctx;
+    unsigned char *buf;         /* INDEX_WRITE_BUFFER bytes */
+    size_t len;
+    int failed;
+};
+
+static void writer_flush(struct index_writer *w)
+{
+    const unsigned char *p = w->buf;
+    size_t left = w->len;
+
+    if (!w->failed && hash_update(&w->ctx, w->buf, w->len) < 0)
+        w->failed = 1;
+    while (!w->failed && left) {
+        ssize_t n = write(w->fd, p, left);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            w->failed = 1;
+        else
+            p += n, left -= n;
+    }
+    w->len = 0;
+}
+
+static void writer_add(struct index_writer *w, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    while (len) {
+        size_t n = INDEX_WRITE_BUFFER - w->len < len ? INDEX_WRITE_BUFFER - w->len : len;
+        memcpy(w->buf + w->len, p, n);
+        w->len += n;
+        p += n;
+        len -= n;
+        if (w->len == INDEX_WRITE_BUFFER)
+            writer_flush(w);
+    }
+}
+
+static void write_extension(struct index_writer *w, const char *sig,
+                            const void *data, size_t size)
+{
+    unsigned char hdr[8];
+    memcpy(hdr, sig, 4);
+    put_be32(hdr + 4, size);
+    writer_add(w, hdr, sizeof(hdr));
+    writer_add(w, data, size);
+}
+
+static void write_entries(struct index_state *istate, struct index_writer *w,
+                          unsigned version)
+{
+    static const unsigned char zeros[8];
+    size_t rawsz = hash_algo_rawsz(istate->algo);
+    const char *prev = "";
+    size_t prevlen = 0;
+
+    for (size_t i = 0; i < istate->nr; i++) {
+        struct index_entry *e = &istate->entries[i];
+        unsigned char tail[4 + 16];
+        size_t n = 2;
+
+        /* racily clean: make sure it is not taken as clean later */
+        if (index_entry_is_racy(istate, e))
+            put_be32(e->ondisk + 36, 0);
+
+        unsigned flags = (e->flags & (INDEX_ENTRY_ASSUME_VALID | INDEX_ENTRY_STAGE_MASK)) |
+                         (e->pathlen < INDEX_NAME_MASK ? e->pathlen : INDEX_NAME_MASK);
+        if (e->flags & INDEX_ENTRY_EXTENDED_FLAGS) {
+            put_be16(tail, flags | INDEX_ENTRY_EXTENDED);
+            put_be16(tail + 2, (e->flags & INDEX_ENTRY_EXTENDED_FLAGS) >> 16);
+            n = 4;
+        } else {
+            put_be16(tail, flags);
+        }
+        writer_add(w, e->ondisk, INDEX_STAT_SIZE + rawsz);
+
+        if (version == 4) {
+            size_t common = 0;
+            while (common < prevlen && common < e->pathlen && prev[common] == e->path[common])
+                common++;
+            n += encode_varint(prevlen - common, tail + n);
+            writer_add(w, tail, n);
+            writer_add(w, e->path + common, e->pathlen - common + 1);
+            prev = e->path;
+            prevlen = e->pathlen;
+        } else {
+            size_t size = (INDEX_STAT_SIZE + rawsz + n + e->pathlen + 8) & ~(size_t)7;
+            writer_add(w, tail, n);
+            writer_add(w, e->path, e->pathlen);
+            writer_add(w, zeros, size - (INDEX_STAT_SIZE + rawsz + n + e->pathlen));
+        }
+    }
+}
+
+static void write_extensions(struct index_state *istate, struct index_writer *w)
+{
+    for (size_t i = 0; i < istate->nr_extensions; i++) {
+        const struct index_extension *ext = &istate->extensions[i];
+
+        if (!memcmp(ext->sig, "TREE", 4) && istate->cache_tree) {
+            struct strbuf_lite sb = { NULL, 0, 0 };
+            if (cache_tree_write(istate->cache_tree, &sb, istate->algo) < 0)
+                w->failed = 1;
+            else
+                write_extension(w, "TREE", sb.buf, sb.len);
+            free(sb.buf);
+            continue;
+        }
+        /* offsets into the file: only valid for the file they were in */
+        if (!memcmp(ext->sig, "EOIE", 4) || !memcmp(ext->sig, "IEOT", 4))
+            continue;
+        if (istate->paths_changed && memcmp(ext->sig, "TREE", 4) &&
+            memcmp(ext->sig, "REUC", 4))
+            continue;
+        write_extension(w, ext->sig, ext->data, ext->size);
+    }
+}
+
+int index_write(struct index_state *istate, const char *path)
+{
+    struct index_writer w = { -1, HASH_CTX_INIT, NULL, 0, 0 };
+    unsigned char hdr[INDEX_HEADER_SIZE], digest[MAX_RAW_OID_LENGTH];
+    unsigned version = istate->version;
+    size_t len = strlen(path);
+    char *lock = malloc(len + 6);
+    int ret = -1;
+
+    if (!lock)
+        return -1;
+    memcpy(lock, path, len);
+    memcpy(lock + len, ".lock", 6);
+
+    if (version == 2 || version == 3) {
+        version = 2;
+        for (size_t i = 0; i < istate->nr; i++)
+            if (istate->entries[i].flags & INDEX_ENTRY_EXTENDED_FLAGS) {
+                version = 3;
+                break;
+            }
+    }
+
+    w.fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (w.fd < 0) {
+        ERROR("unable to create '%s': %s", lock, strerror(errno));
+        free(lock);
+        return -1;
+    }
+    if (!(w.buf = malloc(INDEX_WRITE_BUFFER)) || hash_init(&w.ctx, istate->algo) < 0)
+        w.failed = 1;
+
+    if (!w.failed) {
+        memcpy(hdr, INDEX_SIGNATURE, 4);
+        put_be32(hdr + 4, version);
+        put_be32(hdr + 8, istate->nr);
+        writer_add(&w, hdr, sizeof(hdr));
+        write_entries(istate, &w, version);
+        write_extensions(istate, &w);
+        writer_flush(&w);
+    }
+    if (!w.failed && hash_final(&w.ctx, digest) == 0) {
+        size_t rawsz = hash_algo_rawsz(istate->algo);
+        ret = 0;
+        if (write(w.fd, digest, rawsz) != (ssize_t)rawsz)
+            ret = -1;
+    }
+    if (close(w.fd) < 0)
+        ret = -1;
+
+    struct stat st;
+    if (ret == 0 && rename(lock, path) == 0) {
+        istate->version = version;
+        if (!stat(path, &st)) {
+            istate->mtime_sec = st.st_mtim.tv_sec;
+            istate->mtime_nsec = st.st_mtim.tv_nsec;
+        }
+    } else {
+        ERROR("cannot write the index %s: %s", path, strerror(errno));
+        unlink(lock);
+        ret = -1;
+    }
+    hash_ctx_release(&w.ctx);
+    free(w.buf);
+    free(lock);
+    return ret;
+}
+
+int repo_write_index(struct repository *repo, struct index_state *istate)
+{
+    char *path = utl_path_join(repo->gitdir, "index", 0);
+    if (!path)
+        return -1;
+    int ret = index_write(istate, path);
+    free(path);
+    return ret;
+}
+
+
+/* ---- commands ---- */
+
+int cmd_ls_files(int argc, char **argv)
+{
+    int stage = 0, i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--stage"))
+            stage = 1;
+        else
+            break;
+    }
+    if (argc - i != 1) {
+        fprintf(stderr, "usage: ls-files [-s] <gitdir>\n");
+        return 128;
+    }
+
+    struct repository repo;
+    struct index_state istate;
+    if (repo_open(&repo, argv[i]) < 0) {
+        ERROR("%s is not a git directory", argv[i]);
+        return 128;
+    }
+    if (repo_read_index(&repo, &istate, 0) < 0) {
+        repo_clear(&repo);
+        return 128;
+    }
+
+    for (size_t n = 0; n < istate.nr; n++) {
+        const struct index_entry *e = &istate.entries[n];
+        if (stage) {
+            struct object_id oid;
+            index_entry_oid(&istate, e, &oid);
+            printf("%06o %s %u\t%s\n", index_entry_mode(e), oid_to_hex(&oid),
+                   index_entry_stage(e), e->path);
+        } else {
+            printf("%s\n", e->path);
+        }
+    }
+
+    index_clear(&istate);
+    repo_clear(&repo);
+    return 0;
+}
+
+/* "<mode>,<id>,<path>" */
+static int parse_cacheinfo(const char *arg, hash_algo_t algo, unsigned *mode,
+                           struct object_id *oid, const char **path)
+{
+    char *end;
+    unsigned long m = strtoul(arg, &end, 8);
+    size_t hexsz = hash_algo_hexsz(algo);
+
+    if (end == arg || *end != ',' || strlen(end + 1) < hexsz + 2 ||
+        end[1 + hexsz] != ',' || oid_set_hex(oid, end + 1, hexsz, algo) < 0)
+        return -1;
+    if (m != 0100644 && m != 0100755 && m != 0120000 && m != 0160000)
+        return -1;
+    *mode = m;
+    *path = end + 2 + hexsz;
+    return 0;
+}
+
+int cmd_update_index(int argc, char **argv)
+{
+    static const char usage[] =
+        "usage: update-index [--index-version <n>] [--cacheinfo <mode>,<id>,<path>]..."
+        " [--force-remove <path>]... <gitdir>\n";
+    struct repository repo;
+    struct index_state istate;
+    int ret = 128, i;
+
+    if (argc < 2 || argv[argc - 1][0] == '-') {
+        fprintf(stderr, "%s", usage);
+        return 128;
+    }
+    if (repo_open(&repo, argv[argc - 1]) < 0) {
+        ERROR("%s is not a git directory", argv[argc - 1]);
+        return 128;
+    }
+    if (repo_read_index(&repo, &istate, 0) < 0) {
+        repo_clear(&repo);
+        return 128;
+    }
+
+    for (i = 1; i < argc - 1; i++) {
+        if (!strcmp(argv[i], "--index-version") && i + 1 < argc - 1) {
+            int v = atoi(argv[++i]);
+            if (v < 2 || v > 4) {
+                ERROR("index version %s is not supported", argv[i]);
+                goto out;
+            }
+            istate.version = v;
+        } else if (!strcmp(argv[i], "--cacheinfo") && i + 1 < argc - 1) {
+            unsigned mode;
+            struct object_id oid;
+            const char *path;
+            if (parse_cacheinfo(argv[++i], repo.hash_algo, &mode, &oid, &path) < 0) {
+                ERROR("bad --cacheinfo '%s'", argv[i]);
+                goto out;
+            }
+            if (index_add(&istate, path, mode, &oid, NULL) < 0)
+                goto out;
+        } else if (!strcmp(argv[i], "--force-remove") && i + 1 < argc - 1) {
+            const char *path = argv[++i];
+            long pos = index_pos(&istate, path, strlen(path), 0);
+            if (pos < 0)
+                pos = -pos - 1;
+            while ((size_t)pos < istate.nr && !strcmp(istate.entries[pos].path, path))
+                index_remove(&istate, pos);
+        } else {
+            fprintf(stderr, "%s", usage);
+            goto out;
+        }
+    }
+    if (repo_write_index(&repo, &istate) == 0)
+        ret = 0;
+
+out:
+    index_clear(&istate);
+    repo_clear(&repo);
+    return ret;
+}
@@ -0,0 +1,201 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "hash.h"
+#include "object.h"
+
+struct repository;
+
+/*
+ * The index (staging area), .git/index, in versions 2, 3 and 4.
+ *
+ * The file is mapped copy-on-write and its entries are used in place:
+ * an index_entry points at the entry's stat data and object id as they
+ * sit in the map (big-endian), and at its NUL-terminated path. Only
+ * version 4, whose paths are prefix-compressed, needs a path to be
+ * rebuilt; those go into one buffer sized by a first pass. Reading is
+ * therefore a walk over the entries with no copying and two
+ * allocations, whatever their number. Refreshing the stat data of an
+ * entry writes into the map, which only copies the pages touched.
+ *
+ * Entries are kept sorted by path then stage, as git requires; the
+ * reader rejects a file that is not, and index_add() inserts in place.
+ * The trailing checksum is only verified on request, as in git outside
+ * of fsck.
+ *
+ * Extensions are kept as read and written back after the entries:
+ *  - TREE (cache-tree), the tree ids of directories, is parsed when an
+ *    entry is first added, changed or removed, and every directory
+ *    above that path loses its id;
+ *  - UNTR (untracked cache) and the other optional ones are written
+ *    back unchanged as long as the set of paths is, and dropped once a
+ *    path is added or removed (git rebuilds them), except REUC which
+ *    does not depend on the entries;
+ *  - a required extension (split index, sparse directories) makes the
+ *    index unreadable here.
+ */
+
+/* In-memory entry flags: the on-disk ones, extended flags shifted up. */
+#define INDEX_ENTRY_ASSUME_VALID    0x8000u
+#define INDEX_ENTRY_EXTENDED        0x4000u
+#define INDEX_ENTRY_STAGE_MASK      0x3000u
+#define INDEX_ENTRY_STAGE_SHIFT     12
+#define INDEX_ENTRY_SKIP_WORKTREE   (0x4000u << 16)
+#define INDEX_ENTRY_INTENT_TO_ADD   (0x2000u << 16)
+#define INDEX_ENTRY_EXTENDED_FLAGS  (INDEX_ENTRY_SKIP_WORKTREE | INDEX_ENTRY_INTENT_TO_ADD)
+/* not stored: the entry was allocated by index_add() */
+#define INDEX_ENTRY_ALLOCATED       0x0001u
+
+/* Size of the stat data block that starts an entry; the object id follows. */
+#define INDEX_STAT_SIZE 40
+
+struct index_entry {
+    unsigned char *ondisk;      /* stat data then raw id, as in the file */
+    const char *path;           /* NUL-terminated */
+    unsigned pathlen;
+    unsigned flags;             /* INDEX_ENTRY_* */
+};
+
+/* The lstat() fields git caches, truncated to 32 bits as on disk. */
+struct index_stat {
+    uint32_t ctime_sec, ctime_nsec;
+    uint32_t mtime_sec, mtime_nsec;
+    uint32_t dev, ino;
+    uint32_t uid, gid;
+    uint32_t size;
+};
+
+/* An extension as read: [data] points into the map. */
+struct index_extension {
+    char sig[4];
+    const unsigned char *data;
+    size_t size;
+};
+
+struct cache_tree;
+
+struct index_state {
+    unsigned version;           /* 2, 3 or 4 */
+    hash_algo_t algo;
+    struct index_entry *entries;
+    size_t nr, alloc;
+
+    /* mtime of the file when it was read, for racy entries; 0 if none */
+    uint32_t mtime_sec, mtime_nsec;
+
+    struct index_extension *extensions;
+    size_t nr_extensions;
+    struct cache_tree *cache_tree;      /* parsed TREE, once needed */
+    int paths_changed;                  /* a path was added or removed */
+
+    unsigned char *map;
+    size_t map_size;
+    char *v4_paths;
+};
+
+/* Verify the trailing checksum while reading. */
+#define INDEX_READ_VERIFY (1u << 0)
+
+/*
+ * Read the index file [path] of a repository using [algo] into
+ * [istate]. A missing file is an empty index. Returns 0, or -1 if the
+ * file is malformed, out of order or uses a required extension that is
+ * not supported ([istate] is then empty).
+ */
+int index_read(struct index_state *istate, const char *path, hash_algo_t algo,
+               unsigned flags);
+
+/* index_read() of <gitdir>/index. */
+int repo_read_index(struct repository *repo, struct index_state *istate,
+                    unsigned flags);
+
+/*
+ * Write [istate] to [path] through [path].lock, renamed into place once
+ * complete. Versions 2 and 3 are written as 3 only if an entry has
+ * extended flags, as in git.
+ * Entries that were racily clean in the index read (modified in the
+ * same second it was written, or later) have their size zeroed, so
+ * they are compared by content until refreshed, as in git.
+ * Returns 0, or -1 if the lock is taken or the file cannot be written.
+ */
+int index_write(struct index_state *istate, const char *path);
+
+int repo_write_index(struct repository *repo, struct index_state *istate);
+
+void index_clear(struct index_state *istate);
+
+/*
+ * Position of [path] ([len] bytes) at [stage], or -(insertion point)-1
+ * if it is not in the index, as in git.
+ */
+long index_pos(const struct index_state *istate, const char *path, size_t len,
+               int stage);
+
+/*
+ * Add or replace the stage 0 entry for [path]. [st] may be NULL for
+ * all-zero stat data, which never looks clean. Returns 0, or -1 if
+ * [path] is not a valid path, or a file and a directory would then
+ * share a name.
+ */
+int index_add(struct index_state *istate, const char *path, unsigned mode,
+              const struct object_id *oid, const struct index_stat *st);
+
+/* Remove the entry at [pos]. */
+void index_remove(struct index_state *istate, size_t pos);
+
+/* Store new stat data for the entry at [pos], e.g. after a refresh. */
+void index_set_stat(struct index_state *istate, size_t pos,
+                    const struct index_stat *st);
+
+void index_stat_from(struct index_stat *out, const struct stat *st);
+
+/* The canonical index mode of a file: 0100644, 0100755, 0120000 or 0160000. */
+unsigned index_mode_from_stat(mode_t mode);
+
+static inline uint32_t index_get_be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline unsigned index_entry_stage(const struct index_entry *e)
+{
+    return (e->flags & INDEX_ENTRY_STAGE_MASK) >> INDEX_ENTRY_STAGE_SHIFT;
+}
+
+static inline unsigned index_entry_mode(const struct index_entry *e)
+{
+    return index_get_be32(e->ondisk + 24);
+}
+
+void index_entry_stat(const struct index_entry *e, struct index_stat *st);
+void index_entry_oid(const struct index_state *istate, const struct index_entry *e,
+                     struct object_id *oid);
+
+/*
+ * Whether the stat data of [e] cannot be trusted: the file was changed
+ * no earlier than the index was written, so it may have changed again
+ * within the same timestamp.
+ */
+int index_entry_is_racy(const struct index_state *istate, const struct index_entry *e);
+
+/*
+ * The tree id the cache-tree records for the directory [path] ([len]
+ * bytes, none for the top) and how many entries it covers. Returns 1
+ * if it is known, 0 if the index has no valid id for it.
+ */
+int index_cache_tree_lookup(struct index_state *istate, const char *path, size_t len,
+                            struct object_id *oid, size_t *nr);
+
+/* "ls-files [-s] <gitdir>": the paths of the index, or with -s its entries. */
+int cmd_ls_files(int argc, char **argv);
+
+/*
+ * "update-index [--index-version <n>] [--cacheinfo <mode>,<id>,<path>]...
+ *  [--force-remove <path>]... <gitdir>": edit the index directly.
+ */
+int cmd_update_index(int argc, char **argv);
+
+#endif /* INDEX_H */
@@ -0,0 +1,1003 @@
+#include "line_diff.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+
+/* xdiff's tuning constants, so that the same inputs give the same scripts */
+#define MAX_EQLIMIT         1024    /* a line this frequent may be discarded */
+#define SIMSCAN_WINDOW      100
+#define KPDIS_RUN           4
+#define MAX_COST_MIN        256
+#define HEUR_MIN_COST       256
+#define SNAKE_CNT           20
+#define K_HEUR              4
+#define HISTOGRAM_MAX_CHAIN 64
+#define FUNCNAME_MAX        80
+
+struct diff_file {
+    const char *buf;
+    long nr;
+    size_t *start;              /* nr + 1 offsets: line i is [start[i], start[i + 1]) */
+    uint32_t *cls;              /* equivalence class of each line */
+    char *chg;                  /* changed lines; chg[-1] and chg[nr] stay 0 */
+};
+
+struct diff_env {
+    struct diff_file f[2];
+    uint32_t nr_classes;
+    uint32_t *count[2];         /* per class, zero between uses */
+
+    /* histogram only */
+    long *rec_ptr;              /* per class: first line in the current range */
+    uint32_t *rec_cnt;          /* per class: occurrences there, zero between uses */
+    long *next;                 /* per line of f[0]: next line of its class */
+};
+
+/* A pair of line ranges still to be diffed. */
+struct range {
+    long off1, lim1, off2, lim2;
+    int need_min;
+};
+
+struct range_stack {
+    struct range *items;
+    size_t nr, alloc;
+};
+
+static int range_push(struct range_stack *st, long off1, long lim1,
+                      long off2, long lim2, int need_min)
+{
+    if (st->nr == st->alloc) {
+        size_t alloc = st->alloc ? st->alloc * 2 : 64;
+        struct range *tmp = realloc(st->items, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        st->items = tmp;
+        st->alloc = alloc;
+    }
+    st->items[st->nr++] = (struct range){ off1, lim1, off2, lim2, need_min };
+    return 0;
+}
+
+static long bogosqrt(long n)
+{
+    long i;
+    for (i = 1; n > 0; n >>= 2)
+        i <<= 1;
+    return i;
+}
+
+
+/* ---- preparation ---- */
+
+static uint64_t line_hash(const char *p, size_t len)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+    uint64_t w;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    if (len) {
+        w = 0;
+        memcpy(&w, p, len);
+        h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static int file_init(struct diff_file *f, const char *buf, size_t len)
+{
+    const char *p, *end = buf + len, *nl;
+    long i = 0;
+
+    memset(f, 0, sizeof(*f));
+    f->buf = buf;
+    for (p = buf; p < end; p = nl ? nl + 1 : end) {
+        nl = memchr(p, '\n', end - p);
+        f->nr++;
+    }
+
+    f->start = malloc((f->nr + 1) * sizeof(*f->start));
+    f->cls = malloc((f->nr + 1) * sizeof(*f->cls));
+    char *chg = calloc(f->nr + 2, 1);
+    if (!f->start || !f->cls || !chg) {
+        free(chg);
+        return -1;
+    }
+    f->chg = chg + 1;
+
+    for (p = buf; p < end; p = nl ? nl + 1 : end) {
+        nl = memchr(p, '\n', end - p);
+        f->start[i++] = p - buf;
+    }
+    f->start[f->nr] = len;
+    return 0;
+}
+
+static void file_clear(struct diff_file *f)
+{
+    free(f->start);
+    free(f->cls);
+    if (f->chg)
+        free(f->chg - 1);
+}
+
+struct line_class {
+    uint64_t hash;
+    const char *line;
+    size_t len;
+};
+
+/* Number equal lines alike, across both files. */
+static int classify(struct diff_env *env)
+{
+    size_t total = env->f[0].nr + env->f[1].nr, size = 16;
+    while (size < total * 2)
+        size *= 2;
+
+    uint32_t *slots = calloc(size, sizeof(*slots));
+    struct line_class *classes = malloc((total + 1) * sizeof(*classes));
+    uint32_t nr = 0;
+    if (!slots || !classes) {
+        free(slots);
+        free(classes);
+        return -1;
+    }
+
+    for (int side = 0; side < 2; side++) {
+        struct diff_file *f = &env->f[side];
+        for (long i = 0; i < f->nr; i++) {
+            const char *line = f->buf + f->start[i];
+            size_t len = f->start[i + 1] - f->start[i];
+            uint64_t hash = line_hash(line, len);
+            size_t pos = hash & (size - 1);
+
+            while (slots[pos]) {
+                struct line_class *c = &classes[slots[pos] - 1];
+                if (c->hash == hash && c->len == len && !memcmp(c->line, line, len))
+                    break;
+                pos = (pos + 1) & (size - 1);
+            }
+            if (!slots[pos]) {
+                classes[nr] = (struct line_class){ hash, line, len };
+                slots[pos] = ++nr;
+            }
+            f->cls[i] = slots[pos] - 1;
+        }
+    }
+
+    free(slots);
+    free(classes);
+    env->nr_classes = nr;
+    env->count[0] = calloc(nr + 1, sizeof(uint32_t));
+    env->count[1] = calloc(nr + 1, sizeof(uint32_t));
+    return env->count[0] && env->count[1] ? 0 : -1;
+}
+
+
+/* ---- myers ---- */
+
+struct myers {
+    const uint32_t *ha1, *ha2;
+    long *kvdf, *kvdb;          /* furthest reaching paths, by diagonal */
+    long mxcost;
+};
+
+struct split {
+    long i1, i2;
+    int min_lo, min_hi;         /* must each half be diffed minimally */
+};
+
+/*
+ * Find where to split ha1[off1, lim1) x ha2[off2, lim2): the middle
+ * snake of the shortest edit script or, once that gets too expensive,
+ * the end of a long snake or the furthest any path got.
+ */
+static void myers_split(const struct myers *m, long off1, long lim1,
+                        long off2, long lim2, int need_min, struct split *spl)
+{
+    const uint32_t *ha1 = m->ha1, *ha2 = m->ha2;
+    long *kvdf = m->kvdf, *kvdb = m->kvdb;
+    long dmin = off1 - lim2, dmax = lim1 - off2;
+    long fmid = off1 - off2, bmid = lim1 - lim2;
+    long odd = (fmid - bmid) & 1;
+    long fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+    long ec, d, i1, i2, prev1, best, dd, v, k;
+
+    kvdf[fmid] = off1;
+    kvdb[bmid] = lim1;
+
+    for (ec = 1;; ec++) {
+        int got_snake = 0;
+
+        /* forward */
+        if (fmin > dmin)
+            kvdf[--fmin - 1] = -1;
+        else
+            ++fmin;
+        if (fmax < dmax)
+            kvdf[++fmax + 1] = -1;
+        else
+            --fmax;
+
+        for (d = fmax; d >= fmin; d -= 2) {
+            i1 = kvdf[d - 1] >= kvdf[d + 1] ? kvdf[d - 1] + 1 : kvdf[d + 1];
+            prev1 = i1;
+            i2 = i1 - d;
+            for (; i1 < lim1 && i2 < lim2 && ha1[i1] == ha2[i2]; i1++, i2++)
+                ;
+            if (i1 - prev1 > SNAKE_CNT)
+                got_snake = 1;
+            kvdf[d] = i1;
+            if (odd && bmin <= d && d <= bmax && kvdb[d] <= i1) {
+                *spl = (struct split){ i1, i2, 1, 1 };
+                return;
+            }
+        }
+
+        /* backward */
+        if (bmin > dmin)
+            kvdb[--bmin - 1] = LONG_MAX;
+        else
+            ++bmin;
+        if (bmax < dmax)
+            kvdb[++bmax + 1] = LONG_MAX;
+        else
+            --bmax;
+
+        for (d = bmax; d >= bmin; d -= 2) {
+            i1 = kvdb[d - 1] < kvdb[d + 1] ? kvdb[d - 1] : kvdb[d + 1] - 1;
+            prev1 = i1;
+            i2 = i1 - d;
+            for (; i1 > off1 && i2 > off2 && ha1[i1 - 1] == ha2[i2 - 1]; i1--, i2--)
+                ;
+            if (prev1 - i1 > SNAKE_CNT)
+                got_snake = 1;
+            kvdb[d] = i1;
+            if (!odd && fmin <= d && d <= fmax && i1 <= kvdf[d]) {
+                *spl = (struct split){ i1, i2, 1, 1 };
+                return;
+            }
+        }
+
+        if (need_min)
+            continue;
+
+        /* past a point, any long enough snake that got far will do */
+        if (got_snake && ec > HEUR_MIN_COST) {
+            best = 0;
+            for (d = fmax; d >= fmin; d -= 2) {
+                dd = d > fmid ? d - fmid : fmid - d;
+                i1 = kvdf[d];
+                i2 = i1 - d;
+                v = (i1 - off1) + (i2 - off2) - dd;
+
+                if (v > K_HEUR * ec && v > best &&
+                    off1 + SNAKE_CNT <= i1 && i1 < lim1 &&
+                    off2 + SNAKE_CNT <= i2 && i2 < lim2) {
+                    for (k = 1; ha1[i1 - k] == ha2[i2 - k]; k++)
+                        if (k == SNAKE_CNT) {
+                            best = v;
+                            spl->i1 = i1;
+                            spl->i2 = i2;
+                            break;
+                        }
+                }
+            }
+            if (best > 0) {
+                spl->min_lo = 1;
+                spl->min_hi = 0;
+                return;
+            }
+
+            best = 0;
+            for (d = bmax; d >= bmin; d -= 2) {
+                dd = d > bmid ? d - bmid : bmid - d;
+                i1 = kvdb[d];
+                i2 = i1 - d;
+                v = (lim1 - i1) + (lim2 - i2) - dd;
+
+                if (v > K_HEUR * ec && v > best &&
+                    off1 < i1 && i1 <= lim1 - SNAKE_CNT &&
+                    off2 < i2 && i2 <= lim2 - SNAKE_CNT) {
+                    for (k = 0; ha1[i1 + k] == ha2[i2 + k]; k++)
+                        if (k == SNAKE_CNT - 1) {
+                            best = v;
+                            spl->i1 = i1;
+                            spl->i2 = i2;
+                            break;
+                        }
+                }
+            }
+            if (best > 0) {
+                spl->min_lo = 0;
+                spl->min_hi = 1;
+                return;
+            }
+        }
+
+        /* too expensive: split wherever a path got furthest */
+        if (ec >= m->mxcost) {
+            long fbest = -1, fbest1 = -1, bbest = LONG_MAX, bbest1 = LONG_MAX;
+
+            for (d = fmax; d >= fmin; d -= 2) {
+                i1 = kvdf[d] < lim1 ? kvdf[d] : lim1;
+                i2 = i1 - d;
+                if (lim2 < i2) {
+                    i1 = lim2 + d;
+                    i2 = lim2;
+                }
+                if (fbest < i1 + i2) {
+                    fbest = i1 + i2;
+                    fbest1 = i1;
+                }
+            }
+            for (d = bmax; d >= bmin; d -= 2) {
+                i1 = kvdb[d] > off1 ? kvdb[d] : off1;
+                i2 = i1 - d;
+                if (i2 < off2) {
+                    i1 = off2 + d;
+                    i2 = off2;
+                }
+                if (i1 + i2 < bbest) {
+                    bbest = i1 + i2;
+                    bbest1 = i1;
+                }
+            }
+
+            if ((lim1 + lim2) - bbest < fbest - (off1 + off2))
+                *spl = (struct split){ fbest1, fbest - fbest1, 1, 0 };
+            else
+                *spl = (struct split){ bbest1, bbest - bbest1, 0, 1 };
+            return;
+        }
+    }
+}
+
+/*
+ * Diff ha1[0, n1) against ha2[0, n2), marking changed lines through
+ * the index maps back to the files. Ranges are kept on a stack rather
+ * than recursed into: a split can be very lopsided.
+ */
+static int myers_compare(struct myers *m, long n1, long n2, int need_min,
+                         const long *rindex1, char *chg1,
+                         const long *rindex2, char *chg2)
+{
+    struct range_stack st = { NULL, 0, 0 };
+    const uint32_t *ha1 = m->ha1, *ha2 = m->ha2;
+
+    if (range_push(&st, 0, n1, 0, n2, need_min) < 0)
+        return -1;
+
+    while (st.nr) {
+        struct range r = st.items[--st.nr];
+        struct split spl;
+
+        for (; r.off1 < r.lim1 && r.off2 < r.lim2 && ha1[r.off1] == ha2[r.off2];
+             r.off1++, r.off2++)
+            ;
+        for (; r.off1 < r.lim1 && r.off2 < r.lim2 && ha1[r.lim1 - 1] == ha2[r.lim2 - 1];
+             r.lim1--, r.lim2--)
+            ;
+
+        if (r.off1 == r.lim1) {
+            for (; r.off2 < r.lim2; r.off2++)
+                chg2[rindex2[r.off2]] = 1;
+            continue;
+        }
+        if (r.off2 == r.lim2) {
+            for (; r.off1 < r.lim1; r.off1++)
+                chg1[rindex1[r.off1]] = 1;
+            continue;
+        }
+
+        myers_split(m, r.off1, r.lim1, r.off2, r.lim2, r.need_min, &spl);
+        if (range_push(&st, r.off1, spl.i1, r.off2, spl.i2, spl.min_lo) < 0 ||
+            range_push(&st, spl.i1, r.lim1, spl.i2, r.lim2, spl.min_hi) < 0) {
+            free(st.items);
+            return -1;
+        }
+    }
+    free(st.items);
+    return 0;
+}
+
+/*
+ * Is the frequent line [i] among lines discarded anyway, with few
+ * other frequent ones around? Then it is not worth matching.
+ */
+static int clean_mmatch(const char *dis, long i, long s, long e)
+{
+    long r, rdis0, rpdis0, rdis1, rpdis1;
+
+    if (i - s > SIMSCAN_WINDOW)
+        s = i - SIMSCAN_WINDOW;
+    if (e - i > SIMSCAN_WINDOW)
+        e = i + SIMSCAN_WINDOW;
+
+    for (r = 1, rdis0 = 0, rpdis0 = 1; i - r >= s; r++) {
+        if (!dis[i - r])
+            rdis0++;
+        else if (dis[i - r] == 2)
+            rpdis0++;
+        else
+            break;
+    }
+    if (!rdis0)
+        return 0;
+    for (r = 1, rdis1 = 0, rpdis1 = 1; i + r <= e; r++) {
+        if (!dis[i + r])
+            rdis1++;
+        else if (dis[i + r] == 2)
+            rpdis1++;
+        else
+            break;
+    }
+    if (!rdis1)
+        return 0;
+    rdis1 += rdis0;
+    rpdis1 += rpdis0;
+    return rpdis1 * KPDIS_RUN < rpdis1 + rdis1;
+}
+
+/*
+ * Sort the lines of one side, past the common ends, into those to
+ * match and those changed outright: no counterpart at all, or a
+ * frequent one in a run of changed lines.
+ */
+static long discard(const struct diff_file *f, long off, long lim, long doff, long dlim,
+                    const uint32_t *other_count, char *dis, uint32_t *ha, long *rindex)
+{
+    long mlim = bogosqrt(lim - off), i, n = 0;
+
+    if (mlim > MAX_EQLIMIT)
+        mlim = MAX_EQLIMIT;
+    for (i = doff; i < dlim; i++) {
+        uint32_t nm = other_count[f->cls[i]];
+        dis[i - doff] = !nm ? 0 : nm >= mlim ? 2 : 1;
+    }
+    for (i = doff; i < dlim; i++) {
+        char d = dis[i - doff];
+        if (d == 1 || (d == 2 && !clean_mmatch(dis, i - doff, 0, dlim - doff - 1))) {
+            ha[n] = f->cls[i];
+            rindex[n++] = i;
+        } else {
+            f->chg[i] = 1;
+        }
+    }
+    return n;
+}
+
+/* Myers over f[0][off1, lim1) x f[1][off2, lim2), as if they were whole files. */
+static int myers_diff(struct diff_env *env, long off1, long lim1, long off2, long lim2,
+                      int need_min)
+{
+    struct diff_file *a = &env->f[0], *b = &env->f[1];
+    long i, doff1 = off1, dlim1 = lim1, doff2 = off2, dlim2 = lim2;
+    int ret = -1;
+
+    for (; doff1 < dlim1 && doff2 < dlim2 && a->cls[doff1] == b->cls[doff2]; doff1++, doff2++)
+        ;
+    for (; doff1 < dlim1 && doff2 < dlim2 && a->cls[dlim1 - 1] == b->cls[dlim2 - 1];
+         dlim1--, dlim2--)
+        ;
+    long len1 = dlim1 - doff1, len2 = dlim2 - doff2;
+    if (!len1 || !len2) {
+        for (i = doff1; i < dlim1; i++)
+            a->chg[i] = 1;
+        for (i = doff2; i < dlim2; i++)
+            b->chg[i] = 1;
+        return 0;
+    }
+
+    for (i = off1; i < lim1; i++)
+        env->count[0][a->cls[i]]++;
+    for (i = off2; i < lim2; i++)
+        env->count[1][b->cls[i]]++;
+
+    char *dis = malloc(len1 > len2 ? len1 : len2);
+    uint32_t *ha1 = malloc(len1 * sizeof(*ha1)), *ha2 = malloc(len2 * sizeof(*ha2));
+    long *rindex1 = malloc(len1 * sizeof(*rindex1)), *rindex2 = malloc(len2 * sizeof(*rindex2));
+    long *kvd = NULL;
+    if (!dis || !ha1 || !ha2 || !rindex1 || !rindex2)
+        goto out;
+
+    long n1 = discard(a, off1, lim1, doff1, dlim1, env->count[1], dis, ha1, rindex1);
+    long n2 = discard(b, off2, lim2, doff2, dlim2, env->count[0], dis, ha2, rindex2);
+
+    long ndiags = n1 + n2 + 3;
+    kvd = malloc((2 * ndiags + 2) * sizeof(*kvd));
+    if (!kvd)
+        goto out;
+
+    struct myers m = { ha1, ha2, kvd + n2 + 1, kvd + n2 + 1 + ndiags, bogosqrt(ndiags) };
+    if (m.mxcost < MAX_COST_MIN)
+        m.mxcost = MAX_COST_MIN;
+    ret = myers_compare(&m, n1, n2, need_min, rindex1, a->chg, rindex2, b->chg);
+
+out:
+    for (i = off1; i < lim1; i++)
+        env->count[0][a->cls[i]] = 0;
+    for (i = off2; i < lim2; i++)
+        env->count[1][b->cls[i]] = 0;
+    free(dis);
+    free(ha1);
+    free(ha2);
+    free(rindex1);
+    free(rindex2);
+    free(kvd);
+    return ret;
+}
+
+
+/* ---- histogram ---- */
+
+struct lcs {
+    long begin1, end1, begin2, end2;    /* inclusive */
+    int found;
+};
+
+/*
+ * Find the longest run of common lines whose rarest line is as rare as
+ * possible in f[0][off1, lim1). Returns 1 if every common line is too
+ * frequent to anchor on, 0 otherwise ([lcs] then says whether there
+ * was any common line at all).
+ */
+static int find_lcs(struct diff_env *env, long off1, long lim1, long off2, long lim2,
+                    struct lcs *lcs)
+{
+    const uint32_t *c1 = env->f[0].cls, *c2 = env->f[1].cls;
+    uint32_t best_cnt = HISTOGRAM_MAX_CHAIN + 1;
+    int has_common = 0;
+    long ptr, b;
+
+    for (ptr = lim1 - 1; ptr >= off1; ptr--) {
+        uint32_t c = c1[ptr];
+        env->next[ptr] = env->rec_cnt[c] ? env->rec_ptr[c] : -1;
+        env->rec_ptr[c] = ptr;
+        env->rec_cnt[c]++;
+    }
+
+    memset(lcs, 0, sizeof(*lcs));
+    for (b = off2; b < lim2;) {
+        long b_next = b + 1;
+        uint32_t c = c2[b], cnt = env->rec_cnt[c];
+
+        if (cnt)
+            has_common = 1;
+        if (!cnt || cnt > best_cnt) {
+            b = b_next;
+            continue;
+        }
+
+        for (long as = env->rec_ptr[c];;) {
+            long np = env->next[as], ae = as, bs = b, be = b;
+            uint32_t rc = cnt;
+
+            while (off1 < as && off2 < bs && c1[as - 1] == c2[bs - 1]) {
+                as--;
+                bs--;
+                if (rc > 1 && env->rec_cnt[c1[as]] < rc)
+                    rc = env->rec_cnt[c1[as]];
+            }
+            while (ae + 1 < lim1 && be + 1 < lim2 && c1[ae + 1] == c2[be + 1]) {
+                ae++;
+                be++;
+                if (rc > 1 && env->rec_cnt[c1[ae]] < rc)
+                    rc = env->rec_cnt[c1[ae]];
+            }
+
+            if (b_next <= be)
+                b_next = be + 1;
+            if (lcs->end1 - lcs->begin1 < ae - as || rc < best_cnt) {
+                *lcs = (struct lcs){ as, ae, bs, be, 1 };
+                best_cnt = rc;
+            }
+
+            while (np >= 0 && np <= ae)
+                np = env->next[np];
+            if (np < 0)
+                break;
+            as = np;
+        }
+        b = b_next;
+    }
+
+    for (ptr = off1; ptr < lim1; ptr++)
+        env->rec_cnt[c1[ptr]] = 0;
+    return has_common && best_cnt > HISTOGRAM_MAX_CHAIN;
+}
+
+static void mark_range(struct diff_file *f, long off, long lim)
+{
+    for (; off < lim; off++)
+        f->chg[off] = 1;
+}
+
+static int histogram_diff(struct diff_env *env, long off1, long lim1, long off2, long lim2)
+{
+    struct range_stack st = { NULL, 0, 0 };
+    int ret = 0;
+
+    env->rec_ptr = malloc((env->nr_classes + 1) * sizeof(*env->rec_ptr));
+    env->rec_cnt = calloc(env->nr_classes + 1, sizeof(*env->rec_cnt));
+    env->next = malloc((env->f[0].nr + 1) * sizeof(*env->next));
+    if (!env->rec_ptr || !env->rec_cnt || !env->next ||
+        range_push(&st, off1, lim1, off2, lim2, 0) < 0)
+        ret = -1;
+
+    while (!ret && st.nr) {
+        struct range r = st.items[--st.nr];
+        struct lcs lcs;
+
+        /* the part before each anchor is stacked, the part after looped on */
+        for (;;) {
+            if (r.off1 == r.lim1 || r.off2 == r.lim2) {
+                mark_range(&env->f[0], r.off1, r.lim1);
+                mark_range(&env->f[1], r.off2, r.lim2);
+                break;
+            }
+            if (find_lcs(env, r.off1, r.lim1, r.off2, r.lim2, &lcs)) {
+                ret = myers_diff(env, r.off1, r.lim1, r.off2, r.lim2, 0);
+                break;
+            }
+            if (!lcs.found) {
+                mark_range(&env->f[0], r.off1, r.lim1);
+                mark_range(&env->f[1], r.off2, r.lim2);
+                break;
+            }
+            if (range_push(&st, r.off1, lcs.begin1, r.off2, lcs.begin2, 0) < 0) {
+                ret = -1;
+                break;
+            }
+            r.off1 = lcs.end1 + 1;
+            r.off2 = lcs.end2 + 1;
+        }
+    }
+
+    free(st.items);
+    return ret;
+}
+
+
+/* ---- compaction ---- */
+
+/* A run of changed lines, possibly empty, between unchanged ones. */
+struct group {
+    long start, end;
+};
+
+static void group_init(const struct diff_file *f, struct group *g)
+{
+    g->start = g->end = 0;
+    while (f->chg[g->end])
+        g->end++;
+}
+
+static int group_next(const struct diff_file *f, struct group *g)
+{
+    if (g->end == f->nr)
+        return -1;
+    g->start = g->end + 1;
+    for (g->end = g->start; f->chg[g->end]; g->end++)
+        ;
+    return 0;
+}
+
+static int group_previous(const struct diff_file *f, struct group *g)
+{
+    if (g->start == 0)
+        return -1;
+    g->end = g->start - 1;
+    for (g->start = g->end; f->chg[g->start - 1]; g->start--)
+        ;
+    return 0;
+}
+
+/* Move the group one line down if the line after it equals its first. */
+static int group_slide_down(struct diff_file *f, struct group *g)
+{
+    if (g->end < f->nr && f->cls[g->start] == f->cls[g->end]) {
+        f->chg[g->start++] = 0;
+        f->chg[g->end++] = 1;
+        while (f->chg[g->end])
+            g->end++;
+        return 0;
+    }
+    return -1;
+}
+
+static int group_slide_up(struct diff_file *f, struct group *g)
+{
+    if (g->start > 0 && f->cls[g->start - 1] == f->cls[g->end - 1]) {
+        f->chg[--g->start] = 1;
+        f->chg[--g->end] = 0;
+        while (f->chg[g->start - 1])
+            g->start--;
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Slide each group of [f] as far down as it goes, unless somewhere
+ * along the way it lines up with a change in [other]: then stop at the
+ * last such place. Groups that meet merge, and are slid again. The
+ * groups of [other] are walked in step (the k-th unchanged line of one
+ * file is the k-th of the other).
+ */
+static void change_compact(struct diff_file *f, struct diff_file *other)
+{
+    struct group g, go;
+    long earliest_end, end_matching_other, groupsize;
+
+    group_init(f, &g);
+    group_init(other, &go);
+
+    for (;;) {
+        if (g.end != g.start) {
+            do {
+                groupsize = g.end - g.start;
+                end_matching_other = -1;
+
+                while (!group_slide_up(f, &g))
+                    group_previous(other, &go);
+                earliest_end = g.end;
+                if (go.end > go.start)
+                    end_matching_other = g.end;
+
+                while (!group_slide_down(f, &g)) {
+                    group_next(other, &go);
+                    if (go.end > go.start)
+                        end_matching_other = g.end;
+                }
+            } while (groupsize != g.end - g.start);
+
+            if (g.end != earliest_end && end_matching_other != -1) {
+                while (go.end == go.start) {
+                    group_slide_up(f, &g);
+                    group_previous(other, &go);
+                }
+            }
+        }
+
+        if (group_next(f, &g) || group_next(other, &go))
+            break;
+    }
+}
+
+
+/* ---- output ---- */
+
+struct change {
+    long i1, i2;                /* where it starts in each file */
+    long chg1, chg2;            /* lines removed, added */
+};
+
+/* The first change at or after the paired lines i1 and i2. */
+static int next_change(const struct diff_env *env, long i1, long i2, struct change *ch)
+{
+    const struct diff_file *a = &env->f[0], *b = &env->f[1];
+
+    for (;; i1++, i2++) {
+        if (a->chg[i1] || b->chg[i2]) {
+            ch->i1 = i1;
+            ch->i2 = i2;
+            while (a->chg[i1])
+                i1++;
+            while (b->chg[i2])
+                i2++;
+            ch->chg1 = i1 - ch->i1;
+            ch->chg2 = i2 - ch->i2;
+            return 1;
+        }
+        if (i1 >= a->nr || i2 >= b->nr)
+            return 0;
+    }
+}
+
+static int emit_line(const struct line_diff_options *opts, char marker,
+                     const struct diff_file *f, long i)
+{
+    static const char no_eol[] = "\n\\ No newline at end of file\n";
+    const char *line = f->buf + f->start[i];
+    size_t len = f->start[i + 1] - f->start[i];
+    int ret;
+
+    if ((ret = opts->out(&marker, 1, opts->data)) ||
+        (ret = opts->out(line, len, opts->data)))
+        return ret;
+    if (!len || line[len - 1] != '\n')
+        return opts->out(no_eol, sizeof(no_eol) - 1, opts->data);
+    return 0;
+}
+
+/* git's default function line: one starting like an identifier. */
+static int func_line(const struct diff_file *f, long i, char *buf, size_t *len)
+{
+    const char *line = f->buf + f->start[i];
+    size_t n = f->start[i + 1] - f->start[i];
+
+    if (!n || !(isalpha((unsigned char)*line) || *line == '_' || *line == '$'))
+        return 0;
+    if (n > FUNCNAME_MAX)
+        n = FUNCNAME_MAX;
+    while (n && isspace((unsigned char)line[n - 1]))
+        n--;
+    memcpy(buf, line, n);
+    *len = n;
+    return 1;
+}
+
+static int format_range(char *buf, size_t size, long start, long count)
+{
+    if (count == 1)
+        return snprintf(buf, size, "%ld", start + 1);
+    return snprintf(buf, size, "%ld,%ld", count ? start + 1 : start, count);
+}
+
+/* Group the changes into hunks with their context, and print them. */
+static int emit_diff(const struct diff_env *env, const struct line_diff_options *opts,
+                     struct line_diff_stats *stats)
+{
+    const struct diff_file *a = &env->f[0], *b = &env->f[1];
+    long ctx = opts->context < 0 ? 0 : opts->context, func_prev = -1;
+    char func[FUNCNAME_MAX];
+    size_t func_len = 0;
+    struct change first, last, next, ch;
+    int more, ret;
+
+    if (ctx > a->nr + b->nr)
+        ctx = a->nr + b->nr;
+    if (!next_change(env, 0, 0, &first))
+        return 0;
+
+    for (;; first = next) {
+        /* changes closer than twice the context share a hunk */
+        last = first;
+        while ((more = next_change(env, last.i1 + last.chg1, last.i2 + last.chg2, &next)) &&
+               next.i1 - (last.i1 + last.chg1) <= 2 * ctx)
+            last = next;
+
+        long s1 = first.i1 > ctx ? first.i1 - ctx : 0;
+        long s2 = first.i2 > ctx ? first.i2 - ctx : 0;
+        long lctx = ctx;
+        if (lctx > a->nr - (last.i1 + last.chg1))
+            lctx = a->nr - (last.i1 + last.chg1);
+        if (lctx > b->nr - (last.i2 + last.chg2))
+            lctx = b->nr - (last.i2 + last.chg2);
+        long e1 = last.i1 + last.chg1 + lctx, e2 = last.i2 + last.chg2 + lctx;
+
+        stats->hunks++;
+        for (ch = first;; ) {
+            stats->deleted += ch.chg1;
+            stats->added += ch.chg2;
+            if (ch.i1 == last.i1)
+                break;
+            next_change(env, ch.i1 + ch.chg1, ch.i2 + ch.chg2, &ch);
+        }
+        if (!opts->out)
+            goto next_hunk;
+
+        for (long l = s1 - 1; l > func_prev && l >= 0; l--)
+            if (func_line(a, l, func, &func_len))
+                break;
+        func_prev = s1 - 1;
+
+        char hdr[64 + 2 * 24 + FUNCNAME_MAX], r1[48], r2[48];
+        format_range(r1, sizeof(r1), s1, e1 - s1);
+        format_range(r2, sizeof(r2), s2, e2 - s2);
+        int n = snprintf(hdr, sizeof(hdr), "@@ -%s +%s @@%s%.*s\n", r1, r2,
+                         func_len ? " " : "", (int)func_len, func);
+        if ((ret = opts->out(hdr, n, opts->data)))
+            return ret;
+
+        for (; s2 < first.i2; s2++)
+            if ((ret = emit_line(opts, ' ', b, s2)))
+                return ret;
+        for (ch = first;; ) {
+            for (; s2 < ch.i2; s2++)
+                if ((ret = emit_line(opts, ' ', b, s2)))
+                    return ret;
+            for (s1 = ch.i1; s1 < ch.i1 + ch.chg1; s1++)
+                if ((ret = emit_line(opts, '-', a, s1)))
+                    return ret;
+            for (s2 = ch.i2; s2 < ch.i2 + ch.chg2; s2++)
+                if ((ret = emit_line(opts, '+', b, s2)))
+                    return ret;
+            if (ch.i1 == last.i1)
+                break;
+            next_change(env, ch.i1 + ch.chg1, ch.i2 + ch.chg2, &ch);
+        }
+        for (; s2 < e2; s2++)
+            if ((ret = emit_line(opts, ' ', b, s2)))
+                return ret;
+
+    next_hunk:
+        if (!more)
+            return 0;
+    }
+}
+
+/*
+ * Without context the common tail cannot show: drop it, in 1K blocks
+ * and up to a line end, before even splitting lines. git does this too,
+ * and since it changes what xdiff sees, so must we to print the same.
+ */
+static void trim_common_tail(const char *a, size_t *alen, const char *b, size_t *blen)
+{
+    const size_t blk = 1024;
+    size_t smaller = *alen < *blen ? *alen : *blen, trimmed = 0, recovered = 0;
+    const char *ap = a + *alen, *bp = b + *blen;
+
+    while (blk + trimmed <= smaller && !memcmp(ap - blk, bp - blk, blk)) {
+        trimmed += blk;
+        ap -= blk;
+        bp -= blk;
+    }
+    while (recovered < trimmed)
+        if (ap[recovered++] == '\n')
+            break;
+    *alen -= trimmed - recovered;
+    *blen -= trimmed - recovered;
+}
+
+int line_diff(const char *a, size_t alen, const char *b, size_t blen,
+              const struct line_diff_options *opts, struct line_diff_stats *stats)
+{
+    struct diff_env env;
+    struct line_diff_stats dummy;
+    int ret = -1;
+
+    memset(&env, 0, sizeof(env));
+    if (!stats)
+        stats = &dummy;
+    memset(stats, 0, sizeof(*stats));
+
+    if (opts->context <= 0)
+        trim_common_tail(a, &alen, b, &blen);
+    if (file_init(&env.f[0], a, alen) < 0 || file_init(&env.f[1], b, blen) < 0 ||
+        classify(&env) < 0)
+        goto out;
+
+    struct diff_file *f1 = &env.f[0], *f2 = &env.f[1];
+    long off = 0, lim1 = f1->nr, lim2 = f2->nr;
+    while (off < lim1 && off < lim2 && f1->cls[off] == f2->cls[off])
+        off++;
+    while (off < lim1 && off < lim2 && f1->cls[lim1 - 1] == f2->cls[lim2 - 1]) {
+        lim1--;
+        lim2--;
+    }
+
+    if (opts->algorithm == LINE_DIFF_HISTOGRAM)
+        ret = histogram_diff(&env, off, lim1, off, lim2);
+    else
+        ret = myers_diff(&env, 0, f1->nr, 0, f2->nr, opts->algorithm == LINE_DIFF_MINIMAL);
+    if (ret < 0)
+        goto out;
+
+    change_compact(f1, f2);
+    change_compact(f2, f1);
+    ret = emit_diff(&env, opts, stats);
+
+out:
+    if (ret < 0)
+        ERROR("out of memory diffing %zu and %zu bytes", alen, blen);
+    file_clear(&env.f[0]);
+    file_clear(&env.f[1]);
+    free(env.count[0]);
+    free(env.count[1]);
+    free(env.rec_ptr);
+    free(env.rec_cnt);
+    free(env.next);
+    return ret;
+}
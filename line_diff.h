@@ -0,0 +1,64 @@
+#ifndef LINE_DIFF_H
+#define LINE_DIFF_H
+
+#include <stddef.h>
+
+/*
+ * Line-level diff of two buffers, with unified output.
+ *
+ * Both buffers are only read: lines are (offset, length) pairs into
+ * them. A pre-pass hashes every line and gives equal lines the same
+ * small class number, so the algorithms compare integers. The common
+ * prefix and suffix are then set aside, and (for Myers) lines that do
+ * not occur at all on the other side are marked changed up front, as
+ * are runs of very frequent ones among them, as xdiff does.
+ *
+ * Myers finds a shortest edit script in linear space (forward and
+ * backward searches meeting at a middle snake). Past a cost of about
+ * the square root of the input it settles for a good split instead of
+ * the best one, so 1M-line inputs that share little still finish
+ * quickly. Histogram anchors on the least frequent line common to
+ * both sides and recurses around it, falling back to Myers where
+ * every candidate is too common.
+ *
+ * Finally each run of changed lines is slid as far down as equal
+ * lines allow, or to line up with a change on the other side, so
+ * that equivalent scripts print the same way.
+ *
+ * Memory is a few dozen bytes per line: nothing is copied and nothing
+ * grows with the number of differences.
+ */
+enum line_diff_algorithm {
+    LINE_DIFF_MYERS,
+    LINE_DIFF_MINIMAL,          /* Myers without the cost cut-off */
+    LINE_DIFF_HISTOGRAM,
+};
+
+/* Receives the unified diff in pieces; return non-zero to stop. */
+typedef int (*line_diff_out_fn)(const char *buf, size_t len, void *data);
+
+struct line_diff_options {
+    enum line_diff_algorithm algorithm;
+    long context;               /* lines around each change (3 in git) */
+    line_diff_out_fn out;       /* NULL: only count */
+    void *data;
+};
+
+#define LINE_DIFF_OPTIONS_INIT { LINE_DIFF_MYERS, 3, NULL, NULL }
+
+struct line_diff_stats {
+    size_t added, deleted;      /* lines */
+    size_t hunks;
+};
+
+/*
+ * Diff [a] against [b] and write the hunks to opts->out, without file
+ * headers: each "@@ -l,n +l,n @@" line ends with the last line before
+ * the hunk that starts like an identifier, as git's default does.
+ * [stats] may be NULL. Returns 0, the output function's value, or -1 on allocation
+ * failure.
+ */
+int line_diff(const char *a, size_t alen, const char *b, size_t blen,
+              const struct line_diff_options *opts, struct line_diff_stats *stats);
+
+#endif /* LINE_DIFF_H */
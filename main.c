@@ -1,8 +1,43 @@
+#define _GNU_SOURCE     /* nftw */
 
 #include <stdio.h>
 #include "repository.h"
 #include "ram.h"
 #include "compression/compress.h"
+#include "tree.h"
+#include "commit.h"
+#include "tag.h"
+#include "hex.h"
+#include "fsck.h"
+#include "pack.h"
+#include "compat_map.h"
+#include "prio_queue.h"
+#include "revision.h"
+#include "commit_reach.h"
+#include "reachable.h"
+#include "pathspec.h"
+#include "tree_diff.h"
+#include "grep.h"
+#include "line_diff.h"
+#include "diff_rename.h"
+#include "checkout.h"
+#include "index.h"
+#include "status.h"
+#include "hash_object.h"
+#include "refs.h"
+#include "reftable.h"
+#include "thread_pool.h"
+#include "scan.h"
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <errno.h>
+#include <ftw.h>
+#include <utime.h>
+#include <zlib.h>
 // #include "log.h"
 
 int unit_test_empty(void)
@@ -91,13 +126,2993 @@ int test_ram(void){
     return 0;
 }
 
+int unit_test_ram(void)
+{
+    printf("unit_test_ram\n");
+
+    /* enough variables to grow the cells twice past the first 16 */
+    struct RAM *memory = ram_init();
+    struct RAM_VALUE none = { RAM_VALUE_NONE, NULL };
+    char name[16];
+    int ok = memory != NULL;
+
+    for (int i = 0; i < 40 && ok; i++) {
+        snprintf(name, sizeof(name), "v%d", i);
+        ok = ram_write_cell_by_name(memory, none, name);
+    }
+    for (int i = 0; i < 40 && ok; i++) {
+        snprintf(name, sizeof(name), "v%d", i);
+        struct RAM_VALUE *value = ram_read_cell_by_name(memory, name);
+        ok = value && value->value_type == RAM_VALUE_NONE && !value->obj_value;
+        ram_free_value(value);
+    }
+    ok = ok && ram_size(memory) == 40 && ram_capacity(memory) >= 40;
+    ram_destroy(memory);
+    return ok ? 0 : 1;
+}
+
 int unit_test_compression(void)
 {
     return 0;
 }
 
-int main(void)
+int unit_test_tree(void)
+{
+    printf("unit_test_tree\n");
+
+    /* "a-b" (blob), "a" (tree, sorts as "a/"), "b" (blob), SHA-1 width */
+    unsigned char buf[3 * (12 + 20)];
+    size_t len = 0;
+    const char *entries[][2] = { {"100644", "a-b"}, {"40000", "a"}, {"100644", "b"} };
+
+    for (int i = 0; i < 3; i++) {
+        len += sprintf((char *)buf + len, "%s %s", entries[i][0], entries[i][1]) + 1;
+        memset(buf + len, i + 1, 20);
+        len += 20;
+    }
+
+    struct name_entry entry;
+    if (tree_find_entry(buf, len, 20, "a", 1, &entry) != 1 ||
+        entry.mode != 040000 || entry.oid[0] != 2 ||
+        tree_find_entry(buf, len, 20, "a.c", 3, &entry) != 0) {
+        printf("tree_find_entry failed\n");
+        return 1;
+    }
+
+    struct tree_object *tree = parse_tree_buffer((const char *)buf, len, 20, TREE_DESC_STRICT);
+    if (!tree || tree->entry_count != 3) {
+        printf("parse_tree_buffer failed\n");
+        tree_free(tree);
+        return 1;
+    }
+
+    struct tree_object *copy = tree_clone(tree);
+    tree_free(tree);
+    if (!copy) {
+        printf("tree_clone failed\n");
+        return 1;
+    }
+
+    int ok = tree_entry_mode(copy, 1) == 040000 &&
+             tree_entry_type(copy, 1) == OBJ_TREE &&
+             strcmp(tree_entry_name(copy, 2), "b") == 0 &&
+             tree_entry_oid(copy, 2)[19] == 3 &&
+             tree_lookup(copy, "a", 1) == 1 &&
+             tree_lookup(copy, "a-b", 3) == 0 &&
+             tree_lookup(copy, "c", 1) == -1;
+    tree_free(copy);
+
+    if (!ok) {
+        printf("tree accessors returned wrong data\n");
+        return 1;
+    }
+
+    /* each mode string alone in a tree; 0: the tree is rejected */
+    static const struct {
+        const char *str;
+        unsigned mode;
+    } modes[] = {
+        { "100755", 0100755 }, { "120000", 0120000 }, { "160000", 0160000 },
+        { "100664", 0100644 }, { "100775", 0100755 }, { "040000", 0040000 },
+        { "0100644", 0100644 },
+        { "100648", 0 }, { "10064a", 0 }, { "00100644", 0 }, { "130000", 0 }, { "", 0 },
+    };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        len = sprintf((char *)buf, "%s x", modes[i].str) + 1;
+        memset(buf + len, 7, 20);
+        tree = parse_tree_buffer((const char *)buf, len + 20, 20, 0);
+        if (modes[i].mode ? !tree || tree_entry_mode(tree, 0) != modes[i].mode ||
+                            tree_entry_type(tree, 0) != object_type_from_mode(modes[i].mode)
+                          : tree != NULL) {
+            printf("tree mode %s parsed wrong\n", modes[i].str);
+            tree_free(tree);
+            return 1;
+        }
+        tree_free(tree);
+    }
+    if (object_type_from_mode(0160000) != OBJ_COMMIT ||
+        object_type_from_mode(0120000) != OBJ_BLOB) {
+        printf("object_type_from_mode failed\n");
+        return 1;
+    }
+
+    /* two entries: TREE_DESC_STRICT takes them only in increasing order */
+    static const struct {
+        const char *entries[2][2];
+        int ordered;
+    } pairs[] = {
+        { { {"100644", "b"}, {"100644", "b"} }, 0 },        /* duplicate */
+        { { {"100644", "b"}, {"100644", "a"} }, 0 },
+        { { {"40000", "a"}, {"100644", "a-b"} }, 0 },       /* "a/" > "a-b" */
+        { { {"100644", "a-b"}, {"40000", "a"} }, 1 },
+        { { {"100644", "a"}, {"100644", "a-b"} }, 1 },
+    };
+    for (size_t i = 0; i < sizeof(pairs) / sizeof(*pairs); i++) {
+        len = 0;
+        for (int j = 0; j < 2; j++) {
+            len += sprintf((char *)buf + len, "%s %s", pairs[i].entries[j][0],
+                           pairs[i].entries[j][1]) + 1;
+            memset(buf + len, j + 1, 20);
+            len += 20;
+        }
+        struct tree_object *loose = parse_tree_buffer((const char *)buf, len, 20, 0);
+        tree = parse_tree_buffer((const char *)buf, len, 20, TREE_DESC_STRICT);
+        ok = loose && loose->entry_count == 2 && (tree != NULL) == pairs[i].ordered;
+        tree_free(loose);
+        tree_free(tree);
+        if (!ok) {
+            printf("tree order check %zu wrong\n", i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int unit_test_commit(void)
+{
+    printf("unit_test_commit\n");
+
+    const char *buf =
+        "tree 9ffbfbd8cb769ae42b9d7fd66c4750c873fcd02d\n"
+        "parent 67fe210b1866f9fd6a56bf846d46728b0b809ce3\n"
+        "parent c82138c1d5c120d3ff2728ce60a3cbddb7469948\n"
+        "author A U Thor <author@example.com> 1700000000 -0700\n"
+        "committer C O Mitter <committer@example.com> 1700000100 +0100\n"
+        "encoding ISO-8859-1\n"
+        "\n"
+        "Merge branch 'side'\n"
+        "\n"
+        "A longer body.\n";
+
+    struct commit_object commit = {0};
+    if (parse_commit_buffer(&commit, buf, strlen(buf), HASH_SHA1) != 0) {
+        printf("parse_commit_buffer failed\n");
+        return 1;
+    }
+
+    int ok = commit.parent_count == 2 &&
+             strcmp(oid_to_hex(&commit.parents[1]),
+                    "c82138c1d5c120d3ff2728ce60a3cbddb7469948") == 0 &&
+             commit.author.timestamp == 1700000000 && commit.author.tz == -700 &&
+             commit.committer.name.len == 10 &&
+             commit.encoding.len == 10 &&
+             commit.message.len == strlen("Merge branch 'side'\n\nA longer body.\n");
+    free(commit.parents);
+
+    if (!ok) {
+        printf("commit fields parsed incorrectly\n");
+        return 1;
+    }
+    return 0;
+}
+
+int unit_test_hex(void)
+{
+    printf("unit_test_hex\n");
+
+    /* a SHA-256 id exercises the wide path, a SHA-1 id the tail path */
+    const char *ids[] = {
+        "c82138c1d5c120d3ff2728ce60a3cbddb7469948",
+        "0123456789abcdef0123456789abcdeffedcba9876543210ffeeddccbbaa0099",
+    };
+    const hash_algo_t algos[] = { HASH_SHA1, HASH_SHA256 };
+
+    for (int k = SCAN_KERNEL_SCALAR; k <= SCAN_KERNEL_AVX2; k++) {
+        if (hex_force_kernel(k) < 0)
+            continue;
+        for (int i = 0; i < 2; i++) {
+            struct object_id oid;
+            char upper[MAX_HEX_OID_LENGTH + 1], bad[MAX_HEX_OID_LENGTH + 1];
+            size_t len = strlen(ids[i]);
+
+            for (size_t j = 0; j <= len; j++)
+                upper[j] = (char)toupper((unsigned char)ids[i][j]);
+            memcpy(bad, ids[i], len + 1);
+            bad[len - 3] = 'g';
+
+            if (oid_set_hex(&oid, ids[i], len, algos[i]) != 0 ||
+                strcmp(oid_to_hex(&oid), ids[i]) != 0 ||
+                oid_set_hex(&oid, upper, len, algos[i]) != 0 ||
+                strcmp(oid_to_hex(&oid), ids[i]) != 0 ||
+                oid_set_hex(&oid, bad, len, algos[i]) != -1 ||
+                oid_set_hex(&oid, ids[i], len - 2, algos[i]) != -1) {
+                printf("hex conversion failed (%s kernel, id %d)\n",
+                       scan_kernel_name(k), i);
+                return 1;
+            }
+        }
+    }
+    hex_force_kernel(scan_active_kernel());
+    return 0;
+}
+
+int unit_test_hash(void)
+{
+    printf("unit_test_hash\n");
+
+    /* the empty blob, "blob 0\0", fed in two pieces */
+    const char *expect[] = {
+        "e69de29bb2d1d6434b8b29ae775ad8c2e48c5391",
+        "473a0f4c3be8a93681a267e3b1e9a7dcda1185436fe141f7749120a303721813",
+    };
+    const hash_algo_t algos[] = { HASH_SHA1, HASH_SHA256 };
+    struct hash_ctx ctx = HASH_CTX_INIT;
+
+    for (int i = 0; i < 2; i++) {
+        struct object_id oid;
+        if (hash_init(&ctx, algos[i]) != 0 ||
+            hash_update(&ctx, "blob ", 5) != 0 ||
+            hash_update(&ctx, "0", 2) != 0 ||
+            hash_final(&ctx, oid.hash) != 0) {
+            printf("hashing failed\n");
+            hash_ctx_release(&ctx);
+            return 1;
+        }
+        oid.algo = algos[i];
+        if (strcmp(oid_to_hex(&oid), expect[i]) != 0) {
+            printf("wrong digest %s\n", oid_to_hex(&oid));
+            hash_ctx_release(&ctx);
+            return 1;
+        }
+    }
+    hash_ctx_release(&ctx);
+    return 0;
+}
+
+int unit_test_hash_batch(void)
+{
+    printf("unit_test_hash_batch\n");
+
+    /* lengths around the block and padding boundaries, split at odd places */
+    enum { NR = 40 };
+    unsigned char msg[200], got[NR][32], want[32];
+    struct hash_batch_item items[NR];
+    const hash_algo_t algos[] = { HASH_SHA1, HASH_SHA256 };
+    enum hash_batch_kernel saved = hash_batch_active_kernel();
+    struct hash_ctx ctx = HASH_CTX_INIT;
+    int ret = 0;
+
+    for (size_t i = 0; i < sizeof(msg); i++)
+        msg[i] = (unsigned char)(i * 7 + 3);
+
+    for (int k = HASH_BATCH_EVP; k <= HASH_BATCH_AVX512 && !ret; k++) {
+        if (hash_batch_force_kernel(k) < 0)
+            continue;
+        for (int a = 0; a < 2 && !ret; a++) {
+            for (size_t i = 0; i < NR; i++) {
+                size_t total = (size_t)i * 37 % 140 + (i == 1 ? 55 : 0);
+                items[i].prefix = msg;
+                items[i].prefix_len = total < 70 ? total / 3 : 64 + i % 5;
+                items[i].data = msg + items[i].prefix_len;
+                items[i].len = total - items[i].prefix_len;
+                items[i].out = got[i];
+            }
+            if (hash_batch(algos[a], items, NR) != 0) {
+                printf("hash_batch failed with %s\n", hash_batch_kernel_name(k));
+                ret = 1;
+                break;
+            }
+            for (int i = 0; i < NR; i++) {
+                hash_init(&ctx, algos[a]);
+                hash_update(&ctx, msg, items[i].prefix_len + items[i].len);
+                hash_final(&ctx, want);
+                if (memcmp(got[i], want, hash_algo_rawsz(algos[a])) != 0) {
+                    printf("%s: wrong digest for %zu bytes\n",
+                           hash_batch_kernel_name(k), items[i].prefix_len + items[i].len);
+                    ret = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    hash_ctx_release(&ctx);
+    hash_batch_force_kernel(saved);
+    return ret;
+}
+
+int unit_test_scan_memmem(void)
+{
+    printf("unit_test_scan_memmem\n");
+
+    /* needles of every length up to 40, placed across vector boundaries */
+    char hay[300];
+    enum scan_kernel saved = scan_active_kernel();
+    int ret = 0;
+
+    for (size_t i = 0; i < sizeof(hay); i++)
+        hay[i] = "abcab"[i % 5];
+    for (int k = SCAN_KERNEL_SCALAR; k <= SCAN_KERNEL_AVX2 && !ret; k++) {
+        if (scan_force_kernel(k) < 0)
+            continue;
+        for (size_t len = 1; len <= 40 && !ret; len++) {
+            for (size_t at = 0; at + len <= sizeof(hay); at += 7) {
+                char needle[41];
+                memcpy(needle, hay + at, len);
+                needle[len - 1] = 'x';
+                hay[at + len - 1] = 'x';
+                const char *got = scan_memmem(hay, sizeof(hay), needle, len);
+                const char *want = NULL;
+                for (size_t j = 0; !want && j + len <= sizeof(hay); j++)
+                    if (!memcmp(hay + j, needle, len))
+                        want = hay + j;
+                hay[at + len - 1] = "abcab"[(at + len - 1) % 5];
+                if (got != want) {
+                    printf("%s: wrong match for %zu bytes at %zu\n",
+                           scan_kernel_name(k), len, at);
+                    ret = 1;
+                    break;
+                }
+            }
+        }
+        if (scan_memmem(hay, sizeof(hay), "abd", 3) != NULL)
+            ret = 1;
+    }
+
+    scan_force_kernel(saved);
+    return ret;
+}
+
+/* classify_header_line() with one strncmp() per key. */
+static enum header_kind classify_header_slow(const char *line, size_t len, size_t *key_len)
+{
+    static const struct {
+        const char *key;
+        enum header_kind kind;
+    } keys[] = {
+        { "tree ", HEADER_TREE }, { "parent ", HEADER_PARENT },
+        { "author ", HEADER_AUTHOR }, { "committer ", HEADER_COMMITTER },
+        { "encoding ", HEADER_ENCODING }, { "gpgsig ", HEADER_GPGSIG },
+        { "gpgsig-sha256 ", HEADER_GPGSIG },
+    };
+
+    *key_len = 0;
+    if (!len)
+        return HEADER_BLANK;
+    if (line[0] == ' ')
+        return HEADER_CONTINUATION;
+    for (size_t i = 0; i < sizeof(keys) / sizeof(*keys); i++) {
+        size_t n = strlen(keys[i].key);
+        if (len >= n && !strncmp(line, keys[i].key, n)) {
+            *key_len = n;
+            return keys[i].kind;
+        }
+    }
+    return HEADER_OTHER;
+}
+
+int unit_test_scanner(void)
+{
+    printf("unit_test_scanner\n");
+
+    static const char *const lines[] = {
+        "tree 9ffbfbd8", "tree", "tree ", "treex y", "parent 67fe", "parent",
+        "author A <a@b> 1 +0000", "authors x", "committer C <c@d> 2 +0000",
+        "committe x", "committerx", "encoding UTF-8", "encodin x", "gpgsig x",
+        "gpgsig-sha256 x", "gpgsig-sha25 x", "gpgsig-sha256", " continued", "",
+        "mergetag x",
+    };
+    enum scan_kernel saved = scan_active_kernel();
+    unsigned seed = 1;
+    int ok = 1;
+
+    for (int k = SCAN_KERNEL_SCALAR; k <= SCAN_KERNEL_AVX2 && ok; k++) {
+        if (scan_force_kernel(k) < 0)
+            continue;
+
+        /*
+         * Buffers of every length up to three blocks, allocated to size
+         * so that reading past the short tail is caught, with sparse
+         * delimiters, always one on each side of a block boundary, and
+         * bytes with the high bit set.
+         */
+        for (size_t len = 0; len <= 3 * 64 + 1 && ok; len++) {
+            unsigned char *buf = malloc(len ? len : 1);
+            struct byte_scanner scan;
+
+            for (size_t i = 0; i < len; i++) {
+                seed = seed * 1103515245 + 12345;
+                unsigned r = (seed >> 16) % 16;
+                buf[i] = r == 0 ? ' ' : r == 1 ? '\0' : r < 8 ? 0x80 + r : 'a' + r;
+                if (i % 64 == 63 || i % 64 == 0)
+                    buf[i] = i & 1 ? ' ' : '\0';
+            }
+            scanner_init(&scan, buf, len, ' ', '\0');
+            /* forwards, then backwards so that blocks are reloaded */
+            for (size_t n = 0; n < 2 * (len + 1) && ok; n++) {
+                size_t pos = n <= len ? n : 2 * len + 1 - n;
+                for (int which = 0; which < 2 && ok; which++) {
+                    size_t want = pos;
+                    while (want < len && buf[want] != (which ? '\0' : ' '))
+                        want++;
+                    ok = scanner_next(&scan, pos, which) == want;
+                    if (!ok)
+                        printf("%s: scanner wrong at %zu of %zu\n", scan_kernel_name(k),
+                               pos, len);
+                }
+            }
+            free(buf);
+        }
+
+        /* header lines, starting at every offset around a block boundary */
+        for (size_t i = 0; i < sizeof(lines) / sizeof(*lines) && ok; i++) {
+            char buf[160];
+            size_t len = strlen(lines[i]);
+            for (size_t at = 48; at <= 72 && ok; at++) {
+                size_t got_len, want_len;
+                memset(buf, 'z', sizeof(buf));
+                memcpy(buf + at, lines[i], len);
+                ok = classify_header_line(buf + at, len, &got_len) ==
+                     classify_header_slow(buf + at, len, &want_len) && got_len == want_len;
+                if (!ok)
+                    printf("%s: header \"%s\" misclassified\n", scan_kernel_name(k), lines[i]);
+            }
+        }
+
+        /* whole commits whose header lines end on and around block boundaries */
+        for (size_t pad = 0; pad < 80 && ok; pad++) {
+            char buf[512];
+            int len = snprintf(buf, sizeof(buf),
+                               "tree 9ffbfbd8cb769ae42b9d7fd66c4750c873fcd02d\n"
+                               "author %.*s <a@example.com> 1700000000 +0000\n"
+                               "committer C <c@example.com> 1700000100 +0000\n"
+                               "\nmessage\n", (int)pad + 1,
+                               "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA");
+            struct commit_object commit = {0};
+            ok = parse_commit_buffer(&commit, buf, len, HASH_SHA1) == 0 &&
+                 commit.author.name.len == pad + 1 && commit.committer.timestamp == 1700000100 &&
+                 commit.message.len == 8;
+            free(commit.parents);
+            if (!ok)
+                printf("%s: commit with a %zu byte author misparsed\n",
+                       scan_kernel_name(k), pad + 1);
+        }
+    }
+
+    scan_force_kernel(saved);
+    return ok ? 0 : 1;
+}
+
+int unit_test_compat_map(void)
+{
+    printf("unit_test_compat_map\n");
+
+    char dir[] = "/tmp/nurepo-compat-XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("mkdtemp failed\n");
+        return 1;
+    }
+
+    char path[128];
+    snprintf(path, sizeof(path), "%s/objects", dir);
+    mkdir(path, 0777);
+
+    struct repository repo = {0};
+    repo.gitdir = dir;
+    repo.hash_algo = HASH_SHA1;
+
+    /* pairs whose order differs between the two sides */
+    enum { NR = 50 };
+    unsigned char raw[32];
+    struct object_id a[NR], b[NR], out;
+    int ret = 0;
+
+    for (int i = 0; i < NR; i++) {
+        for (int j = 0; j < 32; j++)
+            raw[j] = (unsigned char)(i * 41 + j * 3);
+        oid_set_raw(&a[i], raw, HASH_SHA1);
+        for (int j = 0; j < 32; j++)
+            raw[j] = (unsigned char)(255 - i * 13 - j);
+        oid_set_raw(&b[i], raw, HASH_SHA256);
+    }
+
+    /* half in the file, half still in memory */
+    for (int i = 0; i < NR && !ret; i++) {
+        if (compat_map_add(&repo, &a[i], &b[i]) != 0 ||
+            (i == NR / 2 && compat_map_write(&repo) != 0))
+            ret = 1;
+    }
+    for (int pass = 0; pass < 2 && !ret; pass++) {
+        for (int i = 0; i < NR; i++) {
+            if (repo_oid_to_algop(&repo, &a[i], HASH_SHA256, &out) != 0 || !oideq(&out, &b[i]) ||
+                repo_oid_to_algop(&repo, &b[i], HASH_SHA1, &out) != 0 || !oideq(&out, &a[i])) {
+                printf("wrong translation of pair %d (pass %d)\n", i, pass);
+                ret = 1;
+                break;
+            }
+        }
+        /* the second pass reads everything back from a fresh load */
+        if (!ret && pass == 0 && compat_map_write(&repo) != 0)
+            ret = 1;
+        compat_map_free(repo.compat_map);
+        repo.compat_map = NULL;
+    }
+
+    /* an unknown id has no translation */
+    memset(raw, 0x5a, sizeof(raw));
+    oid_set_raw(&out, raw, HASH_SHA1);
+    if (!ret && repo_oid_to_algop(&repo, &out, HASH_SHA256, &out) == 0)
+        ret = 1;
+    compat_map_free(repo.compat_map);
+
+    snprintf(path, sizeof(path), "%s/objects/info/compat-map", dir);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/objects/info", dir);
+    rmdir(path);
+    snprintf(path, sizeof(path), "%s/objects", dir);
+    rmdir(path);
+    rmdir(dir);
+    return ret;
+}
+
+/* ---- test repositories ---- */
+
+/* Write [content] to <dir>/<name>. */
+static int write_test_file(const char *dir, const char *name, const char *content)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+    fputs(content, f);
+    return fclose(f);
+}
+
+/* Store [len] bytes of [body] as a loose object of [type]; its id goes to [oid]. */
+static int write_test_object(struct repository *repo, enum object_type type,
+                             const void *body, size_t len, struct object_id *oid)
+{
+    unsigned char raw[SHA_DIGEST_LENGTH];
+    char *buf = malloc(len + 32);
+    int hdr;
+
+    if (!buf)
+        return -1;
+    hdr = sprintf(buf, "%s %zu", type_name(type), len) + 1;
+    memcpy(buf + hdr, body, len);
+    generate_sha1(buf, hdr + len, raw);
+    free(buf);
+    oid_set_raw(oid, raw, HASH_SHA1);
+    return repo_write_loose_object(repo, oid, type, body, len);
+}
+
+/* A commit of [tree] with [nr] [parents], committed at [date]. */
+static int write_test_commit(struct repository *repo, const struct object_id *tree,
+                             const struct object_id *parents, size_t nr,
+                             long date, const char *msg, struct object_id *oid)
+{
+    char buf[1024], hex[MAX_HEX_OID_LENGTH + 1];
+    size_t len = sprintf(buf, "tree %s\n", oid_to_hex_r(hex, tree));
+
+    for (size_t i = 0; i < nr && len < sizeof(buf) - 200; i++)
+        len += sprintf(buf + len, "parent %s\n", oid_to_hex_r(hex, &parents[i]));
+    len += snprintf(buf + len, sizeof(buf) - len,
+                    "author A <a@example.com> %ld +0000\n"
+                    "committer C <c@example.com> %ld +0000\n\n%s\n", date, date, msg);
+    return write_test_object(repo, OBJ_COMMIT, buf, len, oid);
+}
+
+struct test_tree_entry {
+    const char *mode, *name;
+    const struct object_id *oid;
+};
+
+/* A tree of [nr] [entries], which must be in tree order. */
+static int write_test_tree(struct repository *repo, const struct test_tree_entry *entries,
+                           size_t nr, struct object_id *oid)
+{
+    char buf[4096];
+    size_t len = 0;
+
+    size_t rawsz = hash_algo_rawsz(repo->hash_algo);
+
+    for (size_t i = 0; i < nr; i++) {
+        if (len + strlen(entries[i].mode) + strlen(entries[i].name) + 2 + rawsz > sizeof(buf))
+            return -1;
+        len += sprintf(buf + len, "%s %s", entries[i].mode, entries[i].name) + 1;
+        memcpy(buf + len, entries[i].oid->hash, rawsz);
+        len += rawsz;
+    }
+    return write_test_object(repo, OBJ_TREE, buf, len, oid);
+}
+
+static void put_test_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/*
+ * Store the blobs [bodies] undeltified in [dir]/objects/pack/pack-test.pack
+ * with its version 2 index, and their ids in [oids]. The repository
+ * sees the pack once it is reopened.
+ */
+static int write_test_pack(const char *dir, const char *const *bodies, size_t nr,
+                           struct object_id *oids)
+{
+    size_t cap = 12 + SHA_DIGEST_LENGTH, len = 12, idx_len = 0;
+    uint32_t *offsets = calloc(nr + 1, sizeof(*offsets));
+    uint32_t *crcs = calloc(nr + 1, sizeof(*crcs));
+    size_t *order = calloc(nr + 1, sizeof(*order));
+    unsigned char *pack = NULL, *idx = NULL;
+    char path[256];
+    int ret = -1;
+
+    for (size_t i = 0; i < nr; i++)
+        cap += compressBound(strlen(bodies[i])) + 16;
+    pack = malloc(cap);
+    idx = malloc(8 + 256 * 4 + nr * (SHA_DIGEST_LENGTH + 8) + 2 * SHA_DIGEST_LENGTH);
+    if (!offsets || !crcs || !order || !pack || !idx)
+        goto out;
+
+    memcpy(pack, "PACK", 4);
+    put_test_be32(pack + 4, 2);
+    put_test_be32(pack + 8, nr);
+    for (size_t i = 0; i < nr; i++) {
+        size_t n = strlen(bodies[i]), rest = n >> 4;
+        unsigned char c = (OBJ_BLOB << 4) | (n & 15);
+        char hdr[32];
+        int hdr_len = sprintf(hdr, "blob %zu", n) + 1;
+        unsigned char *buf = malloc(hdr_len + n);
+        unsigned char raw[SHA_DIGEST_LENGTH];
+
+        if (!buf)
+            goto out;
+        memcpy(buf, hdr, hdr_len);
+        memcpy(buf + hdr_len, bodies[i], n);
+        generate_sha1(buf, hdr_len + n, raw);
+        free(buf);
+        oid_set_raw(&oids[i], raw, HASH_SHA1);
+
+        offsets[i] = len;
+        while (rest) {
+            pack[len++] = c | 0x80;
+            c = rest & 0x7f;
+            rest >>= 7;
+        }
+        pack[len++] = c;
+        uLongf zlen = cap - len;
+        if (compress2(pack + len, &zlen, (const Bytef *)bodies[i], n, Z_DEFAULT_COMPRESSION) != Z_OK)
+            goto out;
+        len += zlen;
+        crcs[i] = crc32(0, pack + offsets[i], len - offsets[i]);
+
+        /* the index lists the objects by id */
+        size_t j = i;
+        for (; j > 0 && memcmp(oids[order[j - 1]].hash, raw, SHA_DIGEST_LENGTH) > 0; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+    generate_sha1(pack, len, pack + len);
+    len += SHA_DIGEST_LENGTH;
+
+    memcpy(idx, "\377tOc", 4);
+    put_test_be32(idx + 4, 2);
+    for (int b = 0; b < 256; b++) {
+        uint32_t count = 0;
+        for (size_t i = 0; i < nr; i++)
+            count += oids[i].hash[0] <= b;
+        put_test_be32(idx + 8 + 4 * b, count);
+    }
+    idx_len = 8 + 256 * 4;
+    for (size_t i = 0; i < nr; i++, idx_len += SHA_DIGEST_LENGTH)
+        memcpy(idx + idx_len, oids[order[i]].hash, SHA_DIGEST_LENGTH);
+    for (size_t i = 0; i < nr; i++, idx_len += 4)
+        put_test_be32(idx + idx_len, crcs[order[i]]);
+    for (size_t i = 0; i < nr; i++, idx_len += 4)
+        put_test_be32(idx + idx_len, offsets[order[i]]);
+    memcpy(idx + idx_len, pack + len - SHA_DIGEST_LENGTH, SHA_DIGEST_LENGTH);
+    idx_len += SHA_DIGEST_LENGTH;
+    generate_sha1(idx, idx_len, idx + idx_len);
+    idx_len += SHA_DIGEST_LENGTH;
+
+    snprintf(path, sizeof(path), "%s/objects/pack", dir);
+    if (mkdir(path, 0755) < 0 && errno != EEXIST)
+        goto out;
+    snprintf(path, sizeof(path), "%s/objects/pack/pack-test.pack", dir);
+    FILE *f = fopen(path, "wb");
+    ret = f && fwrite(pack, 1, len, f) == len ? 0 : -1;
+    if (f && fclose(f))
+        ret = -1;
+    snprintf(path, sizeof(path), "%s/objects/pack/pack-test.idx", dir);
+    f = ret ? NULL : fopen(path, "wb");
+    ret = f && fwrite(idx, 1, idx_len, f) == idx_len ? 0 : -1;
+    if (f && fclose(f))
+        ret = -1;
+out:
+    free(offsets);
+    free(crcs);
+    free(order);
+    free(pack);
+    free(idx);
+    return ret;
+}
+
+/* Create [dir] as an empty SHA-1 repository (HEAD on main) and open it. */
+static int make_test_repo(const char *dir, struct repository *repo)
+{
+    const char *subdirs[] = { "", "/objects", "/refs", "/refs/heads", "/refs/tags" };
+    char path[256];
+
+    for (size_t i = 0; i < sizeof(subdirs) / sizeof(*subdirs); i++) {
+        snprintf(path, sizeof(path), "%s%s", dir, subdirs[i]);
+        if (mkdir(path, 0755) < 0 && errno != EEXIST)
+            return -1;
+    }
+    if (write_test_file(dir, "HEAD", "ref: refs/heads/main\n") < 0 ||
+        write_test_file(dir, "config", "[core]\n\trepositoryformatversion = 0\n") < 0)
+        return -1;
+    return repo_open(repo, dir);
+}
+
+static int remove_test_entry(const char *path, const struct stat *st, int flag,
+                             struct FTW *ftw)
+{
+    return remove(path) < 0 ? -1 : 0;
+}
+
+/* rm -r [dir]. */
+static int remove_test_dir(const char *dir)
+{
+    return nftw(dir, remove_test_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static int compare_ints(const void *a, const void *b, void *cb_data)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+int unit_test_prio_queue(void)
+{
+    printf("unit_test_prio_queue\n");
+
+    /* largest first, and equal keys in insertion order */
+    int values[] = { 5, 1, 9, 3, 9, 7, 1, 5, 0, 8 };
+    enum { NR = sizeof(values) / sizeof(values[0]) };
+    struct prio_queue queue = PRIO_QUEUE_INIT(compare_ints, NULL);
+    int *prev = NULL, ret = 0;
+
+    for (int i = 0; i < NR; i++)
+        prio_queue_put(&queue, &values[i]);
+    for (int i = 0; i < NR; i++) {
+        int *v = prio_queue_get(&queue);
+        if (!v || (prev && (*v > *prev || (*v == *prev && v < prev)))) {
+            ret = 1;
+            break;
+        }
+        prev = v;
+    }
+    if (prio_queue_get(&queue) != NULL)
+        ret = 1;
+    prio_queue_clear(&queue);
+    return ret;
+}
+
+/*
+ * A random history of REACH_TEST_COMMITS commits for the reachability
+ * tests: commit i has parents among the commits before it (and i == 5
+ * starts a second root). [dates] picks their committer dates: all
+ * equal, a handful of values, or parents newer than their children.
+ */
+#define REACH_TEST_COMMITS 24
+
+struct reach_test {
+    struct object_id oids[REACH_TEST_COMMITS];
+    uint64_t reach[REACH_TEST_COMMITS];     /* ancestors, itself included */
+    int first_parent[REACH_TEST_COMMITS];   /* -1 for a root */
+    struct rev_commit *commits[REACH_TEST_COMMITS];
+};
+
+static int make_reach_test(struct repository *repo, const struct object_id *tree,
+                           int dates, unsigned seed, struct reach_test *t)
+{
+    for (int i = 0; i < REACH_TEST_COMMITS; i++) {
+        struct object_id parents[2];
+        size_t nr = 0;
+        char msg[64];
+        long date = dates == 0 ? 1700000000 :
+                    dates == 1 ? 1700000000 + (long)(seed % 3) :
+                    1700000000 - i;
+
+        t->reach[i] = UINT64_C(1) << i;
+        t->first_parent[i] = -1;
+        seed = seed * 1103515245 + 12345;
+        if (i && i != 5) {
+            int p = i - 1 - (int)((seed >> 8) % (i < 4 ? i : 4));
+            parents[nr++] = t->oids[p];
+            t->first_parent[i] = p;
+            t->reach[i] |= t->reach[p];
+            seed = seed * 1103515245 + 12345;
+            int q = (int)((seed >> 8) % i);
+            if ((seed >> 20) % 3 == 0 && q != p) {
+                parents[nr++] = t->oids[q];
+                t->reach[i] |= t->reach[q];
+            }
+        }
+        snprintf(msg, sizeof(msg), "commit %d of history %d", i, dates);
+        if (write_test_commit(repo, tree, parents, nr, date, msg, &t->oids[i]) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int reach_test_index(const struct reach_test *t, const struct rev_commit *c)
+{
+    for (int i = 0; i < REACH_TEST_COMMITS; i++)
+        if (t->commits[i] == c)
+            return i;
+    return -1;
+}
+
+/* Check is_ancestor() and merge_bases() on every pair of commits of [t]. */
+static int check_merge_bases(struct rev_walk *walk, struct reach_test *t)
+{
+    enum { N = REACH_TEST_COMMITS };
+    int ok = 1;
+
+    for (int a = 0; a < N && ok; a++) {
+        for (int b = 0; b < N && ok; b++) {
+            uint64_t common = t->reach[a] & t->reach[b], want = 0, got = 0;
+            struct rev_commit **bases;
+            long nr;
+
+            ok = is_ancestor(walk, t->commits[a], t->commits[b]) ==
+                 (int)((t->reach[b] >> a) & 1);
+
+            /* the common ancestors no other common ancestor reaches */
+            for (int c = 0; c < N; c++) {
+                int redundant = 0;
+                for (int d = 0; d < N; d++)
+                    redundant |= d != c && ((common >> d) & 1) && ((t->reach[d] >> c) & 1);
+                if (((common >> c) & 1) && !redundant)
+                    want |= UINT64_C(1) << c;
+            }
+            nr = ok ? merge_bases(walk, t->commits[a], &t->commits[b], 1, &bases) : -1;
+            for (long j = 0; j < nr; j++)
+                got |= UINT64_C(1) << reach_test_index(t, bases[j]);
+            ok = ok && nr == __builtin_popcountll(want) && got == want;
+            if (nr >= 0)
+                free(bases);
+        }
+    }
+    return ok ? 0 : -1;
+}
+
+/* Check ahead_behind() of every commit of [t] against every other one. */
+static int check_ahead_behind(struct rev_walk *walk, struct reach_test *t)
+{
+    enum { N = REACH_TEST_COMMITS };
+    struct ahead_behind counts[N];
+    int ok = 1;
+
+    for (int b = 0; b < N && ok; b++) {
+        /* all commits as tips in one walk */
+        ok = ahead_behind(walk, t->commits[b], t->commits, N, counts) == 0;
+        for (int i = 0; i < N && ok; i++)
+            ok = counts[i].ahead == (size_t)__builtin_popcountll(t->reach[i] & ~t->reach[b]) &&
+                 counts[i].behind == (size_t)__builtin_popcountll(t->reach[b] & ~t->reach[i]);
+
+        /* and one at a time, where the walk ends much sooner */
+        for (int i = 0; i < N && ok; i++)
+            ok = ahead_behind(walk, t->commits[b], &t->commits[i], 1, counts) == 0 &&
+                 counts[0].ahead == (size_t)__builtin_popcountll(t->reach[i] & ~t->reach[b]) &&
+                 counts[0].behind == (size_t)__builtin_popcountll(t->reach[b] & ~t->reach[i]);
+    }
+    return ok ? 0 : -1;
+}
+
+int unit_test_commit_reach(void)
+{
+    printf("unit_test_commit_reach\n");
+
+    struct repository repo;
+    struct object_id tree;
+    struct reach_test t;
+    char dir[64];
+    int ok;
+
+    /* no commit graph: the walks go by date, which [dates] skews */
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_commit_reach.%d", (int)getpid());
+    ok = make_test_repo(dir, &repo) == 0 &&
+         write_test_object(&repo, OBJ_TREE, "", 0, &tree) == 0;
+    for (int dates = 0; dates < 3 && ok; dates++) {
+        struct rev_walk walk;
+
+        ok = make_reach_test(&repo, &tree, dates, 7 + dates, &t) == 0;
+        rev_walk_init(&walk, &repo);
+        ok = ok && walk.graph == NULL;
+        for (int i = 0; i < REACH_TEST_COMMITS && ok; i++)
+            ok = (t.commits[i] = rev_walk_lookup(&walk, &t.oids[i])) != NULL;
+        /* by date first; ahead_behind() then numbers the generations */
+        ok = ok && check_merge_bases(&walk, &t) == 0 && check_ahead_behind(&walk, &t) == 0 &&
+             check_merge_bases(&walk, &t) == 0;
+        if (!ok)
+            printf("reachability queries wrong on history %d\n", dates);
+        rev_walk_release(&walk);
+    }
+    repo_clear(&repo);
+    remove_test_dir(dir);
+    return ok ? 0 : 1;
+}
+
+/*
+ * Walk [t] from [specs] and check that the commits of [want] come out,
+ * each of them once, and for the topological orders never after one of
+ * their parents.
+ */
+static int check_rev_walk(struct repository *repo, const struct reach_test *t,
+                          enum rev_sort sort, int first_parent,
+                          const char **specs, size_t nr, uint64_t want)
+{
+    struct rev_walk walk;
+    struct rev_commit *c;
+    uint64_t shown = 0;
+    int ok = 1;
+
+    rev_walk_init(&walk, repo);
+    walk.sort = sort;
+    walk.first_parent = first_parent;
+    for (size_t i = 0; i < nr && ok; i++)
+        ok = rev_walk_add_spec(&walk, specs[i]) == 0;
+    while (ok && (c = rev_walk_next(&walk))) {
+        int topo = sort == REV_SORT_TOPO || sort == REV_SORT_TOPO_DATE, i = 0;
+        size_t followed = first_parent && c->nr_parents ? 1 : c->nr_parents;
+
+        while (i < REACH_TEST_COMMITS && !oideq(&t->oids[i], &c->oid))
+            i++;
+        ok = i < REACH_TEST_COMMITS && !((shown >> i) & 1);
+        for (int k = 0; ok && topo && k < REACH_TEST_COMMITS; k++) {
+            for (size_t j = 0; j < followed; j++)
+                ok = ok && !(((shown >> k) & 1) && oideq(&t->oids[k], &c->parents[j]->oid));
+        }
+        if (ok)
+            shown |= UINT64_C(1) << i;
+    }
+    rev_walk_release(&walk);
+    return ok && shown == want ? 0 : -1;
+}
+
+/* Commits of [t] on the first-parent chain of commit [i]. */
+static uint64_t first_parent_chain(const struct reach_test *t, int i)
+{
+    uint64_t chain = 0;
+    for (; i >= 0; i = t->first_parent[i])
+        chain |= UINT64_C(1) << i;
+    return chain;
+}
+
+int unit_test_rev_walk(void)
+{
+    printf("unit_test_rev_walk\n");
+
+    /* R <- A1 <- A2 <- M -> B2 -> B1 -> R, with skewed dates */
+    static const int parents_of[6][2] = {
+        { -1, -1 }, { 0, -1 }, { 1, -1 }, { 0, -1 }, { 3, -1 }, { 2, 4 },
+    };
+    static const long dates[] = { 100, 10, 45, 20, 40, 50 };
+    static const struct {
+        enum rev_sort sort;
+        int order[6];
+    } orders[] = {
+        { REV_SORT_DATE, { 5, 2, 4, 3, 0, 1 } },       /* R before A1 */
+        { REV_SORT_TOPO_DATE, { 5, 2, 4, 3, 1, 0 } },
+        { REV_SORT_TOPO, { 5, 4, 3, 2, 1, 0 } },        /* one side at a time */
+    };
+    struct repository repo;
+    struct object_id tree, oids[6];
+    struct reach_test t;
+    char dir[64], hex[2][MAX_HEX_OID_LENGTH + 1], range[2 * MAX_HEX_OID_LENGTH + 3];
+    int ok;
+
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_rev_walk.%d", (int)getpid());
+    ok = make_test_repo(dir, &repo) == 0 &&
+         write_test_object(&repo, OBJ_TREE, "", 0, &tree) == 0;
+    for (int i = 0; i < 6 && ok; i++) {
+        struct object_id parents[2];
+        size_t nr = 0;
+        while (nr < 2 && parents_of[i][nr] >= 0) {
+            parents[nr] = oids[parents_of[i][nr]];
+            nr++;
+        }
+        ok = write_test_commit(&repo, &tree, parents, nr, dates[i], "ordered", &oids[i]) == 0;
+    }
+    for (size_t n = 0; n < sizeof(orders) / sizeof(*orders) && ok; n++) {
+        struct rev_walk walk;
+        struct rev_commit *c;
+
+        rev_walk_init(&walk, &repo);
+        walk.sort = orders[n].sort;
+        ok = rev_walk_add(&walk, &oids[5], 0) == 0;
+        for (int i = 0; i < 6 && ok; i++)
+            ok = (c = rev_walk_next(&walk)) && oideq(&c->oid, &oids[orders[n].order[i]]);
+        ok = ok && !rev_walk_next(&walk);
+        if (!ok)
+            printf("walk order %d wrong\n", (int)orders[n].sort);
+        rev_walk_release(&walk);
+    }
+
+    /* every order, with "^a b" and "a..b" exclusions and --first-parent */
+    ok = ok && make_reach_test(&repo, &tree, 2, 11, &t) == 0;
+    for (int sort = REV_SORT_DATE; sort <= REV_SORT_TOPO_DATE && ok; sort++) {
+        for (int a = -1; a < REACH_TEST_COMMITS && ok; a++) {
+            for (int b = 0; b < REACH_TEST_COMMITS && ok; b++) {
+                uint64_t excluded = a < 0 ? 0 : t.reach[a];
+                char exclude[MAX_HEX_OID_LENGTH + 2];
+                const char *specs[2] = { hex[1], exclude };
+                size_t nr = a < 0 ? 1 : 2;
+
+                oid_to_hex_r(hex[1], &t.oids[b]);
+                if (a >= 0) {
+                    oid_to_hex_r(hex[0], &t.oids[a]);
+                    snprintf(exclude, sizeof(exclude), "^%s", hex[0]);
+                    snprintf(range, sizeof(range), "%s..%s", hex[0], hex[1]);
+                }
+                ok = check_rev_walk(&repo, &t, sort, 0, specs, nr,
+                                    t.reach[b] & ~excluded) == 0 &&
+                     check_rev_walk(&repo, &t, sort, 1, specs, nr,
+                                    first_parent_chain(&t, b) & ~excluded) == 0;
+                if (ok && a >= 0) {
+                    specs[0] = range;
+                    ok = check_rev_walk(&repo, &t, sort, 0, specs, 1,
+                                        t.reach[b] & ~excluded) == 0;
+                }
+                if (!ok)
+                    printf("walk %d..%d wrong in order %d\n", a, b, sort);
+            }
+        }
+    }
+    repo_clear(&repo);
+    remove_test_dir(dir);
+    return ok ? 0 : 1;
+}
+
+struct reachable_test {
+    struct object_id oids[32];
+    size_t nr;
+};
+
+static int collect_reachable(const struct reachable_object *obj, void *data)
+{
+    struct reachable_test *t = data;
+    if (t->nr == sizeof(t->oids) / sizeof(*t->oids))
+        return -1;
+    t->oids[t->nr++] = obj->oid;
+    return 0;
+}
+
+/*
+ * Enumerate from [tip], less what [exclude] reaches if not NULL, and
+ * check that exactly the [nr] objects of [want] come out, once each.
+ */
+static int check_reachable(struct repository *repo, const struct object_id *tip,
+                           const struct object_id *exclude, struct reachable_options *opts,
+                           const struct object_id *const *want, size_t nr)
+{
+    struct reachable_test got = { .nr = 0 };
+    struct rev_walk walk;
+    int ok;
+
+    opts->fn = collect_reachable;
+    opts->data = &got;
+    rev_walk_init(&walk, repo);
+    ok = rev_walk_add(&walk, tip, 0) == 0 &&
+         (!exclude || rev_walk_add(&walk, exclude, 1) == 0) &&
+         enumerate_reachable(&walk, opts) == 0 && got.nr == nr;
+    rev_walk_release(&walk);
+    for (size_t i = 0; i < nr && ok; i++) {
+        size_t found = 0;
+        for (size_t j = 0; j < got.nr; j++)
+            found += oideq(want[i], &got.oids[j]);
+        ok = found == 1;
+    }
+    return ok ? 0 : -1;
+}
+
+int unit_test_reachable(void)
+{
+    printf("unit_test_reachable\n");
+
+    /*
+     * c1: f (small), sub/{big, small}
+     * c2: f (mid), mod (gitlink), sub as in c1
+     * c3: f (mid), sub2/{new, small}
+     */
+    struct object_id small, mid, big, fresh, mod, sub, sub2, t1, t2, t3, c1, c2, c3;
+    struct repository repo;
+    char dir[64], data[100];
+    int ok;
+
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_reachable.%d", (int)getpid());
+    memset(data, 'x', sizeof(data));
+    memset(&mod, 0x42, sizeof(mod));
+    ok = make_test_repo(dir, &repo) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "s\n", 2, &small) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, data, 10, &mid) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, data, 100, &big) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "new\n", 4, &fresh) == 0;
+    mod.algo = small.algo;
+    if (ok) {
+        const struct test_tree_entry sub_entries[] = {
+            { "100644", "big", &big }, { "100644", "small", &small },
+        };
+        const struct test_tree_entry sub2_entries[] = {
+            { "100644", "new", &fresh }, { "100644", "small", &small },
+        };
+        const struct test_tree_entry e1[] = {
+            { "100644", "f", &small }, { "40000", "sub", &sub },
+        };
+        const struct test_tree_entry e2[] = {
+            { "100644", "f", &mid }, { "160000", "mod", &mod }, { "40000", "sub", &sub },
+        };
+        const struct test_tree_entry e3[] = {
+            { "100644", "f", &mid }, { "40000", "sub2", &sub2 },
+        };
+        ok = write_test_tree(&repo, sub_entries, 2, &sub) == 0 &&
+             write_test_tree(&repo, sub2_entries, 2, &sub2) == 0 &&
+             write_test_tree(&repo, e1, 2, &t1) == 0 &&
+             write_test_tree(&repo, e2, 3, &t2) == 0 &&
+             write_test_tree(&repo, e3, 2, &t3) == 0 &&
+             write_test_commit(&repo, &t1, NULL, 0, 1700000000, "c1", &c1) == 0 &&
+             write_test_commit(&repo, &t2, &c1, 1, 1700000001, "c2", &c2) == 0 &&
+             write_test_commit(&repo, &t3, &c2, 1, 1700000002, "c3", &c3) == 0;
+    }
+
+    const struct object_id *const all[] = {
+        &c3, &c2, &c1, &t3, &t2, &t1, &sub, &sub2, &small, &mid, &big, &fresh,
+    };
+    const struct object_id *const since_c1[] = { &c3, &c2, &t3, &t2, &sub2, &mid, &fresh };
+    const struct object_id *const small_blobs[] = {
+        &c3, &c2, &c1, &t3, &t2, &t1, &sub, &sub2, &small, &fresh,
+    };
+    const struct object_id *const trees[] = { &t3, &t2, &t1, &sub, &sub2 };
+    const struct object_id *const no_blobs[] = { &c3, &c2, &c1, &t3, &t2, &t1, &sub, &sub2 };
+
+    /* one thread and several must give the same objects */
+    for (int threads = 1; threads <= 4 && ok; threads += 3) {
+        struct reachable_options opts = REACHABLE_OPTIONS_INIT;
+        opts.nr_threads = threads;
+        ok = check_reachable(&repo, &c3, NULL, &opts, all, 12) == 0 &&
+             check_reachable(&repo, &c3, &c1, &opts, since_c1, 7) == 0;
+        opts.blob_limit = 10;       /* blob:limit=10, so not mid */
+        ok = ok && check_reachable(&repo, &c3, NULL, &opts, small_blobs, 10) == 0;
+        opts.blob_limit = -1;
+        opts.types = REACHABLE_TYPE(OBJ_TREE);
+        ok = ok && check_reachable(&repo, &c3, NULL, &opts, trees, 5) == 0;
+        opts.types = ~REACHABLE_TYPE(OBJ_BLOB);
+        ok = ok && check_reachable(&repo, &c3, NULL, &opts, no_blobs, 8) == 0;
+        if (!ok)
+            printf("enumerate_reachable wrong with %d threads\n", threads);
+    }
+    repo_clear(&repo);
+    remove_test_dir(dir);
+    return ok ? 0 : 1;
+}
+
+int unit_test_pathspec(void)
+{
+    printf("unit_test_pathspec\n");
+
+    const char *paths[] = { "src/lib/", "docs/*.md" };
+    struct pathspec ps;
+
+    if (pathspec_init(&ps, paths, 2) != 0)
+        return 1;
+
+    int ok = pathspec_match(&ps, "src/lib", 7) &&
+             pathspec_match(&ps, "src/lib/a.c", 11) &&
+             !pathspec_match(&ps, "src/libx.c", 10) &&
+             pathspec_match(&ps, "docs/a/b.md", 11) &&
+             !pathspec_match(&ps, "docs/a.txt", 10) &&
+             pathspec_match_dir(&ps, "src", 3) == PATHSPEC_DIR_SOME &&
+             pathspec_match_dir(&ps, "src/lib/x", 9) == PATHSPEC_DIR_ALL &&
+             pathspec_match_dir(&ps, "src/other", 9) == PATHSPEC_DIR_NONE &&
+             pathspec_match_dir(&ps, "docs", 4) == PATHSPEC_DIR_SOME &&
+             pathspec_match_dir(&ps, "doc", 3) == PATHSPEC_DIR_NONE;
+    pathspec_clear(&ps);
+    return ok ? 0 : 1;
+}
+
+static int collect_diff(const char *buf, size_t len, void *data)
+{
+    strncat(data, buf, len);
+    return 0;
+}
+
+int unit_test_line_diff(void)
+{
+    printf("unit_test_line_diff\n");
+
+    static const char a[] = "one\ntwo\nthree\nfour\n", b[] = "one\n2\nthree\nfour";
+    static const char want[] = "@@ -1,4 +1,4 @@\n one\n-two\n+2\n three\n-four\n+four\n"
+                               "\\ No newline at end of file\n";
+    char out[256] = "";
+    struct line_diff_options opts = { LINE_DIFF_MYERS, 1, collect_diff, out };
+    struct line_diff_stats stats;
+
+    if (line_diff(a, sizeof(a) - 1, b, sizeof(b) - 1, &opts, &stats) != 0 ||
+        strcmp(out, want) || stats.added != 2 || stats.deleted != 2 || stats.hunks != 1)
+        return 1;
+
+    /* minimal scripts must have the length the LCS says, the others be consistent */
+    srand(7);
+    for (int round = 0; round < 200; round++) {
+        char x[64], y[64];
+        int n = rand() % 30, m = rand() % 30, lcs[31][31];
+        for (int i = 0; i < n; i++)
+            x[2 * i] = "abcd"[rand() % 4], x[2 * i + 1] = '\n';
+        for (int j = 0; j < m; j++)
+            y[2 * j] = "abcd"[rand() % 4], y[2 * j + 1] = '\n';
+        for (int i = n; i >= 0; i--)
+            for (int j = m; j >= 0; j--)
+                lcs[i][j] = i == n || j == m ? 0 :
+                            x[2 * i] == y[2 * j] ? lcs[i + 1][j + 1] + 1 :
+                            lcs[i + 1][j] > lcs[i][j + 1] ? lcs[i + 1][j] : lcs[i][j + 1];
+
+        for (int alg = LINE_DIFF_MYERS; alg <= LINE_DIFF_HISTOGRAM; alg++) {
+            struct line_diff_options o = { alg, 3, NULL, NULL };
+            if (line_diff(x, 2 * n, y, 2 * m, &o, &stats) != 0 ||
+                n - stats.deleted != m - stats.added ||
+                (alg == LINE_DIFF_MINIMAL && stats.deleted != (size_t)(n - lcs[0][0])))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+struct grep_test_output {
+    char *buf;
+    size_t len, alloc;
+};
+
+/* Append "<path>:<lineno>:<line>\n", or "<path>:binary\n", to [data]. */
+static int collect_grep(const struct grep_match *m, void *data)
+{
+    struct grep_test_output *out = data;
+    int n = m->binary ? snprintf(out->buf + out->len, out->alloc - out->len, "%s:binary\n", m->path)
+                      : snprintf(out->buf + out->len, out->alloc - out->len, "%s:%zu:%.*s\n",
+                                 m->path, m->lineno, (int)m->len, m->line);
+    if (n < 0 || (size_t)n >= out->alloc - out->len)
+        return -1;
+    out->len += n;
+    return 0;
+}
+
+int unit_test_grep(void)
+{
+    printf("unit_test_grep\n");
+
+    /* more files than a window of blobs, in 40 directories of 30 */
+    enum { NR_DIRS = 40, NR_FILES = 30, OUT_SIZE = 1 << 16 };
+    static const struct {
+        const char *pattern;
+        enum grep_pattern_type type;
+        int ignore_case;
+    } searches[] = {
+        { "needle", GREP_PATTERN_FIXED, 0 },
+        { "needle", GREP_PATTERN_FIXED, 1 },
+        { "needle [0-9]*7$", GREP_PATTERN_EXTENDED, 0 },
+        { "^ne*dle loud", GREP_PATTERN_BASIC, 1 },
+    };
+    struct object_id dirs[NR_DIRS], tree;
+    struct test_tree_entry entries[NR_DIRS + 2];
+    struct grep_test_output want[4], got = { malloc(OUT_SIZE), 0, OUT_SIZE };
+    struct repository repo;
+    char dir[64], names[NR_DIRS][4], files[NR_FILES][4], body[64];
+    int ok = got.buf != NULL;
+
+    for (size_t s = 0; s < 4; s++) {
+        want[s] = (struct grep_test_output){ malloc(OUT_SIZE), 0, OUT_SIZE };
+        ok = ok && want[s].buf;
+    }
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_grep.%d", (int)getpid());
+    ok = ok && make_test_repo(dir, &repo) == 0;
+
+    /* a binary blob that matches, reported once, and one that does not */
+    struct object_id bin, bin2;
+    ok = ok && write_test_object(&repo, OBJ_BLOB, "bin\0needle\n", 11, &bin) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "\0nothing\n", 9, &bin2) == 0;
+    for (size_t s = 0; s < 2 && ok; s++)
+        want[s].len = sprintf(want[s].buf, "bin:binary\n");
+
+    /*
+     * File k has k % 3 lines of hay, then "needle <k>" unless k is a
+     * multiple of 4, then "NEEDLE loud <k>" if it is a multiple of 7.
+     */
+    for (int d = 0; d < NR_DIRS && ok; d++) {
+        struct test_tree_entry sub[NR_FILES];
+        struct object_id blobs[NR_FILES];
+        for (int f = 0; f < NR_FILES && ok; f++) {
+            int k = d * NR_FILES + f, len = 0, line = k % 3 + 1;
+            char path[16];
+
+            snprintf(files[f], sizeof(files[f]), "f%02d", f);
+            snprintf(path, sizeof(path), "d%02d/f%02d", d, f);
+            for (int i = 0; i < k % 3; i++)
+                len += sprintf(body + len, "hay\n");
+            if (k % 4) {
+                len += sprintf(body + len, "needle %d\n", k);
+                for (size_t s = 0; s < 2; s++)
+                    want[s].len += sprintf(want[s].buf + want[s].len, "%s:%d:needle %d\n",
+                                           path, line, k);
+                if (k % 10 == 7)
+                    want[2].len += sprintf(want[2].buf + want[2].len, "%s:%d:needle %d\n",
+                                           path, line, k);
+                line++;
+            }
+            if (k % 7 == 0) {
+                len += sprintf(body + len, "NEEDLE loud %d\n", k);
+                for (size_t s = 1; s < 4; s += 2)
+                    want[s].len += sprintf(want[s].buf + want[s].len, "%s:%d:NEEDLE loud %d\n",
+                                           path, line, k);
+            }
+            ok = write_test_object(&repo, OBJ_BLOB, body, len, &blobs[f]) == 0;
+            sub[f] = (struct test_tree_entry){ "100644", files[f], &blobs[f] };
+        }
+        ok = ok && write_test_tree(&repo, sub, NR_FILES, &dirs[d]) == 0;
+        snprintf(names[d], sizeof(names[d]), "d%02d", d);
+        entries[d + 2] = (struct test_tree_entry){ "40000", names[d], &dirs[d] };
+    }
+    entries[0] = (struct test_tree_entry){ "100644", "bin", &bin };
+    entries[1] = (struct test_tree_entry){ "100644", "bin2", &bin2 };
+    ok = ok && write_test_tree(&repo, entries, NR_DIRS + 2, &tree) == 0;
+
+    /* one thread or several, the same lines in the same order */
+    for (size_t s = 0; s < 4 && ok; s++) {
+        for (int threads = 1; threads <= 4 && ok; threads += 3) {
+            struct grep_options opts = { searches[s].pattern, searches[s].type,
+                                         searches[s].ignore_case, 0, threads, NULL,
+                                         collect_grep, &got };
+            got.len = 0;
+            ok = grep_tree(&repo, &tree, &opts) == 0 && got.len == want[s].len &&
+                 !memcmp(got.buf, want[s].buf, got.len);
+            if (!ok)
+                printf("grep '%s' with %d threads: %zu bytes instead of %zu\n",
+                       searches[s].pattern, threads, got.len, want[s].len);
+        }
+    }
+
+    for (size_t s = 0; s < 4; s++)
+        free(want[s].buf);
+    free(got.buf);
+    repo_clear(&repo);
+    remove_test_dir(dir);
+    return ok ? 0 : 1;
+}
+
+/* Append "<status> <path>\n" for each change to the string [data]. */
+static int collect_change(const struct diff_change *change, void *data)
+{
+    char *out = data;
+    sprintf(out + strlen(out), "%c %s\n", change->status, change->path);
+    return 0;
+}
+
+/* Diff [old] against [new] and compare the changes with [want]; NULL: the diff fails. */
+static int check_tree_diff(struct repository *repo, const struct object_id *old,
+                           const struct object_id *new, int recursive,
+                           const struct pathspec *pathspec, const char *want)
+{
+    char got[512] = "";
+    struct diff_options opts = { recursive, pathspec, collect_change, got };
+    int ret = diff_trees(repo, old, new, &opts);
+
+    if (!want)
+        return ret < 0;
+    if (ret != 0 || strcmp(got, want) != 0) {
+        printf("diff_trees: got\n%sinstead of\n%s", got, want);
+        return 0;
+    }
+    return 1;
+}
+
+int unit_test_tree_diff(void)
+{
+    printf("unit_test_tree_diff\n");
+
+    struct object_id one, two, x, y, y2, same, sub_old, sub_new, fd, old, new;
+    struct repository repo;
+    struct pathspec ps = { 0 };
+    const char *only_f[] = { "f" };
+    char dir[64];
+    int ok;
+
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_tree_diff.%d", (int)getpid());
+    ok = make_test_repo(dir, &repo) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "one\n", 4, &one) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "two\n", 4, &two) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "x\n", 2, &x) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "y\n", 2, &y) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "y2\n", 3, &y2) == 0;
+    if (ok) {
+        /*
+         * f is modified, fd turns from a file into a directory, gone
+         * goes, link turns into a symlink, new comes, same is the same
+         * subtree on both sides and sub/y changes.
+         */
+        const struct test_tree_entry same_entries[] = { { "100644", "x", &x } };
+        const struct test_tree_entry sub_old_entries[] = { { "100644", "y", &y } };
+        const struct test_tree_entry sub_new_entries[] = { { "100644", "y", &y2 } };
+        const struct test_tree_entry fd_entries[] = { { "100644", "inner", &x } };
+        const struct test_tree_entry old_entries[] = {
+            { "100644", "f", &one }, { "100644", "fd", &one }, { "100644", "gone", &one },
+            { "100644", "link", &one }, { "40000", "same", &same }, { "40000", "sub", &sub_old },
+        };
+        const struct test_tree_entry new_entries[] = {
+            { "100644", "f", &two }, { "40000", "fd", &fd }, { "120000", "link", &one },
+            { "100644", "new", &one }, { "40000", "same", &same }, { "40000", "sub", &sub_new },
+        };
+        ok = write_test_tree(&repo, same_entries, 1, &same) == 0 &&
+             write_test_tree(&repo, sub_old_entries, 1, &sub_old) == 0 &&
+             write_test_tree(&repo, sub_new_entries, 1, &sub_new) == 0 &&
+             write_test_tree(&repo, fd_entries, 1, &fd) == 0 &&
+             write_test_tree(&repo, old_entries, 6, &old) == 0 &&
+             write_test_tree(&repo, new_entries, 6, &new) == 0;
+    }
+
+    /* a root commit: everything is added */
+    ok = ok && check_tree_diff(&repo, NULL, &new, 1, NULL,
+                               "A f\nA fd/inner\nA link\nA new\nA same/x\nA sub/y\n") &&
+         check_tree_diff(&repo, &old, NULL, 0, NULL,
+                         "D f\nD fd\nD gone\nD link\nD same\nD sub\n");
+
+    /* same is never opened: it can go from disk */
+    char *path = ok ? repo_loose_object_path(&repo, &same) : NULL;
+    ok = ok && path && unlink(path) == 0;
+    free(path);
+    ok = ok && check_tree_diff(&repo, &old, &new, 1, NULL,
+                               "M f\nD fd\nA fd/inner\nD gone\nT link\nA new\nM sub/y\n") &&
+         check_tree_diff(&repo, &old, &new, 0, NULL,
+                         "M f\nD fd\nA fd\nD gone\nT link\nA new\nM sub\n") &&
+         check_tree_diff(&repo, &old, &old, 1, NULL, "");
+
+    /* a pathspec prunes the subtrees it cannot match before reading them */
+    path = ok ? repo_loose_object_path(&repo, &sub_new) : NULL;
+    ok = ok && path && unlink(path) == 0 && pathspec_init(&ps, only_f, 1) == 0 &&
+         check_tree_diff(&repo, &old, &new, 1, &ps, "M f\n") &&
+         check_tree_diff(&repo, &old, &new, 1, NULL, NULL);
+    free(path);
+
+    pathspec_clear(&ps);
+    repo_clear(&repo);
+    remove_test_dir(dir);
+    return ok ? 0 : 1;
+}
+
+int unit_test_diff_rename(void)
+{
+    printf("unit_test_diff_rename\n");
+
+    if (parse_rename_score("5") != 30000 || parse_rename_score("5%") != 3000 ||
+        parse_rename_score("0.9") != 54000 || parse_rename_score("100%") != RENAME_MAX_SCORE ||
+        parse_rename_score("5x") != -1)
+        return 1;
+
+    /* at 100% only blob ids are compared, so no repository is needed */
+    struct diff_queue q = { 0 };
+    struct diff_change c = { 0 };
+    struct rename_options opts = RENAME_OPTIONS_INIT;
+    int needed = -1, ok;
+
+    c.old_mode = c.new_mode = 0100644;
+    memset(c.old_oid.hash, 1, sizeof(c.old_oid.hash));
+    c.new_oid = c.old_oid;
+    c.status = 'A', c.path = "b/new.c", c.pathlen = strlen(c.path);
+    diff_queue_add(&c, &q);
+    c.status = 'M', c.path = "keep.c", c.pathlen = strlen(c.path);
+    diff_queue_add(&c, &q);
+    c.status = 'D', c.path = "old.c", c.pathlen = strlen(c.path);
+    diff_queue_add(&c, &q);
+
+    opts.min_score = RENAME_MAX_SCORE;
+    ok = diff_detect_renames(NULL, &q, &opts, &needed) == 0 && needed == 0 && q.nr == 2 &&
+         q.changes[0].status == 'R' && q.changes[0].similarity == 100 &&
+         strcmp(q.changes[0].old_path, "old.c") == 0 && strcmp(q.changes[0].path, "b/new.c") == 0 &&
+         q.changes[1].status == 'M';
+    diff_queue_clear(&q);
+    if (!ok)
+        return 1;
+
+    /*
+     * Inexact matches, against git diff-tree -r on the same trees:
+     * a.txt moves with one line of ten changed (90%), b.txt keeps four
+     * lines of ten (40%), and copy.txt is keep.txt, itself modified,
+     * with its last line changed.
+     */
+    static const struct {
+        enum rename_detect detect;
+        const char *score;
+        int limit;
+        const char *want;
+        int needed;
+    } runs[] = {
+        { RENAME_DETECT_RENAMES, "50", 0,
+          "D b.txt\nA b2.txt\nA copy.txt\nM keep.txt\nR090 a.txt moved/a2.txt\n", 0 },
+        { RENAME_DETECT_RENAMES, "30%", 0,
+          "R040 b.txt b2.txt\nA copy.txt\nM keep.txt\nR090 a.txt moved/a2.txt\n", 0 },
+        { RENAME_DETECT_COPIES, "50", 0,
+          "D b.txt\nA b2.txt\nC090 keep.txt copy.txt\nM keep.txt\nR090 a.txt moved/a2.txt\n", 0 },
+        /* over the limit: only exact renames, and what limit was needed */
+        { RENAME_DETECT_RENAMES, "50", 1,
+          "D a.txt\nD b.txt\nA b2.txt\nA copy.txt\nM keep.txt\nA moved/a2.txt\n", 3 },
+        { RENAME_DETECT_COPIES, "50", 1,
+          "D a.txt\nD b.txt\nA b2.txt\nA copy.txt\nM keep.txt\nA moved/a2.txt\n", 3 },
+    };
+    struct object_id a, a2, b, b2, keep, keep2, copy, moved, old, new;
+    struct repository repo;
+    char dir[64], bodies[7][512];
+    size_t lens[7] = { 0 };
+
+    for (int i = 0; i < 10; i++) {
+        lens[0] += sprintf(bodies[0] + lens[0], "alpha line %d of the first file\n", i);
+        lens[1] += i == 5 ? sprintf(bodies[1] + lens[1], "changed\n") :
+                            sprintf(bodies[1] + lens[1], "alpha line %d of the first file\n", i);
+        lens[2] += sprintf(bodies[2] + lens[2], "bravo line %d of the second file\n", i);
+        lens[3] += i >= 4 ? sprintf(bodies[3] + lens[3], "other %d\n", i) :
+                            sprintf(bodies[3] + lens[3], "bravo line %d of the second file\n", i);
+        lens[4] += sprintf(bodies[4] + lens[4], "kilo line %d of the kept file\n", i);
+        lens[6] += i == 9 ? sprintf(bodies[6] + lens[6], "copied\n") :
+                            sprintf(bodies[6] + lens[6], "kilo line %d of the kept file\n", i);
+    }
+    memcpy(bodies[5], bodies[4], lens[4]);
+    lens[5] = lens[4] + sprintf(bodies[5] + lens[4], "appended\n");
+
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_diff_rename.%d", (int)getpid());
+    ok = make_test_repo(dir, &repo) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, bodies[0], lens[0], &a) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, bodies[1], lens[1], &a2) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, bodies[2], lens[2], &b) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, bodies[3], lens[3], &b2) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, bodies[4], lens[4], &keep) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, bodies[5], lens[5], &keep2) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, bodies[6], lens[6], &copy) == 0;
+    if (ok) {
+        const struct test_tree_entry moved_entries[] = { { "100644", "a2.txt", &a2 } };
+        const struct test_tree_entry old_entries[] = {
+            { "100644", "a.txt", &a }, { "100644", "b.txt", &b }, { "100644", "keep.txt", &keep },
+        };
+        const struct test_tree_entry new_entries[] = {
+            { "100644", "b2.txt", &b2 }, { "100644", "copy.txt", &copy },
+            { "100644", "keep.txt", &keep2 }, { "40000", "moved", &moved },
+        };
+        ok = write_test_tree(&repo, moved_entries, 1, &moved) == 0 &&
+             write_test_tree(&repo, old_entries, 3, &old) == 0 &&
+             write_test_tree(&repo, new_entries, 4, &new) == 0;
+    }
+
+    for (size_t r = 0; r < sizeof(runs) / sizeof(*runs) && ok; r++) {
+        struct diff_options dopts = { 1, NULL, diff_queue_add, &q };
+        char got[512] = "";
+
+        opts.detect = runs[r].detect;
+        opts.min_score = parse_rename_score(runs[r].score);
+        opts.limit = runs[r].limit;
+        opts.nr_threads = 2;
+        ok = diff_trees(&repo, &old, &new, &dopts) == 0 &&
+             diff_detect_renames(&repo, &q, &opts, &needed) == 0 && needed == runs[r].needed;
+        for (size_t i = 0; i < q.nr && ok; i++) {
+            const struct diff_change *ch = &q.changes[i];
+            if (ch->old_path)
+                sprintf(got + strlen(got), "%c%03d %s %s\n", ch->status, ch->similarity,
+                        ch->old_path, ch->path);
+            else
+                sprintf(got + strlen(got), "%c %s\n", ch->status, ch->path);
+        }
+        if (ok && strcmp(got, runs[r].want) != 0) {
+            printf("renames: got\n%sinstead of\n%s", got, runs[r].want);
+            ok = 0;
+        }
+        diff_queue_clear(&q);
+    }
+
+    repo_clear(&repo);
+    remove_test_dir(dir);
+    return ok ? 0 : 1;
+}
+
+/* Whether <dir>/<name> holds exactly [content]. */
+static int test_file_is(const char *dir, const char *name, const char *content)
+{
+    char path[256], buf[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    size_t n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    return n == strlen(content) && !memcmp(buf, content, n);
+}
+
+int unit_test_checkout(void)
+{
+    printf("unit_test_checkout\n");
+
+    /* bin (100755), keep, link -> keep, mod (gitlink), sub/f */
+    struct object_id bin, keep, link, mod, f, sub, tree;
+    struct repository repo;
+    struct checkout_options opts = { 2 };
+    struct checkout_stats stats;
+    struct utimbuf old = { 1000000, 1000000 };
+    struct stat sb;
+    char dir[64], wt[96], path[128], target[16];
+    int ok;
+
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_checkout.%d", (int)getpid());
+    snprintf(wt, sizeof(wt), "%s/wt", dir);
+    ok = make_test_repo(dir, &repo) == 0 && (repo.worktree = strdup(wt)) != NULL &&
+         write_test_object(&repo, OBJ_BLOB, "#!/bin/sh\n", 10, &bin) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "same\n", 5, &keep) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "keep", 4, &link) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "in sub\n", 7, &f) == 0;
+    memset(&mod, 0x42, sizeof(mod));    /* a gitlink's commit is not in the repository */
+    mod.algo = bin.algo;
+    if (ok) {
+        const struct test_tree_entry sub_entries[] = { { "100644", "f", &f } };
+        const struct test_tree_entry entries[] = {
+            { "100755", "bin", &bin }, { "100644", "keep", &keep },
+            { "120000", "link", &link }, { "160000", "mod", &mod },
+            { "40000", "sub", &sub },
+        };
+        ok = write_test_tree(&repo, sub_entries, 1, &sub) == 0 &&
+             write_test_tree(&repo, entries, 5, &tree) == 0;
+    }
+
+    /*
+     * The worktree already has bin with the right content but not
+     * executable, an identical keep, a file where sub must go, and
+     * an untracked file; both good files are dated back to tell if
+     * they get rewritten.
+     */
+    ok = ok && mkdir(wt, 0777) == 0 &&
+         write_test_file(wt, "bin", "#!/bin/sh\n") == 0 &&
+         write_test_file(wt, "keep", "same\n") == 0 &&
+         write_test_file(wt, "sub", "not a directory\n") == 0 &&
+         write_test_file(wt, "untracked", "mine\n") == 0;
+    snprintf(path, sizeof(path), "%s/bin", wt);
+    ok = ok && chmod(path, 0644) == 0 && utime(path, &old) == 0;
+    snprintf(path, sizeof(path), "%s/keep", wt);
+    ok = ok && utime(path, &old) == 0;
+
+    ok = ok && checkout_tree(&repo, &tree, &opts, &stats) == 0 &&
+         stats.nr_files == 4 && stats.nr_written == 2 && stats.nr_uptodate == 2 &&
+         stats.nr_dirs == 2;       /* mod and sub; wt already existed */
+    if (ok) {
+        snprintf(path, sizeof(path), "%s/bin", wt);
+        ok = !stat(path, &sb) && (sb.st_mode & S_IXUSR) && sb.st_mtime == old.modtime;
+        snprintf(path, sizeof(path), "%s/keep", wt);
+        ok = ok && !stat(path, &sb) && !(sb.st_mode & S_IXUSR) && sb.st_mtime == old.modtime;
+        snprintf(path, sizeof(path), "%s/link", wt);
+        ok = ok && !lstat(path, &sb) && S_ISLNK(sb.st_mode) &&
+             readlink(path, target, sizeof(target)) == 4 && !memcmp(target, "keep", 4);
+        /* the gitlink is an empty directory: rmdir() works on it */
+        snprintf(path, sizeof(path), "%s/mod", wt);
+        ok = ok && !stat(path, &sb) && S_ISDIR(sb.st_mode) && rmdir(path) == 0 &&
+             mkdir(path, 0777) == 0;
+        ok = ok && test_file_is(wt, "sub/f", "in sub\n") &&
+             test_file_is(wt, "untracked", "mine\n");
+        if (!ok)
+            printf("checkout left the worktree wrong\n");
+    }
+
+    /* a second checkout finds everything in place */
+    ok = ok && checkout_tree(&repo, &tree, &opts, &stats) == 0 &&
+         stats.nr_written == 0 && stats.nr_uptodate == 4 && stats.nr_dirs == 0;
+
+    /* a directory where a file must go is an error, but the rest is written */
+    snprintf(path, sizeof(path), "%s/keep", wt);
+    ok = ok && remove(path) == 0 && mkdir(path, 0777) == 0 &&
+         write_test_file(wt, "sub/f", "changed\n") == 0 &&
+         checkout_tree(&repo, &tree, &opts, &stats) < 0 &&
+         test_file_is(wt, "sub/f", "in sub\n");
+
+    /* a tree entry that leaves the worktree or enters a repository fails the checkout */
+    static const char *const bad_names[] = { "..", ".", ".git", ".GIT", "a/b" };
+    for (size_t i = 0; i < sizeof(bad_names) / sizeof(*bad_names) && ok; i++) {
+        const struct test_tree_entry bad[] = { { "40000", bad_names[i], &sub } };
+        ok = write_test_tree(&repo, bad, 1, &tree) == 0 &&
+             checkout_tree(&repo, &tree, &opts, &stats) < 0;
+    }
+    snprintf(path, sizeof(path), "%s/f", dir);      /* where ".." would put sub/f */
+    ok = ok && access(path, F_OK) < 0;
+    snprintf(path, sizeof(path), "%s/a", wt);
+    ok = ok && access(path, F_OK) < 0;
+
+    repo_clear(&repo);
+    remove_test_dir(dir);
+    return ok ? 0 : 1;
+}
+
+int unit_test_index(void)
+{
+    printf("unit_test_index\n");
+
+    static const char *const paths[] = { "b/c", "a", "b.txt", "b/a/x", "ab" };
+    char file[64];
+    struct index_state istate;
+    struct object_id oid = { { 0 }, HASH_SHA1 };
+    int ok = 1;
+
+    snprintf(file, sizeof(file), "/tmp/unit_test_index.%d", (int)getpid());
+    if (index_read(&istate, file, HASH_SHA1, 0) != 0 || istate.nr != 0)
+        return 1;
+    for (size_t i = 0; i < sizeof(paths) / sizeof(*paths); i++) {
+        oid.hash[0] = i;
+        if (index_add(&istate, paths[i], 0100644, &oid, NULL) != 0)
+            return 1;
+    }
+    /* a file where a directory is, and the reverse */
+    if (index_add(&istate, "b", 0100644, &oid, NULL) == 0 ||
+        index_add(&istate, "a/y", 0100644, &oid, NULL) == 0 ||
+        index_add(&istate, "../x", 0100644, &oid, NULL) == 0)
+        return 1;
+
+    /* both layouts, the second with prefix-compressed paths */
+    for (unsigned version = 2; version <= 4 && ok; version += 2) {
+        istate.version = version;
+        if (index_write(&istate, file) != 0)
+            return 1;
+        index_clear(&istate);
+        if (index_read(&istate, file, HASH_SHA1, INDEX_READ_VERIFY) != 0)
+            return 1;
+        ok = istate.version == version && istate.nr == 5 &&
+             !strcmp(istate.entries[0].path, "a") && !strcmp(istate.entries[1].path, "ab") &&
+             !strcmp(istate.entries[2].path, "b.txt") && !strcmp(istate.entries[3].path, "b/a/x") &&
+             !strcmp(istate.entries[4].path, "b/c") && istate.entries[4].pathlen == 3 &&
+             index_entry_mode(&istate.entries[4]) == 0100644 &&
+             index_pos(&istate, "b/a/x", 5, 0) == 3 && index_pos(&istate, "b/b", 3, 0) == -5;
+        index_entry_oid(&istate, &istate.entries[4], &oid);
+        ok = ok && oid.hash[0] == 0;
+    }
+
+    index_remove(&istate, 0);
+    ok = ok && istate.nr == 4 && !strcmp(istate.entries[0].path, "ab");
+    index_clear(&istate);
+    unlink(file);
+    return ok ? 0 : 1;
+}
+
+/* Set the mtime of <dir>/<name> to [t]. */
+static int set_test_mtime(const char *dir, const char *name, time_t t)
+{
+    struct utimbuf times = { t, t };
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return utime(path, &times);
+}
+
+/* Stage <wt>/<name> as blob [oid], with its current stat data. */
+static int stage_test_file(struct index_state *istate, const char *wt, const char *name,
+                           const struct object_id *oid)
+{
+    struct index_stat st;
+    struct stat sb;
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/%s", wt, name);
+    if (lstat(path, &sb) < 0)
+        return -1;
+    index_stat_from(&st, &sb);
+    return index_add(istate, name, index_mode_from_stat(sb.st_mode), oid, &st);
+}
+
+/*
+ * Run status on [repo], with or without the directory cache, and
+ * check its porcelain output against [want]. [res] is left filled.
+ */
+static int check_status(struct repository *repo, int dir_cache, const char *want,
+                        struct status_result *res)
+{
+    struct status_options opts = { 2, STATUS_UNTRACKED_NORMAL, !dir_cache, 0 };
+    char got[512] = "";
+    size_t len = 0;
+
+    if (status_collect(repo, &opts, res) < 0)
+        return -1;
+    for (size_t i = 0; i < res->nr && len < sizeof(got); i++)
+        len += snprintf(got + len, sizeof(got) - len, "%c%c %s\n", res->items[i].index_status,
+                        res->items[i].worktree_status, res->items[i].path);
+    for (size_t i = 0; i < res->nr_untracked && len < sizeof(got); i++)
+        len += snprintf(got + len, sizeof(got) - len, "?? %s\n", res->untracked[i]);
+    if (len >= sizeof(got) || strcmp(got, want)) {
+        printf("status gave:\n%s", len < sizeof(got) ? got : "(too long)\n");
+        status_result_clear(res);
+        return -1;
+    }
+    return 0;
+}
+
+int unit_test_status(void)
+{
+    printf("unit_test_status\n");
+
+    /* HEAD and the index hold a and dir/{b,c}, all dated in the past */
+    struct object_id a, b, c, dir_tree, tree, commit, added;
+    struct repository repo;
+    struct index_state istate = { 0 };
+    struct status_result res = { 0 };
+    struct index_stat st;
+    char dir[64], wt[96], path[128], hex[MAX_HEX_OID_LENGTH + 2];
+    int ok;
+
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_status.%d", (int)getpid());
+    snprintf(wt, sizeof(wt), "%s/wt", dir);
+    ok = make_test_repo(dir, &repo) == 0 && (repo.worktree = strdup(wt)) != NULL &&
+         write_test_object(&repo, OBJ_BLOB, "a\n", 2, &a) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "b\n", 2, &b) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "c\n", 2, &c) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "new\n", 4, &added) == 0;
+    if (ok) {
+        const struct test_tree_entry dir_entries[] = {
+            { "100644", "b", &b }, { "100644", "c", &c },
+        };
+        const struct test_tree_entry entries[] = {
+            { "100644", "a", &a }, { "40000", "dir", &dir_tree },
+        };
+        ok = write_test_tree(&repo, dir_entries, 2, &dir_tree) == 0 &&
+             write_test_tree(&repo, entries, 2, &tree) == 0 &&
+             write_test_commit(&repo, &tree, NULL, 0, 1700000000, "status", &commit) == 0;
+        snprintf(hex, sizeof(hex), "%s\n", oid_to_hex(&commit));
+    }
+    snprintf(path, sizeof(path), "%s/dir", wt);
+    ok = ok && write_test_file(dir, "refs/heads/main", hex) == 0 &&
+         mkdir(wt, 0777) == 0 && mkdir(path, 0777) == 0 &&
+         write_test_file(wt, "a", "a\n") == 0 && write_test_file(wt, "dir/b", "b\n") == 0 &&
+         write_test_file(wt, "dir/c", "c\n") == 0 &&
+         set_test_mtime(wt, "a", 1000000) == 0 && set_test_mtime(wt, "dir/b", 1000000) == 0 &&
+         set_test_mtime(wt, "dir/c", 1000000) == 0;
+    ok = ok && repo_read_index(&repo, &istate, 0) == 0 &&      /* none yet */
+         stage_test_file(&istate, wt, "a", &a) == 0 &&
+         stage_test_file(&istate, wt, "dir/b", &b) == 0 &&
+         stage_test_file(&istate, wt, "dir/c", &c) == 0 &&
+         repo_write_index(&repo, &istate) == 0;
+    index_clear(&istate);
+    /* directories changed in the second status starts are not cached */
+    ok = ok && set_test_mtime(wt, ".", 1000000) == 0 && set_test_mtime(wt, "dir", 1000000) == 0;
+
+    /* clean: nothing is hashed, and the second run reuses both listings */
+    ok = ok && check_status(&repo, 1, "", &res) == 0;
+    ok = ok && res.nr_hashed == 0 && res.nr_dirs == 2 && res.nr_dirs_cached == 0;
+    status_result_clear(&res);
+    ok = ok && check_status(&repo, 1, "", &res) == 0;
+    ok = ok && res.nr_dirs_cached == 2;
+    status_result_clear(&res);
+    if (!ok)
+        printf("status of a clean worktree wrong\n");
+
+    /*
+     * Change dir/b, touch a without changing it, add untracked and
+     * ignored files and stage a new one. The directories get new
+     * mtimes, so the cached listings must not be used.
+     */
+    ok = ok && write_test_file(wt, "dir/b", "changed\n") == 0 &&
+         set_test_mtime(wt, "a", 2000000) == 0 &&
+         write_test_file(wt, ".gitignore", "*.o\n") == 0 &&
+         write_test_file(wt, "x.o", "") == 0 && write_test_file(wt, "dir/y.o", "") == 0 &&
+         write_test_file(wt, "dir/new", "") == 0 &&
+         write_test_file(wt, "staged", "new\n") == 0 &&
+         set_test_mtime(wt, "staged", 1000000) == 0 &&
+         repo_read_index(&repo, &istate, 0) == 0 &&
+         stage_test_file(&istate, wt, "staged", &added) == 0 &&
+         repo_write_index(&repo, &istate) == 0;
+    index_clear(&istate);
+    ok = ok && set_test_mtime(wt, ".", 2000000) == 0 && set_test_mtime(wt, "dir", 2000000) == 0;
+
+    static const char changed[] =
+        " M dir/b\nA  staged\n?? .gitignore\n?? dir/new\n";
+    ok = ok && check_status(&repo, 1, changed, &res) == 0;
+    /* a was hashed and refreshed, and the index written back */
+    ok = ok && res.nr_hashed == 1 && res.nr_refreshed == 1 && res.nr_dirs_cached == 0;
+    status_result_clear(&res);
+    ok = ok && repo_read_index(&repo, &istate, 0) == 0 && istate.nr == 4;
+    if (ok) {
+        index_entry_stat(&istate.entries[0], &st);
+        ok = st.mtime_sec == 2000000;
+    }
+    index_clear(&istate);
+    ok = ok && check_status(&repo, 1, changed, &res) == 0;
+    ok = ok && res.nr_hashed == 0 && res.nr_dirs_cached == 2;
+    status_result_clear(&res);
+    /* the same without the cache, and after it is removed */
+    ok = ok && check_status(&repo, 0, changed, &res) == 0 && res.nr_dirs_cached == 0;
+    status_result_clear(&res);
+    snprintf(path, sizeof(path), "%s/status-cache", dir);
+    ok = ok && remove(path) == 0 && check_status(&repo, 1, changed, &res) == 0 &&
+         res.nr_dirs_cached == 0;
+    status_result_clear(&res);
+    if (!ok)
+        printf("status of a changed worktree wrong\n");
+
+    /*
+     * Rewriting and staging dir/new leaves the mtime of dir alone, but
+     * changes the tracked names its cached listing was keyed by.
+     */
+    ok = ok && check_status(&repo, 1, changed, &res) == 0 && res.nr_dirs_cached == 2;
+    status_result_clear(&res);
+    ok = ok && write_test_file(wt, "dir/new", "new\n") == 0 &&
+         set_test_mtime(wt, "dir/new", 1000000) == 0 &&
+         repo_read_index(&repo, &istate, 0) == 0 &&
+         stage_test_file(&istate, wt, "dir/new", &added) == 0 &&
+         repo_write_index(&repo, &istate) == 0;
+    index_clear(&istate);
+    ok = ok && check_status(&repo, 1, " M dir/b\nA  dir/new\nA  staged\n"
+                                      "?? .gitignore\n", &res) == 0 &&
+         res.nr_dirs_cached == 1;
+    status_result_clear(&res);
+    if (!ok)
+        printf("status after staging a cached untracked file wrong\n");
+
+    /*
+     * a dated after the index is racily clean: it is hashed and, once
+     * refreshed, written back with its size smudged, so it stays
+     * hashed until a later index write sees it as older.
+     */
+    ok = ok && set_test_mtime(wt, "a", time(NULL) + 100) == 0;
+    for (int i = 0; i < 2 && ok; i++) {
+        ok = check_status(&repo, 1, " M dir/b\nA  dir/new\nA  staged\n"
+                                    "?? .gitignore\n", &res) == 0 && res.nr_hashed == 1;
+        status_result_clear(&res);
+    }
+    if (!ok)
+        printf("status of a racy entry wrong\n");
+
+    repo_clear(&repo);
+    remove_test_dir(dir);
+    return ok ? 0 : 1;
+}
+
+int unit_test_hash_object(void)
+{
+    printf("unit_test_hash_object\n");
+
+    /* more files than a chunk, so that several batches run */
+    enum { NR = HASH_OBJECT_CHUNK + 3 };
+    char names[NR][64], hex[MAX_HEX_OID_LENGTH + 1];
+    const char *paths[NR];
+    struct object_id oids[NR];
+    struct hash_object_options opts = { 0 };
+    struct hash_object_stats stats = { 0 };
+    struct repository repo;
+    struct thread_pool *pool = thread_pool_create(2);
+    int ok = pool != NULL;
+
+    memset(&repo, 0, sizeof(repo));
+    repo.hash_algo = HASH_SHA1;
+    for (int i = 0; i < NR && ok; i++) {
+        snprintf(names[i], sizeof(names[i]), "/tmp/unit_test_hash_object.%d.%d",
+                 (int)getpid(), i);
+        paths[i] = names[i];
+        /* every other file "hello\n", the rest empty, the last missing */
+        FILE *f = i < NR - 1 ? fopen(names[i], "w") : NULL;
+        if (f) {
+            if (i % 2)
+                fputs("hello\n", f);
+            fclose(f);
+        }
+    }
+
+    ok = ok && hash_object_files(&repo, pool, &opts, paths, NR, oids, &stats) == 1 &&
+         stats.nr_files == NR && stats.nr_failed == 1 && stats.bytes == (NR / 2) * 6;
+    for (int i = 0; i < NR - 1 && ok; i++) {
+        oid_to_hex_r(hex, &oids[i]);
+        ok = !strcmp(hex, i % 2 ? "ce013625030ba8dba906f756967f9e9ca394464a"
+                                : "e69de29bb2d1d6434b8b29ae775ad8c2e48c5391");
+    }
+    ok = ok && !oids[NR - 1].algo;
+
+    /* -t tree, commit and tag: well-formed content is hashed, the rest fails */
+    static const struct {
+        enum object_type type;
+        const char *body;
+        size_t len;
+        const char *hex;        /* NULL: rejected */
+    } typed[] = {
+        { OBJ_TREE, "100644 a\0\x11\x11\x11\x11\x11\x11\x11\x11\x11\x11"
+                    "\x11\x11\x11\x11\x11\x11\x11\x11\x11\x11"
+                    "100644 b\0\x22\x22\x22\x22\x22\x22\x22\x22\x22\x22"
+                    "\x22\x22\x22\x22\x22\x22\x22\x22\x22\x22", 58,
+          "f84e31dcb0e73214f7973baacd86ac5a8f58e682" },
+        { OBJ_TREE, "100644 b\0\x22\x22\x22\x22\x22\x22\x22\x22\x22\x22"
+                    "\x22\x22\x22\x22\x22\x22\x22\x22\x22\x22"
+                    "100644 a\0\x11\x11\x11\x11\x11\x11\x11\x11\x11\x11"
+                    "\x11\x11\x11\x11\x11\x11\x11\x11\x11\x11", 58, NULL },
+        { OBJ_TREE, "hello\n", 6, NULL },
+        { OBJ_COMMIT, "tree 4b825dc642cb6eb9a060e54bf8d69288fbee4904\n"
+                      "author A U Thor <author@example.com> 0 +0000\n"
+                      "committer A U Thor <author@example.com> 0 +0000\n\nmsg\n", 144,
+          "28ce33cd971c75ff0050d386244c35d7dfaa80ab" },
+        { OBJ_COMMIT, "hello\n", 6, NULL },
+        { OBJ_TAG, "object 4b825dc642cb6eb9a060e54bf8d69288fbee4904\ntype tree\ntag v1\n"
+                   "tagger A U Thor <author@example.com> 0 +0000\n\nmsg\n", 115,
+          "df80052480428e6e44da5fa8ae6dc6be7dbb7cab" },
+        { OBJ_TAG, "object 4b825dc642cb6eb9a060e54bf8d69288fbee4904\ntag v1\n\nmsg\n", 60, NULL },
+    };
+    for (size_t i = 0; i < sizeof(typed) / sizeof(typed[0]) && ok; i++) {
+        FILE *f = fopen(names[0], "w");
+        ok = f && fwrite(typed[i].body, 1, typed[i].len, f) == typed[i].len;
+        if (f)
+            fclose(f);
+        opts.type = typed[i].type;
+        ok = ok && hash_object_files(&repo, pool, &opts, paths, 1, oids, NULL) == !typed[i].hex;
+        if (ok && typed[i].hex) {
+            oid_to_hex_r(hex, &oids[0]);
+            ok = !strcmp(hex, typed[i].hex);
+        }
+        ok = ok && (typed[i].hex || !oids[0].algo);
+    }
+
+    for (int i = 0; i < NR; i++)
+        unlink(names[i]);
+    if (pool)
+        thread_pool_destroy(pool);
+    return ok ? 0 : 1;
+}
+
+static int collect_ref_names(const struct ref_entry *ref, void *data)
+{
+    char *out = data;
+    strcat(out, ref->name);
+    strcat(out, ref->flags & REF_ISPACKED ? "=p " : "=l ");
+    return 0;
+}
+
+int unit_test_refs(void)
+{
+    printf("unit_test_refs\n");
+
+    const char *a = "1111111111111111111111111111111111111111";
+    const char *b = "2222222222222222222222222222222222222222";
+    const char *c = "3333333333333333333333333333333333333333";
+    char dir[64], sub[128], names[512] = "", hex[MAX_HEX_OID_LENGTH + 1], *target = NULL;
+    struct repository repo;
+    struct ref_entry ref;
+    struct object_id peeled;
+    int ok = 1;
+
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_refs.%d", (int)getpid());
+    mkdir(dir, 0755);
+    snprintf(sub, sizeof(sub), "%s/refs", dir);
+    mkdir(sub, 0755);
+    snprintf(sub, sizeof(sub), "%s/refs/heads", dir);
+    mkdir(sub, 0755);
+    snprintf(sub, sizeof(sub), "%s/refs/heads/b", dir);
+    mkdir(sub, 0755);
+
+    /* packed refs out of order and without the sorted trait; main is also loose */
+    char packed[1024];
+    snprintf(packed, sizeof(packed),
+             "# pack-refs with: peeled \n"
+             "%s refs/tags/v1\n^%s\n%s refs/heads/main\n%s refs/heads/a\n%s refs/tags/light\n",
+             c, a, a, a, b);
+    ok = write_test_file(dir, "packed-refs", packed) == 0 &&
+         write_test_file(dir, "HEAD", "ref: refs/heads/main\n") == 0 &&
+         write_test_file(dir, "ORIG_HEAD", "ref: refs/heads/unborn\n") == 0 &&
+         write_test_file(dir, "refs/heads/main", "2222222222222222222222222222222222222222\n") == 0 &&
+         write_test_file(dir, "refs/heads/b/c", "3333333333333333333333333333333333333333\n") == 0 &&
+         write_test_file(dir, "refs/heads/a-b", "ref: refs/heads/a\n") == 0 &&
+         write_test_file(dir, "refs/heads/x.lock", "garbage\n") == 0;
+
+    memset(&repo, 0, sizeof(repo));
+    repo.gitdir = strdup(dir);
+    repo.hash_algo = HASH_SHA1;
+
+    ok = ok && refs_resolve(&repo, "HEAD", &ref, &target) == 0 &&
+         (ref.flags & REF_ISSYMREF) && !(ref.flags & REF_ISPACKED) &&
+         !strcmp(oid_to_hex_r(hex, &ref.oid), b) && !strcmp(target, "refs/heads/main");
+    free(target);
+    target = NULL;
+    ok = ok && refs_resolve(&repo, "ORIG_HEAD", &ref, &target) == 1 &&
+         !strcmp(target, "refs/heads/unborn");
+    free(target);
+    ok = ok && refs_resolve(&repo, "refs/tags/v1", &ref, NULL) == 0 &&
+         (ref.flags & REF_ISPACKED) && refs_peel(&repo, &ref, &peeled) == 0 &&
+         !strcmp(oid_to_hex_r(hex, &peeled), a);
+    /* the peeled trait covers tags: no '^' line means not a tag */
+    ok = ok && refs_resolve(&repo, "refs/tags/light", &ref, NULL) == 0 &&
+         (ref.flags & REF_KNOWS_PEELED) && oideq(&ref.peeled, &ref.oid);
+    ok = ok && refs_resolve(&repo, "refs/heads/nope", &ref, NULL) < 0 &&
+         refs_resolve(&repo, "refs/heads/../HEAD", &ref, NULL) < 0 &&
+         refs_check_name("refs/heads/x.lock") != 0 && refs_check_name("refs/heads/a b") != 0 &&
+         refs_check_name("refs/heads/") != 0 && refs_check_name("refs/heads/a/b") == 0;
+
+    ok = ok && refs_for_each_ref(&repo, "refs/heads/", collect_ref_names, names) == 0 &&
+         !strcmp(names, "refs/heads/a=p refs/heads/a-b=p refs/heads/b/c=l refs/heads/main=l ");
+    names[0] = '\0';
+    ok = ok && refs_for_each_ref(&repo, "refs/tags/l", collect_ref_names, names) == 0 &&
+         !strcmp(names, "refs/tags/light=p ");
+
+    repo_clear(&repo);
+    const char *files[] = { "refs/heads/x.lock", "refs/heads/a-b", "refs/heads/b/c",
+                            "refs/heads/main", "ORIG_HEAD", "HEAD", "packed-refs" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(*files); i++) {
+        snprintf(sub, sizeof(sub), "%s/%s", dir, files[i]);
+        unlink(sub);
+    }
+    const char *dirs[] = { "refs/heads/b", "refs/heads", "refs", "" };
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(*dirs); i++) {
+        snprintf(sub, sizeof(sub), "%s/%s", dir, dirs[i]);
+        rmdir(sub);
+    }
+    return ok ? 0 : 1;
+}
+
+/* Append [v] to [buf] as a reftable varint. */
+static size_t put_test_varint(unsigned char *buf, size_t len, uint64_t v)
+{
+    unsigned char tmp[10];
+    size_t i = sizeof(tmp) - 1;
+
+    tmp[i] = v & 0x7f;
+    while (v >>= 7)
+        tmp[--i] = 0x80 | (--v & 0x7f);
+    memcpy(buf + len, tmp + i, sizeof(tmp) - i);
+    return len + sizeof(tmp) - i;
+}
+
+static void put_test_be(unsigned char *p, uint64_t v, int bytes)
+{
+    while (bytes--) {
+        p[bytes] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+struct test_reftable_ref {
+    const char *name;
+    int type;                   /* enum reftable_value */
+    const char *value;          /* hex ids, or the target of a symref */
+};
+
+/* How write_test_reftable() lays a table out. */
+struct test_reftable_layout {
+    uint32_t block_size;        /* 0: blocks written back to back */
+    int restart_interval;       /* a record stored whole every this many */
+    int index;                  /* index the ref blocks, in as many levels as needed */
+};
+
+/* A record of a section: a ref, or an index entry pointing at a block. */
+struct test_reftable_record {
+    const char *name;
+    int type;
+    unsigned char value[64];
+    size_t value_len;
+};
+
+/*
+ * Append the blocks of [type] holding [recs] to [buf] at [*len], a
+ * block being cut when the next record would take it past the block
+ * size and padded to it with NULs. Each block's last name and offset
+ * go to [blocks] as an index record. Returns the number of blocks, or
+ * -1 if [buf] is too small.
+ */
+static int write_test_reftable_section(unsigned char *buf, size_t alloc, size_t *len,
+                                       unsigned char type,
+                                       const struct test_reftable_layout *layout,
+                                       const struct test_reftable_record *recs, int nr,
+                                       struct test_reftable_record *blocks)
+{
+    size_t start = 0, restarts[256], nr_restarts = 0, in_block = 0;
+    unsigned char rec[512];
+    int nr_blocks = 0;
+
+    for (int i = 0; i <= nr; i++) {
+        size_t name_len = i < nr ? strlen(recs[i].name) : 0, prefix = 0, n = 0;
+        int restart = !in_block || in_block % layout->restart_interval == 0;
+
+        if (i < nr && !restart) {
+            const char *last = recs[i - 1].name;
+            while (last[prefix] && last[prefix] == recs[i].name[prefix])
+                prefix++;
+        }
+        if (i < nr) {
+            n = put_test_varint(rec, 0, prefix);
+            n = put_test_varint(rec, n, (name_len - prefix) << 3 | recs[i].type);
+            memcpy(rec + n, recs[i].name + prefix, name_len - prefix);
+            n += name_len - prefix;
+            memcpy(rec + n, recs[i].value, recs[i].value_len);
+            n += recs[i].value_len;
+        }
+
+        /* close the block at the end, or when the record does not fit */
+        if (in_block && (i == nr || (layout->block_size &&
+                         *len + n + 3 * (nr_restarts + restart) + 2 - start >
+                         layout->block_size))) {
+            for (size_t j = 0; j < nr_restarts; j++, *len += 3)
+                put_test_be(buf + *len, restarts[j], 3);
+            put_test_be(buf + *len, nr_restarts, 2);
+            *len += 2;
+            put_test_be(buf + start + (start ? 1 : 25), *len - start, 3);
+            if (layout->block_size && *len - start < layout->block_size) {
+                memset(buf + *len, 0, start + layout->block_size - *len);
+                *len = start + layout->block_size;
+            }
+            blocks[nr_blocks].name = recs[i - 1].name;
+            blocks[nr_blocks].type = 0;
+            blocks[nr_blocks].value_len = put_test_varint(blocks[nr_blocks].value, 0, start);
+            nr_blocks++;
+            in_block = 0;
+            i--;                /* the record again, as the first of a block */
+            continue;
+        }
+        if (i == nr)
+            break;
+        if (*len + n + 3 * 256 + 2 + layout->block_size > alloc || nr_restarts == 256)
+            return -1;
+        if (!in_block) {
+            /* the first block starts with the file header */
+            start = *len == 24 ? 0 : *len;
+            buf[*len] = type;
+            *len += 4;
+            nr_restarts = 0;
+        }
+        if (restart)
+            restarts[nr_restarts++] = *len - start;
+        memcpy(buf + *len, rec, n);
+        *len += n;
+        in_block++;
+    }
+    return nr_blocks;
+}
+
+/*
+ * Write a version 1 reftable holding [refs], which must be sorted, laid
+ * out as [layout] says: without a block size, its ref blocks are
+ * unaligned and every record is a restart point.
+ */
+static int write_test_reftable(const char *path, uint64_t update_index,
+                               const struct test_reftable_ref *refs, int nr,
+                               const struct test_reftable_layout *layout)
+{
+    const struct test_reftable_layout unaligned = { 0, 1, 0 };
+    struct test_reftable_record *recs = calloc(nr + 1, sizeof(*recs));
+    struct test_reftable_record *blocks = calloc(nr + 1, sizeof(*blocks));
+    struct test_reftable_record *level = calloc(nr + 1, sizeof(*level));
+    size_t alloc = 1 << 20, len = 24, index_pos = 0;
+    unsigned char *buf = malloc(alloc);
+    int nr_blocks, ret = -1;
+
+    if (!layout)
+        layout = &unaligned;
+    if (!recs || !blocks || !level || !buf)
+        goto out;
+
+    memcpy(buf, "REFT\1\0\0\0", 8);
+    put_test_be(buf + 5, layout->block_size, 3);
+    put_test_be(buf + 8, update_index, 8);
+    put_test_be(buf + 16, update_index, 8);
+    for (int i = 0; i < nr; i++) {
+        struct test_reftable_record *r = &recs[i];
+        r->name = refs[i].name;
+        r->type = refs[i].type;
+        r->value_len = put_test_varint(r->value, 0, 0);
+        if (refs[i].type == REFTABLE_VAL1 || refs[i].type == REFTABLE_VAL2) {
+            hex_decode(r->value + r->value_len, refs[i].value, 20 * refs[i].type);
+            r->value_len += 20 * refs[i].type;
+        } else if (refs[i].type == REFTABLE_SYMREF) {
+            size_t n = strlen(refs[i].value);
+            r->value_len = put_test_varint(r->value, r->value_len, n);
+            memcpy(r->value + r->value_len, refs[i].value, n);
+            r->value_len += n;
+        }
+    }
+    nr_blocks = write_test_reftable_section(buf, alloc, &len, 'r', layout, recs, nr,
+                                            blocks);
+
+    /* index the blocks of each level until one block is left: the root */
+    while (layout->index && nr_blocks > 0) {
+        memcpy(level, blocks, nr_blocks * sizeof(*level));
+        index_pos = len;
+        nr_blocks = write_test_reftable_section(buf, alloc, &len, 'i', layout, level,
+                                                nr_blocks, blocks);
+        if (nr_blocks == 1)
+            break;
+    }
+    if (nr_blocks < 0 || len + 68 > alloc)
+        goto out;
+
+    /* footer: the header again, the ref index, no other section, and its CRC-32 */
+    memcpy(buf + len, buf, 24);
+    memset(buf + len + 24, 0, 40);
+    put_test_be(buf + len + 24, index_pos, 8);
+    put_test_be(buf + len + 64, crc32(0, buf + len, 64), 4);
+    len += 68;
+
+    FILE *f = fopen(path, "w");
+    if (f) {
+        fwrite(buf, 1, len, f);
+        ret = fclose(f);
+    }
+out:
+    free(recs);
+    free(blocks);
+    free(level);
+    free(buf);
+    return ret;
+}
+
+struct reftable_names {
+    char buf[8192];
+    size_t len;
+};
+
+static int collect_reftable_names(const struct reftable_ref *ref, void *data)
+{
+    struct reftable_names *names = data;
+    size_t n = strlen(ref->name);
+
+    if (names->len + n + 2 > sizeof(names->buf))
+        return -1;
+    memcpy(names->buf + names->len, ref->name, n);
+    names->len += n;
+    names->buf[names->len++] = ' ';
+    names->buf[names->len] = '\0';
+    return 0;
+}
+
+/*
+ * Look every ref of [refs] up in [st], and names around them, then
+ * iterate prefixes, checking each against a linear scan of [refs].
+ */
+static int check_reftable_seeks(struct reftable_stack *st,
+                                const struct test_reftable_ref *refs, int nr)
+{
+    const char *missing[] = { "A", "HEAD0", "refs/heads/topic-", "refs/heads/topic-050x",
+                              "refs/heads/topic-150", "refs/tags/v49x", "zzz" };
+    const char *prefixes[] = { "", "HEAD", "refs/heads/topic-0", "refs/heads/topic-07",
+                               "refs/heads/topic-149", "refs/heads/topic-2", "refs/tags/",
+                               "refs/tags/v4", "zzz" };
+    char hex[MAX_HEX_OID_LENGTH + 1];
+    struct reftable_names got, want;
+    struct reftable_ref ref;
+    int ok = 1;
+
+    for (int i = 0; ok && i < nr; i++) {
+        int r = reftable_stack_read_ref(st, refs[i].name, &ref);
+        if (refs[i].type == REFTABLE_DELETION) {
+            ok = r == 1;
+            continue;
+        }
+        ok = r == 0 && !strcmp(ref.name, refs[i].name) && (int)ref.type == refs[i].type;
+        if (ok && refs[i].type == REFTABLE_SYMREF)
+            ok = !strcmp(ref.target, refs[i].value);
+        else if (ok)
+            ok = !strncmp(oid_to_hex_r(hex, &ref.value), refs[i].value, 40);
+        if (ok && refs[i].type == REFTABLE_VAL2)
+            ok = !strcmp(oid_to_hex_r(hex, &ref.peeled), refs[i].value + 40);
+    }
+    for (size_t i = 0; ok && i < sizeof(missing) / sizeof(*missing); i++)
+        ok = reftable_stack_read_ref(st, missing[i], &ref) == 1;
+
+    for (size_t i = 0; ok && i < sizeof(prefixes) / sizeof(*prefixes); i++) {
+        size_t n = strlen(prefixes[i]);
+        want.len = got.len = 0;
+        want.buf[0] = got.buf[0] = '\0';
+        for (int j = 0; j < nr; j++) {
+            if (refs[j].type != REFTABLE_DELETION && !strncmp(refs[j].name, prefixes[i], n)) {
+                struct reftable_ref r = { .name = refs[j].name };
+                collect_reftable_names(&r, &want);
+            }
+        }
+        ok = reftable_stack_for_each_ref(st, prefixes[i], collect_reftable_names, &got) == 0 &&
+             !strcmp(got.buf, want.buf);
+    }
+    return ok;
+}
+
+int unit_test_reftable(void)
+{
+    printf("unit_test_reftable\n");
+
+    const char *a = "1111111111111111111111111111111111111111";
+    const char *b = "2222222222222222222222222222222222222222";
+    const struct test_reftable_ref old[] = {
+        { "HEAD", REFTABLE_SYMREF, "refs/heads/main" },
+        { "refs/heads/gone", REFTABLE_VAL1, "3333333333333333333333333333333333333333" },
+        { "refs/heads/main", REFTABLE_VAL1, "1111111111111111111111111111111111111111" },
+        { "refs/tags/v1", REFTABLE_VAL2, "2222222222222222222222222222222222222222"
+                                          "1111111111111111111111111111111111111111" },
+    };
+    const struct test_reftable_ref new[] = {
+        { "refs/heads/gone", REFTABLE_DELETION, NULL },
+        { "refs/heads/main", REFTABLE_VAL1, "2222222222222222222222222222222222222222" },
+        { "refs/heads/new", REFTABLE_SYMREF, "refs/tags/v1" },
+    };
+    char dir[64], path[128], names[256] = "", hex[MAX_HEX_OID_LENGTH + 1], *target = NULL;
+    struct repository repo;
+    struct ref_entry ref;
+    struct object_id peeled;
+    int ok;
+
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_reftable.%d", (int)getpid());
+    mkdir(dir, 0755);
+    snprintf(path, sizeof(path), "%s/reftable", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/reftable/1.ref", dir);
+    ok = write_test_reftable(path, 1, old, 4, NULL) == 0;
+    snprintf(path, sizeof(path), "%s/reftable/2.ref", dir);
+    ok = ok && write_test_reftable(path, 2, new, 3, NULL) == 0;
+    ok = ok && write_test_file(dir, "reftable/tables.list", "1.ref\n2.ref\n") == 0;
+
+    memset(&repo, 0, sizeof(repo));
+    repo.gitdir = strdup(dir);
+    repo.hash_algo = HASH_SHA1;
+
+    /* the newest table wins, and its deletion hides the older ref */
+    ok = ok && refs_resolve(&repo, "HEAD", &ref, &target) == 0 &&
+         (ref.flags & REF_ISSYMREF) && !strcmp(oid_to_hex_r(hex, &ref.oid), b) &&
+         !strcmp(target, "refs/heads/main");
+    free(target);
+    ok = ok && refs_resolve(&repo, "refs/heads/gone", &ref, NULL) < 0;
+    ok = ok && refs_resolve(&repo, "refs/heads/new", &ref, NULL) == 0 &&
+         refs_peel(&repo, &ref, &peeled) == 0 && !strcmp(oid_to_hex_r(hex, &peeled), a);
+    ok = ok && refs_for_each_ref(&repo, "refs/", collect_ref_names, names) == 0 &&
+         !strcmp(names, "refs/heads/main=l refs/heads/new=l refs/tags/v1=l ");
+
+    repo_clear(&repo);
+
+    /*
+     * 201 refs sharing long prefixes, laid out with several restart
+     * runs per block, in many padded blocks, and behind one or two
+     * index levels: every seek must agree with a linear scan.
+     */
+    const struct test_reftable_layout layouts[] = {
+        { 0, 1, 0 }, { 0, 16, 0 }, { 256, 4, 0 }, { 256, 4, 1 }, { 1024, 16, 1 },
+        { 4096, 3, 1 },
+    };
+    struct test_reftable_ref gen[201];
+    char gen_names[201][32], gen_values[201][81], gendir[80];
+    int nr = 0;
+
+    gen[nr++] = (struct test_reftable_ref){ "HEAD", REFTABLE_SYMREF, "refs/heads/topic-000" };
+    for (int i = 0; i < 200; i++, nr++) {
+        int type = i >= 150 ? REFTABLE_VAL1 : i % 7 == 3 ? REFTABLE_DELETION :
+                   i % 5 == 0 ? REFTABLE_VAL2 : REFTABLE_VAL1;
+        if (i < 150)
+            snprintf(gen_names[nr], sizeof(gen_names[nr]), "refs/heads/topic-%03d", i);
+        else
+            snprintf(gen_names[nr], sizeof(gen_names[nr]), "refs/tags/v%02d", i - 150);
+        snprintf(gen_values[nr], sizeof(gen_values[nr]), "%08x%08x%08x%08x%08x%08x%08x%08x%08x%08x",
+                 i + 1, i, i, i, i, i + 2, i, i, i, i);
+        gen[nr] = (struct test_reftable_ref){ gen_names[nr], type, gen_values[nr] };
+    }
+    snprintf(gendir, sizeof(gendir), "%s/gen", dir);
+    mkdir(gendir, 0755);
+    snprintf(path, sizeof(path), "%s/gen/reftable", dir);
+    mkdir(path, 0755);
+    ok = ok && write_test_file(gendir, "reftable/tables.list", "1.ref\n") == 0;
+    snprintf(path, sizeof(path), "%s/gen/reftable/1.ref", dir);
+    for (size_t i = 0; ok && i < sizeof(layouts) / sizeof(*layouts); i++) {
+        struct reftable_stack *st = NULL;
+        ok = write_test_reftable(path, 1, gen, nr, &layouts[i]) == 0 &&
+             reftable_stack_open(gendir, HASH_SHA1, &st) == 0 &&
+             check_reftable_seeks(st, gen, nr);
+        if (!ok)
+            printf("reftable layout %zu failed\n", i);
+        reftable_stack_free(st);
+    }
+
+    const char *files[] = { "reftable/tables.list", "reftable/2.ref", "reftable/1.ref",
+                            "reftable", "gen/reftable/tables.list", "gen/reftable/1.ref",
+                            "gen/reftable", "gen", "" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(*files); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        if (unlink(path) < 0)
+            rmdir(path);
+    }
+    return ok ? 0 : 1;
+}
+
+int unit_test_ref_transaction(void)
+{
+    printf("unit_test_ref_transaction\n");
+
+    struct ref_transaction_options loose = { 0, 1, "T <t@t>" }, packed = { 2, 0, NULL };
+    struct object_id c1, c2, blob, zero, oid;
+    struct ref_transaction *tx;
+    struct repository repo;
+    char dir[64], path[256];
+    struct stat st;
+    int ok = 1;
+
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_ref_transaction.%d", (int)getpid());
+    mkdir(dir, 0755);
+    snprintf(path, sizeof(path), "%s/objects", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/refs", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/refs/heads", dir);
+    mkdir(path, 0755);
+
+    memset(&repo, 0, sizeof(repo));
+    repo.gitdir = strdup(dir);
+    repo.hash_algo = HASH_SHA1;
+    memset(&zero, 0, sizeof(zero));
+    zero.algo = HASH_SHA1;
+    ok = write_test_file(dir, "HEAD", "ref: refs/heads/main\n") == 0 &&
+         write_test_object(&repo, OBJ_COMMIT, "one\n", 4, &c1) == 0 &&
+         write_test_object(&repo, OBJ_COMMIT, "two\n", 4, &c2) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "blob\n", 5, &blob) == 0;
+
+    /* loose: HEAD moves its unborn branch, and both get a reflog entry */
+    tx = ref_transaction_begin(&repo);
+    ok = ok && tx && ref_transaction_update(tx, "HEAD", &c1, &zero, "first") == 0 &&
+         ref_transaction_update(tx, "refs/tags/t", &blob, NULL, NULL) == 0 &&
+         ref_transaction_commit(tx, &loose) == 0;
+    ref_transaction_free(tx);
+    snprintf(path, sizeof(path), "%s/refs/heads/main", dir);
+    ok = ok && stat(path, &st) == 0 && refs_read_ref(&repo, "refs/heads/main", &oid) == 0 &&
+         oideq(&oid, &c1) && refs_read_ref(&repo, "refs/tags/t", &oid) == 0 && oideq(&oid, &blob);
+    snprintf(path, sizeof(path), "%s/logs/HEAD", dir);
+    ok = ok && stat(path, &st) == 0 && st.st_size > 0;
+
+    /* one stale old value and nothing is written; a blob is no branch */
+    tx = ref_transaction_begin(&repo);
+    ok = ok && tx && ref_transaction_update(tx, "refs/heads/main", &c2, &c2, NULL) == 0 &&
+         ref_transaction_update(tx, "refs/heads/other", &c2, NULL, NULL) == 0 &&
+         ref_transaction_commit(tx, NULL) < 0 &&
+         refs_read_ref(&repo, "refs/heads/other", &oid) < 0;
+    ref_transaction_free(tx);
+    tx = ref_transaction_begin(&repo);
+    ok = ok && tx && ref_transaction_update(tx, "refs/heads/b", &blob, NULL, NULL) == 0 &&
+         ref_transaction_commit(tx, NULL) < 0;
+    ref_transaction_free(tx);
+    snprintf(path, sizeof(path), "%s/refs/heads/main.lock", dir);
+    ok = ok && stat(path, &st) < 0;
+
+    /* a batch goes to packed-refs, and takes main's loose file with it */
+    tx = ref_transaction_begin(&repo);
+    ok = ok && tx && ref_transaction_update(tx, "refs/heads/main", &c2, &c1, NULL) == 0 &&
+         ref_transaction_update(tx, "refs/heads/p/q", &c1, NULL, NULL) == 0 &&
+         ref_transaction_commit(tx, &packed) == 0;
+    ref_transaction_free(tx);
+    snprintf(path, sizeof(path), "%s/refs/heads/main", dir);
+    ok = ok && stat(path, &st) < 0 && refs_read_ref(&repo, "HEAD", &oid) == 0 && oideq(&oid, &c2);
+    snprintf(path, sizeof(path), "%s/refs/heads/p", dir);
+    ok = ok && stat(path, &st) < 0 && refs_read_ref(&repo, "refs/heads/p/q", &oid) == 0;
+
+    /* refs/heads/p cannot be created over p/q; deleting p/q rewrites packed-refs */
+    tx = ref_transaction_begin(&repo);
+    ok = ok && tx && ref_transaction_update(tx, "refs/heads/p", &c1, NULL, NULL) == 0 &&
+         ref_transaction_commit(tx, NULL) < 0;
+    ref_transaction_free(tx);
+    tx = ref_transaction_begin(&repo);
+    ok = ok && tx && ref_transaction_update(tx, "refs/heads/p/q", &zero, &c1, NULL) == 0 &&
+         ref_transaction_commit(tx, NULL) == 0 &&
+         refs_read_ref(&repo, "refs/heads/p/q", &oid) < 0 &&
+         refs_read_ref(&repo, "refs/heads/main", &oid) == 0 && oideq(&oid, &c2);
+    ref_transaction_free(tx);
+
+    /*
+     * main is only packed now. Another writer holding main.lock keeps a
+     * batch off it; once that write lands as a loose file, the batch
+     * sees it and packs over it.
+     */
+    char hex[MAX_HEX_OID_LENGTH + 2], lock[256];
+    snprintf(lock, sizeof(lock), "%s/refs/heads/main.lock", dir);
+    snprintf(path, sizeof(path), "%s/refs/heads/main", dir);
+    snprintf(hex, sizeof(hex), "%s\n", oid_to_hex(&c1));
+    ok = ok && write_test_file(dir, "refs/heads/main.lock", hex) == 0;
+    tx = ref_transaction_begin(&repo);
+    ok = ok && tx && ref_transaction_update(tx, "refs/heads/main", &c1, &c2, NULL) == 0 &&
+         ref_transaction_update(tx, "refs/heads/n", &c1, NULL, NULL) == 0 &&
+         ref_transaction_commit(tx, &packed) < 0 &&
+         refs_read_ref(&repo, "refs/heads/n", &oid) < 0 && stat(lock, &st) == 0;
+    ref_transaction_free(tx);
+    ok = ok && rename(lock, path) == 0;
+    tx = ref_transaction_begin(&repo);
+    ok = ok && tx && ref_transaction_update(tx, "refs/heads/main", &c2, &c2, NULL) == 0 &&
+         ref_transaction_update(tx, "refs/heads/n", &c1, NULL, NULL) == 0 &&
+         ref_transaction_commit(tx, &packed) < 0;
+    ref_transaction_free(tx);
+    tx = ref_transaction_begin(&repo);
+    ok = ok && tx && ref_transaction_update(tx, "refs/heads/main", &c2, &c1, NULL) == 0 &&
+         ref_transaction_update(tx, "refs/heads/n", &c1, NULL, NULL) == 0 &&
+         ref_transaction_commit(tx, &packed) == 0 && stat(path, &st) < 0 &&
+         refs_read_ref(&repo, "refs/heads/main", &oid) == 0 && oideq(&oid, &c2) &&
+         refs_read_ref(&repo, "refs/heads/n", &oid) == 0 && oideq(&oid, &c1);
+    ref_transaction_free(tx);
+
+    const struct object_id *objects[] = { &c1, &c2, &blob };
+    for (size_t i = 0; i < sizeof(objects) / sizeof(*objects); i++) {
+        char *file = repo_loose_object_path(&repo, objects[i]);
+        if (file) {
+            unlink(file);
+            *strrchr(file, '/') = '\0';
+            rmdir(file);
+        }
+        free(file);
+    }
+    repo_clear(&repo);
+    const char *files[] = { "logs/refs/tags/t", "logs/refs/heads/main", "logs/refs/tags",
+                            "logs/refs/heads", "logs/refs", "logs/HEAD", "logs",
+                            "refs/tags/t", "refs/tags", "refs/heads", "refs", "objects",
+                            "packed-refs", "HEAD", "" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(*files); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        if (unlink(path) < 0)
+            rmdir(path);
+    }
+    return ok ? 0 : 1;
+}
+
+/* Whether the file <dir>/<name> contains [needle]. */
+static int test_file_contains(const char *dir, const char *name, const char *needle)
+{
+    char path[256], buf[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return strstr(buf, needle) != NULL;
+}
+
+/* [value] is NULL and [want] is, or both are the same string. */
+static int config_is(struct repository *repo, const char *key, const char *want)
+{
+    char *value = repo_config_get_string(repo, key);
+    int ok = want ? value && !strcmp(value, want) : !value;
+    if (!ok)
+        printf("%s is \"%s\"\n", key, value ? value : "(unset)");
+    free(value);
+    return ok;
+}
+
+int unit_test_config(void)
+{
+    printf("unit_test_config\n");
+
+    static const char *const vars[] = {
+        "HOME", "XDG_CONFIG_HOME", "GIT_COMMITTER_NAME", "GIT_COMMITTER_EMAIL",
+    };
+    char *saved[4];
+    struct repository repo;
+    struct ref_transaction_options opts = { 0, 1, NULL };
+    struct ref_transaction *tx;
+    struct object_id c1, c2;
+    char dir[64], home[96];
+    int ok;
+
+    for (int i = 0; i < 4; i++) {
+        saved[i] = getenv(vars[i]) ? strdup(getenv(vars[i])) : NULL;
+        unsetenv(vars[i]);
+    }
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_config.%d", (int)getpid());
+    snprintf(home, sizeof(home), "%s/home", dir);
+    setenv("HOME", home, 1);
+    ok = make_test_repo(dir, &repo) == 0 && mkdir(home, 0755) == 0 &&
+         write_test_file(dir, "config",
+                         "[core]\n\trepositoryformatversion = 0\n\tbare\n"
+                         "[User]\n\tName = First ; replaced below\n"
+                         "[user \"sub\"]\n\tname = Wrong\n"
+                         "[user]\n\tname = Config Name\n\temail = a@example.com\n"
+                         "\temailish = no\n"
+                         "[alias] greet = \"  hi \\\"there\\\"\\t\" # comment\n") == 0 &&
+         write_test_file(home, ".gitconfig",
+                         "[user]\n\temail = home@example.com\n\tsigningkey = k\n") == 0;
+
+    /* the repository's config over ~/.gitconfig, and its last value */
+    ok = ok && config_is(&repo, "user.name", "Config Name") &&
+         config_is(&repo, "USER.EMAIL", "a@example.com") &&
+         config_is(&repo, "user.signingkey", "k") &&
+         config_is(&repo, "core.bare", "true") &&
+         config_is(&repo, "alias.greet", "  hi \"there\"\t") &&
+         config_is(&repo, "user.missing", NULL) && config_is(&repo, "user", NULL);
+
+    /* reflog entries go under the configured name, unless the environment has one */
+    ok = ok && write_test_object(&repo, OBJ_COMMIT, "one\n", 4, &c1) == 0 &&
+         write_test_object(&repo, OBJ_COMMIT, "two\n", 4, &c2) == 0;
+    tx = ref_transaction_begin(&repo);
+    ok = ok && tx && ref_transaction_update(tx, "refs/heads/main", &c1, NULL, "one") == 0 &&
+         ref_transaction_commit(tx, &opts) == 0 &&
+         test_file_contains(dir, "logs/refs/heads/main", " Config Name <a@example.com> ");
+    ref_transaction_free(tx);
+    setenv("GIT_COMMITTER_NAME", "Env Name", 1);
+    tx = ref_transaction_begin(&repo);
+    ok = ok && tx && ref_transaction_update(tx, "refs/heads/main", &c2, &c1, "two") == 0 &&
+         ref_transaction_commit(tx, &opts) == 0 &&
+         test_file_contains(dir, "logs/refs/heads/main", " Env Name <a@example.com> ");
+    ref_transaction_free(tx);
+    if (!ok)
+        printf("config or reflog identity wrong\n");
+
+    for (int i = 0; i < 4; i++) {
+        if (saved[i])
+            setenv(vars[i], saved[i], 1);
+        else
+            unsetenv(vars[i]);
+        free(saved[i]);
+    }
+    repo_clear(&repo);
+    remove_test_dir(dir);
+    return ok ? 0 : 1;
+}
+
+/* The reason fsck gave for [oid] in [problems], or NULL. */
+static const char *fsck_reason(const struct fsck_problem *problems, size_t nr,
+                               const struct object_id *oid)
+{
+    for (size_t i = 0; i < nr; i++)
+        if (oideq(&problems[i].oid, oid))
+            return problems[i].reason;
+    return NULL;
+}
+
+int unit_test_fsck(void)
+{
+    printf("unit_test_fsck\n");
+
+    const char *const packed[] = { "packed one\n", "packed two\n" };
+    struct object_id blob, tree, commit, moved, fake, bad, absent, odd, pack_oids[2];
+    struct fsck_options opts = FSCK_OPTIONS_INIT;
+    struct fsck_report report = { 0 };
+    struct repository repo;
+    char dir[64], *from = NULL, *to = NULL;
+    int ok;
+
+    opts.nr_threads = 2;
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_fsck.%d", (int)getpid());
+    ok = make_test_repo(dir, &repo) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "hello\n", 6, &blob) == 0;
+    if (ok) {
+        const struct test_tree_entry entries[] = { { "100644", "hello", &blob } };
+        ok = write_test_tree(&repo, entries, 1, &tree) == 0 &&
+             write_test_commit(&repo, &tree, NULL, 0, 1000, "root", &commit) == 0;
+    }
+
+    /* loose and packed objects that all check out */
+    repo_clear(&repo);
+    ok = ok && write_test_pack(dir, packed, 2, pack_oids) == 0 && repo_open(&repo, dir) == 0 &&
+         fsck_repository(&repo, &opts, &report) == 0 &&
+         report.nr_objects == 5 && report.nr_loose == 3 && report.nr_packed == 2 &&
+         report.nr_by_type[OBJ_BLOB] == 3 && !report.nr_bad && !report.nr_missing &&
+         !report.nr_bad_packs && !report.nr_warnings;
+    fsck_report_clear(&report);
+
+    /*
+     * A blob stored under another id, a commit that does not parse, a
+     * tree pointing at an object that is not there, one with entry
+     * names git warns about, and a pack with a wrong trailer.
+     */
+    unsigned char raw[SHA_DIGEST_LENGTH];
+    memset(raw, 0x11, sizeof(raw));
+    oid_set_raw(&fake, raw, HASH_SHA1);
+    memset(raw, 0x22, sizeof(raw));
+    oid_set_raw(&absent, raw, HASH_SHA1);
+    ok = ok && write_test_object(&repo, OBJ_BLOB, "moved\n", 6, &moved) == 0 &&
+         write_test_object(&repo, OBJ_COMMIT, "hello\n", 6, &bad) == 0 &&
+         (from = repo_loose_object_path(&repo, &moved)) != NULL &&
+         (to = repo_loose_object_path(&repo, &fake)) != NULL;
+    if (ok) {
+        const struct test_tree_entry entries[] = {
+            { "40000", "..", &tree }, { "100644", ".GIT", &blob },
+            { "100644", "a/b", &absent }, { "100644", "ok", &blob },
+        };
+        char sub[128];
+        snprintf(sub, sizeof(sub), "%s/objects/11", dir);
+        ok = (mkdir(sub, 0755) == 0 || errno == EEXIST) && rename(from, to) == 0 &&
+             write_test_tree(&repo, entries, 4, &odd) == 0;
+    }
+    if (ok) {
+        char path[128];
+        snprintf(path, sizeof(path), "%s/objects/pack/pack-test.pack", dir);
+        FILE *f = fopen(path, "r+b");
+        ok = f && fseek(f, -1, SEEK_END) == 0;
+        int c = ok ? fgetc(f) : EOF;
+        ok = ok && c != EOF && fseek(f, -1, SEEK_END) == 0 && fputc(c ^ 1, f) != EOF;
+        if (f)
+            ok = !fclose(f) && ok;
+    }
+    repo_clear(&repo);
+    ok = ok && repo_open(&repo, dir) == 0 && fsck_repository(&repo, &opts, &report) == 1 &&
+         report.nr_bad == 2 && report.nr_missing == 1 && report.nr_bad_packs == 1 &&
+         report.nr_warnings == 3;
+    if (ok) {
+        const char *mismatch = fsck_reason(report.bad, report.nr_bad, &fake);
+        const char *malformed = fsck_reason(report.bad, report.nr_bad, &bad);
+        ok = mismatch && !strcmp(mismatch, "hash mismatch") &&
+             malformed && !strcmp(malformed, "malformed commit") &&
+             oideq(&report.missing[0].oid, &absent) &&
+             oideq(&report.missing[0].referenced_by, &odd) &&
+             !strcmp(report.bad_packs[0].reason, "checksum mismatch");
+        /* one warning of each kind for the tree */
+        const char *want[] = { "hasDotdot: contains '..'", "hasDotgit: contains '.git'",
+                               "fullPathname: contains full pathnames" };
+        for (size_t i = 0; i < 3 && ok; i++) {
+            size_t j = 0;
+            while (j < 3 && strcmp(report.warnings[j].reason, want[i]))
+                j++;
+            ok = j < 3 && oideq(&report.warnings[j].oid, &odd);
+        }
+        if (!ok)
+            printf("fsck reported the wrong problems\n");
+    }
+    fsck_report_clear(&report);
+
+    free(from);
+    free(to);
+    repo_clear(&repo);
+    remove_test_dir(dir);
+    return ok ? 0 : 1;
+}
+
+int unit_test_pack(void)
+{
+    printf("unit_test_pack\n");
+
+    /* copy "hello ", insert "there ", copy "world" */
+    const unsigned char base[] = "hello world";
+    const unsigned char delta[] = {
+        11, 17,
+        0x90, 6,
+        6, 't', 'h', 'e', 'r', 'e', ' ',
+        0x91, 6, 5,
+    };
+    size_t size;
+
+    char *out = patch_delta(base, 11, delta, sizeof(delta), &size);
+    int ok = out && size == 17 && strcmp(out, "hello there world") == 0;
+    free(out);
+
+    /* a delta for a different base size must be refused */
+    if (!ok || patch_delta(base, 10, delta, sizeof(delta), &size) != NULL) {
+        printf("patch_delta failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+int unit_test_tag(void)
+{
+    printf("unit_test_tag\n");
+
+    const char *buf =
+        "object 112fec3b8d4b0b06d113b62579ded07b3a9e8574\n"
+        "type commit\n"
+        "tag v1.0\n"
+        "tagger T Agger <tagger@example.com> 1700000200 +0000\n"
+        "\n"
+        "Release 1.0\n";
+
+    struct tag_object tag = {0};
+    if (parse_tag_buffer(&tag, buf, strlen(buf), HASH_SHA1) != 0) {
+        printf("parse_tag_buffer failed\n");
+        return 1;
+    }
+
+    if (tag.target_type != OBJ_COMMIT ||
+        tag.tag_name.len != 4 || memcmp(tag.tag_name.ptr, "v1.0", 4) != 0 ||
+        tag.tagger.timestamp != 1700000200 ||
+        tag.message.len != strlen("Release 1.0\n")) {
+        printf("tag fields parsed incorrectly\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* An annotated tag [name] of [target], of type [type]. */
+static int write_test_tag(struct repository *repo, const struct object_id *target,
+                          enum object_type type, const char *name, struct object_id *oid)
+{
+    char buf[512], hex[MAX_HEX_OID_LENGTH + 1];
+    int len = snprintf(buf, sizeof(buf),
+                       "object %s\ntype %s\ntag %s\ntagger T <t@example.com> 0 +0000\n\n%s\n",
+                       oid_to_hex_r(hex, target), type_name(type), name, name);
+    return write_test_object(repo, OBJ_TAG, buf, len, oid);
+}
+
+int unit_test_peel(void)
+{
+    printf("unit_test_peel\n");
+
+    struct object_id blob, tree, commit, inner, outer, peeled, absent = { { 0 } };
+    const struct object_id *tags[] = { &outer, &inner };
+    struct repository repo;
+    enum object_type type;
+    char dir[64];
+    int ok;
+
+    snprintf(dir, sizeof(dir), "/tmp/unit_test_peel.%d", (int)getpid());
+    ok = make_test_repo(dir, &repo) == 0 &&
+         write_test_object(&repo, OBJ_BLOB, "hello\n", 6, &blob) == 0;
+    if (ok) {
+        const struct test_tree_entry entries[] = { { "100644", "hello", &blob } };
+        ok = write_test_tree(&repo, entries, 1, &tree) == 0 &&
+             write_test_commit(&repo, &tree, NULL, 0, 1000, "root", &commit) == 0 &&
+             write_test_tag(&repo, &commit, OBJ_COMMIT, "inner", &inner) == 0 &&
+             write_test_tag(&repo, &inner, OBJ_TAG, "outer", &outer) == 0;
+    }
+
+    /* a tag of a tag peels to the commit, and both tags are cached */
+    ok = ok && peel_object(&repo, &outer, &peeled, &type) == 0 &&
+         oideq(&peeled, &commit) && type == OBJ_COMMIT &&
+         oidmap_get(&repo.peel_cache, &outer) && oidmap_get(&repo.peel_cache, &inner) &&
+         oidmap_get(&repo.peel_cache, &commit);
+
+    /* with the tags gone from disk, only the cache can answer */
+    for (size_t i = 0; i < 2 && ok; i++) {
+        char *path = repo_loose_object_path(&repo, tags[i]);
+        ok = path && unlink(path) == 0;
+        free(path);
+    }
+    for (size_t i = 0; i < 2 && ok; i++) {
+        memset(&peeled, 0, sizeof(peeled));
+        ok = peel_object(&repo, tags[i], &peeled, &type) == 0 &&
+             oideq(&peeled, &commit) && type == OBJ_COMMIT;
+    }
+
+    /* anything else peels to itself; a missing object does not peel */
+    ok = ok && peel_object(&repo, &tree, &peeled, &type) == 0 &&
+         oideq(&peeled, &tree) && type == OBJ_TREE &&
+         peel_object(&repo, &blob, &peeled, &type) == 0 &&
+         oideq(&peeled, &blob) && type == OBJ_BLOB;
+    absent.algo = HASH_SHA1;
+    absent.hash[0] = 0x33;
+    ok = ok && peel_object(&repo, &absent, &peeled, &type) < 0;
+
+    repo_clear(&repo);
+    remove_test_dir(dir);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
 {
+    /* "a.out fsck ..." runs a command; no arguments runs the tests */
+    if (argc > 1 && strcmp(argv[1], "fsck") == 0)
+        return cmd_fsck(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "rev-list") == 0)
+        return cmd_rev_list(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "merge-base") == 0)
+        return cmd_merge_base(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "ahead-behind") == 0)
+        return cmd_ahead_behind(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "grep") == 0)
+        return cmd_grep(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "diff-tree") == 0)
+        return cmd_diff_tree(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "checkout") == 0)
+        return cmd_checkout(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "ls-files") == 0)
+        return cmd_ls_files(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "update-index") == 0)
+        return cmd_update_index(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "status") == 0)
+        return cmd_status(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "hash-object") == 0)
+        return cmd_hash_object(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "show-ref") == 0)
+        return cmd_show_ref(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "update-ref") == 0)
+        return cmd_update_ref(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "convert-objects") == 0)
+        return cmd_convert_objects(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "translate-oid") == 0)
+        return cmd_translate_oid(argc - 1, argv + 1);
+
+
 //    if (unit_test_empty() != 0) {
 //         printf("unit_test_empty failed\n");
 //         return 1;
@@ -107,6 +3122,126 @@ int main(void)
         printf("unit_test_SINGLE_BRANCH failed\n");
         return 1;
     }
+    if (unit_test_ram() != 0) {
+        printf("unit_test_ram failed\n");
+        return 1;
+    }
+    if (unit_test_tree() != 0) {
+        printf("unit_test_tree failed\n");
+        return 1;
+    }
+    if (unit_test_commit() != 0) {
+        printf("unit_test_commit failed\n");
+        return 1;
+    }
+    if (unit_test_hex() != 0) {
+        printf("unit_test_hex failed\n");
+        return 1;
+    }
+    if (unit_test_hash() != 0) {
+        printf("unit_test_hash failed\n");
+        return 1;
+    }
+    if (unit_test_hash_batch() != 0) {
+        printf("unit_test_hash_batch failed\n");
+        return 1;
+    }
+    if (unit_test_scan_memmem() != 0) {
+        printf("unit_test_scan_memmem failed\n");
+        return 1;
+    }
+    if (unit_test_scanner() != 0) {
+        printf("unit_test_scanner failed\n");
+        return 1;
+    }
+    if (unit_test_fsck() != 0) {
+        printf("unit_test_fsck failed\n");
+        return 1;
+    }
+    if (unit_test_compat_map() != 0) {
+        printf("unit_test_compat_map failed\n");
+        return 1;
+    }
+    if (unit_test_prio_queue() != 0) {
+        printf("unit_test_prio_queue failed\n");
+        return 1;
+    }
+    if (unit_test_commit_reach() != 0) {
+        printf("unit_test_commit_reach failed\n");
+        return 1;
+    }
+    if (unit_test_rev_walk() != 0) {
+        printf("unit_test_rev_walk failed\n");
+        return 1;
+    }
+    if (unit_test_reachable() != 0) {
+        printf("unit_test_reachable failed\n");
+        return 1;
+    }
+    if (unit_test_pathspec() != 0) {
+        printf("unit_test_pathspec failed\n");
+        return 1;
+    }
+    if (unit_test_grep() != 0) {
+        printf("unit_test_grep failed\n");
+        return 1;
+    }
+    if (unit_test_tree_diff() != 0) {
+        printf("unit_test_tree_diff failed\n");
+        return 1;
+    }
+    if (unit_test_line_diff() != 0) {
+        printf("unit_test_line_diff failed\n");
+        return 1;
+    }
+    if (unit_test_diff_rename() != 0) {
+        printf("unit_test_diff_rename failed\n");
+        return 1;
+    }
+    if (unit_test_checkout() != 0) {
+        printf("unit_test_checkout failed\n");
+        return 1;
+    }
+    if (unit_test_index() != 0) {
+        printf("unit_test_index failed\n");
+        return 1;
+    }
+    if (unit_test_status() != 0) {
+        printf("unit_test_status failed\n");
+        return 1;
+    }
+    if (unit_test_hash_object() != 0) {
+        printf("unit_test_hash_object failed\n");
+        return 1;
+    }
+    if (unit_test_refs() != 0) {
+        printf("unit_test_refs failed\n");
+        return 1;
+    }
+    if (unit_test_reftable() != 0) {
+        printf("unit_test_reftable failed\n");
+        return 1;
+    }
+    if (unit_test_ref_transaction() != 0) {
+        printf("unit_test_ref_transaction failed\n");
+        return 1;
+    }
+    if (unit_test_config() != 0) {
+        printf("unit_test_config failed\n");
+        return 1;
+    }
+    if (unit_test_pack() != 0) {
+        printf("unit_test_pack failed\n");
+        return 1;
+    }
+    if (unit_test_tag() != 0) {
+        printf("unit_test_tag failed\n");
+        return 1;
+    }
+    if (unit_test_peel() != 0) {
+        printf("unit_test_peel failed\n");
+        return 1;
+    }
     // if (test_ram() != 0) {
     //     printf("test_ram failed\n");
     //     return 1;
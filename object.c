@@ -1,5 +1,8 @@
 #include <stdlib.h>
 #include "object.h"
+#include "tree.h"
+#include "commit.h"
+#include "tag.h"
 #include <string.h>
 
 void blob_free(struct blob_object *b) {
@@ -9,30 +12,48 @@ void blob_free(struct blob_object *b) {
 }
 
 void tree_free(struct tree_object *t) {
-    if (!t) return;
-    for (size_t i = 0; i < t->entry_count; i++) {
-        free(t->entries[i].name);
-    }
-    free(t->entries);
+    /* packed trees are a single allocation */
     free(t);
 }
 
 void commit_free(struct commit_object *c) {
     if (!c) return;
     free(c->parents);
-    free(c->author);
-    free(c->message);
+    free(c->buffer);
     free(c);
 }
 
 void tag_free(struct tag_object *t) {
     if (!t) return;
-    free(t->tag_name);
-    free(t->tagger);
-    free(t->message);
+    free(t->buffer);
     free(t);
 }
 
+static const char *const object_type_names[] = {
+    [OBJ_NONE]   = NULL,
+    [OBJ_COMMIT] = "commit",
+    [OBJ_TREE]   = "tree",
+    [OBJ_BLOB]   = "blob",
+    [OBJ_TAG]    = "tag",
+};
+
+enum object_type type_from_string(const char *str, size_t len)
+{
+    for (int i = OBJ_COMMIT; i <= OBJ_TAG; i++) {
+        if (strlen(object_type_names[i]) == len &&
+            memcmp(object_type_names[i], str, len) == 0)
+            return (enum object_type)i;
+    }
+    return OBJ_NONE;
+}
+
+const char *type_name(enum object_type type)
+{
+    if (type < OBJ_COMMIT || type > OBJ_TAG)
+        return "none";
+    return object_type_names[type];
+}
+
 void object_free(struct object *obj)
 {
     if (!obj) return;
@@ -79,15 +100,21 @@ struct object *object_clone(const struct object *src)
     }
 
     case OBJ_COMMIT:
-        /* TODO: deep copy commit fields */
+        dst->as.commit = commit_clone(src->as.commit);
+        if (!dst->as.commit)
+            goto fail;
         break;
 
     case OBJ_TREE:
-        /* TODO */
+        dst->as.tree = tree_clone(src->as.tree);
+        if (!dst->as.tree)
+            goto fail;
         break;
 
     case OBJ_TAG:
-        /* TODO */
+        dst->as.tag = tag_clone(src->as.tag);
+        if (!dst->as.tag)
+            goto fail;
         break;
 
     default:
@@ -2,6 +2,8 @@
 #define OBJECT_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <openssl/sha.h>
 
 
@@ -13,14 +15,40 @@
 
 /* Max hash size we support (SHA-256) */
 #define HASH256_DIGEST_LENGTH 65 /* e.g., SHA-256 in hex + null terminator */
-#define HASH1_DIGEST_LENGTH 41. /* e.g., SHA-1 in hex + null terminator */
+#define HASH1_DIGEST_LENGTH 41 /* e.g., SHA-1 in hex + null terminator */
 #define MAX_OBJECT_ID_LENGTH HASH256_DIGEST_LENGTH
 
+/* Widest raw (binary) object id we support (SHA-256) */
+#define MAX_RAW_OID_LENGTH 32
 
+
+/*
+ * Object ids are kept in binary form; use hex.h to convert them from and
+ * to text. [algo] records the width (a hash_algo_t, 0 while unset) and
+ * unused trailing bytes of [hash] are always zero.
+ */
 struct object_id {
-    unsigned char hash[MAX_OBJECT_ID_LENGTH];
+    unsigned char hash[MAX_RAW_OID_LENGTH];
+    int algo;
 };
 
+/* Object ids are compared over the whole (zero padded) array. */
+static inline int oideq(const struct object_id *a, const struct object_id *b)
+{
+    return memcmp(a->hash, b->hash, sizeof(a->hash)) == 0;
+}
+
+/*
+ * Hash-table hash of an object id. The id is already a cryptographic
+ * hash, so its leading bytes are as good as any mixing function.
+ */
+static inline unsigned int oidhash(const struct object_id *oid)
+{
+    unsigned int h;
+    memcpy(&h, oid->hash, sizeof(h));
+    return h;
+}
+
 
 /*
  * ============================================================
@@ -46,7 +74,18 @@ enum object_flags {
     OBJ_FLAG_NONE   = 0,
     OBJ_FLAG_SEEN   = 1 << 0,
     OBJ_FLAG_MARKED = 1 << 1,
-    OBJ_FLAG_BAD    = 1 << 2
+    OBJ_FLAG_BAD    = 1 << 2,
+
+    /* history walks (revision.h) */
+    OBJ_FLAG_UNINTERESTING = 1 << 3,    /* reachable from an excluded tip */
+    OBJ_FLAG_WALKED        = 1 << 4,    /* popped, parents queued */
+
+    /* ancestry queries (commit_reach.h), cleared after each one */
+    OBJ_FLAG_PARENT1 = 1 << 5,          /* reachable from the first side */
+    OBJ_FLAG_PARENT2 = 1 << 6,          /* reachable from the other side */
+    OBJ_FLAG_STALE   = 1 << 7,          /* below a common ancestor found */
+    OBJ_FLAG_RESULT  = 1 << 8,          /* collected as a merge base */
+    OBJ_FLAG_QUEUED  = 1 << 9           /* in the query's queue */
 };
 
 /*
@@ -62,33 +101,83 @@ struct blob_object {
 };
 
 /* ---------- Tree ---------- */
-struct tree_entry {
-    char *name;
-    enum object_type type;   /* blob or tree */
-    struct object_id oid;
-};
-
+/*
+ * Trees are stored packed (struct-of-arrays) in a single allocation:
+ * the struct itself is followed by the name offsets, the modes, the
+ * raw OIDs and finally the name arena. Walking a tree therefore only
+ * touches contiguous memory. Use the accessors in tree.h.
+ */
 struct tree_object {
     size_t entry_count;
-    struct tree_entry *entries;
+    size_t alloc_size;          /* bytes in the single allocation */
+    size_t oid_len;             /* raw OID width: 20 or 32 bytes */
+    uint32_t *name_offsets;     /* entry_count + 1 offsets into names */
+    uint16_t *modes;            /* numeric mode, e.g. 0100644 */
+    unsigned char *oids;        /* entry_count * oid_len raw bytes */
+    char *names;                /* NUL-terminated names back to back */
 };
 
 /* ---------- Commit ---------- */
+
+/* A byte range inside an object's buffer (not NUL-terminated). */
+struct slice {
+    const char *ptr;
+    size_t len;
+};
+
+/* "Name <email> 1700000000 +0100" */
+struct ident {
+    struct slice name;
+    struct slice email;
+    int64_t timestamp;          /* seconds since the epoch */
+    int tz;                     /* e.g. -0700 is stored as -700 */
+};
+
+/* Move slices from one copy of an object buffer onto another. */
+static inline void slice_rebase(struct slice *s, const char *old_base, char *new_base)
+{
+    if (s->ptr)
+        s->ptr = new_base + (s->ptr - old_base);
+}
+
+static inline void ident_rebase(struct ident *id, const char *old_base, char *new_base)
+{
+    slice_rebase(&id->name, old_base, new_base);
+    slice_rebase(&id->email, old_base, new_base);
+}
+
+/*
+ * Commits keep their inflated buffer and describe it with slices, so
+ * the only allocation made while parsing is the parents array.
+ */
 struct commit_object {
+    char *buffer;               /* owned; every slice points into it */
+    size_t buffer_len;
+
     struct object_id tree;
-    struct object_id *parents;
+    struct object_id *parents;  /* NULL for a root commit */
     size_t parent_count;
-    char *author;
-    char *message;
+
+    struct ident author;
+    struct ident committer;
+
+    struct slice encoding;      /* value of "encoding", if present */
+    struct slice gpgsig;        /* "gpgsig" value, continuation lines included */
+    struct slice extra_headers; /* raw header lines after "committer" */
+    struct slice message;       /* everything after the blank line */
 };
 
 /* ---------- Tag ---------- */
+/* Like commits, tags own their buffer and expose slices of it. */
 struct tag_object {
+    char *buffer;               /* owned; every slice points into it */
+    size_t buffer_len;
+
     struct object_id target;
     enum object_type target_type;
-    char *tag_name;
-    char *tagger;
-    char *message;
+    struct slice tag_name;
+    struct ident tagger;        /* all zero if the tag has no tagger */
+    struct slice message;       /* includes a trailing signature, if any */
 };
 
 /*
@@ -113,6 +202,10 @@ struct object {
 
 
 
+/* "commit", "tree", "blob" or "tag" -> OBJ_*, anything else -> OBJ_NONE */
+enum object_type type_from_string(const char *str, size_t len);
+const char *type_name(enum object_type type);
+
 void object_free(struct object *obj);
 void blob_free(struct blob_object *b);
 void tree_free(struct tree_object *t);
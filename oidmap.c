@@ -0,0 +1,74 @@
+#include "oidmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+static struct oidmap_entry *find_slot(struct oidmap_entry *entries, size_t alloc,
+                                      const struct object_id *oid)
+{
+    size_t mask = alloc - 1;
+    size_t i = oidhash(oid) & mask;
+
+    /* linear probing; the table is never more than half full */
+    while (entries[i].data && !oideq(&entries[i].oid, oid))
+        i = (i + 1) & mask;
+    return &entries[i];
+}
+
+
+static int grow(struct oidmap *map)
+{
+    size_t alloc = map->alloc ? map->alloc * 2 : 64;
+    struct oidmap_entry *entries = calloc(alloc, sizeof(*entries));
+    if (!entries)
+        return -1;
+
+    for (size_t i = 0; i < map->alloc; i++) {
+        if (!map->entries[i].data)
+            continue;
+        *find_slot(entries, alloc, &map->entries[i].oid) = map->entries[i];
+    }
+
+    free(map->entries);
+    map->entries = entries;
+    map->alloc = alloc;
+    return 0;
+}
+
+
+void *oidmap_get(const struct oidmap *map, const struct object_id *oid)
+{
+    if (!map->alloc)
+        return NULL;
+    return find_slot(map->entries, map->alloc, oid)->data;
+}
+
+
+void *oidmap_put(struct oidmap *map, const struct object_id *oid, void *data)
+{
+    if (2 * (map->nr + 1) > map->alloc && grow(map) < 0)
+        return data;
+
+    struct oidmap_entry *slot = find_slot(map->entries, map->alloc, oid);
+    void *old = slot->data;
+    if (!old) {
+        slot->oid = *oid;
+        map->nr++;
+    }
+    slot->data = data;
+    return old;
+}
+
+
+void oidmap_clear(struct oidmap *map, int free_data)
+{
+    if (free_data) {
+        for (size_t i = 0; i < map->alloc; i++)
+            free(map->entries[i].data);
+    }
+    free(map->entries);
+    map->entries = NULL;
+    map->nr = 0;
+    map->alloc = 0;
+}
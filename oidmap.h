@@ -0,0 +1,37 @@
+#ifndef OIDMAP_H
+#define OIDMAP_H
+
+#include <stddef.h>
+#include "object.h"
+
+/*
+ * Open-addressing hash map from object id to a caller-owned pointer.
+ * Values must be non-NULL: an empty slot is one whose data is NULL.
+ */
+struct oidmap_entry {
+    struct object_id oid;
+    void *data;
+};
+
+struct oidmap {
+    struct oidmap_entry *entries;
+    size_t nr;          /* occupied slots */
+    size_t alloc;       /* always a power of two, or 0 */
+};
+
+#define OIDMAP_INIT { NULL, 0, 0 }
+
+/* Returns the value stored for [oid], or NULL. */
+void *oidmap_get(const struct oidmap *map, const struct object_id *oid);
+
+/*
+ * Store [data] for [oid], replacing (and returning) any previous value.
+ * Returns NULL if there was none. On allocation failure the map is left
+ * unchanged and [data] itself is returned.
+ */
+void *oidmap_put(struct oidmap *map, const struct object_id *oid, void *data);
+
+/* Release the table; with [free_data] also free() every value. */
+void oidmap_clear(struct oidmap *map, int free_data);
+
+#endif /* OIDMAP_H */
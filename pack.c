@@ -0,0 +1,666 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pack.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include "log.h"
+#include "utl.h"
+
+/* Longest delta chain we follow before calling the pack corrupt. */
+#define MAX_DELTA_DEPTH 10000
+
+#define PACK_SIGNATURE  0x5041434b      /* "PACK" */
+#define IDX_SIGNATURE   0xff744f63      /* "\377tOc" */
+
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+           (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+    return (uint64_t)get_be32(p) << 32 | get_be32(p + 4);
+}
+
+
+static int parse_index(struct packed_git *p)
+{
+    const unsigned char *idx = p->idx_map;
+    size_t rawsz = p->rawsz;
+    size_t need;
+
+    if (p->idx_len >= 8 && get_be32(idx) == IDX_SIGNATURE) {
+        p->idx_version = get_be32(idx + 4);
+        if (p->idx_version != 2) {
+            ERROR("%s: unsupported index version %d", p->pack_path, p->idx_version);
+            return -1;
+        }
+        p->fanout = idx + 8;
+    } else {
+        p->idx_version = 1;
+        p->fanout = idx;
+    }
+
+    if ((size_t)(p->fanout - idx) + 256 * 4 > p->idx_len)
+        return -1;
+
+    /* the fanout must be monotonic; its last entry is the object count */
+    for (int i = 1; i < 256; i++) {
+        if (get_be32(p->fanout + 4 * i) < get_be32(p->fanout + 4 * (i - 1)))
+            return -1;
+    }
+    p->nr_objects = get_be32(p->fanout + 255 * 4);
+    p->oids = p->fanout + 256 * 4;
+
+    if (p->idx_version == 1) {
+        need = 256 * 4 + (size_t)p->nr_objects * (4 + rawsz) + 2 * rawsz;
+        return p->idx_len == need ? 0 : -1;
+    }
+
+    p->offsets = p->oids + (size_t)p->nr_objects * (rawsz + 4);
+    p->large_offsets = p->offsets + (size_t)p->nr_objects * 4;
+    need = 8 + 256 * 4 + (size_t)p->nr_objects * (rawsz + 8) + 2 * rawsz;
+    if (p->idx_len < need || (p->idx_len - need) % 8)
+        return -1;
+    p->nr_large_offsets = (p->idx_len - need) / 8;
+    return 0;
+}
+
+
+struct packed_git *pack_open(const char *idx_path, hash_algo_t algo)
+{
+    size_t len = strlen(idx_path);
+    if (len < 4 || strcmp(idx_path + len - 4, ".idx") != 0)
+        return NULL;
+
+    struct packed_git *p = calloc(1, sizeof(*p));
+    if (!p)
+        return NULL;
+    p->algo = algo;
+    p->rawsz = hash_algo_rawsz(algo);
+
+    p->pack_path = malloc(len + 2);
+    if (!p->pack_path)
+        goto fail;
+    memcpy(p->pack_path, idx_path, len - 4);
+    strcpy(p->pack_path + len - 4, ".pack");
+
+    p->idx_map = utl_map_file(idx_path, &p->idx_len);
+    if (!p->idx_map || parse_index(p) < 0) {
+        ERROR("%s: missing or corrupt pack index", idx_path);
+        goto fail;
+    }
+
+    p->pack_map = utl_map_file(p->pack_path, &p->pack_len);
+    if (!p->pack_map || p->pack_len < 12 + p->rawsz ||
+        get_be32(p->pack_map) != PACK_SIGNATURE) {
+        ERROR("%s: missing or corrupt pack", p->pack_path);
+        goto fail;
+    }
+
+    uint32_t version = get_be32(p->pack_map + 4);
+    if (version != 2 && version != 3) {
+        ERROR("%s: unsupported pack version %u", p->pack_path, version);
+        goto fail;
+    }
+    if (get_be32(p->pack_map + 8) != p->nr_objects) {
+        ERROR("%s: pack and index disagree on the object count", p->pack_path);
+        goto fail;
+    }
+    return p;
+
+fail:
+    pack_close(p);
+    return NULL;
+}
+
+void pack_close(struct packed_git *p)
+{
+    if (!p)
+        return;
+    if (p->idx_map)
+        munmap((void *)p->idx_map, p->idx_len);
+    if (p->pack_map)
+        munmap((void *)p->pack_map, p->pack_len);
+    free(p->pack_path);
+    free(p);
+}
+
+
+const unsigned char *pack_nth_oid(const struct packed_git *p, uint32_t n)
+{
+    if (p->idx_version == 1)
+        return p->oids + (size_t)n * (4 + p->rawsz) + 4;
+    return p->oids + (size_t)n * p->rawsz;
+}
+
+uint64_t pack_nth_offset(const struct packed_git *p, uint32_t n)
+{
+    if (p->idx_version == 1)
+        return get_be32(p->oids + (size_t)n * (4 + p->rawsz));
+
+    uint32_t off = get_be32(p->offsets + (size_t)n * 4);
+    if (!(off & 0x80000000u))
+        return off;
+
+    off &= 0x7fffffffu;
+    if (off >= p->nr_large_offsets)
+        return UINT64_MAX;     /* caught by the bounds check of the reader */
+    return get_be64(p->large_offsets + (size_t)off * 8);
+}
+
+int pack_find_entry(const struct packed_git *p, const unsigned char *oid,
+                    uint32_t *pos)
+{
+    uint32_t lo = oid[0] ? get_be32(p->fanout + 4 * (oid[0] - 1)) : 0;
+    uint32_t hi = get_be32(p->fanout + 4 * oid[0]);
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(oid, pack_nth_oid(p, mid), p->rawsz);
+        if (!cmp) {
+            *pos = mid;
+            return 1;
+        }
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return 0;
+}
+
+
+/* ---- delta base cache ---- */
+
+void delta_base_cache_init(struct delta_base_cache *cache, size_t limit)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->limit = limit;
+}
+
+void delta_base_cache_clear(struct delta_base_cache *cache)
+{
+    for (size_t i = 0; i < DELTA_CACHE_SLOTS; i++)
+        free(cache->slots[i].buf);
+    memset(cache->slots, 0, sizeof(cache->slots));
+    cache->bytes = 0;
+}
+
+static struct delta_cache_entry *cache_slot(struct delta_base_cache *cache,
+                                            const struct packed_git *p,
+                                            uint64_t offset)
+{
+    uint64_t h = (offset ^ (uintptr_t)p) * 0x9e3779b97f4a7c15ull;
+    return &cache->slots[h >> 56 & (DELTA_CACHE_SLOTS - 1)];
+}
+
+static struct delta_cache_entry *cache_lookup(struct delta_base_cache *cache,
+                                              const struct packed_git *p,
+                                              uint64_t offset)
+{
+    struct delta_cache_entry *e = cache_slot(cache, p, offset);
+    return e->buf && e->pack == p && e->offset == offset ? e : NULL;
+}
+
+/* Takes ownership of [buf], caching or freeing it. */
+static void cache_add(struct delta_base_cache *cache, const struct packed_git *p,
+                      uint64_t offset, enum object_type type,
+                      unsigned char *buf, size_t size)
+{
+    struct delta_cache_entry *e = cache_slot(cache, p, offset);
+
+    if (size > cache->limit / 4) {
+        free(buf);
+        return;
+    }
+
+    if (e->buf) {
+        cache->bytes -= e->size;
+        free(e->buf);
+        e->buf = NULL;
+    }
+
+    /* over budget: drop other entries, scanning from this slot on */
+    for (size_t i = 1; cache->bytes + size > cache->limit && i < DELTA_CACHE_SLOTS; i++) {
+        struct delta_cache_entry *victim = &cache->slots[(e - cache->slots + i) % DELTA_CACHE_SLOTS];
+        if (victim->buf) {
+            cache->bytes -= victim->size;
+            free(victim->buf);
+            victim->buf = NULL;
+        }
+    }
+
+    e->pack = p;
+    e->offset = offset;
+    e->type = type;
+    e->buf = buf;
+    e->size = size;
+    cache->bytes += size;
+}
+
+
+/* ---- reading entries ---- */
+
+struct entry_header {
+    int type;               /* OBJ_* or OBJ_OFS_DELTA / OBJ_REF_DELTA */
+    size_t size;            /* inflated size of the entry's data */
+    uint64_t data;          /* offset of the zlib stream */
+    uint64_t base;          /* OBJ_OFS_DELTA: offset of the base */
+    const unsigned char *base_oid;  /* OBJ_REF_DELTA: id of the base */
+};
+
+static int read_entry_header(const struct packed_git *p, uint64_t offset,
+                             struct entry_header *h)
+{
+    const unsigned char *map = p->pack_map;
+    uint64_t end = p->pack_len - p->rawsz;
+    uint64_t pos = offset;
+    unsigned shift = 4;
+
+    if (offset < 12 || offset >= end)
+        return -1;
+
+    unsigned char c = map[pos++];
+    h->type = (c >> 4) & 7;
+    h->size = c & 15;
+    while (c & 0x80) {
+        if (pos >= end || shift > 8 * sizeof(size_t) - 7)
+            return -1;
+        c = map[pos++];
+        h->size |= (size_t)(c & 0x7f) << shift;
+        shift += 7;
+    }
+
+    switch (h->type) {
+    case OBJ_COMMIT:
+    case OBJ_TREE:
+    case OBJ_BLOB:
+    case OBJ_TAG:
+        break;
+
+    case OBJ_OFS_DELTA: {
+        uint64_t rel;
+        if (pos >= end)
+            return -1;
+        c = map[pos++];
+        rel = c & 0x7f;
+        while (c & 0x80) {
+            if (pos >= end || rel >= (UINT64_MAX >> 7))
+                return -1;
+            c = map[pos++];
+            rel = ((rel + 1) << 7) | (c & 0x7f);
+        }
+        if (rel == 0 || rel > offset)
+            return -1;
+        h->base = offset - rel;
+        break;
+    }
+
+    case OBJ_REF_DELTA:
+        if (pos + p->rawsz > end)
+            return -1;
+        h->base_oid = map + pos;
+        pos += p->rawsz;
+        break;
+
+    default:
+        return -1;
+    }
+
+    h->data = pos;
+    return 0;
+}
+
+static unsigned char *inflate_entry(const struct packed_git *p, uint64_t data,
+                                    size_t size)
+{
+    unsigned char *out = malloc(size + 1);
+    if (!out)
+        return NULL;
+
+    z_stream strm = {0};
+    if (inflateInit(&strm) != Z_OK) {
+        free(out);
+        return NULL;
+    }
+
+    strm.next_in = (unsigned char *)p->pack_map + data;
+    uint64_t avail = p->pack_len - p->rawsz - data;
+    strm.avail_in = avail > UINT32_MAX ? UINT32_MAX : (uInt)avail;
+    strm.next_out = out;
+    strm.avail_out = (uInt)size;
+
+    int ret = inflate(&strm, Z_FINISH);
+    /* a zero-sized entry still has to end right there */
+    if (ret == Z_BUF_ERROR && strm.avail_out == 0 && size == 0) {
+        unsigned char dummy;
+        strm.next_out = &dummy;
+        strm.avail_out = 1;
+        ret = inflate(&strm, Z_FINISH);
+        if (strm.avail_out == 0)
+            ret = Z_DATA_ERROR;
+    }
+    inflateEnd(&strm);
+
+    if (ret != Z_STREAM_END || strm.total_out != size) {
+        free(out);
+        return NULL;
+    }
+    out[size] = '\0';
+    return out;
+}
+
+
+void *pack_read_object(struct packed_git *p, uint64_t offset,
+                       enum object_type *type, size_t *size,
+                       struct delta_base_cache *cache)
+{
+    uint64_t *chain = NULL;
+    size_t depth = 0, alloc = 0;
+    uint64_t cur = offset;
+    unsigned char *base = NULL;
+    size_t base_size = 0;
+    enum object_type base_type = OBJ_NONE;
+    int base_cached = 0;
+    struct entry_header h;
+
+    /* walk down to a cached or undeltified base, remembering the deltas */
+    for (;;) {
+        struct delta_cache_entry *hit = cache ? cache_lookup(cache, p, cur) : NULL;
+        if (hit) {
+            base = hit->buf;
+            base_size = hit->size;
+            base_type = hit->type;
+            base_cached = 1;
+            break;
+        }
+
+        if (read_entry_header(p, cur, &h) < 0)
+            goto fail;
+
+        if (h.type != OBJ_OFS_DELTA && h.type != OBJ_REF_DELTA) {
+            base = inflate_entry(p, h.data, h.size);
+            if (!base)
+                goto fail;
+            base_size = h.size;
+            base_type = (enum object_type)h.type;
+            break;
+        }
+
+        if (depth == MAX_DELTA_DEPTH)
+            goto fail;
+        if (depth == alloc) {
+            alloc = alloc ? 2 * alloc : 16;
+            uint64_t *tmp = realloc(chain, alloc * sizeof(*chain));
+            if (!tmp)
+                goto fail;
+            chain = tmp;
+        }
+        chain[depth++] = cur;
+
+        if (h.type == OBJ_OFS_DELTA) {
+            cur = h.base;
+        } else {
+            uint32_t pos;
+            if (!pack_find_entry(p, h.base_oid, &pos))
+                goto fail;      /* thin packs are not supported */
+            cur = pack_nth_offset(p, pos);
+        }
+    }
+
+    /* then apply the deltas back up to [offset] */
+    while (depth) {
+        uint64_t delta_off = chain[--depth];
+        if (read_entry_header(p, delta_off, &h) < 0)
+            goto fail;
+
+        unsigned char *delta = inflate_entry(p, h.data, h.size);
+        if (!delta)
+            goto fail;
+
+        size_t result_size;
+        unsigned char *result = patch_delta(base, base_size, delta, h.size,
+                                            &result_size);
+        free(delta);
+        if (!result)
+            goto fail;
+
+        /* the base we just used is likely to be a base again */
+        if (!base_cached) {
+            if (cache)
+                cache_add(cache, p, cur, base_type, base, base_size);
+            else
+                free(base);
+        }
+        base = result;
+        base_size = result_size;
+        base_cached = 0;
+        cur = delta_off;
+    }
+    free(chain);
+
+    if (base_cached) {
+        unsigned char *copy = malloc(base_size + 1);
+        if (!copy)
+            return NULL;
+        memcpy(copy, base, base_size + 1);
+        base = copy;
+    }
+
+    *type = base_type;
+    *size = base_size;
+    return base;
+
+fail:
+    if (!base_cached)
+        free(base);
+    free(chain);
+    ERROR("%s: corrupt entry at offset %llu", p->pack_path,
+          (unsigned long long)offset);
+    return NULL;
+}
+
+
+/* ---- deltas ---- */
+
+static int delta_varint(const unsigned char **pp, const unsigned char *end,
+                        size_t *out)
+{
+    const unsigned char *p = *pp;
+    size_t v = 0;
+    unsigned shift = 0;
+    unsigned char c;
+
+    do {
+        if (p >= end || shift > 8 * sizeof(size_t) - 7)
+            return -1;
+        c = *p++;
+        v |= (size_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    *pp = p;
+    *out = v;
+    return 0;
+}
+
+void *patch_delta(const unsigned char *base, size_t base_size,
+                  const unsigned char *delta, size_t delta_size,
+                  size_t *out_size)
+{
+    const unsigned char *p = delta, *end = delta + delta_size;
+    size_t src_size, dst_size;
+
+    if (delta_varint(&p, end, &src_size) < 0 || src_size != base_size ||
+        delta_varint(&p, end, &dst_size) < 0)
+        return NULL;
+
+    unsigned char *out = malloc(dst_size + 1);
+    if (!out)
+        return NULL;
+    unsigned char *dst = out, *dst_end = out + dst_size;
+
+    while (p < end) {
+        unsigned char op = *p++;
+
+        if (op & 0x80) {
+            /* copy from base: bits 0-3 select offset bytes, 4-6 size bytes */
+            size_t off = 0, len = 0;
+            for (int i = 0; i < 4; i++) {
+                if (op & (1 << i)) {
+                    if (p >= end)
+                        goto fail;
+                    off |= (size_t)*p++ << (8 * i);
+                }
+            }
+            for (int i = 0; i < 3; i++) {
+                if (op & (0x10 << i)) {
+                    if (p >= end)
+                        goto fail;
+                    len |= (size_t)*p++ << (8 * i);
+                }
+            }
+            if (!len)
+                len = 0x10000;
+            if (off > base_size || len > base_size - off ||
+                len > (size_t)(dst_end - dst))
+                goto fail;
+            memcpy(dst, base + off, len);
+            dst += len;
+        } else if (op) {
+            /* insert the next [op] literal bytes */
+            if (op > end - p || op > dst_end - dst)
+                goto fail;
+            memcpy(dst, p, op);
+            dst += op;
+            p += op;
+        } else {
+            goto fail;      /* opcode 0 is reserved */
+        }
+    }
+
+    if (dst != dst_end)
+        goto fail;
+    *dst = '\0';
+    *out_size = dst_size;
+    return out;
+
+fail:
+    free(out);
+    return NULL;
+}
+
+
+/* ---- object info ---- */
+
+/*
+ * Inflate just the start of the entry whose zlib stream begins at
+ * [data] into [out]. Returns how many bytes came out, or -1.
+ */
+static long inflate_entry_head(const struct packed_git *p, uint64_t data,
+                               unsigned char *out, size_t len)
+{
+    z_stream strm = {0};
+    if (inflateInit(&strm) != Z_OK)
+        return -1;
+
+    strm.next_in = (unsigned char *)p->pack_map + data;
+    uint64_t avail = p->pack_len - p->rawsz - data;
+    strm.avail_in = avail > UINT32_MAX ? UINT32_MAX : (uInt)avail;
+    strm.next_out = out;
+    strm.avail_out = (uInt)len;
+
+    int ret = inflate(&strm, Z_SYNC_FLUSH);
+    long have = (long)(len - strm.avail_out);
+    inflateEnd(&strm);
+    return ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR ? have : -1;
+}
+
+int pack_read_object_info(struct packed_git *p, uint64_t offset,
+                          enum object_type *type, size_t *size)
+{
+    struct entry_header h;
+    uint64_t cur = offset;
+    size_t depth = 0;
+
+    if (read_entry_header(p, cur, &h) < 0)
+        goto fail;
+
+    if (h.type != OBJ_OFS_DELTA && h.type != OBJ_REF_DELTA) {
+        *type = (enum object_type)h.type;
+        *size = h.size;
+        return 0;
+    }
+
+    /* the result size is the second varint of the delta itself */
+    unsigned char head[20];
+    long n = inflate_entry_head(p, h.data, head, sizeof(head));
+    const unsigned char *q = head;
+    size_t src_size;
+    if (n < 0 || delta_varint(&q, head + n, &src_size) < 0 ||
+        delta_varint(&q, head + n, size) < 0)
+        goto fail;
+
+    /* and the type is that of the base at the bottom of the chain */
+    while (h.type == OBJ_OFS_DELTA || h.type == OBJ_REF_DELTA) {
+        if (depth++ == MAX_DELTA_DEPTH)
+            goto fail;
+        if (h.type == OBJ_OFS_DELTA) {
+            cur = h.base;
+        } else {
+            uint32_t pos;
+            if (!pack_find_entry(p, h.base_oid, &pos))
+                goto fail;
+            cur = pack_nth_offset(p, pos);
+        }
+        if (read_entry_header(p, cur, &h) < 0)
+            goto fail;
+    }
+    *type = (enum object_type)h.type;
+    return 0;
+
+fail:
+    ERROR("%s: corrupt entry at offset %llu", p->pack_path,
+          (unsigned long long)offset);
+    return -1;
+}
+
+
+/* ---- checksums ---- */
+
+static int checksum_matches(hash_algo_t algo, const unsigned char *data,
+                            size_t len, const unsigned char *expect)
+{
+    struct hash_ctx ctx = HASH_CTX_INIT;
+    unsigned char digest[MAX_RAW_OID_LENGTH];
+    int ok = hash_init(&ctx, algo) == 0 &&
+             hash_update(&ctx, data, len) == 0 &&
+             hash_final(&ctx, digest) == 0 &&
+             memcmp(digest, expect, hash_algo_rawsz(algo)) == 0;
+    hash_ctx_release(&ctx);
+    return ok;
+}
+
+int pack_verify_checksums(const struct packed_git *p)
+{
+    size_t rawsz = p->rawsz;
+    const unsigned char *pack_sum = p->pack_map + p->pack_len - rawsz;
+
+    if (!checksum_matches(p->algo, p->pack_map, p->pack_len - rawsz, pack_sum)) {
+        ERROR("%s: pack checksum mismatch", p->pack_path);
+        return -1;
+    }
+    if (memcmp(p->idx_map + p->idx_len - 2 * rawsz, pack_sum, rawsz) != 0 ||
+        !checksum_matches(p->algo, p->idx_map, p->idx_len - rawsz,
+                          p->idx_map + p->idx_len - rawsz)) {
+        ERROR("%s: index checksum mismatch", p->pack_path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hash.h"
+#include "object.h"
+
+/*
+ * Read-only access to a packfile and its .idx (versions 1 and 2).
+ *
+ * Both files are mmapped. Objects are located through the index
+ * (fanout table + binary search) and read with pack_read_object(),
+ * which inflates the entry and resolves OFS_DELTA / REF_DELTA chains
+ * against the same pack. Nothing here writes, so one packed_git can be
+ * read from any number of threads as long as each brings its own
+ * delta_base_cache.
+ */
+struct packed_git {
+    struct packed_git *next;    /* repo->packs list */
+    char *pack_path;
+
+    hash_algo_t algo;
+    size_t rawsz;
+
+    const unsigned char *idx_map;
+    size_t idx_len;
+    const unsigned char *pack_map;
+    size_t pack_len;
+
+    uint32_t nr_objects;
+    int idx_version;
+    const unsigned char *fanout;        /* 256 big-endian counts */
+    const unsigned char *oids;          /* v2: sorted table; v1: entries */
+    const unsigned char *offsets;       /* v2: 32-bit offsets */
+    const unsigned char *large_offsets; /* v2: 64-bit offsets */
+    size_t nr_large_offsets;
+};
+
+/* Pack object types that only exist inside packs. */
+#define OBJ_OFS_DELTA 6
+#define OBJ_REF_DELTA 7
+
+/*
+ * Open [idx_path] and the .pack next to it. Returns NULL (after logging
+ * why) if either is missing, truncated or has an unsupported version.
+ */
+struct packed_git *pack_open(const char *idx_path, hash_algo_t algo);
+void pack_close(struct packed_git *p);
+
+/* The [n]th object id (in sorted order) and its offset in the pack. */
+const unsigned char *pack_nth_oid(const struct packed_git *p, uint32_t n);
+uint64_t pack_nth_offset(const struct packed_git *p, uint32_t n);
+
+/*
+ * Find the raw id [oid] in the index. Returns 1 and its position in
+ * *[pos], or 0 if the pack does not contain it.
+ */
+int pack_find_entry(const struct packed_git *p, const unsigned char *oid,
+                    uint32_t *pos);
+
+/*
+ * Recently used delta bases, keyed by (pack, offset). Resolving a long
+ * delta chain then only inflates the part that is not cached. Each
+ * thread needs its own cache.
+ */
+#define DELTA_CACHE_SLOTS 256
+
+struct delta_cache_entry {
+    const struct packed_git *pack;
+    uint64_t offset;
+    enum object_type type;
+    unsigned char *buf;
+    size_t size;
+};
+
+struct delta_base_cache {
+    struct delta_cache_entry slots[DELTA_CACHE_SLOTS];
+    size_t bytes;           /* sum of the cached sizes */
+    size_t limit;           /* evict to stay under this */
+};
+
+/* The [limit] each worker of a parallel command gives its cache. */
+#define DELTA_CACHE_WORKER_BYTES (16u << 20)
+
+void delta_base_cache_init(struct delta_base_cache *cache, size_t limit);
+void delta_base_cache_clear(struct delta_base_cache *cache);
+
+/*
+ * Read the object at [offset], resolving deltas. Returns the inflated
+ * body (NUL-terminated, caller frees) with its final type and size, or
+ * NULL if the entry is corrupt. [cache] may be NULL.
+ */
+void *pack_read_object(struct packed_git *p, uint64_t offset,
+                       enum object_type *type, size_t *size,
+                       struct delta_base_cache *cache);
+
+/*
+ * The final type and size of the object at [offset] without inflating
+ * it: only its header, the first bytes of a delta and the headers down
+ * its delta chain are read. Returns 0, or -1 if the entry is corrupt.
+ */
+int pack_read_object_info(struct packed_git *p, uint64_t offset,
+                          enum object_type *type, size_t *size);
+
+/*
+ * Check the trailing checksums of the pack and of its index, and that
+ * the index was written for this pack. Returns 0, or -1 on a mismatch.
+ */
+int pack_verify_checksums(const struct packed_git *p);
+
+/*
+ * Apply a git delta to [base]. Returns the result (NUL-terminated,
+ * caller frees) and its size, or NULL if the delta is malformed or was
+ * made for a base of a different size.
+ */
+void *patch_delta(const unsigned char *base, size_t base_size,
+                  const unsigned char *delta, size_t delta_size,
+                  size_t *out_size);
+
+#endif /* PACK_H */
@@ -0,0 +1,107 @@
+#include "pathspec.h"
+
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+int pathspec_init(struct pathspec *ps, const char *const *paths, size_t nr)
+{
+    ps->items = NULL;
+    ps->nr = 0;
+    if (!nr)
+        return 0;
+
+    ps->items = calloc(nr, sizeof(*ps->items));
+    if (!ps->items)
+        return -1;
+
+    for (size_t i = 0; i < nr; i++) {
+        const char *p = paths[i];
+        size_t len = strlen(p);
+
+        while (len > 1 && p[len - 1] == '/')
+            len--;
+        if (len == 1 && p[0] == '.') {
+            /* the whole tree */
+            pathspec_clear(ps);
+            return 0;
+        }
+
+        struct pathspec_item *item = &ps->items[ps->nr++];
+        item->match = strndup(p, len);
+        if (!item->match) {
+            pathspec_clear(ps);
+            return -1;
+        }
+        item->len = len;
+        item->nowildcard_len = strcspn(item->match, "*?[\\");
+    }
+    return 0;
+}
+
+void pathspec_clear(struct pathspec *ps)
+{
+    for (size_t i = 0; i < ps->nr; i++)
+        free(ps->items[i].match);
+    free(ps->items);
+    ps->items = NULL;
+    ps->nr = 0;
+}
+
+
+/* [path] is [prefix] itself or lies below it. */
+static int is_leading_dir(const char *prefix, size_t prefix_len,
+                          const char *path, size_t len)
+{
+    return len >= prefix_len && !memcmp(path, prefix, prefix_len) &&
+           (len == prefix_len || path[prefix_len] == '/');
+}
+
+int pathspec_match(const struct pathspec *ps, const char *path, size_t len)
+{
+    if (!ps || !ps->nr)
+        return 1;
+
+    for (size_t i = 0; i < ps->nr; i++) {
+        const struct pathspec_item *item = &ps->items[i];
+
+        if (item->nowildcard_len == item->len) {
+            if (is_leading_dir(item->match, item->len, path, len))
+                return 1;
+        } else if (len >= item->nowildcard_len &&
+                   !memcmp(path, item->match, item->nowildcard_len) &&
+                   !fnmatch(item->match, path, 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+enum pathspec_dir_match pathspec_match_dir(const struct pathspec *ps,
+                                           const char *dir, size_t len)
+{
+    enum pathspec_dir_match best = PATHSPEC_DIR_NONE;
+
+    if (!ps || !ps->nr)
+        return PATHSPEC_DIR_ALL;
+
+    for (size_t i = 0; i < ps->nr && best != PATHSPEC_DIR_ALL; i++) {
+        const struct pathspec_item *item = &ps->items[i];
+        size_t n = item->nowildcard_len;
+
+        if (n == item->len) {
+            if (is_leading_dir(item->match, item->len, dir, len))
+                best = PATHSPEC_DIR_ALL;            /* named, or below one */
+            else if (is_leading_dir(dir, len, item->match, item->len))
+                best = PATHSPEC_DIR_SOME;           /* names something inside */
+        } else {
+            /* "<dir>/" and the literal prefix must agree as far as both go */
+            size_t common = n < len ? n : len;
+            if (!memcmp(dir, item->match, common) &&
+                (n <= len || item->match[len] == '/'))
+                best = PATHSPEC_DIR_SOME;
+        }
+    }
+    return best;
+}
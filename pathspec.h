@@ -0,0 +1,42 @@
+#ifndef PATHSPEC_H
+#define PATHSPEC_H
+
+#include <stddef.h>
+
+/*
+ * Paths given on the command line to limit a command to part of the
+ * tree. An item without glob characters matches the path it names and
+ * everything below it; an item with them ("*.c", "src/test_*.c") is
+ * matched with fnmatch() and, like in git, '*' also matches '/'.
+ * An empty pathspec matches every path.
+ */
+struct pathspec_item {
+    char *match;                /* without trailing '/' */
+    size_t len;
+    size_t nowildcard_len;      /* length of the literal prefix */
+};
+
+struct pathspec {
+    struct pathspec_item *items;
+    size_t nr;
+};
+
+/* What pathspec_match_dir() knows about the paths inside a directory. */
+enum pathspec_dir_match {
+    PATHSPEC_DIR_NONE = 0,      /* nothing inside can match: skip it */
+    PATHSPEC_DIR_SOME,          /* look at each path inside */
+    PATHSPEC_DIR_ALL,           /* everything inside matches */
+};
+
+/* Returns 0, or -1 on allocation failure. "." alone matches everything. */
+int pathspec_init(struct pathspec *ps, const char *const *paths, size_t nr);
+void pathspec_clear(struct pathspec *ps);
+
+/* Non-zero if [path] ([len] bytes, NUL-terminated) is matched. */
+int pathspec_match(const struct pathspec *ps, const char *path, size_t len);
+
+/* Whether the directory [dir] ([len] bytes) is worth descending into. */
+enum pathspec_dir_match pathspec_match_dir(const struct pathspec *ps,
+                                           const char *dir, size_t len);
+
+#endif /* PATHSPEC_H */
@@ -0,0 +1,88 @@
+#include "prio_queue.h"
+
+#include <stdlib.h>
+
+
+/* Non-zero if entry [i] must come out before entry [j]. */
+static int before(const struct prio_queue *queue, size_t i, size_t j)
+{
+    int cmp = queue->compare(queue->array[i].data, queue->array[j].data,
+                             queue->cb_data);
+    if (cmp)
+        return cmp > 0;
+    return queue->array[i].ctr < queue->array[j].ctr;
+}
+
+static void swap(struct prio_queue *queue, size_t i, size_t j)
+{
+    struct prio_queue_entry tmp = queue->array[i];
+    queue->array[i] = queue->array[j];
+    queue->array[j] = tmp;
+}
+
+
+int prio_queue_put(struct prio_queue *queue, void *data)
+{
+    if (queue->nr == queue->alloc) {
+        size_t alloc = queue->alloc ? 2 * queue->alloc : 64;
+        struct prio_queue_entry *array = realloc(queue->array, alloc * sizeof(*array));
+        if (!array)
+            return -1;
+        queue->array = array;
+        queue->alloc = alloc;
+    }
+
+    size_t i = queue->nr++;
+    queue->array[i].ctr = queue->insertion_ctr++;
+    queue->array[i].data = data;
+
+    /* sift up */
+    while (i) {
+        size_t parent = (i - 1) / 2;
+        if (!before(queue, i, parent))
+            break;
+        swap(queue, i, parent);
+        i = parent;
+    }
+    return 0;
+}
+
+void *prio_queue_get(struct prio_queue *queue)
+{
+    if (!queue->nr)
+        return NULL;
+
+    void *result = queue->array[0].data;
+    if (!--queue->nr)
+        return result;
+
+    queue->array[0] = queue->array[queue->nr];
+
+    /* sift down */
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= queue->nr)
+            break;
+        if (child + 1 < queue->nr && before(queue, child + 1, child))
+            child++;
+        if (!before(queue, child, i))
+            break;
+        swap(queue, i, child);
+        i = child;
+    }
+    return result;
+}
+
+void *prio_queue_peek(const struct prio_queue *queue)
+{
+    return queue->nr ? queue->array[0].data : NULL;
+}
+
+void prio_queue_clear(struct prio_queue *queue)
+{
+    free(queue->array);
+    queue->array = NULL;
+    queue->nr = queue->alloc = 0;
+    queue->insertion_ctr = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef PRIO_QUEUE_H
+#define PRIO_QUEUE_H
+
+#include <stddef.h>
+
+/*
+ * Binary max-heap of caller-owned pointers. [compare] returns > 0 when
+ * its first argument must come out before the second; items that
+ * compare equal come out in the order they were put in.
+ */
+typedef int (*prio_queue_compare_fn)(const void *a, const void *b, void *cb_data);
+
+struct prio_queue_entry {
+    size_t ctr;                 /* insertion order, breaks ties */
+    void *data;
+};
+
+struct prio_queue {
+    prio_queue_compare_fn compare;
+    void *cb_data;
+    size_t insertion_ctr;
+    struct prio_queue_entry *array;
+    size_t nr, alloc;
+};
+
+#define PRIO_QUEUE_INIT(cmp, data) { (cmp), (data), 0, NULL, 0, 0 }
+
+/* Returns 0, or -1 on allocation failure. */
+int prio_queue_put(struct prio_queue *queue, void *data);
+
+/* Remove and return the first item, or NULL if the queue is empty. */
+void *prio_queue_get(struct prio_queue *queue);
+
+/* The first item without removing it, or NULL. */
+void *prio_queue_peek(const struct prio_queue *queue);
+
+void prio_queue_clear(struct prio_queue *queue);
+
+#endif /* PRIO_QUEUE_H */
@@ -6,6 +6,14 @@
 #include "object.h"
 
 
+// set cells [from, to) to None
+static void ram_init_cells(struct RAM* memory, int from, int to){
+    for (int i = from; i < to; i++){
+        memory->cells[i].value_type = RAM_VALUE_NONE;
+        memory->cells[i].obj_value  = NULL;
+    }
+}
+
 /**
   * @brief ram_init: initialize memory unit
   *
@@ -39,10 +47,7 @@ struct RAM* ram_init(void){
         return NULL;
     }
     // initialize all cells to NONE
-    for (int i = 0; i < memory->capacity; i++){
-        memory->cells[i].value_type = RAM_VALUE_NONE;
-        memory->cells[i].obj_value  = NULL;  
-    }
+    ram_init_cells(memory, 0, memory->capacity);
 
     return memory;
 }
@@ -343,6 +348,9 @@ bool ram_write_cell_by_name(struct RAM* memory, struct RAM_VALUE value, char* va
         if (!new_map)
             return false;
         memory->map = new_map;
+
+        // new cells start out as NONE too: writing a cell clears it first
+        ram_init_cells(memory, memory->capacity, new_capacity);
         memory->capacity = new_capacity;
     }
     
@@ -0,0 +1,448 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "reachable.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "hex.h"
+#include "pack.h"
+#include "repository.h"
+#include "revision.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+/*
+ * Trees up to this depth below the root get a pool task of their own;
+ * deeper ones are walked by the worker that found them.
+ */
+#define REACH_SPLIT_DEPTH 2
+
+/* Objects a worker collects before taking the lock to emit them. */
+#define REACH_BATCH 256
+
+
+/* ---- seen set ---- */
+
+/*
+ * Fixed-size open-addressing set of raw ids, sized up front from the
+ * number of objects in the repository, which bounds what can be
+ * reached. A slot is claimed with a compare-and-swap on its state and
+ * published once its id is written; a reader that finds a slot being
+ * written waits for it, since it may hold the very id being inserted.
+ */
+enum { SLOT_EMPTY, SLOT_WRITING, SLOT_READY };
+
+struct seen_set {
+    unsigned char *keys;
+    unsigned char *state;
+    size_t mask;
+    size_t rawsz;
+};
+
+static void seen_clear(struct seen_set *set)
+{
+    free(set->keys);
+    free(set->state);
+    set->keys = set->state = NULL;
+}
+
+static int count_loose(const struct object_id *oid, const char *path, void *data)
+{
+    ++*(size_t *)data;
+    return 0;
+}
+
+static int seen_init(struct seen_set *set, struct repository *repo)
+{
+    size_t bound = 0, slots = 1024;
+
+    for_each_loose_object(repo, count_loose, &bound);
+    for (struct packed_git *p = repo->packs; p; p = p->next)
+        bound += p->nr_objects;
+    while (slots < bound + bound / 3)
+        slots *= 2;
+
+    set->rawsz = hash_algo_rawsz(repo->hash_algo);
+    set->mask = slots - 1;
+    set->keys = malloc(slots * set->rawsz);
+    set->state = calloc(slots, 1);
+    if (!set->keys || !set->state) {
+        seen_clear(set);
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns 1 if [raw] was not in the set yet, 0 if it was, -1 if full. */
+static int seen_insert(struct seen_set *set, const unsigned char *raw)
+{
+    uint64_t h;
+    memcpy(&h, raw, sizeof(h));     /* ids are uniformly distributed */
+
+    for (size_t n = 0, i = h & set->mask; n <= set->mask; n++, i = (i + 1) & set->mask) {
+        unsigned char *key = set->keys + i * set->rawsz;
+        unsigned char s = __atomic_load_n(&set->state[i], __ATOMIC_ACQUIRE);
+
+        if (s == SLOT_EMPTY) {
+            unsigned char expect = SLOT_EMPTY;
+            if (__atomic_compare_exchange_n(&set->state[i], &expect, SLOT_WRITING, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                memcpy(key, raw, set->rawsz);
+                __atomic_store_n(&set->state[i], SLOT_READY, __ATOMIC_RELEASE);
+                return 1;
+            }
+            s = expect;
+        }
+        while (s == SLOT_WRITING) {
+            sched_yield();
+            s = __atomic_load_n(&set->state[i], __ATOMIC_ACQUIRE);
+        }
+        if (!memcmp(key, raw, set->rawsz))
+            return 0;
+    }
+    return -1;
+}
+
+
+/* ---- workers ---- */
+
+struct batch_entry {
+    struct object_id oid;
+    enum object_type type;
+    size_t path;                /* offset in the worker's arena, or SIZE_MAX */
+};
+
+struct reach_worker {
+    struct delta_base_cache cache;
+
+    struct batch_entry *batch;
+    size_t nr;
+    char *arena;                /* the batch's paths, NUL-terminated */
+    size_t arena_len, arena_alloc;
+
+    char *path;                 /* path of the tree being walked */
+    size_t path_len, path_alloc;
+};
+
+struct reach_state {
+    struct repository *repo;
+    const struct reachable_options *opts;
+    struct thread_pool *pool;
+    struct seen_set seen;
+    unsigned types;
+    int want_blobs;
+
+    /* one per pool thread, plus the caller's for commits */
+    struct reach_worker *workers;
+    int nr_workers;
+
+    pthread_mutex_t emit_lock;
+    int stop;                   /* callback's return value (atomic) */
+    int failed;                 /* an object could not be read (atomic) */
+};
+
+/* A tree to walk: its id and path, and whether it is only claimed. */
+struct tree_task {
+    struct reach_state *st;
+    struct object_id oid;
+    int depth;
+    int mark_only;
+    char path[];
+};
+
+static int stopped(struct reach_state *st)
+{
+    return __atomic_load_n(&st->stop, __ATOMIC_RELAXED) ||
+           __atomic_load_n(&st->failed, __ATOMIC_RELAXED);
+}
+
+static void fail(struct reach_state *st)
+{
+    __atomic_store_n(&st->failed, 1, __ATOMIC_RELAXED);
+}
+
+static void flush(struct reach_state *st, struct reach_worker *w)
+{
+    if (!w->nr)
+        return;
+
+    pthread_mutex_lock(&st->emit_lock);
+    for (size_t i = 0; i < w->nr && !st->stop; i++) {
+        struct reachable_object obj = {
+            w->batch[i].oid, w->batch[i].type,
+            w->batch[i].path == SIZE_MAX ? NULL : w->arena + w->batch[i].path,
+        };
+        int ret = st->opts->fn(&obj, st->opts->data);
+        if (ret)
+            __atomic_store_n(&st->stop, ret, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&st->emit_lock);
+    w->nr = 0;
+    w->arena_len = 0;
+}
+
+static int grow(void **p, size_t *alloc, size_t need, size_t size)
+{
+    if (need <= *alloc)
+        return 0;
+    size_t a = *alloc ? *alloc : 64;
+    while (a < need)
+        a *= 2;
+    void *tmp = realloc(*p, a * size);
+    if (!tmp)
+        return -1;
+    *p = tmp;
+    *alloc = a;
+    return 0;
+}
+
+static void emit(struct reach_state *st, struct reach_worker *w,
+                 const struct object_id *oid, enum object_type type,
+                 const char *path, size_t len)
+{
+    if (!(st->types & REACHABLE_TYPE(type)))
+        return;
+    if (!w->batch && !(w->batch = malloc(REACH_BATCH * sizeof(*w->batch)))) {
+        fail(st);
+        return;
+    }
+
+    struct batch_entry *e = &w->batch[w->nr];
+    e->oid = *oid;
+    e->type = type;
+    e->path = SIZE_MAX;
+    if (path) {
+        if (grow((void **)&w->arena, &w->arena_alloc, w->arena_len + len + 1, 1) < 0) {
+            fail(st);
+            return;
+        }
+        e->path = w->arena_len;
+        memcpy(w->arena + w->arena_len, path, len);
+        w->arena[w->arena_len + len] = '\0';
+        w->arena_len += len + 1;
+    }
+    if (++w->nr == REACH_BATCH)
+        flush(st, w);
+}
+
+static int blob_wanted(struct reach_state *st, const struct object_id *oid)
+{
+    enum object_type type;
+    size_t size;
+
+    if (st->opts->blob_limit < 0)
+        return 1;
+    if (repo_read_object_info(st->repo, oid, &type, &size) < 0) {
+        fail(st);
+        return 0;
+    }
+    return size < (size_t)st->opts->blob_limit;
+}
+
+static int submit_tree(struct reach_state *st, const struct object_id *oid,
+                       const char *path, size_t len, int depth, int mark_only);
+
+/*
+ * Walk the tree [oid], found at the worker's current path, whose id
+ * has already been claimed: emit it, then claim and emit its entries.
+ */
+static void walk_tree(struct reach_state *st, struct reach_worker *w,
+                      const struct object_id *oid, int depth, int mark_only)
+{
+    enum object_type type;
+    size_t size;
+    char *buf;
+
+    if (stopped(st))
+        return;
+    buf = repo_read_object_cached(st->repo, oid, &type, &size, &w->cache);
+    if (!buf || type != OBJ_TREE) {
+        ERROR("cannot read tree %s", oid_to_hex(oid));
+        free(buf);
+        fail(st);
+        return;
+    }
+    if (!mark_only)
+        emit(st, w, oid, OBJ_TREE, w->path, w->path_len);
+
+    struct tree_desc desc;
+    struct name_entry entry;
+    struct object_id child;
+    size_t base = w->path_len;
+    int ret;
+
+    init_tree_desc(&desc, buf, size, st->seen.rawsz, 0);
+    while (!stopped(st) && (ret = tree_desc_next(&desc, &entry)) > 0) {
+        int is_dir = S_ISDIR_MODE(entry.mode);
+        if (S_ISGITLINK_MODE(entry.mode) || (!is_dir && !st->want_blobs))
+            continue;
+
+        int fresh = seen_insert(&st->seen, entry.oid);
+        if (fresh < 0) {
+            ERROR("more objects reachable than the repository holds");
+            fail(st);
+            break;
+        }
+        if (!fresh)
+            continue;
+
+        if (grow((void **)&w->path, &w->path_alloc, base + entry.pathlen + 2, 1) < 0) {
+            fail(st);
+            break;
+        }
+        if (base)
+            w->path[w->path_len++] = '/';
+        memcpy(w->path + w->path_len, entry.path, entry.pathlen);
+        w->path_len += entry.pathlen;
+        w->path[w->path_len] = '\0';
+
+        oid_set_raw(&child, entry.oid, st->repo->hash_algo);
+        if (!is_dir) {
+            if (!mark_only && blob_wanted(st, &child))
+                emit(st, w, &child, OBJ_BLOB, w->path, w->path_len);
+        } else if (depth < REACH_SPLIT_DEPTH) {
+            if (submit_tree(st, &child, w->path, w->path_len, depth + 1, mark_only) < 0)
+                fail(st);
+        } else {
+            walk_tree(st, w, &child, depth + 1, mark_only);
+        }
+        w->path_len = base;
+        w->path[base] = '\0';
+    }
+    if (ret < 0) {
+        ERROR("malformed tree %s", oid_to_hex(oid));
+        fail(st);
+    }
+    free(buf);
+}
+
+static void tree_task_run(void *arg, int worker)
+{
+    struct tree_task *task = arg;
+    struct reach_state *st = task->st;
+    struct reach_worker *w = &st->workers[worker];
+    size_t len = strlen(task->path);
+
+    if (grow((void **)&w->path, &w->path_alloc, len + 1, 1) < 0) {
+        fail(st);
+    } else {
+        memcpy(w->path, task->path, len + 1);
+        w->path_len = len;
+        walk_tree(st, w, &task->oid, task->depth, task->mark_only);
+    }
+    free(task);
+}
+
+static int submit_tree(struct reach_state *st, const struct object_id *oid,
+                       const char *path, size_t len, int depth, int mark_only)
+{
+    struct tree_task *task = malloc(sizeof(*task) + len + 1);
+    if (!task)
+        return -1;
+    task->st = st;
+    task->oid = *oid;
+    task->depth = depth;
+    task->mark_only = mark_only;
+    memcpy(task->path, path, len);
+    task->path[len] = '\0';
+    if (thread_pool_submit(st->pool, tree_task_run, task) < 0) {
+        free(task);
+        return -1;
+    }
+    return 0;
+}
+
+/* Claim [tree] and queue it, unless some earlier commit had it. */
+static int add_root_tree(struct reach_state *st, const struct object_id *tree,
+                         int mark_only)
+{
+    int fresh = seen_insert(&st->seen, tree->hash);
+    if (fresh <= 0)
+        return fresh;
+    return submit_tree(st, tree, "", 0, 0, mark_only);
+}
+
+/*
+ * With excluded tips, claim the trees of every excluded parent of a
+ * commit to show (the "edges"), so that objects they have are left
+ * out. The limited walk has already flagged what it will show.
+ */
+static int mark_edges(struct reach_state *st, struct rev_walk *walk)
+{
+    for (size_t i = 0; i < walk->commits.alloc; i++) {
+        struct rev_commit *c = walk->commits.entries[i].data;
+        if (!c || !(c->flags & OBJ_FLAG_MARKED))
+            continue;
+        for (size_t j = 0; j < c->nr_parents; j++) {
+            struct rev_commit *p = c->parents[j];
+            if ((p->flags & OBJ_FLAG_UNINTERESTING) && p->parsed &&
+                add_root_tree(st, &p->tree, 1) < 0)
+                return -1;
+        }
+    }
+    thread_pool_wait(st->pool);
+    return 0;
+}
+
+
+int enumerate_reachable(struct rev_walk *walk, const struct reachable_options *opts)
+{
+    struct reach_state st;
+    int ret = 0;
+
+    memset(&st, 0, sizeof(st));
+    st.repo = walk->repo;
+    st.opts = opts;
+    st.types = opts->types ? opts->types : ~0u;
+    st.want_blobs = !!(st.types & REACHABLE_TYPE(OBJ_BLOB));
+    pthread_mutex_init(&st.emit_lock, NULL);
+
+    if (seen_init(&st.seen, walk->repo) < 0 ||
+        !(st.pool = thread_pool_create(opts->nr_threads))) {
+        ret = -1;
+        goto out;
+    }
+    st.nr_workers = thread_pool_nr_threads(st.pool) + 1;
+    st.workers = calloc(st.nr_workers, sizeof(*st.workers));
+    if (!st.workers) {
+        ret = -1;
+        goto out;
+    }
+    for (int i = 0; i < st.nr_workers; i++)
+        delta_base_cache_init(&st.workers[i].cache, DELTA_CACHE_WORKER_BYTES);
+
+    /* the first rev_walk_next() runs a limited walk to the end */
+    struct reach_worker *self = &st.workers[st.nr_workers - 1];
+    struct rev_commit *c = rev_walk_next(walk);
+    if (walk->excluding && mark_edges(&st, walk) < 0)
+        fail(&st);
+
+    for (; c && !stopped(&st); c = rev_walk_next(walk)) {
+        emit(&st, self, &c->oid, OBJ_COMMIT, NULL, 0);
+        if (add_root_tree(&st, &c->tree, 0) < 0)
+            fail(&st);
+    }
+    thread_pool_wait(st.pool);
+
+    for (int i = 0; i < st.nr_workers; i++)
+        flush(&st, &st.workers[i]);
+    ret = st.failed ? -1 : st.stop;
+
+out:
+    thread_pool_destroy(st.pool);
+    for (int i = 0; st.workers && i < st.nr_workers; i++) {
+        struct reach_worker *w = &st.workers[i];
+        delta_base_cache_clear(&w->cache);
+        free(w->batch);
+        free(w->arena);
+        free(w->path);
+    }
+    free(st.workers);
+    seen_clear(&st.seen);
+    pthread_mutex_destroy(&st.emit_lock);
+    return ret;
+}
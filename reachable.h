@@ -0,0 +1,59 @@
+#ifndef REACHABLE_H
+#define REACHABLE_H
+
+#include <stddef.h>
+#include "object.h"
+
+struct rev_walk;
+
+/*
+ * Reachable object enumeration: every commit of a walk, plus every
+ * tree and blob reachable from them ("rev-list --objects").
+ *
+ * Commits come from the rev_walk, serially, in its order. Their root
+ * trees are handed to a thread pool; a worker reads a tree, emits it
+ * and its new blobs, and goes on with its new subtrees, queueing those
+ * near the root as tasks of their own so that idle workers pick them
+ * up. An object is claimed by whichever worker first inserts its id in
+ * a shared lock-free set, so a subtree shared by many commits (or many
+ * paths) is read once. When the walk excludes commits, the trees of
+ * the excluded parents of shown commits are claimed first, without
+ * being emitted, so that only what those parents lack comes out.
+ *
+ * Trees and blobs are therefore not in any particular order.
+ */
+struct reachable_object {
+    struct object_id oid;
+    enum object_type type;
+    const char *path;           /* tree or blob: where it was first found
+                                   ("" for a root tree); commit: NULL */
+};
+
+/*
+ * Called for each object, one call at a time but from any thread.
+ * Return non-zero to stop; enumerate_reachable() then returns that.
+ */
+typedef int (*reachable_fn)(const struct reachable_object *obj, void *data);
+
+#define REACHABLE_TYPE(t) (1u << (t))
+
+struct reachable_options {
+    int nr_threads;             /* 0: one per online CPU */
+    unsigned types;             /* REACHABLE_TYPE() mask to emit; 0: all */
+    long blob_limit;            /* emit only blobs smaller than this; -1: all */
+    reachable_fn fn;
+    void *data;
+};
+
+#define REACHABLE_OPTIONS_INIT { 0, 0, -1, NULL, NULL }
+
+/*
+ * Run [walk] (set up with its tips, not started) and emit what it
+ * reaches. Blobs are not even looked up when they cannot be emitted;
+ * with a blob limit only their headers are read. Gitlinks are skipped.
+ * Returns 0, the callback's non-zero value, or -1 if an object is
+ * missing or corrupt.
+ */
+int enumerate_reachable(struct rev_walk *walk, const struct reachable_options *opts);
+
+#endif /* REACHABLE_H */
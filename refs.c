@@ -0,0 +1,1913 @@
+#define _GNU_SOURCE     /* DT_DIR */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "log.h"
+#include "refs.h"
+#include "repository.h"
+#include "hex.h"
+#include "reftable.h"
+#include "tag.h"
+#include "thread_pool.h"
+#include "utl.h"
+
+/* Symbolic refs nest at most this deep, like git's own limit. */
+#define MAX_SYMREF_DEPTH 5
+
+/* A loose ref holds an id or "ref: <name>"; anything longer is broken. */
+#define LOOSE_REF_MAX 1024
+
+/* ---- packed-refs ---- */
+
+enum packed_peeled {
+    PEELED_NONE,                /* no '^' lines can be relied on */
+    PEELED_TAGS,                /* every refs/tags/ record has its '^' line */
+    PEELED_FULLY,               /* every record that needs one has it */
+};
+
+/*
+ * packed-refs as last read. [start, end) are the records, after the
+ * header: in the map, or in [sorted] if the file was not in order.
+ */
+struct packed_refs {
+    int loaded;
+    struct stat st;             /* of the file mapped; st_ino 0 if none */
+    void *map;
+    size_t map_len;
+    char *sorted;
+    const char *start, *end;
+    enum packed_peeled peeled;
+};
+
+struct ref_store {
+    struct reftable_stack *reftable;    /* NULL: loose and packed refs */
+    int iterating;              /* the stack must not be reloaded */
+    struct packed_refs packed;
+};
+
+/*
+ * The refs of [repo], opened on first use: a reftable stack if the
+ * repository has reftable/tables.list, else loose and packed refs.
+ */
+static struct ref_store *get_ref_store(struct repository *repo)
+{
+    struct ref_store *refs = repo->refs;
+
+    if (refs)
+        return refs;
+    if (!(refs = calloc(1, sizeof(*refs))))
+        return NULL;
+    if (reftable_stack_open(repo->gitdir, repo->hash_algo, &refs->reftable) < 0) {
+        free(refs);
+        return NULL;
+    }
+    return repo->refs = refs;
+}
+
+static void packed_refs_release(struct packed_refs *pr)
+{
+    if (pr->map)
+        munmap(pr->map, pr->map_len);
+    free(pr->sorted);
+    memset(pr, 0, sizeof(*pr));
+}
+
+/* The start of the record holding [p]; a '^' line is part of the one before. */
+static const char *find_start_of_record(const char *buf, const char *p)
+{
+    while (p > buf && (p[-1] != '\n' || p[0] == '^'))
+        p--;
+    return p;
+}
+
+/* The start of the record after the one at [p]. */
+static const char *find_end_of_record(const char *p, const char *end)
+{
+    p = memchr(p, '\n', end - p);
+    p = p ? p + 1 : end;
+    if (p < end && *p == '^') {
+        p = memchr(p, '\n', end - p);
+        p = p ? p + 1 : end;
+    }
+    return p;
+}
+
+/* The name of the record at [rec], up to its newline. */
+static const char *record_name(const char *rec, const char *end, size_t hexsz,
+                               size_t *len)
+{
+    const char *eol = memchr(rec, '\n', end - rec);
+    const char *name = rec + hexsz + 1;
+
+    if (!eol)
+        eol = end;
+    if (name > eol)
+        name = eol;
+    *len = eol - name;
+    return name;
+}
+
+/* Compare the name of the record at [rec] with [refname], as strcmp() does. */
+static int compare_record(const char *rec, const char *end, size_t hexsz,
+                          const char *refname)
+{
+    size_t len;
+    const char *name = record_name(rec, end, hexsz, &len);
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char a = name[i], b = refname[i];
+        if (!b)
+            return 1;
+        if (a != b)
+            return a < b ? -1 : 1;
+    }
+    return refname[len] ? -1 : 0;
+}
+
+struct record {
+    const char *ptr;
+    size_t len;
+    hash_algo_t algo;
+};
+
+static int compare_records(const void *a, const void *b)
+{
+    const struct record *x = a, *y = b;
+    size_t hexsz = hash_algo_hexsz(x->algo), xl, yl;
+    const char *xn = record_name(x->ptr, x->ptr + x->len, hexsz, &xl);
+    const char *yn = record_name(y->ptr, y->ptr + y->len, hexsz, &yl);
+    int cmp = memcmp(xn, yn, xl < yl ? xl : yl);
+
+    return cmp ? cmp : (xl > yl) - (xl < yl);
+}
+
+/*
+ * Put the records of a file written without the "sorted" trait in
+ * order, in a copy, unless they already are. Returns 0, or -1 if out
+ * of memory.
+ */
+static int sort_packed_refs(struct packed_refs *pr, hash_algo_t algo)
+{
+    size_t nr = 0, alloc = 0;
+    struct record *recs = NULL;
+    int sorted = 1;
+
+    for (const char *p = pr->start; p < pr->end; ) {
+        const char *next = find_end_of_record(p, pr->end);
+        if (nr == alloc) {
+            alloc = alloc ? 2 * alloc : 1024;
+            struct record *tmp = realloc(recs, alloc * sizeof(*recs));
+            if (!tmp) {
+                free(recs);
+                return -1;
+            }
+            recs = tmp;
+        }
+        recs[nr] = (struct record){ p, next - p, algo };
+        if (nr && sorted && compare_records(&recs[nr - 1], &recs[nr]) > 0)
+            sorted = 0;
+        nr++;
+        p = next;
+    }
+
+    if (!sorted) {
+        size_t len = pr->end - pr->start;
+        char *copy = malloc(len ? len : 1), *out = copy;
+        if (!copy) {
+            free(recs);
+            return -1;
+        }
+        qsort(recs, nr, sizeof(*recs), compare_records);
+        for (size_t i = 0; i < nr; i++) {
+            memcpy(out, recs[i].ptr, recs[i].len);
+            out += recs[i].len;
+        }
+        pr->sorted = copy;
+        pr->start = copy;
+        pr->end = copy + len;
+    }
+    free(recs);
+    return 0;
+}
+
+/* Parse the "# pack-refs with: <trait>..." header, if any. */
+static void parse_packed_header(struct packed_refs *pr, int *sorted)
+{
+    static const char header[] = "# pack-refs with:";
+    const char *eol;
+
+    *sorted = 0;
+    if (pr->start == pr->end || *pr->start != '#')
+        return;
+    eol = memchr(pr->start, '\n', pr->end - pr->start);
+    if (!eol)
+        eol = pr->end;
+
+    if ((size_t)(eol - pr->start) >= sizeof(header) - 1 &&
+        !memcmp(pr->start, header, sizeof(header) - 1)) {
+        const char *p = pr->start + sizeof(header) - 1;
+        while (p < eol) {
+            while (p < eol && *p == ' ')
+                p++;
+            const char *word = p;
+            while (p < eol && *p != ' ')
+                p++;
+            size_t len = p - word;
+            if (len == 6 && !memcmp(word, "peeled", 6) && pr->peeled == PEELED_NONE)
+                pr->peeled = PEELED_TAGS;
+            else if (len == 12 && !memcmp(word, "fully-peeled", 12))
+                pr->peeled = PEELED_FULLY;
+            else if (len == 6 && !memcmp(word, "sorted", 6))
+                *sorted = 1;
+        }
+    }
+    pr->start = eol < pr->end ? eol + 1 : eol;
+}
+
+/*
+ * Make [refs]->packed the current packed-refs: kept as it is if the
+ * file has the same stat data, else mapped again (or dropped if it is
+ * gone). Returns 0, or -1 if the file cannot be used.
+ */
+static int prepare_packed_refs(struct repository *repo, struct ref_store *refs)
+{
+    struct packed_refs *pr = &refs->packed;
+    char *path = utl_path_join(repo->gitdir, "packed-refs", 0);
+    struct stat st;
+    int sorted, fd;
+
+    if (!path)
+        return -1;
+    if (stat(path, &st) < 0) {
+        free(path);
+        if (errno != ENOENT)
+            return -1;
+        packed_refs_release(pr);
+        pr->loaded = 1;
+        return 0;
+    }
+    if (pr->loaded && utl_stat_unchanged(&pr->st, &st)) {
+        free(path);
+        return 0;
+    }
+
+    packed_refs_release(pr);
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0 || fstat(fd, &pr->st) < 0) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if (pr->st.st_size > 0) {
+        pr->map = mmap(NULL, pr->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pr->map == MAP_FAILED) {
+            pr->map = NULL;
+            close(fd);
+            return -1;
+        }
+        pr->map_len = pr->st.st_size;
+    }
+    close(fd);
+    pr->loaded = 1;
+    pr->start = pr->map;
+    pr->end = pr->start + pr->map_len;
+
+    /* every record ends with a newline, so a scan never runs off the map */
+    if (pr->map_len && pr->end[-1] != '\n') {
+        ERROR("packed-refs is not terminated by a newline");
+        packed_refs_release(pr);
+        return -1;
+    }
+    parse_packed_header(pr, &sorted);
+    if (!sorted && sort_packed_refs(pr, repo->hash_algo) < 0) {
+        packed_refs_release(pr);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * The record named [refname], or with [lower_bound] the first whose
+ * name is not less than it (which may be the end). NULL if not found.
+ */
+static const char *packed_find(const struct packed_refs *pr, size_t hexsz,
+                               const char *refname, int lower_bound)
+{
+    const char *lo = pr->start, *hi = pr->end;
+
+    while (lo < hi) {
+        const char *mid = find_start_of_record(lo, lo + (hi - lo) / 2);
+        int cmp = compare_record(mid, pr->end, hexsz, refname);
+        if (cmp < 0)
+            lo = find_end_of_record(mid, hi);
+        else if (cmp > 0)
+            hi = mid;
+        else
+            return mid;
+    }
+    return lower_bound ? lo : NULL;
+}
+
+/*
+ * Fill [ref] (but its name) from the record at [rec], and return its
+ * name's length. Returns -1 if the record is malformed.
+ */
+static long parse_packed_record(const struct packed_refs *pr, const char *rec,
+                                hash_algo_t algo, struct ref_entry *ref)
+{
+    size_t hexsz = hash_algo_hexsz(algo), len;
+    const char *name = record_name(rec, pr->end, hexsz, &len);
+    const char *next = name + len + 1;
+
+    if (name != rec + hexsz + 1 || rec[hexsz] != ' ' || !len ||
+        oid_set_hex(&ref->oid, rec, hexsz, algo) < 0) {
+        ERROR("bad packed-refs record: %.*s", (int)(name + len - rec), rec);
+        return -1;
+    }
+    ref->flags = REF_ISPACKED;
+
+    if (next < pr->end && *next == '^') {
+        const char *eol = memchr(next, '\n', pr->end - next);
+        if ((size_t)(eol - next - 1) != hexsz ||
+            oid_set_hex(&ref->peeled, next + 1, hexsz, algo) < 0) {
+            ERROR("bad peeled line in packed-refs for %.*s", (int)len, name);
+            return -1;
+        }
+        ref->flags |= REF_KNOWS_PEELED;
+    } else if (pr->peeled == PEELED_FULLY ||
+               (pr->peeled == PEELED_TAGS && len > 10 && !memcmp(name, "refs/tags/", 10))) {
+        /* a record the trait covers without a '^' line is not a tag */
+        ref->peeled = ref->oid;
+        ref->flags |= REF_KNOWS_PEELED;
+    }
+    return len;
+}
+
+/* Look [refname] up in packed-refs. Returns 0, or -1 if it is not there. */
+static int read_packed_ref(struct repository *repo, const char *refname,
+                           struct ref_entry *ref)
+{
+    struct ref_store *refs = get_ref_store(repo);
+    const char *rec;
+
+    if (!refs || prepare_packed_refs(repo, refs) < 0)
+        return -1;
+    rec = packed_find(&refs->packed, hash_algo_hexsz(repo->hash_algo), refname, 0);
+    if (!rec)
+        return -1;
+    return parse_packed_record(&refs->packed, rec, repo->hash_algo, ref) < 0 ? -1 : 0;
+}
+
+/* ---- loose refs ---- */
+
+/* A ref as stored, before a symbolic ref is followed. */
+enum raw_ref {
+    RAW_BROKEN = -2,
+    RAW_MISSING = -1,
+    RAW_OID = 0,
+    RAW_SYMREF = 1,
+};
+
+/*
+ * Read the loose ref [refname] into [oid], or for a symbolic ref the
+ * name it points at into [target]. A directory in its place counts as
+ * missing, as a packed ref of that name may still exist.
+ */
+static enum raw_ref read_loose_ref(struct repository *repo, const char *refname,
+                                  struct object_id *oid,
+                                  char *target, size_t target_size)
+{
+    size_t hexsz = hash_algo_hexsz(repo->hash_algo);
+    char *path = utl_path_join(repo->gitdir, refname, 0);
+    char buf[LOOSE_REF_MAX];
+    ssize_t len;
+    int fd;
+
+    if (!path)
+        return RAW_BROKEN;
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0)
+        return errno == ENOENT || errno == ENOTDIR ? RAW_MISSING : RAW_BROKEN;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len < 0)
+        return errno == EISDIR ? RAW_MISSING : RAW_BROKEN;
+    while (len && (buf[len - 1] == '\n' || buf[len - 1] == '\r' || buf[len - 1] == ' '))
+        len--;
+    buf[len] = '\0';
+
+    if (!strncmp(buf, "ref:", 4)) {
+        const char *name = buf + 4;
+        while (*name == ' ' || *name == '\t')
+            name++;
+        if (strlen(name) >= target_size || refs_check_name(name))
+            return RAW_BROKEN;
+        strcpy(target, name);
+        return RAW_SYMREF;
+    }
+    /* FETCH_HEAD and the like may go on after the id */
+    if ((size_t)len < hexsz || (buf[hexsz] && buf[hexsz] != '\t' && buf[hexsz] != ' ' &&
+                                buf[hexsz] != '\n') ||
+        oid_set_hex(oid, buf, hexsz, repo->hash_algo) < 0)
+        return RAW_BROKEN;
+    return RAW_OID;
+}
+
+/* FETCH_HEAD and MERGE_HEAD stay files next to a reftable stack. */
+static int is_special_ref(const char *refname)
+{
+    return !strcmp(refname, "FETCH_HEAD") || !strcmp(refname, "MERGE_HEAD");
+}
+
+/* Read [refname] from the reftable stack, as read_raw_ref() does. */
+static enum raw_ref read_reftable_ref(struct ref_store *refs, const char *refname,
+                                      struct ref_entry *ref,
+                                      char *target, size_t target_size)
+{
+    struct reftable_ref rec;
+    int r;
+
+    if (!refs->iterating && reftable_stack_refresh(refs->reftable) < 0)
+        return RAW_BROKEN;
+    r = reftable_stack_read_ref(refs->reftable, refname, &rec);
+    if (r)
+        return r < 0 ? RAW_BROKEN : RAW_MISSING;
+
+    if (rec.type == REFTABLE_SYMREF) {
+        if (strlen(rec.target) >= target_size || refs_check_name(rec.target))
+            return RAW_BROKEN;
+        strcpy(target, rec.target);
+        return RAW_SYMREF;
+    }
+    ref->oid = rec.value;
+    ref->flags = 0;
+    if (rec.type == REFTABLE_VAL2) {
+        ref->peeled = rec.peeled;
+        ref->flags = REF_KNOWS_PEELED;
+    }
+    return RAW_OID;
+}
+
+/*
+ * Read [refname] as stored into [ref], or for a symbolic ref the name
+ * it points at into [target]: from the reftable stack, or as a loose
+ * ref and then from packed-refs.
+ */
+static enum raw_ref read_raw_ref(struct repository *repo, const char *refname,
+                                 struct ref_entry *ref,
+                                 char *target, size_t target_size)
+{
+    struct ref_store *refs = get_ref_store(repo);
+    enum raw_ref r;
+
+    if (!refs)
+        return RAW_BROKEN;
+    if (refs->reftable && !is_special_ref(refname))
+        return read_reftable_ref(refs, refname, ref, target, target_size);
+
+    r = read_loose_ref(repo, refname, &ref->oid, target, target_size);
+    if (r == RAW_OID)
+        ref->flags = 0;
+    if (r != RAW_MISSING || refs->reftable)
+        return r;
+    return read_packed_ref(repo, refname, ref) == 0 ? RAW_OID : RAW_MISSING;
+}
+
+/* ---- names ---- */
+
+static int bad_ref_char(unsigned char c)
+{
+    return c < 0x20 || c == 0x7f || c == ' ' || c == '~' || c == '^' || c == ':' ||
+           c == '?' || c == '*' || c == '[' || c == '\\';
+}
+
+int refs_check_name(const char *refname)
+{
+    const char *p = refname;
+
+    if (strncmp(refname, "refs/", 5)) {
+        /* HEAD, FETCH_HEAD, ...: one level of capitals and '_' */
+        if (!*p)
+            return -1;
+        for (; *p; p++)
+            if (!((*p >= 'A' && *p <= 'Z') || *p == '_'))
+                return -1;
+        return 0;
+    }
+
+    p += 5;
+    for (;;) {
+        const char *comp = p;
+        if (*p == '.')
+            return -1;
+        while (*p && *p != '/') {
+            if (bad_ref_char(*p) || (*p == '.' && p[1] == '.') ||
+                (*p == '@' && p[1] == '{'))
+                return -1;
+            p++;
+        }
+        if (p == comp)
+            return -1;          /* empty component, or a trailing '/' */
+        if (p - comp >= 5 && !memcmp(p - 5, ".lock", 5))
+            return -1;
+        if (!*p)
+            return p[-1] == '.' ? -1 : 0;
+        p++;
+    }
+}
+
+/* ---- lookup ---- */
+
+int refs_resolve(struct repository *repo, const char *refname,
+                 struct ref_entry *ref, char **target)
+{
+    char name[LOOSE_REF_MAX], next[LOOSE_REF_MAX];
+    unsigned flags = 0;
+
+    memset(ref, 0, sizeof(*ref));
+    ref->name = refname;
+    if (target)
+        *target = NULL;
+    if (refs_check_name(refname) || strlen(refname) >= sizeof(name))
+        return -1;
+    strcpy(name, refname);
+
+    for (int depth = 0; ; depth++) {
+        if (depth > MAX_SYMREF_DEPTH) {
+            ERROR("symbolic ref loop at %s", refname);
+            return -1;
+        }
+        switch (read_raw_ref(repo, name, ref, next, sizeof(next))) {
+        case RAW_SYMREF:
+            strcpy(name, next);
+            flags |= REF_ISSYMREF;
+            continue;
+        case RAW_OID:
+            break;
+        case RAW_BROKEN:
+            ERROR("broken ref %s", name);
+            return -1;
+        case RAW_MISSING:
+            if (!(flags & REF_ISSYMREF))
+                return -1;
+            /* an unborn branch */
+            memset(&ref->oid, 0, sizeof(ref->oid));
+            ref->flags = flags;
+            if (target && !(*target = strdup(name)))
+                return -1;
+            return 1;
+        }
+        break;
+    }
+
+    ref->flags |= flags;
+    if (target && !(*target = strdup(name)))
+        return -1;
+    return 0;
+}
+
+int refs_read_ref(struct repository *repo, const char *refname,
+                  struct object_id *oid)
+{
+    struct ref_entry ref;
+
+    if (refs_resolve(repo, refname, &ref, NULL) != 0)
+        return -1;
+    *oid = ref.oid;
+    return 0;
+}
+
+int refs_peel(struct repository *repo, const struct ref_entry *ref,
+              struct object_id *peeled)
+{
+    enum object_type type;
+
+    if (ref->flags & REF_KNOWS_PEELED) {
+        *peeled = ref->peeled;
+        return 0;
+    }
+    return peel_object(repo, &ref->oid, peeled, &type);
+}
+
+/* ---- iteration ---- */
+
+struct loose_names {
+    char **names;
+    size_t nr, alloc;
+};
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Add the files under <gitdir>/[dir] (a ref name prefix ending with
+ * '/') whose ref name starts with [prefix] to [out].
+ */
+static int collect_loose(struct repository *repo, char *dir, size_t dir_len,
+                         const char *prefix, size_t prefix_len,
+                         struct loose_names *out)
+{
+    char *path = utl_path_join(repo->gitdir, dir, 0);
+    DIR *d = path ? opendir(path) : NULL;
+    struct dirent *de;
+    int ret = 0;
+
+    if (!d) {
+        int missing = path && (errno == ENOENT || errno == ENOTDIR);
+        free(path);
+        return missing ? 0 : -1;
+    }
+
+    while (!ret && (de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        int is_dir;
+
+        if (de->d_name[0] == '.')
+            continue;       /* ".", ".." and names git rejects */
+        if (dir_len + len + 2 > LOOSE_REF_MAX)
+            continue;
+        memcpy(dir + dir_len, de->d_name, len + 1);
+
+        /* only go where the prefix leads */
+        size_t n = dir_len + len < prefix_len ? dir_len + len : prefix_len;
+        if (memcmp(dir, prefix, n))
+            continue;
+
+        if (de->d_type == DT_DIR || de->d_type == DT_REG) {
+            is_dir = de->d_type == DT_DIR;
+        } else {
+            struct stat st;
+            char *full = utl_path_join(path, de->d_name, 0);
+            if (!full || stat(full, &st) < 0) {
+                free(full);
+                continue;
+            }
+            free(full);
+            is_dir = S_ISDIR(st.st_mode);
+        }
+
+        if (is_dir) {
+            dir[dir_len + len] = '/';
+            dir[dir_len + len + 1] = '\0';
+            ret = collect_loose(repo, dir, dir_len + len + 1, prefix, prefix_len, out);
+            continue;
+        }
+        if (dir_len + len < prefix_len || refs_check_name(dir))
+            continue;       /* short of the prefix, or a lock or stray file */
+
+        if (out->nr == out->alloc) {
+            size_t alloc = out->alloc ? 2 * out->alloc : 64;
+            char **tmp = realloc(out->names, alloc * sizeof(*tmp));
+            if (!tmp) {
+                ret = -1;
+                break;
+            }
+            out->names = tmp;
+            out->alloc = alloc;
+        }
+        if (!(out->names[out->nr] = strdup(dir)))
+            ret = -1;
+        else
+            out->nr++;
+    }
+    dir[dir_len] = '\0';
+    closedir(d);
+    free(path);
+    return ret;
+}
+
+struct reftable_each {
+    struct repository *repo;
+    each_ref_fn fn;
+    void *data;
+};
+
+static int each_reftable_ref(const struct reftable_ref *rec, void *data)
+{
+    struct reftable_each *each = data;
+    struct ref_entry ref = { rec->name, rec->value, rec->peeled, 0 };
+
+    if (refs_check_name(rec->name))
+        return 0;
+    if (rec->type == REFTABLE_SYMREF) {
+        /* resolving it does not disturb the iteration */
+        int r = refs_resolve(each->repo, rec->name, &ref, NULL);
+        if (r < 0)
+            WARN("ignoring broken ref %s", rec->name);
+        return r ? 0 : each->fn(&ref, each->data);
+    }
+    if (rec->type == REFTABLE_VAL2)
+        ref.flags = REF_KNOWS_PEELED;
+    return each->fn(&ref, each->data);
+}
+
+int refs_for_each_ref(struct repository *repo, const char *prefix,
+                      each_ref_fn fn, void *data)
+{
+    struct ref_store *refs = get_ref_store(repo);
+    size_t hexsz = hash_algo_hexsz(repo->hash_algo);
+    size_t prefix_len = strlen(prefix);
+    struct loose_names loose = { 0 };
+    char dir[LOOSE_REF_MAX], *name = NULL;
+    size_t name_alloc = 0, li = 0;
+    const char *rec = NULL;
+    int ret = 0;
+
+    if (!refs)
+        return -1;
+    /* every ref lives under refs/ */
+    if (strncmp(prefix, "refs/", prefix_len < 5 ? prefix_len : 5))
+        return 0;
+
+    if (refs->reftable) {
+        struct reftable_each each = { repo, fn, data };
+        if (reftable_stack_refresh(refs->reftable) < 0)
+            return -1;
+        /* the tables stay mapped while the iteration reads them */
+        refs->iterating++;
+        ret = reftable_stack_for_each_ref(refs->reftable, prefix_len < 5 ? "refs/" : prefix,
+                                          each_reftable_ref, &each);
+        refs->iterating--;
+        return ret;
+    }
+
+    /* loose refs from the deepest directory the prefix names */
+    if (prefix_len >= sizeof(dir))
+        return -1;
+    if (prefix_len <= 5) {
+        strcpy(dir, "refs/");
+    } else {
+        size_t dir_len = strrchr(prefix, '/') - prefix + 1;
+        memcpy(dir, prefix, dir_len);
+        dir[dir_len] = '\0';
+    }
+    if (collect_loose(repo, dir, strlen(dir), prefix, prefix_len, &loose) < 0) {
+        ret = -1;
+        goto out;
+    }
+    if (loose.nr)
+        qsort(loose.names, loose.nr, sizeof(*loose.names), compare_names);
+
+    if (prepare_packed_refs(repo, refs) < 0) {
+        ret = -1;
+        goto out;
+    }
+    rec = packed_find(&refs->packed, hexsz, prefix, 1);
+
+    while (!ret) {
+        struct ref_entry ref = { 0 };
+        size_t len = 0;
+        int cmp;
+
+        if (rec && rec < refs->packed.end) {
+            const char *rname = record_name(rec, refs->packed.end, hexsz, &len);
+            if (len < prefix_len || memcmp(rname, prefix, prefix_len))
+                rec = NULL;     /* past the prefix */
+            else if (len + 1 > name_alloc) {
+                char *tmp = realloc(name, name_alloc = 2 * len + 64);
+                if (!tmp) {
+                    ret = -1;
+                    break;
+                }
+                name = tmp;
+            }
+            if (rec) {
+                memcpy(name, rname, len);
+                name[len] = '\0';
+            }
+        } else {
+            rec = NULL;
+        }
+        if (!rec && li == loose.nr)
+            break;
+
+        cmp = !rec ? -1 : li == loose.nr ? 1 : strcmp(loose.names[li], name);
+        if (cmp <= 0) {
+            /* a loose ref, overriding a packed one of the same name */
+            int r = refs_resolve(repo, loose.names[li], &ref, NULL);
+            if (r < 0)
+                WARN("ignoring broken ref %s", loose.names[li]);
+            else if (r == 0)
+                ret = fn(&ref, data);
+            li++;
+            if (cmp == 0)
+                rec = find_end_of_record(rec, refs->packed.end);
+            continue;
+        }
+
+        const char *next = find_end_of_record(rec, refs->packed.end);
+        if (parse_packed_record(&refs->packed, rec, repo->hash_algo, &ref) < 0) {
+            ret = -1;
+            break;
+        }
+        ref.name = name;
+        ret = fn(&ref, data);
+        rec = next;
+    }
+
+out:
+    for (size_t i = 0; i < loose.nr; i++)
+        free(loose.names[i]);
+    free(loose.names);
+    free(name);
+    return ret;
+}
+
+void ref_store_free(struct ref_store *refs)
+{
+    if (!refs)
+        return;
+    reftable_stack_free(refs->reftable);
+    packed_refs_release(&refs->packed);
+    free(refs);
+}
+
+/* ---- transactions ---- */
+
+#define UPDATE_HAVE_NEW (1u << 0)
+#define UPDATE_HAVE_OLD (1u << 1)
+
+/* Packed-refs writes go through a buffer of this size. */
+#define PACKED_WRITE_BUFFER (64u << 10)
+
+struct ref_update {
+    char *refname;
+    struct object_id new_oid, old_oid;
+    unsigned flags;             /* UPDATE_* */
+    char *msg;
+
+    /* found by the commit, under its locks */
+    struct object_id current;
+    int exists;                 /* [current] is valid */
+    int loose;                  /* it has a loose file */
+    int packed;                 /* its new value goes to packed-refs */
+    int locked;                 /* we created <refname>.lock */
+};
+
+struct ref_transaction {
+    struct repository *repo;
+    struct ref_update *updates;
+    size_t nr, alloc;
+    int packed_locked;
+};
+
+static int oid_is_null(const struct object_id *oid, hash_algo_t algo)
+{
+    size_t rawsz = hash_algo_rawsz(algo);
+
+    for (size_t i = 0; i < rawsz; i++)
+        if (oid->hash[i])
+            return 0;
+    return 1;
+}
+
+static int update_is_delete(const struct ref_update *u, hash_algo_t algo)
+{
+    return (u->flags & UPDATE_HAVE_NEW) && oid_is_null(&u->new_oid, algo);
+}
+
+static int update_is_write(const struct ref_update *u, hash_algo_t algo)
+{
+    return (u->flags & UPDATE_HAVE_NEW) && !oid_is_null(&u->new_oid, algo);
+}
+
+struct ref_transaction *ref_transaction_begin(struct repository *repo)
+{
+    struct ref_transaction *tx = calloc(1, sizeof(*tx));
+
+    if (tx)
+        tx->repo = repo;
+    return tx;
+}
+
+int ref_transaction_update(struct ref_transaction *tx, const char *refname,
+                           const struct object_id *new_oid,
+                           const struct object_id *old_oid, const char *msg)
+{
+    struct ref_update *u;
+
+    if (refs_check_name(refname) || strlen(refname) >= LOOSE_REF_MAX) {
+        ERROR("invalid ref name %s", refname);
+        return -1;
+    }
+    if (tx->nr == tx->alloc) {
+        size_t alloc = tx->alloc ? 2 * tx->alloc : 16;
+        struct ref_update *tmp = realloc(tx->updates, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        tx->updates = tmp;
+        tx->alloc = alloc;
+    }
+    u = &tx->updates[tx->nr];
+    memset(u, 0, sizeof(*u));
+    if (!(u->refname = strdup(refname)) || (msg && !(u->msg = strdup(msg)))) {
+        free(u->refname);
+        return -1;
+    }
+    if (new_oid) {
+        u->new_oid = *new_oid;
+        u->flags |= UPDATE_HAVE_NEW;
+    }
+    if (old_oid) {
+        u->old_oid = *old_oid;
+        u->flags |= UPDATE_HAVE_OLD;
+    }
+    tx->nr++;
+    return 0;
+}
+
+static int compare_updates(const void *a, const void *b)
+{
+    return strcmp(((const struct ref_update *)a)->refname,
+                  ((const struct ref_update *)b)->refname);
+}
+
+/* The first update whose name is not less than [name]. */
+static size_t find_update(const struct ref_transaction *tx, const char *name)
+{
+    size_t lo = 0, hi = tx->nr;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(tx->updates[mid].refname, name) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* mkdir() every missing directory above [path]. */
+static int create_leading_dirs(char *path)
+{
+    for (char *p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        int r = mkdir(path, 0777);
+        *p = '/';
+        if (r < 0 && errno != EEXIST)
+            return -1;
+    }
+    return 0;
+}
+
+/* rmdir() [path] if it only holds empty directories. Returns 0 if it is gone. */
+static int remove_empty_dirs(const char *path)
+{
+    DIR *d = opendir(path);
+    struct dirent *de;
+    int ret = 0;
+
+    if (!d)
+        return errno == ENOENT ? 0 : -1;
+    while (!ret && (de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        char *sub = utl_path_join(path, de->d_name, 0);
+        ret = sub && is_directory(sub) ? remove_empty_dirs(sub) : -1;
+        free(sub);
+    }
+    closedir(d);
+    return ret ? ret : rmdir(path);
+}
+
+/* Remove the directories above the loose ref [refname] it left empty. */
+static void remove_empty_parents(struct repository *repo, const char *refname)
+{
+    char name[LOOSE_REF_MAX], *slash;
+
+    if (strlen(refname) >= sizeof(name))
+        return;
+    strcpy(name, refname);
+    while ((slash = strrchr(name, '/')) != NULL) {
+        *slash = '\0';
+        /* refs/heads and the like stay */
+        const char *first = strchr(name, '/');
+        if (!first || !strchr(first + 1, '/'))
+            break;
+        char *path = utl_path_join(repo->gitdir, name, 0);
+        int r = path ? rmdir(path) : -1;
+        free(path);
+        if (r < 0)
+            break;
+    }
+}
+
+/*
+ * Whether creating [u]'s ref would clash with another ref: one named
+ * like a directory above it, or one inside a directory of its name,
+ * whether it exists or the transaction creates it. An empty directory
+ * in the way is removed.
+ */
+static int check_df_conflict(struct ref_transaction *tx, struct ref_store *refs,
+                             const struct ref_update *u)
+{
+    struct repository *repo = tx->repo;
+    size_t len = strlen(u->refname), hexsz = hash_algo_hexsz(repo->hash_algo);
+    char name[LOOSE_REF_MAX + 1], target[LOOSE_REF_MAX];
+    struct loose_names loose = { 0 };
+    struct ref_entry ref;
+    const char *rec;
+    size_t i;
+    int conflict = 0;
+
+    if (len + 1 >= sizeof(name))
+        return -1;
+    memcpy(name, u->refname, len + 1);
+
+    /* refs/heads/a when creating refs/heads/a/b */
+    for (char *p = strchr(name, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        i = find_update(tx, name);
+        if (read_raw_ref(repo, name, &ref, target, sizeof(target)) != RAW_MISSING ||
+            (i < tx->nr && !strcmp(tx->updates[i].refname, name) &&
+             update_is_write(&tx->updates[i], repo->hash_algo))) {
+            ERROR("cannot lock ref '%s': '%s' exists", u->refname, name);
+            return -1;
+        }
+        *p = '/';
+    }
+
+    /* refs/heads/a/b when creating refs/heads/a */
+    name[len] = '/';
+    name[len + 1] = '\0';
+    for (i = find_update(tx, name); i < tx->nr && !strncmp(tx->updates[i].refname, name, len + 1); i++)
+        if (update_is_write(&tx->updates[i], repo->hash_algo))
+            conflict = 1;
+    if (!conflict && prepare_packed_refs(repo, refs) == 0) {
+        rec = packed_find(&refs->packed, hexsz, name, 1);
+        if (rec < refs->packed.end) {
+            size_t rlen;
+            const char *rname = record_name(rec, refs->packed.end, hexsz, &rlen);
+            conflict = rlen > len + 1 && !memcmp(rname, name, len + 1);
+        }
+    }
+    if (!conflict) {
+        char *path = utl_path_join(repo->gitdir, u->refname, 0);
+        if (path && is_directory(path)) {
+            char dir[LOOSE_REF_MAX];
+            memcpy(dir, name, len + 2);
+            conflict = collect_loose(repo, dir, len + 1, name, len + 1, &loose) < 0 ||
+                       loose.nr || remove_empty_dirs(path) < 0;
+        }
+        free(path);
+    }
+    for (i = 0; i < loose.nr; i++)
+        free(loose.names[i]);
+    free(loose.names);
+    if (conflict)
+        ERROR("cannot lock ref '%s': there are refs under '%s'", u->refname, name);
+    return conflict ? -1 : 0;
+}
+
+/* Create <gitdir>/[name].lock, holding [content] if not NULL. */
+static int create_lock(struct repository *repo, const char *name, const char *content)
+{
+    char *path = utl_path_join(repo->gitdir, name, 0);
+    char *lock = path ? malloc(strlen(path) + 6) : NULL;
+    int fd = -1, ret = -1;
+
+    if (lock) {
+        sprintf(lock, "%s.lock", path);
+        fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd < 0 && errno == ENOENT && create_leading_dirs(lock) == 0)
+            fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    }
+    if (fd < 0) {
+        ERROR("cannot lock ref '%s': %s", name,
+              errno == EEXIST ? "lock file exists" : strerror(errno));
+    } else {
+        size_t len = content ? strlen(content) : 0;
+        ret = len && write(fd, content, len) != (ssize_t)len ? -1 : 0;
+        if (close(fd) < 0 || ret < 0) {
+            ERROR("cannot write %s", lock);
+            unlink(lock);
+            ret = -1;
+        }
+    }
+    free(lock);
+    free(path);
+    return ret;
+}
+
+/* Rename <gitdir>/[name].lock to [name], or with [rollback] remove it. */
+static int release_lock(struct repository *repo, const char *name, int rollback)
+{
+    char *path = utl_path_join(repo->gitdir, name, 0);
+    char *lock = path ? malloc(strlen(path) + 6) : NULL;
+    int ret = -1;
+
+    if (lock) {
+        sprintf(lock, "%s.lock", path);
+        ret = rollback ? unlink(lock) : rename(lock, path);
+        if (ret < 0)
+            ERROR("cannot %s %s: %s", rollback ? "remove" : "commit", lock, strerror(errno));
+    }
+    free(lock);
+    free(path);
+    return ret;
+}
+
+/* Read the current value of [u]'s ref, with its locks held. */
+static int read_current(struct ref_transaction *tx, struct ref_store *refs,
+                        struct ref_update *u)
+{
+    struct repository *repo = tx->repo;
+    char target[LOOSE_REF_MAX];
+    struct ref_entry ref;
+    const char *rec;
+
+    switch (read_loose_ref(repo, u->refname, &u->current, target, sizeof(target))) {
+    case RAW_OID:
+        u->exists = 1;
+        return 0;
+    case RAW_SYMREF:
+        ERROR("cannot lock ref '%s': it became a symbolic ref", u->refname);
+        return -1;
+    case RAW_BROKEN:
+        ERROR("cannot lock ref '%s': unable to resolve reference", u->refname);
+        return -1;
+    case RAW_MISSING:
+        break;
+    }
+    rec = packed_find(&refs->packed, hash_algo_hexsz(repo->hash_algo), u->refname, 0);
+    if (rec) {
+        if (parse_packed_record(&refs->packed, rec, repo->hash_algo, &ref) < 0)
+            return -1;
+        u->current = ref.oid;
+        u->exists = 1;
+    }
+    return 0;
+}
+
+static int check_old_value(const struct ref_update *u, hash_algo_t algo)
+{
+    char hex[MAX_HEX_OID_LENGTH + 1], want[MAX_HEX_OID_LENGTH + 1];
+    size_t rawsz = hash_algo_rawsz(algo);
+
+    if (!(u->flags & UPDATE_HAVE_OLD))
+        return 0;
+    if (oid_is_null(&u->old_oid, algo)) {
+        if (!u->exists)
+            return 0;
+        ERROR("cannot lock ref '%s': reference already exists", u->refname);
+        return -1;
+    }
+    if (!u->exists) {
+        ERROR("cannot lock ref '%s': unable to resolve reference", u->refname);
+        return -1;
+    }
+    if (memcmp(u->current.hash, u->old_oid.hash, rawsz)) {
+        oid_to_hex_r(hex, &u->current);
+        oid_to_hex_r(want, &u->old_oid);
+        ERROR("cannot lock ref '%s': is at %s but expected %s", u->refname, hex, want);
+        return -1;
+    }
+    return 0;
+}
+
+struct packed_writer {
+    int fd;
+    char *buf;
+    size_t len;
+    int failed;
+};
+
+static void packed_write_all(struct packed_writer *w, const char *p, size_t len)
+{
+    while (len && !w->failed) {
+        ssize_t n = write(w->fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            w->failed = 1;
+        else {
+            p += n;
+            len -= n;
+        }
+    }
+}
+
+static void packed_flush(struct packed_writer *w)
+{
+    packed_write_all(w, w->buf, w->len);
+    w->len = 0;
+}
+
+static void packed_write(struct packed_writer *w, const char *data, size_t len)
+{
+    if (!len)
+        return;
+    if (w->len + len > PACKED_WRITE_BUFFER)
+        packed_flush(w);
+    /* a long run of records goes straight out */
+    if (len >= PACKED_WRITE_BUFFER) {
+        packed_write_all(w, data, len);
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+/*
+ * Write packed-refs.lock: the current records, with those of the
+ * updates in [to_packed] replaced (or dropped for a deletion). Both
+ * are sorted, so each update finds its place with a binary search
+ * and the records in between are copied in one piece.
+ */
+static int write_packed_refs(struct ref_transaction *tx, struct ref_store *refs,
+                             char *to_packed)
+{
+    struct repository *repo = tx->repo;
+    struct packed_refs *pr = &refs->packed;
+    size_t hexsz = hash_algo_hexsz(repo->hash_algo);
+    struct packed_writer w = { -1, malloc(PACKED_WRITE_BUFFER), 0, 0 };
+    char *path = utl_path_join(repo->gitdir, "packed-refs.lock", 0);
+    const char *cursor = pr->start;
+    char line[2 * MAX_HEX_OID_LENGTH + LOOSE_REF_MAX + 8];
+    const char *header;
+
+    if (!w.buf || !path || (w.fd = open(path, O_WRONLY | O_TRUNC)) < 0) {
+        free(w.buf);
+        free(path);
+        return -1;
+    }
+
+    /* the records kept as they are keep what their traits promised */
+    header = !pr->loaded || !pr->map || pr->peeled == PEELED_FULLY ?
+             "# pack-refs with: peeled fully-peeled sorted \n" :
+             pr->peeled == PEELED_TAGS ? "# pack-refs with: peeled sorted \n" :
+             "# pack-refs with: sorted \n";
+    packed_write(&w, header, strlen(header));
+
+    for (size_t i = 0; i < tx->nr; i++) {
+        struct ref_update *u = &tx->updates[i];
+        const char *rec;
+        size_t len;
+
+        if (!to_packed[i])
+            continue;
+        rec = cursor < pr->end ? packed_find(pr, hexsz, u->refname, 1) : pr->end;
+        if (rec < cursor)
+            rec = cursor;
+        packed_write(&w, cursor, rec - cursor);
+        cursor = rec;
+        if (rec < pr->end && compare_record(rec, pr->end, hexsz, u->refname) == 0)
+            cursor = find_end_of_record(rec, pr->end);
+        if (update_is_delete(u, repo->hash_algo))
+            continue;
+
+        struct object_id peeled;
+        enum object_type type;
+        char hex[MAX_HEX_OID_LENGTH + 1];
+        len = snprintf(line, sizeof(line), "%s %s\n", oid_to_hex_r(hex, &u->new_oid), u->refname);
+        if (peel_object(repo, &u->new_oid, &peeled, &type) == 0 &&
+            !oideq(&peeled, &u->new_oid))
+            len += snprintf(line + len, sizeof(line) - len, "^%s\n", oid_to_hex_r(hex, &peeled));
+        packed_write(&w, line, len);
+    }
+    packed_write(&w, cursor, pr->end - cursor);
+    packed_flush(&w);
+
+    free(w.buf);
+    free(path);
+    if (close(w.fd) < 0 || w.failed) {
+        ERROR("cannot write packed-refs.lock");
+        return -1;
+    }
+    return 0;
+}
+
+/* The environment variable [env], else the first of [keys] set in the config. */
+static char *ident_part(struct repository *repo, const char *env, const char *const *keys)
+{
+    const char *value = getenv(env);
+    char *config = NULL;
+
+    if (value)
+        return strdup(value);
+    for (; *keys && !config; keys++)
+        config = repo_config_get_string(repo, *keys);
+    return config;
+}
+
+/*
+ * "Name <email>" of the reflog entries, found as git finds the
+ * committer: GIT_COMMITTER_NAME and _EMAIL, then committer.name and
+ * .email, then user.name and .email in the config. Failing those, the
+ * name is the account's full name or login, and the email $EMAIL or
+ * <login>@<host>.
+ */
+static char *default_ident(struct repository *repo)
+{
+    static const char *const name_keys[] = { "committer.name", "user.name", NULL };
+    static const char *const email_keys[] = { "committer.email", "user.email", NULL };
+    char *name = ident_part(repo, "GIT_COMMITTER_NAME", name_keys);
+    char *email = ident_part(repo, "GIT_COMMITTER_EMAIL", email_keys);
+    struct passwd *pw = NULL;
+    char *ident = NULL;
+
+    if ((!name || !email) && !(pw = getpwuid(getuid())))
+        ERROR("cannot find the user's name: set user.name and user.email");
+    if (!name && pw && pw->pw_gecos && *pw->pw_gecos && *pw->pw_gecos != ',')
+        name = strndup(pw->pw_gecos, strcspn(pw->pw_gecos, ","));
+    if (!name && pw)
+        name = strdup(pw->pw_name);
+    if (!email && getenv("EMAIL"))
+        email = strdup(getenv("EMAIL"));
+    if (!email && pw) {
+        char host[256];
+        if (gethostname(host, sizeof(host)) < 0)
+            strcpy(host, "(none)");
+        host[sizeof(host) - 1] = '\0';
+        if (asprintf(&email, "%s@%s", pw->pw_name, host) < 0)
+            email = NULL;
+    }
+    if (name && email && asprintf(&ident, "%s <%s>", name, email) < 0)
+        ident = NULL;
+    free(name);
+    free(email);
+    return ident;
+}
+
+/* Append one entry to logs/[refname], in a single write(). */
+static int append_reflog(struct repository *repo, const char *refname,
+                         const struct ref_update *u, const char *ident,
+                         time_t now, int tz)
+{
+    char old_hex[MAX_HEX_OID_LENGTH + 1], new_hex[MAX_HEX_OID_LENGTH + 1];
+    char *logname = NULL, *path = NULL, *entry = NULL;
+    struct object_id zero;
+    int fd = -1, len, ret = -1;
+
+    memset(&zero, 0, sizeof(zero));
+    zero.algo = repo->hash_algo;
+    oid_to_hex_r(old_hex, u->exists ? &u->current : &zero);
+    oid_to_hex_r(new_hex, &u->new_oid);
+    len = asprintf(&entry, "%s %s %s %lld %c%02d%02d\t%s\n", old_hex, new_hex, ident,
+                   (long long)now, tz < 0 ? '-' : '+', abs(tz) / 60, abs(tz) % 60,
+                   u->msg ? u->msg : "");
+    if (len < 0)
+        return -1;
+    /* one line per entry */
+    for (char *p = strchr(entry, '\t'); p && p < entry + len - 1; p++)
+        if (*p == '\n')
+            *p = ' ';
+
+    if (asprintf(&logname, "logs/%s", refname) >= 0 &&
+        (path = utl_path_join(repo->gitdir, logname, 0)) != NULL &&
+        create_leading_dirs(path) == 0 &&
+        (fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666)) >= 0 &&
+        write(fd, entry, len) == len)
+        ret = 0;
+    if (fd >= 0 && close(fd) < 0)
+        ret = -1;
+    if (ret < 0)
+        ERROR("cannot append to the reflog of %s", refname);
+    free(entry);
+    free(logname);
+    free(path);
+    return ret;
+}
+
+static int write_reflogs(struct ref_transaction *tx, const struct ref_transaction_options *opts)
+{
+    struct repository *repo = tx->repo;
+    char *ident = opts->ident ? strdup(opts->ident) : default_ident(repo);
+    char *head = NULL;
+    struct ref_entry ref;
+    time_t now = time(NULL);
+    struct tm tm;
+    int tz, ret = 0;
+
+    if (!ident)
+        return -1;
+    localtime_r(&now, &tm);
+    tz = (int)(tm.tm_gmtoff / 60);
+    /* the current branch's entries go to HEAD's reflog as well */
+    if (refs_resolve(repo, "HEAD", &ref, &head) < 0 || !(ref.flags & REF_ISSYMREF)) {
+        free(head);
+        head = NULL;
+    }
+
+    for (size_t i = 0; i < tx->nr; i++) {
+        struct ref_update *u = &tx->updates[i];
+        if (!update_is_write(u, repo->hash_algo))
+            continue;
+        if (append_reflog(repo, u->refname, u, ident, now, tz) < 0 ||
+            (head && !strcmp(head, u->refname) &&
+             append_reflog(repo, "HEAD", u, ident, now, tz) < 0))
+            ret = -1;
+    }
+    free(head);
+    free(ident);
+    return ret;
+}
+
+/*
+ * Follow symbolic refs, sort, and check what can be checked without
+ * locks. Returns 0, or -1.
+ */
+static int prepare_updates(struct ref_transaction *tx, struct ref_store *refs)
+{
+    struct repository *repo = tx->repo;
+
+    for (size_t i = 0; i < tx->nr; i++) {
+        struct ref_update *u = &tx->updates[i];
+        struct ref_entry ref;
+        char *target = NULL;
+
+        if (refs_resolve(repo, u->refname, &ref, &target) >= 0 &&
+            (ref.flags & REF_ISSYMREF)) {
+            free(u->refname);
+            u->refname = target;
+        } else {
+            free(target);
+        }
+    }
+    if (tx->nr)
+        qsort(tx->updates, tx->nr, sizeof(*tx->updates), compare_updates);
+
+    for (size_t i = 0; i < tx->nr; i++) {
+        struct ref_update *u = &tx->updates[i];
+        enum object_type type;
+        size_t size;
+
+        if (strncmp(u->refname, "refs/", 5) && strcmp(u->refname, "HEAD")) {
+            ERROR("cannot update %s: not under refs/", u->refname);
+            return -1;
+        }
+        if (i && !strcmp(u->refname, tx->updates[i - 1].refname)) {
+            ERROR("multiple updates for ref '%s' not allowed", u->refname);
+            return -1;
+        }
+        if (!update_is_write(u, repo->hash_algo))
+            continue;
+        if (repo_read_object_info(repo, &u->new_oid, &type, &size) < 0) {
+            ERROR("trying to write ref '%s' with nonexistent object %s",
+                  u->refname, oid_to_hex(&u->new_oid));
+            return -1;
+        }
+        if (type != OBJ_COMMIT && !strncmp(u->refname, "refs/heads/", 11)) {
+            ERROR("trying to write non-commit object %s to branch '%s'",
+                  oid_to_hex(&u->new_oid), u->refname);
+            return -1;
+        }
+        if (check_df_conflict(tx, refs, u) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int ref_transaction_commit(struct ref_transaction *tx,
+                           const struct ref_transaction_options *opts)
+{
+    static const struct ref_transaction_options defaults = { 0 };
+    struct repository *repo = tx->repo;
+    struct ref_store *refs = get_ref_store(repo);
+    hash_algo_t algo = repo->hash_algo;
+    size_t threshold, nr_writes = 0, nr_deletes = 0;
+    char *to_packed = NULL, hex[MAX_HEX_OID_LENGTH + 2];
+    int packed, packed_changed = 0, ret = -1;
+
+    if (!opts)
+        opts = &defaults;
+    threshold = opts->packed_threshold ? opts->packed_threshold : REF_TRANSACTION_PACKED_THRESHOLD;
+    if (!refs)
+        goto out;
+    if (refs->reftable) {
+        ERROR("cannot update refs: reftable repositories are read-only");
+        goto out;
+    }
+    if (prepare_updates(tx, refs) < 0)
+        goto out;
+
+    for (size_t i = 0; i < tx->nr; i++) {
+        nr_writes += update_is_write(&tx->updates[i], algo);
+        nr_deletes += update_is_delete(&tx->updates[i], algo);
+    }
+    packed = nr_writes && nr_writes >= threshold;
+    if (!(to_packed = calloc(tx->nr ? tx->nr : 1, 1)))
+        goto out;
+
+    /*
+     * Loose locks: every ref is locked, packed or not, as git does, so
+     * that no loose write lands between reading it and renaming
+     * packed-refs. A ref written loose holds its new value in its lock
+     * already. HEAD is never packed.
+     */
+    for (size_t i = 0; i < tx->nr; i++) {
+        struct ref_update *u = &tx->updates[i];
+        char *path;
+        struct stat st;
+
+        u->packed = packed && (u->flags & UPDATE_HAVE_NEW) && !strncmp(u->refname, "refs/", 5);
+        if (!u->packed && update_is_write(u, algo))
+            snprintf(hex, sizeof(hex), "%s\n", oid_to_hex(&u->new_oid));
+        if (create_lock(repo, u->refname,
+                        !u->packed && update_is_write(u, algo) ? hex : NULL) < 0)
+            goto out;
+        u->locked = 1;
+
+        /* under the lock, so that a loose file written just before is seen */
+        path = utl_path_join(repo->gitdir, u->refname, 0);
+        u->loose = path && lstat(path, &st) == 0 && !S_ISDIR(st.st_mode);
+        free(path);
+    }
+    if (packed || nr_deletes) {
+        if (create_lock(repo, "packed-refs", NULL) < 0)
+            goto out;
+        tx->packed_locked = 1;
+    }
+    if (prepare_packed_refs(repo, refs) < 0)
+        goto out;
+
+    /* the values the caller expects, read under the locks */
+    for (size_t i = 0; i < tx->nr; i++) {
+        struct ref_update *u = &tx->updates[i];
+        if (read_current(tx, refs, u) < 0 || check_old_value(u, algo) < 0)
+            goto out;
+        if (u->packed || (update_is_delete(u, algo) &&
+                          packed_find(&refs->packed, hash_algo_hexsz(algo), u->refname, 0))) {
+            to_packed[i] = 1;
+            packed_changed = 1;
+        }
+    }
+
+    /* nothing has changed yet; from here on each step is applied */
+    if (packed_changed) {
+        if (write_packed_refs(tx, refs, to_packed) < 0 ||
+            release_lock(repo, "packed-refs", 0) < 0)
+            goto out;
+        tx->packed_locked = 0;
+    }
+    ret = 0;
+    for (size_t i = 0; i < tx->nr; i++) {
+        struct ref_update *u = &tx->updates[i];
+        if (!u->locked)
+            continue;
+        if (!u->packed && update_is_write(u, algo)) {
+            if (release_lock(repo, u->refname, 0) < 0)
+                ret = -1;
+            u->locked = 0;
+            continue;
+        }
+        /* a deletion, or a ref now packed: its loose file goes */
+        if ((update_is_delete(u, algo) || u->packed) && u->loose) {
+            char *path = utl_path_join(repo->gitdir, u->refname, 0);
+            if (!path || unlink(path) < 0)
+                ret = -1;
+            free(path);
+        }
+        release_lock(repo, u->refname, 1);
+        u->locked = 0;
+        if (update_is_delete(u, algo)) {
+            char *log = NULL;
+            if (asprintf(&log, "logs/%s", u->refname) >= 0) {
+                char *path = utl_path_join(repo->gitdir, log, 0);
+                if (path)
+                    unlink(path);
+                free(path);
+            }
+            free(log);
+        }
+        remove_empty_parents(repo, u->refname);
+    }
+    if (ret == 0 && opts->reflog && write_reflogs(tx, opts) < 0)
+        ret = -1;
+
+out:
+    /* whatever is still locked was not applied */
+    for (size_t i = 0; i < tx->nr; i++)
+        if (tx->updates[i].locked) {
+            release_lock(repo, tx->updates[i].refname, 1);
+            remove_empty_parents(repo, tx->updates[i].refname);
+            tx->updates[i].locked = 0;
+        }
+    if (tx->packed_locked) {
+        release_lock(repo, "packed-refs", 1);
+        tx->packed_locked = 0;
+    }
+    free(to_packed);
+    return ret;
+}
+
+void ref_transaction_free(struct ref_transaction *tx)
+{
+    if (!tx)
+        return;
+    for (size_t i = 0; i < tx->nr; i++) {
+        if (tx->updates[i].locked)
+            release_lock(tx->repo, tx->updates[i].refname, 1);
+        free(tx->updates[i].refname);
+        free(tx->updates[i].msg);
+    }
+    if (tx->packed_locked)
+        release_lock(tx->repo, "packed-refs", 1);
+    free(tx->updates);
+    free(tx);
+}
+
+/* ---- show-ref ---- */
+
+struct show_ref {
+    struct repository *repo;
+    char **patterns;
+    int nr_patterns;
+    int dereference, quiet;
+    int found;
+};
+
+/* git show-ref: a pattern matches the end of a name, on a '/' boundary. */
+static int show_ref_matches(const struct show_ref *sr, const char *refname)
+{
+    size_t len = strlen(refname);
+
+    if (!sr->nr_patterns)
+        return 1;
+    for (int i = 0; i < sr->nr_patterns; i++) {
+        size_t plen = strlen(sr->patterns[i]);
+        if (plen <= len && !strcmp(refname + len - plen, sr->patterns[i]) &&
+            (plen == len || refname[len - plen - 1] == '/'))
+            return 1;
+    }
+    return 0;
+}
+
+static int show_one_ref(const struct ref_entry *ref, void *data)
+{
+    struct show_ref *sr = data;
+    char hex[MAX_HEX_OID_LENGTH + 1];
+    struct object_id peeled;
+
+    if (!show_ref_matches(sr, ref->name))
+        return 0;
+    sr->found = 1;
+    if (sr->quiet)
+        return 0;
+    printf("%s %s\n", oid_to_hex_r(hex, &ref->oid), ref->name);
+    if (sr->dereference && refs_peel(sr->repo, ref, &peeled) == 0 &&
+        !oideq(&peeled, &ref->oid))
+        printf("%s %s^{}\n", oid_to_hex_r(hex, &peeled), ref->name);
+    return 0;
+}
+
+static void show_ref_usage(void)
+{
+    fprintf(stderr, "usage: show-ref [--head] [--branches] [--tags] [-d] [-q] "
+                    "[--verify] <gitdir> [<pattern>...]\n");
+}
+
+int cmd_show_ref(int argc, char **argv)
+{
+    struct show_ref sr = { 0 };
+    struct repository repo;
+    int head = 0, branches = 0, tags = 0, verify = 0, i, ret = 0;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "--head"))
+            head = 1;
+        else if (!strcmp(argv[i], "--branches") || !strcmp(argv[i], "--heads"))
+            branches = 1;
+        else if (!strcmp(argv[i], "--tags"))
+            tags = 1;
+        else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--dereference"))
+            sr.dereference = 1;
+        else if (!strcmp(argv[i], "-q") || !strcmp(argv[i], "--quiet"))
+            sr.quiet = 1;
+        else if (!strcmp(argv[i], "--verify"))
+            verify = 1;
+        else {
+            show_ref_usage();
+            return 128;
+        }
+    }
+    if (i >= argc || (verify && i + 1 >= argc)) {
+        show_ref_usage();
+        return 128;
+    }
+    if (repo_open(&repo, argv[i]) < 0) {
+        ERROR("cannot open repository %s", argv[i]);
+        return 128;
+    }
+    sr.repo = &repo;
+    sr.patterns = argv + i + 1;
+    sr.nr_patterns = argc - i - 1;
+
+    if (verify) {
+        /* each pattern is a ref name looked up on its own */
+        for (int j = 0; j < sr.nr_patterns; j++) {
+            struct ref_entry ref;
+            const char *name = sr.patterns[j];
+            struct show_ref one = sr;
+
+            one.nr_patterns = 0;
+            if ((strcmp(name, "HEAD") && strncmp(name, "refs/", 5)) ||
+                refs_resolve(&repo, name, &ref, NULL) != 0) {
+                /* like git, -q turns the error into a plain failure */
+                if (!sr.quiet)
+                    fprintf(stderr, "fatal: '%s' - not a valid ref\n", name);
+                ret = sr.quiet ? 1 : 128;
+                break;
+            }
+            show_one_ref(&ref, &one);
+        }
+        repo_clear(&repo);
+        return ret;
+    }
+
+    if (head) {
+        struct ref_entry ref;
+        struct show_ref one = sr;
+        one.nr_patterns = 0;
+        if (refs_resolve(&repo, "HEAD", &ref, NULL) == 0) {
+            show_one_ref(&ref, &one);
+            sr.found = 1;
+        }
+    }
+    if (!branches && !tags)
+        ret = refs_for_each_ref(&repo, "refs/", show_one_ref, &sr);
+    if (branches && ret == 0)
+        ret = refs_for_each_ref(&repo, "refs/heads/", show_one_ref, &sr);
+    if (tags && ret == 0)
+        ret = refs_for_each_ref(&repo, "refs/tags/", show_one_ref, &sr);
+
+    repo_clear(&repo);
+    if (ret < 0)
+        return 128;
+    return sr.found ? 0 : 1;
+}
+
+/* ---- update-ref ---- */
+
+/* An id of the command line or stdin: all zeros (or empty) is the null id. */
+static int parse_update_value(struct repository *repo, const char *arg,
+                              struct object_id *oid)
+{
+    memset(oid, 0, sizeof(*oid));
+    oid->algo = repo->hash_algo;
+    if (!*arg || strspn(arg, "0") == strlen(arg))
+        return 0;
+    if (repo_resolve_ref(repo, arg, oid) < 0) {
+        ERROR("%s: not a valid object name", arg);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Queue one line of update-ref --stdin. [line] is cut up in place.
+ * Returns 0, or -1 if it cannot be parsed.
+ */
+static int queue_stdin_update(struct ref_transaction *tx, struct repository *repo,
+                              char *line, const char *msg)
+{
+    static const struct {
+        const char *name;
+        int min_args, max_args;     /* after the ref name */
+        int has_new;                /* args[0] is the new value */
+        int must_be_new;            /* no old value: it must not exist */
+    } commands[] = {
+        { "update", 1, 2, 1, 0 },
+        { "create", 1, 1, 1, 1 },
+        { "delete", 0, 1, 0, 0 },
+        { "verify", 0, 1, 0, 1 },
+    };
+    char *args[4], *save = NULL;
+    struct object_id new_oid, old_oid;
+    const char *old_arg;
+    size_t c;
+    int nr = 0;
+
+    for (char *tok = strtok_r(line, " \n", &save); tok; tok = strtok_r(NULL, " \n", &save)) {
+        if (nr == 4) {
+            ERROR("%s: too many arguments", args[0]);
+            return -1;
+        }
+        args[nr++] = tok;
+    }
+    if (!nr)
+        return 0;
+    for (c = 0; c < sizeof(commands) / sizeof(commands[0]); c++)
+        if (!strcmp(args[0], commands[c].name))
+            break;
+    if (c == sizeof(commands) / sizeof(commands[0])) {
+        ERROR("unknown command: %s", args[0]);
+        return -1;
+    }
+    if (nr - 2 < commands[c].min_args || nr - 2 > commands[c].max_args) {
+        ERROR("%s: wrong number of arguments", args[0]);
+        return -1;
+    }
+
+    /* delete's new value and a missing old value are the null id */
+    if (parse_update_value(repo, commands[c].has_new ? args[2] : "", &new_oid) < 0)
+        return -1;
+    old_arg = nr > 2 + commands[c].has_new ? args[2 + commands[c].has_new] : "";
+    if (parse_update_value(repo, old_arg, &old_oid) < 0)
+        return -1;
+    return ref_transaction_update(tx, args[1], strcmp(args[0], "verify") ? &new_oid : NULL,
+                                  *old_arg || commands[c].must_be_new ? &old_oid : NULL,
+                                  msg);
+}
+
+static void update_ref_usage(void)
+{
+    fprintf(stderr, "usage: update-ref [-v] [-m <msg>] [--create-reflog] "
+                    "[--packed-threshold <n>] <gitdir>\n"
+                    "                  (--stdin | -d <ref> [<old>] | <ref> <new> [<old>])\n");
+}
+
+int cmd_update_ref(int argc, char **argv)
+{
+    struct ref_transaction_options opts = { 0 };
+    struct ref_transaction *tx = NULL;
+    struct repository repo;
+    struct object_id new_oid, old_oid;
+    const char *msg = NULL;
+    int verbose = 0, delete = 0, use_stdin = 0, i, ret = 128;
+    double start;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-v"))
+            verbose = 1;
+        else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+            msg = argv[++i];
+        else if (!strcmp(argv[i], "--create-reflog"))
+            opts.reflog = 1;
+        else if (!strcmp(argv[i], "--packed-threshold") && i + 1 < argc)
+            opts.packed_threshold = strtoul(argv[++i], NULL, 10);
+        else {
+            update_ref_usage();
+            return 128;
+        }
+    }
+    if (i >= argc) {
+        update_ref_usage();
+        return 128;
+    }
+    if (repo_open(&repo, argv[i]) < 0) {
+        ERROR("cannot open repository %s", argv[i]);
+        return 128;
+    }
+    /* the mode comes after the gitdir */
+    if (i + 1 < argc && !strcmp(argv[i + 1], "--stdin"))
+        use_stdin = 1;
+    else if (i + 1 < argc && !strcmp(argv[i + 1], "-d"))
+        delete = 1;
+    i += 1 + use_stdin + delete;
+    if (use_stdin ? i != argc : argc - i < 2 - delete || argc - i > 3 - delete) {
+        update_ref_usage();
+        goto out;
+    }
+
+    start = monotonic_seconds();
+    if (!(tx = ref_transaction_begin(&repo)))
+        goto out;
+    if (use_stdin) {
+        char *line = NULL;
+        size_t cap = 0;
+        int failed = 0;
+
+        while (!failed && getline(&line, &cap, stdin) >= 0)
+            failed = queue_stdin_update(tx, &repo, line, msg) < 0;
+        free(line);
+        if (failed)
+            goto out;
+    } else {
+        int have_old = argc - i == 3 - delete;
+        const char *old_arg = have_old ? argv[i + 2 - delete] : NULL;
+
+        if (delete) {
+            memset(&new_oid, 0, sizeof(new_oid));
+            new_oid.algo = repo.hash_algo;
+        } else if (parse_update_value(&repo, argv[i + 1], &new_oid) < 0) {
+            goto out;
+        }
+        if (have_old && parse_update_value(&repo, old_arg, &old_oid) < 0)
+            goto out;
+        if (ref_transaction_update(tx, argv[i], &new_oid, have_old ? &old_oid : NULL, msg) < 0)
+            goto out;
+    }
+    if (ref_transaction_commit(tx, &opts) == 0)
+        ret = 0;
+    if (verbose)
+        fprintf(stderr, "%zu refs updated in %.3fs\n", tx->nr, monotonic_seconds() - start);
+
+out:
+    ref_transaction_free(tx);
+    repo_clear(&repo);
+    return ret;
+}
@@ -0,0 +1,187 @@
+#ifndef REFS_H
+#define REFS_H
+
+#include <stddef.h>
+#include "hash.h"
+#include "object.h"
+
+struct repository;
+
+/*
+ * References: HEAD and the other files directly in the gitdir, loose
+ * refs under refs/, and packed-refs, or a reftable stack.
+ *
+ * A loose ref is one small file, read when it is asked for. packed-refs
+ * is mapped once and kept until its stat data changes. Its records are
+ * sorted by name (a file without the "sorted" trait is checked, and
+ * sorted into a copy if it is not), so a single lookup is a binary
+ * search over the map and touches a few pages whatever the number of
+ * refs, and iterating a prefix is a binary search for its first record
+ * followed by a scan that stops at the first record past it. The
+ * "^<id>" line after a tag's record is its peeled value; with the
+ * "peeled" trait (for tags) or "fully-peeled" (for every ref) a
+ * record without one is known not to be a tag.
+ *
+ * A loose ref overrides a packed one of the same name. Iteration reads
+ * the loose refs under the directory of the prefix, sorts them, and
+ * merges them with the packed ones.
+ *
+ * A repository with reftable/tables.list keeps its refs, HEAD included,
+ * in a reftable stack instead (see reftable.h), behind the same calls;
+ * only FETCH_HEAD and MERGE_HEAD are still files there. The stack is
+ * read again when tables.list changes.
+ *
+ * The packed-refs map or the reftable stack is cached on the
+ * repository; none of this is thread-safe.
+ */
+
+#define REF_ISSYMREF        (1u << 0)   /* reached through a symbolic ref */
+#define REF_ISPACKED        (1u << 1)   /* read from packed-refs */
+#define REF_KNOWS_PEELED    (1u << 2)   /* [peeled] is valid */
+
+struct ref_entry {
+    const char *name;           /* full name, e.g. "refs/heads/main" */
+    struct object_id oid;
+    struct object_id peeled;    /* the non-tag object it leads to */
+    unsigned flags;             /* REF_* */
+};
+
+struct ref_store;
+
+/*
+ * Whether [refname] is a well-formed full ref name: "refs/" followed
+ * by components that do not start with '.' or end with ".lock", with
+ * no "..", "@{", control characters, spaces or any of "~^:?*[\", and
+ * no empty or trailing component; or a name of capitals and '_' such
+ * as HEAD or FETCH_HEAD. Returns 0 if it is.
+ */
+int refs_check_name(const char *refname);
+
+/*
+ * Read [refname], a full ref name, following symbolic refs into [ref]
+ * (ref->name is [refname]). [target], if not NULL, is set to the name
+ * of the last ref of the chain (caller frees), e.g. the current branch
+ * for HEAD. Returns 0; 1 if a symbolic ref points at a ref that does
+ * not exist yet (an unborn branch: ref->oid is zero, [target] is set);
+ * or -1 if it does not exist or cannot be read.
+ */
+int refs_resolve(struct repository *repo, const char *refname,
+                 struct ref_entry *ref, char **target);
+
+/* refs_resolve() for just the id. Returns 0, or -1 if there is none. */
+int refs_read_ref(struct repository *repo, const char *refname,
+                  struct object_id *oid);
+
+/*
+ * The object [ref] leads to once tags are followed: from packed-refs
+ * if it is known there, else by reading the tags with peel_object().
+ * Returns 0, or -1 if an object is missing.
+ */
+int refs_peel(struct repository *repo, const struct ref_entry *ref,
+              struct object_id *peeled);
+
+/*
+ * Call fn(ref, data) for every ref whose name starts with [prefix]
+ * (e.g. "refs/tags/", or "" for all of them), in name order. Symbolic
+ * refs are reported resolved, and skipped if they lead nowhere; a
+ * broken loose ref is skipped with a warning. ref->name is only valid
+ * during the call. Stops early and returns fn's value if it is
+ * non-zero; returns 0 once done, or -1 on error.
+ */
+typedef int (*each_ref_fn)(const struct ref_entry *ref, void *data);
+
+int refs_for_each_ref(struct repository *repo, const char *prefix,
+                      each_ref_fn fn, void *data);
+
+/*
+ * A ref transaction: updates of many refs, applied together or not at
+ * all.
+ *
+ * ref_transaction_commit() follows symbolic refs (an update of HEAD
+ * moves its branch), sorts the updates and checks them: valid names,
+ * no ref updated twice, no ref created where another's name is a
+ * directory of it or the other way round, and new values that exist
+ * (commits, under refs/heads/). It then takes the locks it needs,
+ * reads every ref under them, and compares the values the caller
+ * expects before anything is written; one mismatch and every lock is
+ * released with nothing changed.
+ *
+ * A small batch is written as loose refs: each lock file
+ * (<ref>.lock, created exclusively) receives its new value and is
+ * renamed over the ref. A batch of at least [packed_threshold] new
+ * values goes to packed-refs instead: only packed-refs.lock is taken,
+ * plus the locks of those refs that have a loose file (removed once
+ * the packed value is in place), and packed-refs is rewritten once:
+ * the runs of records between updated names are copied as they are
+ * and the updated ones replaced, with their peeled values. Deleting a
+ * ref also rewrites packed-refs if it is packed, and removes its
+ * reflog.
+ *
+ * With [reflog], each updated ref gets an entry in logs/<ref> (and
+ * logs/HEAD when it is the current branch), appended with a single
+ * write() so that concurrent writers do not interleave.
+ *
+ * Reftable repositories are read-only here.
+ */
+
+/* Batches from this many new values on rewrite packed-refs. */
+#define REF_TRANSACTION_PACKED_THRESHOLD 100
+
+struct ref_transaction_options {
+    size_t packed_threshold;    /* 0: REF_TRANSACTION_PACKED_THRESHOLD */
+    int reflog;
+    const char *ident;          /* "Name <email>" for the reflog; NULL:
+                                   the committer, found as git does */
+};
+
+struct ref_transaction;
+
+struct ref_transaction *ref_transaction_begin(struct repository *repo);
+
+/*
+ * Add an update of [refname] to [new_oid] (NULL: no change, only check
+ * the old value; all-zero: delete it) if it holds [old_oid] (NULL: any
+ * value; all-zero: it must not exist). [msg] is for the reflog and
+ * may be NULL. Returns 0, or -1 if [refname] is not a valid name.
+ */
+int ref_transaction_update(struct ref_transaction *tx, const char *refname,
+                           const struct object_id *new_oid,
+                           const struct object_id *old_oid, const char *msg);
+
+/*
+ * Apply the updates of [tx] (see above); [opts] may be NULL. Returns
+ * 0, or -1 with nothing changed if a check fails or a lock is taken.
+ * [tx] is spent either way.
+ */
+int ref_transaction_commit(struct ref_transaction *tx,
+                           const struct ref_transaction_options *opts);
+
+void ref_transaction_free(struct ref_transaction *tx);
+
+/* Release what repo->refs holds; called by repo_clear(). */
+void ref_store_free(struct ref_store *refs);
+
+/*
+ * "show-ref [--head] [--branches] [--tags] [-d] [-q] [--verify]
+ *  <gitdir> [<pattern>...]": print "<id> <name>" for every ref, as git
+ * does. --branches and --tags only list refs/heads/ and refs/tags/; a
+ * pattern keeps the refs it matches at the end, on a '/' boundary;
+ * -d adds "<peeled> <name>^{}" for tags. With --verify every pattern is
+ * a full ref name looked up directly, and one that does not exist is
+ * an error unless -q is given. Exits with 0, 1 if nothing matched, or
+ * 128 on error.
+ */
+int cmd_show_ref(int argc, char **argv);
+
+/*
+ * "update-ref [-v] [-m <msg>] [--create-reflog] [--packed-threshold <n>]
+ *  <gitdir> (--stdin | -d <ref> [<old>] | <ref> <new> [<old>])": update
+ * one ref, or in one transaction every ref named on stdin by the lines
+ * of git update-ref --stdin: "update <ref> <new> [<old>]",
+ * "create <ref> <new>", "delete <ref> [<old>]" and "verify <ref> [<old>]".
+ * --create-reflog writes reflog entries; -v prints the time taken to
+ * stderr. Exits with 0, or 128 if the transaction failed.
+ */
+int cmd_update_ref(int argc, char **argv);
+
+#endif /* REFS_H */
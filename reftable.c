@@ -0,0 +1,713 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "log.h"
+#include "reftable.h"
+#include "hex.h"
+#include "utl.h"
+
+#define REFTABLE_MAGIC "REFT"
+#define REFTABLE_HASH_SHA1 0x73686131u     /* "sha1" */
+#define REFTABLE_HASH_SHA256 0x73323536u   /* "s256" */
+
+/* Five be64 section positions and a CRC-32 after the header copy. */
+#define FOOTER_EXTRA (5 * 8 + 4)
+
+#define BLOCK_REF 'r'
+#define BLOCK_INDEX 'i'
+
+/* A ref index deeper than this is taken to be a loop in a corrupt file. */
+#define MAX_INDEX_DEPTH 16
+
+/* Tables a concurrent compaction removed are looked for again this often. */
+#define MAX_RELOAD_TRIES 3
+
+static uint32_t get_be16(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 8 | p[1];
+}
+
+static uint32_t get_be24(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static uint32_t get_be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+    return (uint64_t)get_be32(p) << 32 | get_be32(p + 4);
+}
+
+/*
+ * The varint of reftable (and of pack offsets): 7 bits per byte, most
+ * significant first, each continuation adding one so that every value
+ * has a single encoding. Returns 0, or -1 if it runs past [end].
+ */
+static int get_varint(const unsigned char **p, const unsigned char *end, uint64_t *out)
+{
+    const unsigned char *q = *p;
+    uint64_t val;
+
+    if (q >= end)
+        return -1;
+    val = *q & 0x7f;
+    while (*q++ & 0x80) {
+        if (q >= end || val >= (UINT64_MAX >> 7))
+            return -1;
+        val = ((val + 1) << 7) | (*q & 0x7f);
+    }
+    *p = q;
+    *out = val;
+    return 0;
+}
+
+/* ---- tables ---- */
+
+struct reftable_table {
+    char *name;
+    unsigned char *map;
+    size_t size;
+    size_t header_size;         /* 24 (version 1) or 28 (version 2) */
+    size_t data_end;            /* where the footer starts */
+    size_t hash_size;
+    hash_algo_t algo;
+    uint32_t block_size;        /* 0: blocks are not aligned */
+    uint64_t min_update_index;
+    uint64_t ref_index_pos;     /* 0: no ref index */
+    uint64_t ref_end;           /* end of the ref blocks */
+};
+
+struct reftable_stack {
+    char *dir;
+    hash_algo_t algo;
+    struct stat list_st;        /* of tables.list when it was read */
+    struct reftable_table *tables;  /* oldest first */
+    size_t nr;
+
+    /* what reftable_stack_read_ref() returns */
+    char *name, *target;
+    size_t name_alloc, target_alloc;
+};
+
+static void table_close(struct reftable_table *t)
+{
+    if (t->map)
+        munmap(t->map, t->size);
+    free(t->name);
+}
+
+/* Map <dir>/[name] and check its header and footer. Returns 0, or -1. */
+static int table_open(struct reftable_table *t, const char *dir, const char *name,
+                      hash_algo_t algo)
+{
+    char *path = utl_path_join(dir, name, 0);
+    const unsigned char *footer;
+    struct stat st;
+    size_t footer_size;
+    uint64_t obj_pos, log_pos;
+    int fd, version;
+
+    memset(t, 0, sizeof(*t));
+    fd = path ? open(path, O_RDONLY) : -1;
+    free(path);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size < 24) {
+        close(fd);
+        ERROR("reftable %s is truncated", name);
+        errno = 0;
+        return -1;
+    }
+    t->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (t->map == MAP_FAILED) {
+        t->map = NULL;
+        return -1;
+    }
+    t->size = st.st_size;
+    t->name = strdup(name);
+
+    if (memcmp(t->map, REFTABLE_MAGIC, 4))
+        goto corrupt;
+    version = t->map[4];
+    if (version != 1 && version != 2)
+        goto corrupt;
+    t->header_size = version == 1 ? 24 : 28;
+    footer_size = t->header_size + FOOTER_EXTRA;
+    if (t->size < t->header_size + footer_size)
+        goto corrupt;
+    t->block_size = get_be24(t->map + 5);
+    t->min_update_index = get_be64(t->map + 8);
+
+    /* version 1 tables only hold SHA-1 ids */
+    t->algo = HASH_SHA1;
+    if (version == 2) {
+        uint32_t id = get_be32(t->map + 24);
+        if (id == REFTABLE_HASH_SHA256)
+            t->algo = HASH_SHA256;
+        else if (id != REFTABLE_HASH_SHA1)
+            goto corrupt;
+    }
+    if (t->algo != algo) {
+        ERROR("reftable %s does not use the repository's hash", name);
+        errno = 0;
+        goto fail;
+    }
+    t->hash_size = hash_algo_rawsz(algo);
+
+    /* the footer repeats the header, then says where each section is */
+    t->data_end = t->size - footer_size;
+    footer = t->map + t->data_end;
+    if (memcmp(footer, t->map, t->header_size) ||
+        crc32(0, footer, footer_size - 4) != get_be32(footer + footer_size - 4))
+        goto corrupt;
+    t->ref_index_pos = get_be64(footer + t->header_size);
+    obj_pos = get_be64(footer + t->header_size + 8) >> 5;
+    log_pos = get_be64(footer + t->header_size + 24);
+
+    /* ref blocks run from the start to the first other section */
+    t->ref_end = t->data_end;
+    if (t->ref_index_pos && t->ref_index_pos < t->ref_end)
+        t->ref_end = t->ref_index_pos;
+    if (obj_pos && obj_pos < t->ref_end)
+        t->ref_end = obj_pos;
+    if (log_pos && log_pos < t->ref_end)
+        t->ref_end = log_pos;
+    if (t->ref_index_pos >= t->data_end)
+        goto corrupt;
+    return 0;
+
+corrupt:
+    ERROR("reftable %s is corrupt", name);
+    errno = 0;
+fail:
+    table_close(t);
+    memset(t, 0, sizeof(*t));
+    return -1;
+}
+
+/* ---- blocks ---- */
+
+struct block {
+    const unsigned char *data;  /* the block, with the file header for the first */
+    uint64_t off;
+    unsigned char type;
+    size_t records_start, records_end;
+    const unsigned char *restarts;
+    size_t nr_restarts;
+    size_t full_size;           /* to the next block, padding included */
+};
+
+/* The type of the block at [off], or 0 if there is none before the footer. */
+static unsigned char block_type_at(const struct reftable_table *t, uint64_t off)
+{
+    uint64_t at = off + (off ? 0 : t->header_size);
+    return at < t->data_end ? t->map[at] : 0;
+}
+
+/*
+ * Read the header of the block at [off], which must end before
+ * [limit]. Returns 0; 1 if there is no block of [type] there (the end
+ * of its section); or -1 if it is corrupt.
+ */
+static int block_open(const struct reftable_table *t, uint64_t off, unsigned char type,
+                      uint64_t limit, struct block *b)
+{
+    size_t header_off = off ? 0 : t->header_size;
+    size_t len;
+
+    if (off >= limit || limit - off < header_off + 4 ||
+        t->map[off + header_off] != type)
+        return 1;
+
+    b->data = t->map + off;
+    b->off = off;
+    b->type = type;
+    len = get_be24(b->data + header_off + 1);   /* the file header included */
+    if (len < header_off + 4 + 2 || len > limit - off)
+        return -1;
+    b->nr_restarts = get_be16(b->data + len - 2);
+    if (!b->nr_restarts || 3 * b->nr_restarts > len - header_off - 4 - 2)
+        return -1;
+    b->records_start = header_off + 4;
+    b->records_end = len - 2 - 3 * b->nr_restarts;
+    b->restarts = b->data + b->records_end;
+
+    /* a padded block is followed by NULs; an unaligned one by the next block */
+    if (!t->block_size || (len < t->block_size && off + len < limit && b->data[len]))
+        b->full_size = len;
+    else
+        b->full_size = t->block_size > len ? t->block_size : len;
+    return 0;
+}
+
+/*
+ * Compare the name of the record at restart point [i], which is stored
+ * whole, with [want]. Returns 0 and sets [cmp], or -1 if it is corrupt.
+ */
+static int compare_restart(const struct block *b, size_t i, const char *want,
+                           size_t want_len, int *cmp)
+{
+    size_t off = get_be24(b->restarts + 3 * i);
+    const unsigned char *p = b->data + off, *end = b->data + b->records_end;
+    uint64_t prefix, x, suffix;
+
+    if (off < b->records_start || off >= b->records_end ||
+        get_varint(&p, end, &prefix) || get_varint(&p, end, &x) || prefix)
+        return -1;
+    suffix = x >> 3;
+    if (suffix > (uint64_t)(end - p))
+        return -1;
+    *cmp = memcmp(p, want, suffix < want_len ? suffix : want_len);
+    if (!*cmp)
+        *cmp = (suffix > want_len) - (suffix < want_len);
+    return 0;
+}
+
+/* ---- iterators ---- */
+
+/* A position in the ref blocks of a table, or in one of its index blocks. */
+struct table_iter {
+    const struct reftable_table *t;
+    struct block blk;
+    size_t pos;                 /* of the next record in blk */
+    int done;
+
+    /* the current record: its full name, and its value */
+    char *key;
+    size_t key_len, key_alloc;
+    struct reftable_ref rec;    /* in a ref block */
+    uint64_t child;             /* in an index block: the block it points at */
+    char *target;
+    size_t target_alloc;
+};
+
+static void table_iter_release(struct table_iter *it)
+{
+    free(it->key);
+    free(it->target);
+}
+
+static int grow(char **buf, size_t *alloc, size_t len)
+{
+    if (len <= *alloc)
+        return 0;
+    size_t n = len > 2 * *alloc ? len : 2 * *alloc;
+    char *tmp = realloc(*buf, n);
+    if (!tmp)
+        return -1;
+    *buf = tmp;
+    *alloc = n;
+    return 0;
+}
+
+/*
+ * Decode the record at it->pos, its name completing the name of the
+ * one before. Returns 0, or -1 if it is corrupt.
+ */
+static int decode_record(struct table_iter *it)
+{
+    const struct reftable_table *t = it->t;
+    const unsigned char *p = it->blk.data + it->pos;
+    const unsigned char *end = it->blk.data + it->blk.records_end;
+    uint64_t prefix, x, suffix, val;
+    unsigned type;
+
+    if (get_varint(&p, end, &prefix) || get_varint(&p, end, &x))
+        return -1;
+    suffix = x >> 3;
+    type = x & 7;
+    if (prefix > it->key_len || suffix > (uint64_t)(end - p) ||
+        grow(&it->key, &it->key_alloc, prefix + suffix + 1) < 0)
+        return -1;
+    memcpy(it->key + prefix, p, suffix);
+    it->key_len = prefix + suffix;
+    it->key[it->key_len] = '\0';
+    p += suffix;
+
+    if (it->blk.type == BLOCK_INDEX) {
+        if (type || get_varint(&p, end, &it->child))
+            return -1;
+        it->pos = p - it->blk.data;
+        return 0;
+    }
+
+    if (get_varint(&p, end, &val))
+        return -1;
+    it->rec.name = it->key;
+    it->rec.update_index = t->min_update_index + val;
+    it->rec.target = NULL;
+    switch (type) {
+    case REFTABLE_DELETION:
+        break;
+    case REFTABLE_VAL1:
+    case REFTABLE_VAL2:
+        if ((uint64_t)(end - p) < type * t->hash_size)
+            return -1;
+        oid_set_raw(&it->rec.value, p, t->algo);
+        p += t->hash_size;
+        if (type == REFTABLE_VAL2) {
+            oid_set_raw(&it->rec.peeled, p, t->algo);
+            p += t->hash_size;
+        }
+        break;
+    case REFTABLE_SYMREF:
+        if (get_varint(&p, end, &val) || val > (uint64_t)(end - p) ||
+            grow(&it->target, &it->target_alloc, val + 1) < 0)
+            return -1;
+        memcpy(it->target, p, val);
+        it->target[val] = '\0';
+        it->rec.target = it->target;
+        p += val;
+        break;
+    default:
+        return -1;
+    }
+    it->rec.type = type;
+    it->pos = p - it->blk.data;
+    return 0;
+}
+
+/*
+ * Move to the next record, going on to the next ref block at the end
+ * of one (an index block is searched on its own). Returns 0; 1 at the
+ * end, setting it->done; or -1 if it is corrupt.
+ */
+static int table_iter_next(struct table_iter *it)
+{
+    while (it->pos >= it->blk.records_end) {
+        int r = it->blk.type == BLOCK_REF ?
+                block_open(it->t, it->blk.off + it->blk.full_size, BLOCK_REF,
+                           it->t->ref_end, &it->blk) : 1;
+        if (r) {
+            it->done = 1;
+            return r;
+        }
+        it->pos = it->blk.records_start;
+        it->key_len = 0;
+    }
+    return decode_record(it);
+}
+
+/*
+ * Stop at the first record of it->blk (or of a later ref block) whose
+ * name is not less than [want]: the last restart point not past it is
+ * found by binary search, and the records are decoded from there.
+ * Returns 0, with it->done set if there is none, or -1 if corrupt.
+ */
+static int block_seek(struct table_iter *it, const char *want)
+{
+    size_t want_len = strlen(want), lo = 0, hi = it->blk.nr_restarts;
+    int cmp, r;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare_restart(&it->blk, mid, want, want_len, &cmp) < 0)
+            return -1;
+        if (cmp > 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    it->pos = get_be24(it->blk.restarts + 3 * (lo ? lo - 1 : 0));
+    it->key_len = 0;
+    it->done = 0;
+
+    while ((r = table_iter_next(it)) == 0 && strcmp(it->key, want) < 0)
+        ;
+    return r < 0 ? -1 : 0;
+}
+
+/*
+ * Position [it] on the first ref of [t] whose name is not less than
+ * [want]. Returns 0, with it->done set if there is none, or -1 if the
+ * table is corrupt.
+ */
+static int table_seek(const struct reftable_table *t, const char *want,
+                      struct table_iter *it)
+{
+    struct block next;
+    uint64_t off;
+    int r, cmp;
+
+    it->t = t;
+    it->done = 1;
+
+    if (t->ref_index_pos) {
+        /* each index record holds the last name of the block it points at */
+        off = t->ref_index_pos;
+        for (int depth = 0; depth < MAX_INDEX_DEPTH; depth++) {
+            if (block_open(t, off, BLOCK_INDEX, t->data_end, &it->blk) ||
+                block_seek(it, want) < 0)
+                return -1;
+            if (it->done)
+                return 0;       /* past the last ref */
+            off = it->child;
+            if (block_type_at(t, off) == BLOCK_INDEX)
+                continue;
+            if (block_open(t, off, BLOCK_REF, t->ref_end, &it->blk))
+                return -1;
+            return block_seek(it, want);
+        }
+        return -1;
+    }
+
+    /* no index: the block is the last whose first name is not past [want] */
+    r = block_open(t, 0, BLOCK_REF, t->ref_end, &it->blk);
+    if (r)
+        return r < 0 ? -1 : 0;
+    for (;;) {
+        r = block_open(t, it->blk.off + it->blk.full_size, BLOCK_REF, t->ref_end, &next);
+        if (r < 0)
+            return -1;
+        if (r)
+            break;
+        if (compare_restart(&next, 0, want, strlen(want), &cmp) < 0)
+            return -1;
+        if (cmp > 0)
+            break;
+        it->blk = next;
+    }
+    return block_seek(it, want);
+}
+
+/* ---- stack ---- */
+
+static void stack_clear_tables(struct reftable_stack *st)
+{
+    for (size_t i = 0; i < st->nr; i++)
+        table_close(&st->tables[i]);
+    free(st->tables);
+    st->tables = NULL;
+    st->nr = 0;
+}
+
+/*
+ * Read tables.list and open its tables, replacing the current ones if
+ * all of them open. Returns 0; 1 if there is no tables.list; -1 on
+ * error, with errno ENOENT if a listed table has gone.
+ */
+static int stack_load(struct reftable_stack *st)
+{
+    char *path = utl_path_join(st->dir, "tables.list", 0);
+    struct reftable_table *tables = NULL;
+    size_t nr = 0, alloc = 0;
+    struct stat list_st;
+    char *buf = NULL;
+    FILE *f;
+    int ret = 0;
+
+    f = path ? fopen(path, "r") : NULL;
+    free(path);
+    if (!f)
+        return errno == ENOENT ? 1 : -1;
+    if (fstat(fileno(f), &list_st) < 0 ||
+        !(buf = malloc(list_st.st_size + 1)) ||
+        fread(buf, 1, list_st.st_size, f) != (size_t)list_st.st_size) {
+        fclose(f);
+        free(buf);
+        return -1;
+    }
+    fclose(f);
+    buf[list_st.st_size] = '\0';
+
+    for (char *line = buf, *eol; *line && !ret; line = eol) {
+        eol = line + strcspn(line, "\n");
+        if (*eol)
+            *eol++ = '\0';
+        if (!*line)
+            continue;
+        if (strchr(line, '/') || line[0] == '.') {
+            ERROR("bad table name in tables.list: %s", line);
+            errno = 0;
+            ret = -1;
+            break;
+        }
+        if (nr == alloc) {
+            alloc = alloc ? 2 * alloc : 8;
+            struct reftable_table *tmp = realloc(tables, alloc * sizeof(*tmp));
+            if (!tmp) {
+                ret = -1;
+                break;
+            }
+            tables = tmp;
+        }
+        if (table_open(&tables[nr], st->dir, line, st->algo) < 0)
+            ret = -1;
+        else
+            nr++;
+    }
+    free(buf);
+
+    if (ret < 0) {
+        int err = errno;
+        for (size_t i = 0; i < nr; i++)
+            table_close(&tables[i]);
+        free(tables);
+        errno = err;
+        return -1;
+    }
+    stack_clear_tables(st);
+    st->tables = tables;
+    st->nr = nr;
+    st->list_st = list_st;
+    return 0;
+}
+
+/* stack_load(), again while a compaction removes tables under it. */
+static int stack_load_retry(struct reftable_stack *st)
+{
+    int r;
+
+    for (int i = 0; ; i++) {
+        r = stack_load(st);
+        if (r >= 0 || errno != ENOENT || i + 1 == MAX_RELOAD_TRIES)
+            break;
+    }
+    if (r < 0)
+        ERROR("cannot read the reftable stack in %s", st->dir);
+    return r;
+}
+
+int reftable_stack_open(const char *gitdir, hash_algo_t algo,
+                        struct reftable_stack **out)
+{
+    struct reftable_stack *st = calloc(1, sizeof(*st));
+    int r;
+
+    if (!st || !(st->dir = utl_path_join(gitdir, "reftable", 0))) {
+        free(st);
+        return -1;
+    }
+    st->algo = algo;
+    r = stack_load_retry(st);
+    if (r) {
+        reftable_stack_free(st);
+        return r;
+    }
+    *out = st;
+    return 0;
+}
+
+int reftable_stack_refresh(struct reftable_stack *st)
+{
+    char *path = utl_path_join(st->dir, "tables.list", 0);
+    struct stat list_st;
+    int r = path ? stat(path, &list_st) : -1;
+
+    free(path);
+    if (r == 0 && utl_stat_unchanged(&st->list_st, &list_st))
+        return 0;
+    return stack_load_retry(st) == 0 ? 0 : -1;
+}
+
+int reftable_stack_read_ref(struct reftable_stack *st, const char *name,
+                            struct reftable_ref *ref)
+{
+    struct table_iter it = { 0 };
+    int ret = 1;
+
+    /* the newest table that knows the name decides */
+    for (size_t i = st->nr; i-- > 0; ) {
+        if (table_seek(&st->tables[i], name, &it) < 0) {
+            ERROR("reftable %s is corrupt", st->tables[i].name);
+            ret = -1;
+            break;
+        }
+        if (it.done || strcmp(it.key, name))
+            continue;
+
+        ret = it.rec.type == REFTABLE_DELETION;
+        *ref = it.rec;
+        if (grow(&st->name, &st->name_alloc, it.key_len + 1) < 0) {
+            ret = -1;
+            break;
+        }
+        memcpy(st->name, it.key, it.key_len + 1);
+        ref->name = st->name;
+        if (it.rec.target) {
+            size_t len = strlen(it.rec.target);
+            if (grow(&st->target, &st->target_alloc, len + 1) < 0) {
+                ret = -1;
+                break;
+            }
+            memcpy(st->target, it.rec.target, len + 1);
+            ref->target = st->target;
+        }
+        break;
+    }
+    table_iter_release(&it);
+    return ret;
+}
+
+int reftable_stack_for_each_ref(struct reftable_stack *st, const char *prefix,
+                                reftable_ref_fn fn, void *data)
+{
+    struct table_iter *its = calloc(st->nr ? st->nr : 1, sizeof(*its));
+    size_t prefix_len = strlen(prefix);
+    int ret = 0;
+
+    if (!its)
+        return -1;
+    for (size_t i = 0; i < st->nr && !ret; i++) {
+        if (table_seek(&st->tables[i], prefix, &its[i]) < 0) {
+            ERROR("reftable %s is corrupt", st->tables[i].name);
+            ret = -1;
+        }
+    }
+
+    /* merge the tables; on equal names the newest (last) one wins */
+    while (!ret) {
+        struct table_iter *best = NULL;
+        for (size_t i = 0; i < st->nr; i++)
+            if (!its[i].done && (!best || strcmp(its[i].key, best->key) <= 0))
+                best = &its[i];
+        if (!best || strncmp(best->key, prefix, prefix_len))
+            break;
+
+        if (best->rec.type != REFTABLE_DELETION)
+            ret = fn(&best->rec, data);
+
+        /* step past the name in every table, the winner last */
+        for (size_t i = 0; i < st->nr && !ret; i++) {
+            struct table_iter *it = &its[i];
+            if (it != best && !it->done && !strcmp(it->key, best->key) &&
+                table_iter_next(it) < 0) {
+                ERROR("reftable %s is corrupt", st->tables[i].name);
+                ret = -1;
+            }
+        }
+        if (!ret && table_iter_next(best) < 0) {
+            ERROR("reftable %s is corrupt", best->t->name);
+            ret = -1;
+        }
+    }
+
+    for (size_t i = 0; i < st->nr; i++)
+        table_iter_release(&its[i]);
+    free(its);
+    return ret;
+}
+
+void reftable_stack_free(struct reftable_stack *st)
+{
+    if (!st)
+        return;
+    stack_clear_tables(st);
+    free(st->dir);
+    free(st->name);
+    free(st->target);
+    free(st);
+}
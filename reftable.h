@@ -0,0 +1,88 @@
+#ifndef REFTABLE_H
+#define REFTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hash.h"
+#include "object.h"
+
+/*
+ * Read-only access to refs stored as reftables, in
+ * <gitdir>/reftable/ with tables.list naming the stack, oldest first.
+ *
+ * Every table is mapped; only its header and footer are read when the
+ * stack is opened. A table is a file header, ref blocks ('r'), an
+ * optional ref index ('i'), object and log blocks that are not read
+ * here, and a footer locating each section. Blocks may be padded to the
+ * table's block size or written back to back.
+ *
+ * Records are sorted by name and prefix-compressed against the record
+ * before them, and a block ends with a table of restart points: records
+ * stored whole, every few records. A lookup in a table descends the
+ * index (one or more levels of "last name of the block" -> offset) to
+ * the one ref block that can hold the name, or without an index walks
+ * the first name of each block, then binary-searches the restart points
+ * and decodes at most one run of records. A lookup in the stack asks
+ * the tables from newest to oldest; the first that has the name decides,
+ * a deletion record meaning the ref does not exist. Iterating a prefix
+ * seeks every table to it and merges them, the newest table winning on
+ * equal names.
+ *
+ * Not supported: writing, reflogs, and the object index (finding refs
+ * by the id they point at).
+ */
+
+enum reftable_value {
+    REFTABLE_DELETION,
+    REFTABLE_VAL1,              /* an object id */
+    REFTABLE_VAL2,              /* an object id and its peeled value */
+    REFTABLE_SYMREF,            /* a target ref name */
+};
+
+struct reftable_ref {
+    const char *name;
+    uint64_t update_index;
+    enum reftable_value type;
+    struct object_id value, peeled;
+    const char *target;         /* REFTABLE_SYMREF */
+};
+
+struct reftable_stack;
+
+/*
+ * Open the stack of <gitdir>/reftable for ids of [algo]. Returns 0 and
+ * sets [out]; 1 if the repository has no tables.list; or -1 if a table
+ * is missing or corrupt, or made for another hash.
+ */
+int reftable_stack_open(const char *gitdir, hash_algo_t algo,
+                        struct reftable_stack **out);
+
+/*
+ * Open the stack again if tables.list has changed since it was read,
+ * e.g. after another process added or compacted a table. Returns 0,
+ * or -1 if the new stack cannot be read (the old one is kept).
+ */
+int reftable_stack_refresh(struct reftable_stack *st);
+
+/*
+ * Look [name] up into [ref], whose strings stay valid until the next
+ * lookup. Returns 0; 1 if there is no such ref (or the newest record
+ * for it is a deletion); or -1 if a table is corrupt.
+ */
+int reftable_stack_read_ref(struct reftable_stack *st, const char *name,
+                            struct reftable_ref *ref);
+
+/*
+ * Call fn(ref, data) for every ref whose name starts with [prefix], in
+ * name order, without deletions. ref's strings are only valid during
+ * the call. Stops early and returns fn's value if it is non-zero;
+ * returns 0 once done, or -1 if a table is corrupt.
+ */
+typedef int (*reftable_ref_fn)(const struct reftable_ref *ref, void *data);
+
+int reftable_stack_for_each_ref(struct reftable_stack *st, const char *prefix,
+                                reftable_ref_fn fn, void *data);
+
+void reftable_stack_free(struct reftable_stack *st);
+
+#endif /* REFTABLE_H */
@@ -8,55 +8,34 @@
 
 #include <stdio.h>
 #include <dirent.h>
+#include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/stat.h>
+#include <zlib.h>
 #include "log.h"
 #include "repository.h"
 #include "hash.h"
+#include "hex.h"
 #include "utl.h"
 #include "compression/compress.h"
 #include "ram.h"
+#include "tree.h"
+#include "commit.h"
+#include "tag.h"
+#include "pack.h"
+#include "compat_map.h"
+#include "refs.h"
 
-static int parse_one_line_of_commit_object(
-    char **cursor,
-    const char *end,
-    const char *prefix,
-    char *out,
-    size_t out_size
-){
-    size_t prefix_len = prefix ? strlen(prefix) : 0;
-
-    char *line_start = *cursor;
-    if (line_start >= end)
-        return -1;
-
-    char *line_end = memchr(line_start, '\n', end - line_start);
-    if (!line_end)
-        return -1;
-
-    /* OPTIONAL FIELD HANDLING */
-    if (prefix_len > 0 &&
-        strncmp(line_start, prefix, prefix_len) != 0)
-    {
-        return 1;   // <-- means "prefix not present"
-    }
-
-    line_start += prefix_len;
-
-    size_t len = line_end - line_start;
-    if (len >= out_size)
-        return -1;
-
-    strncpy(out, line_start, len);
-    out[len] = '\0';
-
-    *cursor = line_end + 1;
-    return 0;
-}
-
+/* zlib level of new loose objects: git's core.looseCompression default */
+#define LOOSE_COMPRESSION Z_BEST_SPEED
 
+/* Deflate output buffer when writing a loose object. */
+#define LOOSE_WRITE_BUFFER (64u << 10)
 
 static void dump_object_pretty(const char *hash,
                                const char *header,
@@ -113,6 +92,7 @@ static void dump_object_pretty(const char *hash,
 
 
 static void parse_objects(struct repository *repo, struct RAM* memory);
+static void load_head(struct repository *repo);
 
 // }
 
@@ -128,6 +108,34 @@ static void parse_objects(struct repository *repo, struct RAM* memory);
 
 
 
+/*
+ * Whether HEAD is "ref: refs/..." or a hex id, as git's own check for
+ * a repository goes: a directory with a HEAD that is neither is not one.
+ */
+static int is_valid_head(const char *path)
+{
+	char buf[256];
+	size_t len, hex = 0;
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return 0;
+	len = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[len] = '\0';
+
+	if (!strncmp(buf, "ref:", 4)) {
+		const char *p = buf + 4;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		return !strncmp(p, "refs/", 5);
+	}
+	while (hex < len && ((buf[hex] >= '0' && buf[hex] <= '9') ||
+			     (buf[hex] >= 'a' && buf[hex] <= 'f')))
+		hex++;
+	return (hex == 40 || hex == 64) && (hex == len || buf[hex] == '\n');
+}
+
 static int is_porcelain_repo(const char *gitdir)
 {
 	char path[4096];
@@ -143,7 +151,8 @@ static int is_porcelain_repo(const char *gitdir)
 	CHECK("config");
 
 #undef CHECK
-	return 1;
+	snprintf(path, sizeof(path), "%s/HEAD", gitdir);
+	return is_valid_head(path);
 }
 
 
@@ -198,6 +207,9 @@ int repo_init(struct repository *repo,
 
 	if (worktree)
 		repo->worktree = strdup(worktree);
+
+    repo_prepare_packs(repo);
+    load_head(repo);
 	
     struct RAM* memory = ram_init();
     if (!memory){
@@ -217,6 +229,196 @@ error:
 }
 
 
+int repo_open(struct repository *repo, const char *gitdir)
+{
+    memset(repo, 0, sizeof(*repo));
+
+    if (repo_init_gitdir(repo, gitdir)) {
+        repo_clear(repo);
+        return -1;
+    }
+
+    repo->hash_algo = detect_repo_hash(gitdir);
+    repo_prepare_packs(repo);
+    load_head(repo);
+    return 0;
+}
+
+
+char *repo_default_worktree(const char *gitdir)
+{
+    size_t len = strlen(gitdir);
+
+    while (len > 1 && gitdir[len - 1] == '/')
+        len--;
+    if (len < 4 || memcmp(gitdir + len - 4, ".git", 4) ||
+        (len > 4 && gitdir[len - 5] != '/'))
+        return NULL;
+    if (len == 4)
+        return strdup(".");
+    len -= 5;
+    return len ? strndup(gitdir, len) : strdup("/");
+}
+
+
+/* ---- config ---- */
+
+/*
+ * Parse the value after '=' at [p] into a new string: quotes removed,
+ * \\, \", \n, \t and \b unescaped, and an unquoted comment and the
+ * whitespace around it dropped.
+ */
+static char *config_parse_value(const char *p)
+{
+    char *out = malloc(strlen(p) + 1);
+    size_t len = 0, keep = 0;
+    int quoted = 0;
+
+    if (!out)
+        return NULL;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    for (; *p && *p != '\n'; p++) {
+        if (!quoted && (*p == '#' || *p == ';'))
+            break;
+        if (*p == '"') {
+            quoted = !quoted;
+            keep = len;
+            continue;
+        }
+        if (*p == '\\' && p[1] && p[1] != '\n') {
+            p++;
+            out[len++] = *p == 'n' ? '\n' : *p == 't' ? '\t' : *p == 'b' ? '\b' : *p;
+            keep = len;
+            continue;
+        }
+        out[len++] = *p;
+        if (quoted || !isspace((unsigned char)*p))
+            keep = len;
+    }
+    out[keep] = '\0';
+    return out;
+}
+
+/*
+ * The last value of [name] in [section] of the config file [path], as
+ * a new string in *out. Returns 1 if it is set there, else 0.
+ */
+static int config_file_get(const char *path, const char *section, size_t section_len,
+                           const char *name, char **out)
+{
+    FILE *f = fopen(path, "r");
+    char *line = NULL;
+    size_t alloc = 0, name_len = strlen(name);
+    int in_section = 0, found = 0;
+
+    if (!f)
+        return 0;
+    while (getline(&line, &alloc, f) >= 0) {
+        char *p = line;
+        while (isspace((unsigned char)*p))
+            p++;
+        if (*p == '[') {
+            /* "[section]" applies, "[section "sub"]" does not */
+            char *end = strchr(++p, ']');
+            in_section = end && (size_t)(end - p) == section_len &&
+                         !strncasecmp(p, section, section_len);
+            p = end ? end + 1 : p + strlen(p);
+            while (isspace((unsigned char)*p))
+                p++;
+        }
+        if (!in_section || strncasecmp(p, name, name_len))
+            continue;
+        p += name_len;
+        if (isalnum((unsigned char)*p) || *p == '-')
+            continue;           /* a longer name */
+        while (*p == ' ' || *p == '\t')
+            p++;
+
+        char *value;
+        if (*p == '=')
+            value = config_parse_value(p + 1);
+        else if (!*p || *p == '\n' || *p == '#' || *p == ';')
+            value = strdup("true");     /* "name" alone is a true boolean */
+        else
+            continue;
+        if (value) {
+            free(*out);
+            *out = value;
+            found = 1;
+        }
+    }
+    free(line);
+    fclose(f);
+    return found;
+}
+
+char *repo_config_get_string(struct repository *repo, const char *key)
+{
+    const char *dot = strrchr(key, '.');
+    const char *home = getenv("HOME"), *xdg = getenv("XDG_CONFIG_HOME");
+    char *files[4] = { NULL }, *value = NULL;
+
+    if (!dot || dot == key || !dot[1])
+        return NULL;
+    /* most specific first: the first file that sets [key] wins */
+    files[0] = utl_path_join(repo->gitdir, "config", 0);
+    if (home)
+        files[1] = utl_path_join(home, ".gitconfig", 0);
+    if (xdg && *xdg)
+        files[2] = utl_path_join(xdg, "git/config", 0);
+    else if (home)
+        files[2] = utl_path_join(home, ".config/git/config", 0);
+    files[3] = strdup("/etc/gitconfig");
+
+    for (size_t i = 0; i < 4; i++) {
+        if (!value && files[i])
+            config_file_get(files[i], key, dot - key, dot + 1, &value);
+        free(files[i]);
+    }
+    return value;
+}
+
+
+int repo_prepare_packs(struct repository *repo)
+{
+    char *pack_dir = utl_path_join(repo->gitdir, "objects/pack", 0);
+    if (!pack_dir)
+        return -1;
+
+    DIR *d = opendir(pack_dir);
+    if (!d) {
+        free(pack_dir);
+        return 0;       /* no packs yet */
+    }
+
+    int count = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (len < 4 || strcmp(de->d_name + len - 4, ".idx") != 0)
+            continue;
+
+        char *idx_path = utl_path_join(pack_dir, de->d_name, 0);
+        if (!idx_path)
+            continue;
+
+        struct packed_git *p = pack_open(idx_path, repo->hash_algo);
+        free(idx_path);
+        if (!p)
+            continue;
+
+        p->next = repo->packs;
+        repo->packs = p;
+        count++;
+    }
+
+    closedir(d);
+    free(pack_dir);
+    return count;
+}
+
+
 
 void repo_clear(struct repository *repo)
 {
@@ -225,6 +427,16 @@ void repo_clear(struct repository *repo)
 
     free(repo->gitdir);
     free(repo->worktree);
+    oidmap_clear(&repo->peel_cache, 1);
+    compat_map_free(repo->compat_map);
+    object_free(repo->head);
+    ref_store_free(repo->refs);
+
+    while (repo->packs) {
+        struct packed_git *next = repo->packs->next;
+        pack_close(repo->packs);
+        repo->packs = next;
+    }
 }
 
 
@@ -242,13 +454,405 @@ static enum object_type get_type_from_header(const char *unzipped_buffer) {
 }
 
 
+size_t parse_object_header(const char *buf, size_t len,
+                           enum object_type *type)
+{
+    const char *nul = memchr(buf, '\0', len);
+    if (!nul)
+        return 0;
+
+    *type = get_type_from_header(buf);
+    if (*type == OBJ_NONE)
+        return 0;
+
+    /* the declared size must be exactly what follows the header */
+    const char *p = strchr(buf, ' ') + 1;
+    size_t declared = 0;
+    if (p == nul)
+        return 0;
+    for (; p < nul; p++) {
+        if (*p < '0' || *p > '9' || declared > (SIZE_MAX - 9) / 10)
+            return 0;
+        declared = declared * 10 + (size_t)(*p - '0');
+    }
+
+    size_t body_off = (size_t)(nul - buf) + 1;
+    return declared == len - body_off ? body_off : 0;
+}
+
+
+char *repo_loose_object_path(struct repository *repo,
+                             const struct object_id *oid)
+{
+    char hex[MAX_HEX_OID_LENGTH + 1];
+    char rel[8 + 3 + HASH256_DIGEST_LENGTH];
+
+    oid_to_hex_r(hex, oid);
+    snprintf(rel, sizeof(rel), "objects/%.2s/%s", hex, hex + 2);
+    return utl_path_join(repo->gitdir, rel, 0);
+}
+
+
+/*
+ * Inflate the loose object file [path], hashing the stream as it is
+ * inflated. *[verified] is set to 1 if the content hashes to [oid] and
+ * to 0 if it does not. Returns the inflated object (header included),
+ * or NULL if the file is missing or not a valid zlib stream.
+ */
+static char *inflate_loose_object(struct repository *repo, const char *path,
+                                  const struct object_id *oid,
+                                  size_t *size, int *verified)
+{
+    struct hash_ctx ctx = HASH_CTX_INIT;
+    unsigned char digest[MAX_RAW_OID_LENGTH];
+    char *buf = NULL;
+
+    *verified = 0;
+    if (hash_init(&ctx, repo->hash_algo) == 0) {
+        buf = decompress_file_hashed(path, size, &ctx);
+        if (buf && hash_final(&ctx, digest) == 0)
+            *verified = memcmp(digest, oid->hash,
+                               hash_algo_rawsz(repo->hash_algo)) == 0;
+    }
+    hash_ctx_release(&ctx);
+    return buf;
+}
+
+
+static void *read_packed_object(struct repository *repo,
+                                const struct object_id *oid,
+                                enum object_type *type, size_t *size,
+                                struct delta_base_cache *cache)
+{
+    for (struct packed_git *p = repo->packs; p; p = p->next) {
+        uint32_t pos;
+        if (pack_find_entry(p, oid->hash, &pos))
+            return pack_read_object(p, pack_nth_offset(p, pos), type, size, cache);
+    }
+    return NULL;
+}
+
+
+void *repo_read_object_data(struct repository *repo, const struct object_id *oid,
+                            enum object_type *type, size_t *size)
+{
+    return repo_read_object_cached(repo, oid, type, size, NULL);
+}
+
+void *repo_read_object_cached(struct repository *repo, const struct object_id *oid,
+                              enum object_type *type, size_t *size,
+                              struct delta_base_cache *cache)
+{
+    char *path = repo_loose_object_path(repo, oid);
+    if (!path)
+        return NULL;
+
+    if (access(path, F_OK) != 0) {
+        free(path);
+        return read_packed_object(repo, oid, type, size, cache);
+    }
+
+    size_t total_size = 0;
+    int verified;
+    char *buf = inflate_loose_object(repo, path, oid, &total_size, &verified);
+    free(path);
+    if (!buf)
+        return NULL;
+
+    if (!verified) {
+        ERROR("hash mismatch for %s", oid_to_hex(oid));
+        free(buf);
+        return NULL;
+    }
+
+    size_t body_off = parse_object_header(buf, total_size, type);
+    if (!body_off) {
+        ERROR("Invalid object header in %s", oid_to_hex(oid));
+        free(buf);
+        return NULL;
+    }
+
+    /* hand back just the body, still NUL-terminated */
+    *size = total_size - body_off;
+    memmove(buf, buf + body_off, *size + 1);
+    return buf;
+}
+
+
+int repo_read_object_info(struct repository *repo, const struct object_id *oid,
+                          enum object_type *type, size_t *size)
+{
+    char *path = repo_loose_object_path(repo, oid);
+    if (!path)
+        return -1;
+
+    if (access(path, F_OK) != 0) {
+        free(path);
+        for (struct packed_git *p = repo->packs; p; p = p->next) {
+            uint32_t pos;
+            if (pack_find_entry(p, oid->hash, &pos))
+                return pack_read_object_info(p, pack_nth_offset(p, pos), type, size);
+        }
+        return -1;
+    }
+
+    /* "<type> <size>\0" is all we need out of the file */
+    char head[32];
+    long n = decompress_file_head(path, head, sizeof(head));
+    free(path);
+
+    const char *nul = n > 0 ? memchr(head, '\0', (size_t)n) : NULL;
+    const char *sp = nul ? memchr(head, ' ', (size_t)(nul - head)) : NULL;
+    if (!sp || sp + 1 == nul || (*type = get_type_from_header(head)) == OBJ_NONE) {
+        ERROR("Invalid object header in %s", oid_to_hex(oid));
+        return -1;
+    }
+
+    *size = 0;
+    for (const char *p = sp + 1; p < nul; p++) {
+        if (*p < '0' || *p > '9' || *size > (SIZE_MAX - 9) / 10) {
+            ERROR("Invalid object header in %s", oid_to_hex(oid));
+            return -1;
+        }
+        *size = *size * 10 + (size_t)(*p - '0');
+    }
+    return 0;
+}
+
+
+int repo_has_object(struct repository *repo, const struct object_id *oid)
+{
+    char *path = repo_loose_object_path(repo, oid);
+    int found = path && access(path, F_OK) == 0;
+
+    free(path);
+    for (struct packed_git *p = repo->packs; p && !found; p = p->next) {
+        uint32_t pos;
+        found = pack_find_entry(p, oid->hash, &pos);
+    }
+    return found;
+}
+
+/* Deflate [len] bytes of [data] into [fd] through [strm]; [flush] ends the stream. */
+static int deflate_to(int fd, z_stream *strm, const void *data, size_t len, int flush)
+{
+    unsigned char out[LOOSE_WRITE_BUFFER];
+    int ret;
+
+    strm->next_in = (unsigned char *)data;
+    do {
+        /* avail_in is 32-bit: feed huge buffers in pieces */
+        size_t piece = len < (1u << 30) ? len : (1u << 30);
+        strm->avail_in = piece;
+        len -= piece;
+        do {
+            strm->next_out = out;
+            strm->avail_out = sizeof(out);
+            ret = deflate(strm, len ? Z_NO_FLUSH : flush);
+            if (ret == Z_STREAM_ERROR)
+                return -1;
+            size_t have = sizeof(out) - strm->avail_out;
+            for (size_t done = 0; done < have;) {
+                ssize_t n = write(fd, out + done, have - done);
+                if (n < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    return -1;
+                }
+                done += n;
+            }
+        } while (strm->avail_out == 0);
+    } while (len);
+    return flush == Z_FINISH && ret != Z_STREAM_END ? -1 : 0;
+}
+
+int repo_write_loose_object(struct repository *repo, const struct object_id *oid,
+                            enum object_type type, const void *data, size_t len)
+{
+    char header[32], *path, *tmp = NULL;
+    int header_len = snprintf(header, sizeof(header), "%s %zu", type_name(type), len) + 1;
+    z_stream strm = { 0 };
+    int fd = -1, ret = -1;
+
+    if (repo_has_object(repo, oid))
+        return 0;
+    if (!(path = repo_loose_object_path(repo, oid)))
+        return -1;
+
+    size_t dir_len = strrchr(path, '/') - path;
+    if (!(tmp = malloc(dir_len + sizeof("/tmp_obj_XXXXXX"))))
+        goto out;
+    memcpy(tmp, path, dir_len);
+    memcpy(tmp + dir_len, "/tmp_obj_XXXXXX", sizeof("/tmp_obj_XXXXXX"));
+    if ((fd = mkstemp(tmp)) < 0 && errno == ENOENT) {
+        /* first object of objects/xx/: another writer may be creating it too */
+        tmp[dir_len] = '\0';
+        if (mkdir(tmp, 0777) == 0 || errno == EEXIST) {
+            memcpy(tmp + dir_len, "/tmp_obj_XXXXXX", sizeof("/tmp_obj_XXXXXX"));
+            fd = mkstemp(tmp);
+        }
+    }
+    if (fd < 0) {
+        ERROR("cannot create a temporary object in %.*s: %s", (int)dir_len, path,
+              strerror(errno));
+        free(tmp);
+        tmp = NULL;
+        goto out;
+    }
+
+    if (deflateInit(&strm, LOOSE_COMPRESSION) != Z_OK)
+        goto out;
+    if (deflate_to(fd, &strm, header, header_len, Z_NO_FLUSH) < 0 ||
+        deflate_to(fd, &strm, data, len, Z_FINISH) < 0) {
+        ERROR("cannot write %s: %s", tmp, strerror(errno));
+        deflateEnd(&strm);
+        goto out;
+    }
+    deflateEnd(&strm);
+
+    /* read-only like git's; link() leaves an object another writer won the race for alone */
+    if (fchmod(fd, 0444) || close(fd)) {
+        fd = -1;
+        goto out;
+    }
+    fd = -1;
+    if (link(tmp, path) && errno != EEXIST) {
+        ERROR("cannot create %s: %s", path, strerror(errno));
+        goto out;
+    }
+    ret = 0;
+out:
+    if (fd >= 0)
+        close(fd);
+    if (tmp)
+        unlink(tmp);
+    free(tmp);
+    free(path);
+    return ret;
+}
+
+void *repo_read_object_peeled(struct repository *repo, const char *hex,
+                              enum object_type required_type, size_t *size,
+                              struct object_id *actual_oid_return)
+{
+    struct object_id oid;
+    enum object_type type;
+    size_t hexsz = hash_algo_hexsz(repo->hash_algo);
+
+    if (oid_set_hex(&oid, hex, strlen(hex), repo->hash_algo) < 0)
+        return NULL;
+
+    if (required_type != OBJ_TAG) {
+        if (peel_object(repo, &oid, &oid, &type) < 0)
+            return NULL;
+
+        /* a commit peels one step further, to its tree */
+        if (type == OBJ_COMMIT && required_type == OBJ_TREE) {
+            char *commit = repo_read_object_data(repo, &oid, &type, size);
+            if (!commit)
+                return NULL;
+            int ret = strncmp(commit, "tree ", 5) == 0 ?
+                      oid_set_hex(&oid, commit + 5, hexsz, repo->hash_algo) : -1;
+            free(commit);
+            if (ret < 0)
+                return NULL;
+        }
+    }
+
+    char *buf = repo_read_object_data(repo, &oid, &type, size);
+    if (buf && type != required_type) {
+        free(buf);
+        return NULL;
+    }
+
+    if (buf && actual_oid_return)
+        *actual_oid_return = oid;
+    return buf;
+}
+
+
+int repo_resolve_ref(struct repository *repo, const char *name,
+                     struct object_id *oid)
+{
+    static const char *const rules[] = {
+        "%s", "refs/%s", "refs/tags/%s", "refs/heads/%s", "refs/remotes/%s",
+        "refs/remotes/%s/HEAD",
+    };
+    size_t len = strlen(name);
+    char refname[1024];
+
+    if (len == hash_algo_hexsz(repo->hash_algo) &&
+        oid_set_hex(oid, name, len, repo->hash_algo) == 0)
+        return 0;
+    if (!len || strstr(name, "..") || name[0] == '/')
+        return -1;
+
+    for (size_t i = 0; i < sizeof(rules) / sizeof(*rules); i++) {
+        if (snprintf(refname, sizeof(refname), rules[i], name) >= (int)sizeof(refname))
+            return -1;
+        /* the bare form only covers HEAD-like files and full ref names */
+        if (i == 0 && strncmp(name, "refs/", 5) && strchr(name, '/'))
+            continue;
+        if (refs_read_ref(repo, refname, oid) == 0)
+            return 0;
+    }
+    return -1;
+}
+
+struct object *repo_read_commit(struct repository *repo,
+                                const struct object_id *oid)
+{
+    enum object_type type;
+    size_t size;
+    char *buf = repo_read_object_data(repo, oid, &type, &size);
+    if (!buf)
+        return NULL;
+    if (type != OBJ_COMMIT) {
+        free(buf);
+        return NULL;
+    }
+
+    struct object *obj = calloc(1, sizeof(*obj));
+    struct commit_object *commit = calloc(1, sizeof(*commit));
+    if (!obj || !commit ||
+        parse_commit_buffer(commit, buf, size, repo->hash_algo) < 0) {
+        free(obj);
+        free(commit);
+        free(buf);
+        return NULL;
+    }
+    commit->buffer = buf;
+    commit->buffer_len = size;
+
+    obj->type = OBJ_COMMIT;
+    obj->oid = *oid;
+    obj->as.commit = commit;
+    return obj;
+}
+
+/* Point repo->head at HEAD's commit, if HEAD has one yet. */
+static void load_head(struct repository *repo)
+{
+    struct object_id oid;
+    enum object_type type;
+
+    if (refs_read_ref(repo, "HEAD", &oid) < 0)
+        return;             /* unborn branch */
+    if (peel_object(repo, &oid, &oid, &type) < 0 || type != OBJ_COMMIT ||
+        !(repo->head = repo_read_commit(repo, &oid)))
+        ERROR("HEAD does not point at a valid commit");
+}
+
+
 static struct object *process(struct repository *repo,
-                              const char *hash_value,
+                              const struct object_id *oid,
                               const char *file_path)
 {
     DEBUG("processing object file: %s", file_path);
     size_t total_size = 0;
-    char *unzipped_buffer = decompress_file(file_path, &total_size);
+    int verified;
+    char *unzipped_buffer = inflate_loose_object(repo, file_path, oid,
+                                                 &total_size, &verified);
     if (!unzipped_buffer) {
         ERROR("Decompression failed for %s", file_path);
         return NULL;
@@ -257,28 +861,23 @@ static struct object *process(struct repository *repo,
     //
     // --- parse header ---
     //
-    char *nul = memchr(unzipped_buffer, '\0', total_size);
-    if (!nul) {
-        ERROR("Invalid object: missing NUL header terminator");
+    enum object_type type;
+    size_t body_off = parse_object_header(unzipped_buffer, total_size, &type);
+    if (!body_off) {
+        ERROR("Invalid object header in %s", file_path);
         free(unzipped_buffer);
         return NULL;
     }
 
-    char *body = nul + 1;
-    size_t body_len = total_size - (body - unzipped_buffer);
+    char *body = unzipped_buffer + body_off;
+    size_t body_len = total_size - body_off;
 
-    size_t header_len = (size_t)(nul - unzipped_buffer);
+    size_t header_len = body_off - 1;
     char saved_header[256] = {0};
     snprintf(saved_header, sizeof(saved_header), "%.*s",
             (int)header_len, unzipped_buffer);
 
-    dump_object_pretty(hash_value, saved_header, body, body_len);
-    enum object_type type = get_type_from_header(unzipped_buffer);
-    if (type == OBJ_NONE) {
-        ERROR("Unknown object type in %s", file_path);
-        free(unzipped_buffer);
-        return NULL;
-    }
+    dump_object_pretty(oid_to_hex(oid), saved_header, body, body_len);
 
     //
     // --- allocate object ---
@@ -292,15 +891,16 @@ static struct object *process(struct repository *repo,
     obj->type = type;
     obj->flags = OBJ_FLAG_NONE;
 
+    /* keep corrupt objects, but make sure nobody trusts them */
+    if (!verified) {
+        ERROR("hash mismatch for %s", oid_to_hex(oid));
+        obj->flags |= OBJ_FLAG_BAD;
+    }
+
     //
     // --- fill OID ---
     //
-    size_t digest_len =
-        (repo->hash_algo == HASH1_DIGEST_LENGTH)
-        ? HASH1_DIGEST_LENGTH
-        : HASH256_DIGEST_LENGTH;
-
-    strcpy((char *)obj->oid.hash, hash_value);
+    obj->oid = *oid;
 
 
     //
@@ -324,169 +924,48 @@ static struct object *process(struct repository *repo,
         break;
     }
 
-    case OBJ_COMMIT:
-
-        char *cursor = body;
-        char *end = body + body_len;
-
-        char tree_hash[HASH256_DIGEST_LENGTH] = {0};
-        char parent_hash[HASH256_DIGEST_LENGTH] = {0};
-        char author[256] = {0};
-        char commiter[256] = {0};
-        char message[1024] = {0};
-
-        DEBUG("parsing commit object fields");
-        if (parse_one_line_of_commit_object(&cursor, end, "tree ", tree_hash, sizeof(tree_hash)) < 0)
-            goto fail;
-
-        DEBUG("parsed tree: %s", tree_hash);
-        if (parse_one_line_of_commit_object(&cursor, end, "parent ", parent_hash, sizeof(parent_hash)) < 0)
-            goto fail;
-
-        DEBUG("parsed parent: %s", parent_hash);
-        if (parse_one_line_of_commit_object(&cursor, end, "author ", author, sizeof(author)) < 0)
-            goto fail;
-
-        DEBUG("parsed author: %s", author);
-        if (parse_one_line_of_commit_object(&cursor, end, "committer ", commiter, sizeof(commiter)) < 0)
-            goto fail;
-
-        DEBUG("parsed committer: %s", commiter);
-        if (parse_one_line_of_commit_object(&cursor, end, NULL, message, sizeof(message)) < 0)
-            goto fail;
-        
-        DEBUG("parsed message: %s", message);
-        struct commit_object *commit = malloc(sizeof(*commit));
+    case OBJ_COMMIT: {
+        struct commit_object *commit = calloc(1, sizeof(*commit));
         if (!commit) goto fail;
-        commit->parents = malloc(sizeof(struct object_id));
-        if (!commit->parents) {
-            free(commit);
-            goto fail;
-        }
-        commit->parent_count = 1;
-        commit->tree = (struct object_id){0};
-        strncpy((char *)commit->tree.hash, tree_hash, digest_len);
-        commit->parents[0] = (struct object_id){0};
-        strncpy((char *)commit->parents[0].hash, parent_hash, digest_len);
-        commit->author = strdup(author);
-        commit->message = strdup(message);    
-
         obj->as.commit = commit;
 
+        if (parse_commit_buffer(commit, body, body_len, repo->hash_algo) < 0)
+            goto fail;
+
+        /* the commit's slices point into the inflated buffer: keep it */
+        commit->buffer = unzipped_buffer;
+        commit->buffer_len = total_size;
+        unzipped_buffer = NULL;
         break;
+    }
 
     case OBJ_TREE:
-        // TODO later
-        char *tree_cursor = body;
-        char *tree_end = body + body_len;
-
-        obj->as.tree = malloc(sizeof(struct tree_object));
-        if (!obj->as.tree) goto fail;
-
-        struct tree_object *tree = obj->as.tree;
-        tree->entry_count = 0;
-        tree->entries = NULL;
-
-        while (tree_cursor < tree_end) {
-
-            DEBUG("parsing tree object fields");
-
-            /* ---- parse mode ---- */
-
-            char *mode_start = tree_cursor;
-
-            char *sp = memchr(mode_start, ' ', tree_end - mode_start);
-            if (!sp)
-                goto fail;
-
-            size_t mode_len = sp - mode_start;
-
-            enum object_type entry_type;
-
-            if (mode_len == 5 && strncmp(mode_start, "40000", 5) == 0)
-                entry_type = OBJ_TREE;
-            else if (mode_len == 6 && strncmp(mode_start, "100644", 6) == 0)
-                entry_type = OBJ_BLOB;
-            else
-                goto fail;
-
-            tree_cursor = sp + 1;   /* skip past space after mode */
-
-
-            /* ---- parse name ---- */
-
-            char *name_start = tree_cursor;
-
-            char *name_end = memchr(name_start, '\0', tree_end - name_start);
-            if (!name_end)
-                goto fail;
-
-            size_t name_len = name_end - name_start;
-
-            char name[name_len + 1];
-            memcpy(name, name_start, name_len);
-            name[name_len] = '\0';
-
-            tree_cursor = name_end + 1;   /* skip null terminator */
-
-            DEBUG("parsed tree entry name: %s", name);
-
-
-            /* ---- parse raw hash (binary) ---- */
-
-            size_t hash_len = digest_len;   /* e.g., 20 for SHA-1 */
-
-            if (tree_cursor + hash_len > tree_end)
-                goto fail;
-
-
-            /* ---- store entry ---- */
-            tree->entry_count++;
-
-            tree->entries =
-                realloc(tree->entries,
-                        tree->entry_count * sizeof(struct tree_entry));
-
-            if (!tree->entries) {
-                goto fail;
-            }
-
-            struct tree_entry *tree_entry =
-                &tree->entries[tree->entry_count - 1];
-
-            tree_entry->name = strdup(name);
-            tree_entry->type = entry_type;
-            memset(&tree_entry->oid, 0, sizeof(tree_entry->oid));
-            memcpy(tree_entry->oid.hash, tree_cursor, hash_len);
+        obj->as.tree = parse_tree_buffer(body, body_len,
+                                         hash_algo_rawsz(repo->hash_algo), 0);
+        if (!obj->as.tree)
+            goto fail;
+        break;
 
-            tree_cursor += hash_len;
+    case OBJ_TAG: {
+        struct tag_object *tag = calloc(1, sizeof(*tag));
+        if (!tag) goto fail;
+        obj->as.tag = tag;
 
-            DEBUG("parsed tree entry hash (first 4 bytes): %02x%02x%02x%02x",
-                tree_entry->oid.hash[0], tree_entry->oid.hash[1],
-                tree_entry->oid.hash[2], tree_entry->oid.hash[3]);
-            
-        }
-        // char *cursor = body;
-        // char *end = body + body_len;
-
-        // char tree_hash[HASH256_DIGEST_LENGTH] = {0};
-        // char parent_hash[HASH256_DIGEST_LENGTH] = {0};
-        // char author[256] = {0};
-        // char commiter[256] = {0};
-        // char message[1024] = {0};
-        
-        break;
+        if (parse_tag_buffer(tag, body, body_len, repo->hash_algo) < 0)
+            goto fail;
 
-    case OBJ_TAG:
-        // TODO later
+        tag->buffer = unzipped_buffer;
+        tag->buffer_len = total_size;
+        unzipped_buffer = NULL;
         break;
+    }
 
     default:
         goto fail;
     }
 
     free(unzipped_buffer);
-    DEBUG("Processed object %s of type %d", hash_value, type);
+    DEBUG("Processed object %s of type %d", oid_to_hex(oid), type);
     return obj;
 
 fail:
@@ -500,9 +979,55 @@ fail:
 
 
 
+struct parse_objects_data {
+    struct repository *repo;
+    struct RAM *memory;
+};
+
+static int parse_one_object(const struct object_id *oid, const char *path,
+                            void *data)
+{
+    struct parse_objects_data *pd = data;
+    struct object *obj = process(pd->repo, oid, path);
+    if (!obj)
+        return 0;
+
+    struct RAM_VALUE value;
+    switch (obj->type) {
+        case OBJ_BLOB:   value.value_type = RAM_VALUE_BLOB; break;
+        case OBJ_TREE:   value.value_type = RAM_VALUE_TREE; break;
+        case OBJ_COMMIT: value.value_type = RAM_VALUE_COMMIT; break;
+        case OBJ_TAG:    value.value_type = RAM_VALUE_TAG; break;
+        default:         value.value_type = RAM_VALUE_NONE; break;
+    }
+
+    value.obj_value = obj;
+
+    char hash_value[MAX_HEX_OID_LENGTH + 1];
+    oid_to_hex_r(hash_value, oid);
+    if (!ram_write_cell_by_name(pd->memory, value, hash_value)) {
+        ERROR("ram_write_cell_by_name failed for %s", hash_value);
+    }
+
+    object_free(obj);   // RAM now owns its own clone
+    return 0;
+}
+
 static void parse_objects(struct repository *repo, struct RAM* memory)
 {
+    struct parse_objects_data pd = { repo, memory };
+
     DEBUG("starting parse_objects");
+    for_each_loose_object(repo, parse_one_object, &pd);
+    DEBUG("finished parse_objects");
+}
+
+
+int for_each_loose_object(struct repository *repo, each_loose_object_fn fn,
+                          void *data)
+{
+    size_t hexsz = hash_algo_hexsz(repo->hash_algo);
+    int ret = 0;
 
     DIR *d = NULL;
     DIR *d2 = NULL;
@@ -511,81 +1036,50 @@ static void parse_objects(struct repository *repo, struct RAM* memory)
 
     char *objects_path = utl_path_join(repo->gitdir, "objects", 0);
     if (!objects_path)
-        return;
+        return -1;
 
     d = opendir(objects_path);
     if (!d) {
         free(objects_path);
-        return;
+        return -1;
     }
     DEBUG("opened objects directory: %s", objects_path);
-    while ((dir1 = readdir(d)) != NULL) {
+    while (!ret && (dir1 = readdir(d)) != NULL) {
 
+        /* objects/xx/yyyy...: anything else is not an object */
         const char *prefix = dir1->d_name;
-        if (!strcmp(prefix,".") || !strcmp(prefix,"..") ||
-            !strcmp(prefix,"pack") || !strcmp(prefix,"info"))
+        if (strlen(prefix) != 2)
             continue;
 
         char *prefix_path = utl_path_join(objects_path, prefix, 0);
         if (!prefix_path)
             continue;
 
-        if (!is_directory(prefix_path)) {
-            free(prefix_path);
-            continue;
-        }
-
         d2 = opendir(prefix_path);
         if (!d2) {
             free(prefix_path);
             continue;
         }
 
-        while ((dir2 = readdir(d2)) != NULL) {
+        while (!ret && (dir2 = readdir(d2)) != NULL) {
 
             const char *suffix = dir2->d_name;
-            if (!strcmp(suffix,".") || !strcmp(suffix,".."))
-                continue;
+            char hash_value[MAX_HEX_OID_LENGTH + 1];
+            struct object_id oid;
 
-            char *file_path = utl_path_join(prefix_path, suffix, 0);
-            if (!file_path)
+            if (strlen(suffix) != hexsz - 2)
                 continue;
-
-            if (is_directory(file_path)) {
-                free(file_path);
+            memcpy(hash_value, prefix, 2);
+            memcpy(hash_value + 2, suffix, hexsz - 2);
+            if (oid_set_hex(&oid, hash_value, hexsz, repo->hash_algo) < 0)
                 continue;
-            }
 
-            char *hash_value = utl_path_join(prefix, suffix, 1);
-            if (!hash_value) {
-                free(file_path);
+            char *file_path = utl_path_join(prefix_path, suffix, 0);
+            if (!file_path)
                 continue;
-            }
-
-            struct object *obj =
-                process(repo, hash_value, file_path);
-
-            if (obj) {
 
-                struct RAM_VALUE value;
-                switch (obj->type) {
-                    case OBJ_BLOB:   value.value_type = RAM_VALUE_BLOB; break;
-                    case OBJ_TREE:   value.value_type = RAM_VALUE_TREE; break;
-                    case OBJ_COMMIT: value.value_type = RAM_VALUE_COMMIT; break;
-                    case OBJ_TAG:    value.value_type = RAM_VALUE_TAG; break;
-                    default:         value.value_type = RAM_VALUE_NONE; break;
-                }
-
-                value.obj_value = obj;
-
-                if (!ram_write_cell_by_name(memory, value, hash_value)) {
-                    ERROR("ram_write_cell_by_name failed for %s", hash_value);
-                }
-
-                object_free(obj);   // RAM now owns its own clone
-            }
-
-            free(hash_value);
+            if (!is_directory(file_path))
+                ret = fn(&oid, file_path, data);
             free(file_path);
         }
 
@@ -595,6 +1089,5 @@ static void parse_objects(struct repository *repo, struct RAM* memory)
 
     closedir(d);
     free(objects_path);
-
-    DEBUG("finished parse_objects");
+    return ret;
 }
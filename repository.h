@@ -1,5 +1,11 @@
 #include "hash.h"
 #include "object.h"
+#include "oidmap.h"
+
+struct packed_git;
+struct delta_base_cache;
+struct compat_map;
+struct ref_store;
 
 
 
@@ -11,7 +17,7 @@
  * - single worktree
  * - SHA-1 only (for now)
  * - submodules : we may add submodules to be tricky and to have some recursive calls. 
- * - staging area or index : we may also wanna add index 
+ * - staging area or index : see index.h; callers read it when they need it
  * - dangling cached objects - temporarily stored 
  */
 struct repository {
@@ -20,7 +26,20 @@ struct repository {
 
     hash_algo_t hash_algo;
 
+    /* the commit HEAD points at, loaded by repo_open(); NULL if unborn */
     struct object *head;
+
+    /* object id -> struct peeled_entry, filled by peel_object() */
+    struct oidmap peel_cache;
+
+    /* objects/pack/<name>.idx, opened by repo_prepare_packs() */
+    struct packed_git *packs;
+
+    /* SHA-1 <-> SHA-256 id table, loaded by compat_map_load() */
+    struct compat_map *compat_map;
+
+    /* packed-refs as last mapped, or the reftable stack; see refs.h */
+    struct ref_store *refs;
 };
 
 
@@ -31,6 +50,123 @@ int repo_init(struct repository *repo,
               const char *worktree);
 
 
+/*
+ * Like repo_init(), but without loading every loose object into
+ * memory: objects are read on demand (loose first, then packs).
+ * Returns 0 on success, -1 if [gitdir] is not a repository.
+ */
+int repo_open(struct repository *repo, const char *gitdir);
+
+/*
+ * The worktree of [gitdir] when none is given: the directory holding
+ * it if it is called .git, else NULL (caller frees).
+ */
+char *repo_default_worktree(const char *gitdir);
+
+/*
+ * The value of [key] ("section.name") in git's config: the
+ * repository's, then ~/.gitconfig, $XDG_CONFIG_HOME/git/config and
+ * /etc/gitconfig; the first file that sets it wins, and within a file
+ * the last setting does. Subsections and include directives are not
+ * supported. Returns a new string, or NULL if [key] is not set.
+ */
+char *repo_config_get_string(struct repository *repo, const char *key);
+
+/* Open every pack in objects/pack. Returns how many were opened. */
+int repo_prepare_packs(struct repository *repo);
+
 void repo_clear(struct repository *repo);
 
 void repo_parse_objects(struct repository *repo);
+
+/*
+ * Split an inflated loose object into its "<type> <size>\0" header and
+ * body. Returns the body offset, or 0 if the header is malformed or
+ * the declared size is not the actual body size.
+ */
+size_t parse_object_header(const char *buf, size_t len,
+                           enum object_type *type);
+
+/* "<gitdir>/objects/xx/yyyy..." for [oid] (caller frees). */
+char *repo_loose_object_path(struct repository *repo,
+                             const struct object_id *oid);
+
+/*
+ * Call fn(oid, path, data) for every loose object file, in directory
+ * order. Stops early and returns fn's value if it is non-zero.
+ */
+typedef int (*each_loose_object_fn)(const struct object_id *oid,
+                                    const char *path, void *data);
+
+int for_each_loose_object(struct repository *repo, each_loose_object_fn fn,
+                          void *data);
+
+/*
+ * Read the object [oid] without parsing it, e.g. to walk a tree
+ * in place with a tree_desc instead of materializing it.
+ * Returns the inflated body (NUL-terminated, caller frees) and sets
+ * [type] and [size], or NULL if the object is missing or corrupt.
+ */
+void *repo_read_object_data(struct repository *repo, const struct object_id *oid,
+                            enum object_type *type, size_t *size);
+
+/*
+ * Like repo_read_object_data(), resolving packed deltas through
+ * [cache] (which may be NULL). A thread reading many related objects,
+ * such as the trees of one history, should keep its own cache.
+ */
+void *repo_read_object_cached(struct repository *repo, const struct object_id *oid,
+                              enum object_type *type, size_t *size,
+                              struct delta_base_cache *cache);
+
+/*
+ * The type and size of [oid] without reading its body: only the
+ * header of a loose object is inflated, and a packed one is looked up
+ * with pack_read_object_info(). Returns 0, or -1 if it is missing or
+ * corrupt.
+ */
+int repo_read_object_info(struct repository *repo, const struct object_id *oid,
+                          enum object_type *type, size_t *size);
+
+/* Whether [oid] is in the repository, loose or packed. */
+int repo_has_object(struct repository *repo, const struct object_id *oid);
+
+/*
+ * Store [len] bytes of [data] as a loose object of [type], whose id
+ * the caller has computed as [oid], unless the repository has it
+ * already. The object is deflated into a temporary file in its
+ * objects/xx directory and linked into place, so concurrent writers
+ * (threads or processes) of the same object are harmless.
+ * Returns 0, or -1 if it cannot be written.
+ */
+int repo_write_loose_object(struct repository *repo, const struct object_id *oid,
+                            enum object_type type, const void *data, size_t len);
+
+/*
+ * Read [hex] and peel it until an object of [required_type] is reached:
+ * tags are followed to their target (using the peel cache) and a commit
+ * yields its tree. Returns the body like repo_read_object_data() and
+ * optionally the id of the object actually read, or NULL if the chain
+ * does not lead to [required_type].
+ */
+void *repo_read_object_peeled(struct repository *repo, const char *hex,
+                              enum object_type required_type, size_t *size,
+                              struct object_id *actual_oid_return);
+
+/*
+ * Resolve [name] to an object id. [name] may be a full hex id, "HEAD"
+ * (or another file directly in the gitdir), a full ref name, or a short
+ * one tried as refs/<name>, refs/tags/<name>, refs/heads/<name>,
+ * refs/remotes/<name> and refs/remotes/<name>/HEAD in that order, each
+ * read with refs_read_ref().
+ * Returns 0, or -1 if [name] resolves to nothing.
+ */
+int repo_resolve_ref(struct repository *repo, const char *name,
+                     struct object_id *oid);
+
+/*
+ * Read and parse the commit [oid] into a new object (free with
+ * object_free()). Returns NULL if it is missing or not a commit.
+ */
+struct object *repo_read_commit(struct repository *repo,
+                                const struct object_id *oid);
@@ -0,0 +1,577 @@
+#include "revision.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "hex.h"
+#include "commit_graph.h"
+#include "reachable.h"
+#include "repository.h"
+#include "tag.h"
+
+
+static int compare_commits(const void *a_, const void *b_, void *cb_data)
+{
+    const struct rev_commit *a = a_, *b = b_;
+    const struct rev_walk *walk = cb_data;
+
+    if (walk->sort == REV_SORT_GENERATION && a->generation != b->generation)
+        return a->generation > b->generation ? 1 : -1;
+    if (a->date != b->date)
+        return a->date > b->date ? 1 : -1;
+    return 0;
+}
+
+void rev_walk_init(struct rev_walk *walk, struct repository *repo)
+{
+    memset(walk, 0, sizeof(*walk));
+    walk->repo = repo;
+    walk->graph = commit_graph_open(repo);
+    walk->sort = REV_SORT_DATE;
+    walk->max_count = -1;
+    walk->queue = (struct prio_queue)PRIO_QUEUE_INIT(compare_commits, walk);
+    walk->ready = (struct prio_queue)PRIO_QUEUE_INIT(compare_commits, walk);
+}
+
+void rev_walk_release(struct rev_walk *walk)
+{
+    for (size_t i = 0; i < walk->commits.alloc; i++) {
+        struct rev_commit *c = walk->commits.entries[i].data;
+        if (c)
+            free(c->parents);
+    }
+    oidmap_clear(&walk->commits, 1);
+    prio_queue_clear(&walk->queue);
+    prio_queue_clear(&walk->ready);
+    free(walk->list);
+    walk->list = NULL;
+    commit_graph_free(walk->graph);
+    walk->graph = NULL;
+}
+
+
+/* ---- commit nodes ---- */
+
+static struct rev_commit *get_node(struct rev_walk *walk, const struct object_id *oid)
+{
+    struct rev_commit *c = oidmap_get(&walk->commits, oid);
+    if (c)
+        return c;
+
+    c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+    c->oid = *oid;
+    c->generation = GENERATION_INFINITY;
+    if (oidmap_put(&walk->commits, oid, c) == c) {
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static int parse_from_graph(struct rev_walk *walk, struct rev_commit *c, long pos)
+{
+    struct commit_graph_entry entry;
+    struct object_id oid;
+
+    if (commit_graph_entry(walk->graph, pos, &entry) < 0)
+        return -1;
+    c->tree = entry.tree;
+    c->date = entry.date;
+    c->generation = entry.generation;
+
+    if (entry.nr_parents) {
+        c->parents = calloc(entry.nr_parents, sizeof(*c->parents));
+        if (!c->parents)
+            return -1;
+    }
+    for (uint32_t i = 0; i < entry.nr_parents; i++) {
+        long parent = commit_graph_parent(walk->graph, &entry, i);
+        if (parent < 0)
+            return -1;
+        commit_graph_oid(walk->graph, parent, &oid);
+        if (!(c->parents[i] = get_node(walk, &oid)))
+            return -1;
+        c->nr_parents++;
+    }
+    return 0;
+}
+
+static int parse_from_odb(struct rev_walk *walk, struct rev_commit *c)
+{
+    struct object *obj = repo_read_commit(walk->repo, &c->oid);
+    if (!obj)
+        return -1;
+
+    struct commit_object *commit = obj->as.commit;
+    int ret = 0;
+
+    c->tree = commit->tree;
+    c->date = commit->committer.timestamp;
+    if (commit->parent_count) {
+        c->parents = calloc(commit->parent_count, sizeof(*c->parents));
+        if (!c->parents)
+            ret = -1;
+    }
+    for (size_t i = 0; !ret && i < commit->parent_count; i++) {
+        if (!(c->parents[i] = get_node(walk, &commit->parents[i])))
+            ret = -1;
+        else
+            c->nr_parents++;
+    }
+    object_free(obj);
+    return ret;
+}
+
+int rev_walk_parse(struct rev_walk *walk, struct rev_commit *c)
+{
+    long pos;
+    int ret;
+
+    if (c->parsed)
+        return 0;
+    if (c->flags & OBJ_FLAG_BAD)
+        return -1;          /* already reported */
+    if (walk->graph && (pos = commit_graph_find(walk->graph, &c->oid)) >= 0)
+        ret = parse_from_graph(walk, c, pos);
+    else
+        ret = parse_from_odb(walk, c);
+
+    if (ret < 0) {
+        free(c->parents);
+        c->parents = NULL;
+        c->nr_parents = 0;
+        c->flags |= OBJ_FLAG_BAD;
+        ERROR("cannot read commit %s", oid_to_hex(&c->oid));
+        return -1;
+    }
+    c->parsed = 1;
+    walk->nr_parsed++;
+    return 0;
+}
+
+struct rev_commit *rev_walk_lookup(struct rev_walk *walk, const struct object_id *oid)
+{
+    struct rev_commit *c = get_node(walk, oid);
+    if (!c || rev_walk_parse(walk, c) < 0)
+        return NULL;
+    return c;
+}
+
+static size_t nr_followed(const struct rev_walk *walk, const struct rev_commit *c)
+{
+    if (walk->first_parent && c->nr_parents > 1 && !(c->flags & OBJ_FLAG_UNINTERESTING))
+        return 1;
+    return c->nr_parents;
+}
+
+
+/* ---- the walk ---- */
+
+static int push_commit(struct rev_walk *walk, struct rev_commit *c)
+{
+    if (c->flags & OBJ_FLAG_SEEN)
+        return 0;
+    if (rev_walk_parse(walk, c) < 0)
+        return -1;
+    if (prio_queue_put(&walk->queue, c) < 0)
+        return -1;
+
+    c->flags |= OBJ_FLAG_SEEN;
+    if (!(c->flags & OBJ_FLAG_UNINTERESTING))
+        walk->nr_interesting++;
+    return 0;
+}
+
+/*
+ * Exclude [c] and, for commits already expanded, their ancestors too;
+ * the others pass the flag on when they are popped.
+ */
+static void mark_uninteresting(struct rev_walk *walk, struct rev_commit *c)
+{
+    struct rev_commit **stack = NULL;
+    size_t nr = 0, alloc = 0;
+
+    for (;;) {
+        if (!(c->flags & OBJ_FLAG_UNINTERESTING)) {
+            c->flags |= OBJ_FLAG_UNINTERESTING;
+            if ((c->flags & (OBJ_FLAG_SEEN | OBJ_FLAG_WALKED)) == OBJ_FLAG_SEEN)
+                walk->nr_interesting--;         /* still queued */
+
+            size_t n = c->flags & OBJ_FLAG_WALKED ? nr_followed(walk, c) : 0;
+            if (nr + n > alloc) {
+                size_t a = alloc ? 2 * alloc : 64;
+                while (a < nr + n)
+                    a *= 2;
+                struct rev_commit **tmp = realloc(stack, a * sizeof(*tmp));
+                if (!tmp)
+                    break;      /* the marks already made stand */
+                stack = tmp;
+                alloc = a;
+            }
+            for (size_t i = 0; i < n; i++)
+                stack[nr++] = c->parents[i];
+        }
+        if (!nr)
+            break;
+        c = stack[--nr];
+    }
+    free(stack);
+}
+
+/*
+ * Pop the next commit, excluded or not, and queue its parents: the
+ * first one only with --first-parent, but every parent of an excluded
+ * commit so that exclusion reaches all of its history.
+ */
+static struct rev_commit *expand_next(struct rev_walk *walk)
+{
+    struct rev_commit *c = prio_queue_get(&walk->queue);
+    if (!c)
+        return NULL;
+    if (!(c->flags & OBJ_FLAG_UNINTERESTING))
+        walk->nr_interesting--;
+
+    c->flags |= OBJ_FLAG_WALKED;
+    for (size_t i = 0; i < nr_followed(walk, c); i++) {
+        struct rev_commit *p = c->parents[i];
+        if (c->flags & OBJ_FLAG_UNINTERESTING)
+            mark_uninteresting(walk, p);
+        push_commit(walk, p);   /* a failure is reported; history is cut there */
+    }
+    return c;
+}
+
+/* Commits the walk keeps going for once only excluded ones are queued. */
+#define WALK_SLOP 5
+
+/*
+ * Whether to keep walking after [date] was popped. Clock skew can put an
+ * excluded commit behind one of its own ancestors, so like git this goes
+ * on for a few commits after the queue only holds excluded ones, and for
+ * as long as dates do not decrease.
+ */
+static int still_interesting(struct rev_walk *walk, int64_t date, int slop)
+{
+    struct rev_commit *next = prio_queue_peek(&walk->queue);
+
+    if (!next)
+        return 0;
+    if (date <= next->date || walk->nr_interesting)
+        return WALK_SLOP;
+    return slop - 1;
+}
+
+static int is_topo(enum rev_sort sort)
+{
+    return sort == REV_SORT_TOPO || sort == REV_SORT_TOPO_DATE;
+}
+
+/*
+ * Run the whole walk before showing anything, so that exclusions have
+ * reached every commit: needed for topological order and whenever some
+ * tip is excluded. The commits to show are kept in walk order and, in
+ * topological order, become ready once all of their children have been
+ * shown. REV_SORT_TOPO_DATE shows the newest ready commit first;
+ * REV_SORT_TOPO keeps them on a stack in [list] instead, so that a line
+ * of history is finished before the next one starts, as git does.
+ */
+static int limit_walk(struct rev_walk *walk)
+{
+    struct rev_commit **list = NULL, *c;
+    size_t nr = 0, alloc = 0;
+    int slop = WALK_SLOP, ret = 0;
+
+    walk->limited = 1;
+    while (slop && (c = expand_next(walk))) {
+        slop = still_interesting(walk, c->date, slop);
+        if (c->flags & OBJ_FLAG_UNINTERESTING)
+            continue;
+        if (nr == alloc) {
+            size_t a = alloc ? 2 * alloc : 1024;
+            struct rev_commit **tmp = realloc(list, a * sizeof(*tmp));
+            if (!tmp) {
+                free(list);
+                return -1;
+            }
+            list = tmp;
+            alloc = a;
+        }
+        list[nr++] = c;
+    }
+
+    /* OBJ_FLAG_MARKED: will be shown; some got excluded after popping */
+    size_t kept = 0;
+    for (size_t i = 0; i < nr; i++) {
+        if (!(list[i]->flags & OBJ_FLAG_UNINTERESTING)) {
+            list[i]->flags |= OBJ_FLAG_MARKED;
+            list[kept++] = list[i];
+        }
+    }
+    nr = kept;
+
+    if (!is_topo(walk->sort)) {
+        walk->list = list;
+        walk->list_nr = nr;
+        return 0;
+    }
+
+    for (size_t i = 0; i < nr; i++) {
+        c = list[i];
+        for (size_t j = 0; j < nr_followed(walk, c); j++) {
+            if (c->parents[j]->flags & OBJ_FLAG_MARKED)
+                c->parents[j]->indegree++;
+        }
+    }
+    if (walk->sort == REV_SORT_TOPO) {
+        /* each commit is stacked once, so [list] is big enough */
+        size_t top = 0;
+        for (size_t i = 0; i < nr; i++) {
+            if (!list[i]->indegree)
+                list[top++] = list[i];
+        }
+        for (size_t i = 0; i < top / 2; i++) {
+            c = list[i];
+            list[i] = list[top - 1 - i];
+            list[top - 1 - i] = c;
+        }
+        walk->list = list;
+        walk->list_nr = top;
+        return 0;
+    }
+    for (size_t i = 0; i < nr && !ret; i++) {
+        if (!list[i]->indegree)
+            ret = prio_queue_put(&walk->ready, list[i]);
+    }
+    free(list);
+    return ret;
+}
+
+static struct rev_commit *next_topo(struct rev_walk *walk)
+{
+    struct rev_commit *c;
+
+    if (walk->sort == REV_SORT_TOPO)
+        c = walk->list_nr ? walk->list[--walk->list_nr] : NULL;
+    else
+        c = prio_queue_get(&walk->ready);
+    if (!c)
+        return NULL;
+
+    for (size_t i = 0; i < nr_followed(walk, c); i++) {
+        struct rev_commit *p = c->parents[i];
+        if (!(p->flags & OBJ_FLAG_MARKED) || --p->indegree)
+            continue;
+        if (walk->sort == REV_SORT_TOPO)
+            walk->list[walk->list_nr++] = p;
+        else
+            prio_queue_put(&walk->ready, p);
+    }
+    return c;
+}
+
+struct rev_commit *rev_walk_next(struct rev_walk *walk)
+{
+    struct rev_commit *c = NULL;
+
+    if (walk->max_count >= 0 && walk->nr_shown >= (size_t)walk->max_count)
+        return NULL;
+
+    if (!walk->limited && (is_topo(walk->sort) || walk->excluding) &&
+        limit_walk(walk) < 0)
+        return NULL;
+
+    if (is_topo(walk->sort)) {
+        c = next_topo(walk);
+    } else if (walk->limited) {
+        if (walk->list_pos < walk->list_nr)
+            c = walk->list[walk->list_pos++];
+    } else {
+        /* lazily: the end is reached when only excluded commits are left */
+        while (walk->nr_interesting && (c = expand_next(walk)) &&
+               (c->flags & OBJ_FLAG_UNINTERESTING))
+            c = NULL;
+    }
+
+    if (c)
+        walk->nr_shown++;
+    return c;
+}
+
+
+/* ---- adding tips ---- */
+
+int rev_walk_add(struct rev_walk *walk, const struct object_id *oid, int uninteresting)
+{
+    struct object_id peeled;
+    enum object_type type;
+
+    if (peel_object(walk->repo, oid, &peeled, &type) < 0 || type != OBJ_COMMIT) {
+        ERROR("%s is not a commit", oid_to_hex(oid));
+        return -1;
+    }
+
+    struct rev_commit *c = rev_walk_lookup(walk, &peeled);
+    if (!c)
+        return -1;
+    if (uninteresting) {
+        mark_uninteresting(walk, c);
+        walk->excluding = 1;
+    }
+    return push_commit(walk, c);
+}
+
+static int add_name(struct rev_walk *walk, const char *name, size_t len,
+                    int uninteresting)
+{
+    struct object_id oid;
+    char buf[1024];
+
+    if (!len) {
+        name = "HEAD";
+        len = 4;
+    }
+    if (len >= sizeof(buf))
+        return -1;
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+
+    if (repo_resolve_ref(walk->repo, buf, &oid) < 0) {
+        ERROR("unknown revision %s", buf);
+        return -1;
+    }
+    return rev_walk_add(walk, &oid, uninteresting);
+}
+
+int rev_walk_add_spec(struct rev_walk *walk, const char *spec)
+{
+    const char *dots = strstr(spec, "..");
+
+    if (dots) {
+        if (dots[2] == '.') {
+            ERROR("symmetric differences (a...b) are not supported");
+            return -1;
+        }
+        if (add_name(walk, spec, dots - spec, 1) < 0)
+            return -1;
+        return add_name(walk, dots + 2, strlen(dots + 2), 0);
+    }
+    if (spec[0] == '^')
+        return add_name(walk, spec + 1, strlen(spec + 1), 1);
+    return add_name(walk, spec, strlen(spec), 0);
+}
+
+
+/* ---- command ---- */
+
+static int print_object(const struct reachable_object *obj, void *data)
+{
+    if (obj->path)
+        printf("%s %s\n", oid_to_hex(&obj->oid), obj->path);
+    else
+        printf("%s\n", oid_to_hex(&obj->oid));
+    return 0;
+}
+
+/* "blob:none", "blob:limit=<n>[kmg]" or "object:type=<type>" */
+static int parse_filter(const char *arg, struct reachable_options *opts)
+{
+    if (!strcmp(arg, "blob:none")) {
+        opts->types = ~REACHABLE_TYPE(OBJ_BLOB);
+        return 0;
+    }
+    if (!strncmp(arg, "blob:limit=", 11)) {
+        char *end;
+        long n = strtol(arg + 11, &end, 10);
+        switch (*end) {
+        case 'k': case 'K': n <<= 10; end++; break;
+        case 'm': case 'M': n <<= 20; end++; break;
+        case 'g': case 'G': n <<= 30; end++; break;
+        }
+        if (end == arg + 11 || *end || n < 0)
+            return -1;
+        opts->blob_limit = n;
+        return 0;
+    }
+    if (!strncmp(arg, "object:type=", 12)) {
+        enum object_type type = type_from_string(arg + 12, strlen(arg + 12));
+        if (type == OBJ_NONE)
+            return -1;
+        opts->types = REACHABLE_TYPE(type);
+        return 0;
+    }
+    return -1;
+}
+
+int cmd_rev_list(int argc, char **argv)
+{
+    static const char usage[] =
+        "usage: rev-list [-n <count>] [--first-parent] [--date-order | --topo-order"
+        " | --generation-order] [--objects [--filter=<filter>] [-j <threads>]]"
+        " <gitdir> [<rev>...]\n";
+    struct reachable_options objects = REACHABLE_OPTIONS_INIT;
+    enum rev_sort sort = REV_SORT_DATE;
+    long max_count = -1;
+    int first_parent = 0, with_objects = 0, i;
+
+    objects.fn = print_object;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            max_count = atol(argv[++i]);
+        else if (!strncmp(argv[i], "--max-count=", 12))
+            max_count = atol(argv[i] + 12);
+        else if (!strcmp(argv[i], "--first-parent"))
+            first_parent = 1;
+        else if (!strcmp(argv[i], "--date-order"))
+            sort = REV_SORT_TOPO_DATE;
+        else if (!strcmp(argv[i], "--topo-order"))
+            sort = REV_SORT_TOPO;
+        else if (!strcmp(argv[i], "--generation-order"))
+            sort = REV_SORT_GENERATION;
+        else if (!strcmp(argv[i], "--objects"))
+            with_objects = 1;
+        else if (!strncmp(argv[i], "--filter=", 9) && !parse_filter(argv[i] + 9, &objects))
+            continue;
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            objects.nr_threads = atoi(argv[++i]);
+        else
+            break;
+    }
+    if (i >= argc) {
+        fprintf(stderr, "%s", usage);
+        return 128;
+    }
+
+    struct repository repo;
+    if (repo_open(&repo, argv[i]) < 0) {
+        ERROR("%s is not a git directory", argv[i]);
+        return 128;
+    }
+
+    struct rev_walk walk;
+    int ret = 0;
+
+    rev_walk_init(&walk, &repo);
+    walk.sort = sort;
+    walk.max_count = max_count;
+    walk.first_parent = first_parent;
+
+    if (i + 1 == argc && repo.head)
+        ret = rev_walk_add(&walk, &repo.head->oid, 0);
+    for (i++; i < argc && !ret; i++)
+        ret = rev_walk_add_spec(&walk, argv[i]);
+
+    if (!ret && with_objects) {
+        ret = enumerate_reachable(&walk, &objects);
+    } else if (!ret) {
+        struct rev_commit *c;
+        while ((c = rev_walk_next(&walk)))
+            printf("%s\n", oid_to_hex(&c->oid));
+    }
+
+    rev_walk_release(&walk);
+    repo_clear(&repo);
+    return ret ? 128 : 0;
+}
@@ -0,0 +1,125 @@
+#ifndef REVISION_H
+#define REVISION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "object.h"
+#include "oidmap.h"
+#include "prio_queue.h"
+
+struct repository;
+struct commit_graph;
+
+/*
+ * History walking.
+ *
+ * A walk starts from a set of tips, some of which may be excluded
+ * (^A, or the A in A..B). Commits come out of a binary heap, newest
+ * first; each one is expanded (its parents queued) only when it is
+ * popped, and OBJ_FLAG_SEEN keeps a commit from being queued twice, so
+ * "rev-list -n 20" reads about 20 commits. Exclusion spreads through
+ * OBJ_FLAG_UNINTERESTING, and the walk ends once only excluded commits
+ * are left in the queue. --first-parent restricts which parents of the
+ * shown commits are followed, not how far exclusion reaches.
+ *
+ * Parents, dates and generation numbers come from the commit graph
+ * when there is one, otherwise from the commit objects themselves.
+ * Topological order and excluded tips are the exception to laziness:
+ * then everything is walked first, so that no commit is shown before
+ * one of its descendants, or before it turns out to be excluded.
+ */
+struct rev_commit {
+    struct object_id oid;
+    struct object_id tree;          /* set once parsed */
+    unsigned flags;                 /* OBJ_FLAG_* */
+    int64_t date;                   /* committer timestamp */
+    uint32_t generation;            /* GENERATION_INFINITY if unknown */
+
+    struct rev_commit **parents;    /* NULL until the commit is parsed */
+    size_t nr_parents;
+    int parsed;
+
+    size_t indegree;                /* children left to show, topo order */
+    void *util;                     /* per-query scratch (commit_reach.c) */
+};
+
+enum rev_sort {
+    REV_SORT_DATE,          /* newest committer date first */
+    REV_SORT_GENERATION,    /* highest generation first, then by date;
+                               topological too when all are in the graph */
+    REV_SORT_TOPO,          /* never a parent before one of its children,
+                               each line of history kept together */
+    REV_SORT_TOPO_DATE,     /* never a parent before one of its children,
+                               otherwise newest first (--date-order) */
+};
+
+struct rev_walk {
+    struct repository *repo;
+    struct commit_graph *graph;     /* NULL if the repository has none */
+
+    /* options, set before the first rev_walk_next() */
+    enum rev_sort sort;
+    long max_count;                 /* -1: no limit */
+    int first_parent;
+
+    struct oidmap commits;          /* id -> struct rev_commit */
+    struct prio_queue queue;
+    size_t nr_interesting;          /* queued and not excluded */
+    size_t nr_shown;
+    size_t nr_parsed;               /* commits read, from graph or odb */
+
+    /*
+     * In topological order or with an excluded tip, every commit to
+     * show is collected before the first one is returned.
+     */
+    int excluding;                  /* some tip is excluded */
+    int limited;                    /* the commits have been collected */
+    struct rev_commit **list;       /* them, in walk order; a stack for
+                                       REV_SORT_TOPO */
+    size_t list_nr, list_pos;
+    struct prio_queue ready;        /* REV_SORT_TOPO_DATE: commits whose
+                                       children were shown */
+};
+
+void rev_walk_init(struct rev_walk *walk, struct repository *repo);
+void rev_walk_release(struct rev_walk *walk);
+
+/*
+ * Fill in [c]'s date, generation and parents (a no-op if it already
+ * is parsed). Returns 0, or -1 if it cannot be read.
+ */
+int rev_walk_parse(struct rev_walk *walk, struct rev_commit *c);
+
+/*
+ * The walk's node for commit [oid], parsed. Returns NULL if it is
+ * missing or not a commit.
+ */
+struct rev_commit *rev_walk_lookup(struct rev_walk *walk, const struct object_id *oid);
+
+/*
+ * Start from [oid] (tags are peeled), or exclude everything reachable
+ * from it if [uninteresting]. Returns 0, or -1 if it is not a commit.
+ */
+int rev_walk_add(struct rev_walk *walk, const struct object_id *oid, int uninteresting);
+
+/*
+ * Add a tip given on the command line: "<rev>", "^<rev>" or
+ * "<a>..<b>" (a missing side means HEAD), where <rev> is anything
+ * repo_resolve_ref() accepts. Returns 0, or -1 if it cannot be resolved.
+ */
+int rev_walk_add_spec(struct rev_walk *walk, const char *spec);
+
+/* The next commit to show, or NULL at the end of the walk. */
+struct rev_commit *rev_walk_next(struct rev_walk *walk);
+
+/*
+ * "rev-list [-n <count>] [--first-parent] [--date-order | --topo-order
+ *  | --generation-order] [--objects [--filter=<filter>] [-j <threads>]]
+ *  <gitdir> <rev>...": print the id of every commit of the walk, one
+ * per line. With no <rev>, walks from HEAD. --objects adds "<id> <path>"
+ * for every tree and blob they reach (see enumerate_reachable()); the
+ * filter is "blob:none", "blob:limit=<n>[kmg]" or "object:type=<type>".
+ */
+int cmd_rev_list(int argc, char **argv);
+
+#endif /* REVISION_H */
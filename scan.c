@@ -0,0 +1,311 @@
+#define _GNU_SOURCE
+#include "scan.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+
+typedef void (*block_masks_fn)(const unsigned char *p,
+                               unsigned char c1, unsigned char c2,
+                               uint64_t *m1, uint64_t *m2);
+
+static void block_masks_scalar(const unsigned char *p,
+                               unsigned char c1, unsigned char c2,
+                               uint64_t *m1, uint64_t *m2)
+{
+    uint64_t a = 0, b = 0;
+    for (int i = 0; i < 64; i++) {
+        a |= (uint64_t)(p[i] == c1) << i;
+        b |= (uint64_t)(p[i] == c2) << i;
+    }
+    *m1 = a;
+    *m2 = b;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static void block_masks_sse2(const unsigned char *p,
+                             unsigned char c1, unsigned char c2,
+                             uint64_t *m1, uint64_t *m2)
+{
+    const __m128i v1 = _mm_set1_epi8((char)c1);
+    const __m128i v2 = _mm_set1_epi8((char)c2);
+    uint64_t a = 0, b = 0;
+
+    for (int i = 0; i < 4; i++) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        a |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, v1)) << (16 * i);
+        b |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, v2)) << (16 * i);
+    }
+    *m1 = a;
+    *m2 = b;
+}
+
+__attribute__((target("avx2")))
+static void block_masks_avx2(const unsigned char *p,
+                             unsigned char c1, unsigned char c2,
+                             uint64_t *m1, uint64_t *m2)
+{
+    const __m256i v1 = _mm256_set1_epi8((char)c1);
+    const __m256i v2 = _mm256_set1_epi8((char)c2);
+    __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+
+    *m1 = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, v1)) |
+          (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, v1)) << 32;
+    *m2 = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, v2)) |
+          (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, v2)) << 32;
+}
+#endif
+
+
+
+/* ---- substring search ---- */
+
+/*
+ * Candidates are the positions where both the first and the last byte
+ * of the needle line up, found 16 or 32 at a time by comparing two
+ * loads (at i and at i + len - 1) against broadcast copies of them.
+ * Only candidates are compared in full, so text that rarely has both
+ * bytes [len - 1] apart is skipped at vector speed.
+ */
+typedef const void *(*memmem_fn)(const unsigned char *hay, size_t hay_len,
+                                 const unsigned char *needle, size_t len);
+
+static const void *memmem_scalar(const unsigned char *hay, size_t hay_len,
+                                 const unsigned char *needle, size_t len)
+{
+    return memmem(hay, hay_len, needle, len);
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2")))
+static const void *memmem_sse2(const unsigned char *hay, size_t hay_len,
+                               const unsigned char *needle, size_t len)
+{
+    const __m128i first = _mm_set1_epi8((char)needle[0]);
+    const __m128i last = _mm_set1_epi8((char)needle[len - 1]);
+    size_t i = 0;
+
+    for (; i + len - 1 + 16 <= hay_len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + len - 1));
+        unsigned m = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        while (m) {
+            size_t at = i + (size_t)__builtin_ctz(m);
+            if (!memcmp(hay + at + 1, needle + 1, len - 2))
+                return hay + at;
+            m &= m - 1;
+        }
+    }
+    return memmem(hay + i, hay_len - i, needle, len);
+}
+
+__attribute__((target("avx2")))
+static const void *memmem_avx2(const unsigned char *hay, size_t hay_len,
+                               const unsigned char *needle, size_t len)
+{
+    const __m256i first = _mm256_set1_epi8((char)needle[0]);
+    const __m256i last = _mm256_set1_epi8((char)needle[len - 1]);
+    size_t i = 0;
+
+    for (; i + len - 1 + 32 <= hay_len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(hay + i + len - 1));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+        while (m) {
+            size_t at = i + (size_t)__builtin_ctz(m);
+            if (!memcmp(hay + at + 1, needle + 1, len - 2))
+                return hay + at;
+            m &= m - 1;
+        }
+    }
+    return memmem(hay + i, hay_len - i, needle, len);
+}
+#endif
+
+static enum scan_kernel active_kernel = SCAN_KERNEL_SCALAR;
+static block_masks_fn block_masks = block_masks_scalar;
+static memmem_fn memmem_kernel = memmem_scalar;
+
+
+int scan_kernel_supported(enum scan_kernel kernel)
+{
+    switch (kernel) {
+    case SCAN_KERNEL_SCALAR:
+        return 1;
+#ifdef SCAN_X86
+    case SCAN_KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case SCAN_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return 0;
+    }
+}
+
+int scan_force_kernel(enum scan_kernel kernel)
+{
+    if (!scan_kernel_supported(kernel))
+        return -1;
+
+    switch (kernel) {
+#ifdef SCAN_X86
+    case SCAN_KERNEL_SSE2:
+        block_masks = block_masks_sse2;
+        memmem_kernel = memmem_sse2;
+        break;
+    case SCAN_KERNEL_AVX2:
+        block_masks = block_masks_avx2;
+        memmem_kernel = memmem_avx2;
+        break;
+#endif
+    default:
+        block_masks = block_masks_scalar;
+        memmem_kernel = memmem_scalar;
+        break;
+    }
+    active_kernel = kernel;
+    return 0;
+}
+
+enum scan_kernel scan_active_kernel(void)
+{
+    return active_kernel;
+}
+
+const char *scan_kernel_name(enum scan_kernel kernel)
+{
+    switch (kernel) {
+    case SCAN_KERNEL_SSE2: return "sse2";
+    case SCAN_KERNEL_AVX2: return "avx2";
+    default:               return "scalar";
+    }
+}
+
+
+/* ---- commit header classification ---- */
+
+static const struct {
+    const char *key;
+    size_t len;
+    enum header_kind kind;
+} header_keys[] = {
+    { "tree ",          5,  HEADER_TREE },
+    { "parent ",        7,  HEADER_PARENT },
+    { "author ",        7,  HEADER_AUTHOR },
+    { "committer ",     10, HEADER_COMMITTER },
+    { "encoding ",      9,  HEADER_ENCODING },
+    { "gpgsig ",        7,  HEADER_GPGSIG },
+    { "gpgsig-sha256 ", 14, HEADER_GPGSIG },
+};
+
+#define NR_HEADER_KEYS (sizeof(header_keys) / sizeof(header_keys[0]))
+
+/* first (up to) eight bytes of each key, and the mask selecting them */
+static uint64_t header_words[NR_HEADER_KEYS];
+static uint64_t header_masks[NR_HEADER_KEYS];
+
+static uint64_t load_word(const void *p, size_t len)
+{
+    uint64_t w = 0;
+    memcpy(&w, p, len < 8 ? len : 8);
+    return w;
+}
+
+enum header_kind classify_header_line(const char *line, size_t len,
+                                      size_t *key_len)
+{
+    *key_len = 0;
+    if (len == 0)
+        return HEADER_BLANK;
+    if (line[0] == ' ')
+        return HEADER_CONTINUATION;
+
+    uint64_t w = load_word(line, len);
+    for (size_t i = 0; i < NR_HEADER_KEYS; i++) {
+        size_t klen = header_keys[i].len;
+        if (len < klen || (w & header_masks[i]) != header_words[i])
+            continue;
+        if (klen > 8 && memcmp(line + 8, header_keys[i].key + 8, klen - 8) != 0)
+            continue;
+        *key_len = klen;
+        return header_keys[i].kind;
+    }
+    return HEADER_OTHER;
+}
+
+
+__attribute__((constructor))
+static void scan_setup(void)
+{
+    static const unsigned char ones[8] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+    };
+
+    for (size_t i = 0; i < NR_HEADER_KEYS; i++) {
+        header_words[i] = load_word(header_keys[i].key, header_keys[i].len);
+        header_masks[i] = load_word(ones, header_keys[i].len);
+    }
+
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (scan_force_kernel(SCAN_KERNEL_AVX2) < 0)
+        scan_force_kernel(SCAN_KERNEL_SSE2);
+#endif
+}
+
+
+/* ---- scanner ---- */
+
+void scanner_init(struct byte_scanner *s, const void *buf, size_t len,
+                  unsigned char c1, unsigned char c2)
+{
+    s->buf = buf;
+    s->len = len;
+    s->c1 = c1;
+    s->c2 = c2;
+    s->block = SIZE_MAX;
+    s->m1 = 0;
+    s->m2 = 0;
+}
+
+void scanner_load_block(struct byte_scanner *s, size_t block)
+{
+    size_t avail = s->len - block;
+
+    if (avail >= 64) {
+        block_masks(s->buf + block, s->c1, s->c2, &s->m1, &s->m2);
+    } else {
+        /* tail: pad a copy, then drop matches on the padding */
+        unsigned char tmp[64] = {0};
+        uint64_t keep = (1ULL << avail) - 1;
+        memcpy(tmp, s->buf + block, avail);
+        block_masks(tmp, s->c1, s->c2, &s->m1, &s->m2);
+        s->m1 &= keep;
+        s->m2 &= keep;
+    }
+    s->block = block;
+}
+
+
+const void *scan_memmem(const void *hay, size_t hay_len,
+                        const void *needle, size_t len)
+{
+    if (len == 0)
+        return hay;
+    if (len > hay_len)
+        return NULL;
+    if (len == 1)
+        return memchr(hay, *(const unsigned char *)needle, hay_len);
+    return memmem_kernel(hay, hay_len, needle, len);
+}
@@ -0,0 +1,102 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Delimiter scanning for object parsers.
+ *
+ * A byte_scanner looks for two delimiter bytes at once. It classifies
+ * the buffer 64 bytes at a time into a pair of bitmasks (with AVX2 or
+ * SSE2 where available, chosen at startup) and answers "next delimiter
+ * at or after pos" with a count-trailing-zeros on the cached masks.
+ * Consecutive lookups that land in the same block cost no extra loads,
+ * so a parser that walks forward touches every byte at most once.
+ */
+struct byte_scanner {
+    const unsigned char *buf;
+    size_t len;
+    unsigned char c1, c2;       /* the two delimiters */
+    size_t block;               /* offset of the cached block, or SIZE_MAX */
+    uint64_t m1, m2;            /* c1/c2 positions within that block */
+};
+
+void scanner_init(struct byte_scanner *s, const void *buf, size_t len,
+                  unsigned char c1, unsigned char c2);
+
+/* Compute the masks of the 64-byte block starting at [block]. */
+void scanner_load_block(struct byte_scanner *s, size_t block);
+
+/* Offset of the first c1 (which == 0) or c2 (which == 1) at or after
+ * [pos], or s->len if there is none. */
+static inline size_t scanner_next(struct byte_scanner *s, size_t pos, int which)
+{
+    while (pos < s->len) {
+        size_t block = pos & ~(size_t)63;
+        if (block != s->block)
+            scanner_load_block(s, block);
+
+        uint64_t m = (which ? s->m2 : s->m1) >> (pos & 63);
+        if (m)
+            return pos + (size_t)__builtin_ctzll(m);
+        pos = block + 64;
+    }
+    return s->len;
+}
+
+
+/* Kernels that can compute the block masks. */
+enum scan_kernel {
+    SCAN_KERNEL_SCALAR,
+    SCAN_KERNEL_SSE2,
+    SCAN_KERNEL_AVX2,
+};
+
+/* The kernel selected by runtime CPU detection (or scan_force_kernel). */
+enum scan_kernel scan_active_kernel(void);
+const char *scan_kernel_name(enum scan_kernel kernel);
+
+/* 1 if this CPU and build can run [kernel], 0 otherwise. */
+int scan_kernel_supported(enum scan_kernel kernel);
+
+/*
+ * Override the kernel, e.g. to benchmark or test the fallbacks.
+ * Returns 0, or -1 if this CPU or build does not support [kernel].
+ */
+int scan_force_kernel(enum scan_kernel kernel);
+
+/*
+ * First occurrence of [needle] ([len] bytes) in [hay], or NULL: like
+ * memmem(), with the active kernel's vector compares.
+ */
+const void *scan_memmem(const void *hay, size_t hay_len,
+                        const void *needle, size_t len);
+
+
+/*
+ * Commit/tag header classification. The line is identified from its
+ * first eight bytes with masked word compares instead of one strncmp()
+ * per candidate prefix.
+ */
+enum header_kind {
+    HEADER_OTHER,
+    HEADER_TREE,            /* "tree " */
+    HEADER_PARENT,          /* "parent " */
+    HEADER_AUTHOR,          /* "author " */
+    HEADER_COMMITTER,       /* "committer " */
+    HEADER_ENCODING,        /* "encoding " */
+    HEADER_GPGSIG,          /* "gpgsig " or "gpgsig-sha256 " */
+    HEADER_CONTINUATION,    /* starts with a space */
+    HEADER_BLANK,           /* empty line: end of headers */
+};
+
+/*
+ * Classify the header line [line] of [len] bytes (without its '\n') and
+ * return the length of the matched "key " prefix in *key_len (0 for
+ * HEADER_OTHER, HEADER_CONTINUATION and HEADER_BLANK).
+ */
+enum header_kind classify_header_line(const char *line, size_t len,
+                                      size_t *key_len);
+
+#endif /* SCAN_H */
@@ -0,0 +1,1608 @@
+#define _GNU_SOURCE
+#include "status.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "log.h"
+#include "hash.h"
+#include "hex.h"
+#include "index.h"
+#include "pack.h"
+#include "repository.h"
+#include "thread_pool.h"
+#include "tree.h"
+
+/* Index entries handed to an lstat() worker at a time. */
+#define STATUS_LSTAT_CHUNK 64
+
+/* Read size when hashing a file of the worktree. */
+#define STATUS_HASH_BUFFER (64u << 10)
+
+#define STATUS_CACHE_FILE "status-cache"
+#define STATUS_CACHE_MAGIC "NSC1"
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+
+/* An entry whose content matched: its new stat data, for the index. */
+struct status_refresh {
+    size_t pos;
+    struct index_stat st;
+};
+
+struct status_worker {
+    struct hash_ctx ctx;
+    char *buf;                  /* STATUS_HASH_BUFFER bytes */
+    char *path;                 /* worktree path being looked at */
+    size_t path_alloc;
+    struct status_refresh *refresh;
+    size_t nr_refresh, alloc_refresh;
+    size_t nr_hashed;
+    int failed;
+};
+
+struct dir_cache_entry {
+    const char *path;
+    uint32_t mtime_sec, mtime_nsec;
+    uint64_t tracked;
+    const char *names;
+    size_t names_len;
+};
+
+/* The listings of <gitdir>/status-cache, sorted by path. */
+struct dir_cache {
+    char *buf;
+    struct dir_cache_entry *entries;
+    size_t nr;
+};
+
+struct walk_dir;
+
+struct status_state {
+    struct repository *repo;
+    const struct status_options *opts;
+    struct status_result *res;
+    struct index_state istate;
+    size_t rawsz;
+
+    /* HEAD against the index */
+    struct delta_base_cache cache;
+    size_t pos;                 /* next entry of the merge walk */
+
+    /* the index against the worktree: one status per entry */
+    char *worktree_status;
+    struct thread_pool *pool;
+    struct status_worker *workers;
+    int nr_workers;
+
+    /* untracked files */
+    const char *worktree;
+    size_t worktree_len;
+    time_t start;
+    struct dir_cache dir_cache;
+    struct walk_dir **level;
+};
+
+static int add_item(struct status_result *res, const char *path, size_t len,
+                    char index_status, char worktree_status)
+{
+    if (res->nr == res->alloc) {
+        size_t alloc = res->alloc ? 2 * res->alloc : 64;
+        struct status_item *tmp = realloc(res->items, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        res->items = tmp;
+        res->alloc = alloc;
+    }
+    struct status_item *item = &res->items[res->nr];
+    if (!(item->path = strndup(path, len)))
+        return -1;
+    item->index_status = index_status;
+    item->worktree_status = worktree_status;
+    res->nr++;
+    return 0;
+}
+
+/* worktree "/" [rel] in w->path, or NULL. */
+static const char *worker_path(const struct status_state *st, struct status_worker *w,
+                               const char *rel, size_t len)
+{
+    size_t n = st->worktree_len + 1 + len + 1;
+
+    if (n > w->path_alloc) {
+        size_t alloc = w->path_alloc ? w->path_alloc : 256;
+        while (alloc < n)
+            alloc *= 2;
+        char *tmp = realloc(w->path, alloc);
+        if (!tmp) {
+            w->failed = 1;
+            return NULL;
+        }
+        w->path = tmp;
+        w->path_alloc = alloc;
+    }
+    memcpy(w->path, st->worktree, st->worktree_len);
+    w->path[st->worktree_len] = '/';
+    memcpy(w->path + st->worktree_len + 1, rel, len);
+    w->path[n - 1] = '\0';
+    return w->path;
+}
+
+
+/* ---- index lookups ---- */
+
+/* The first entry at or after [lo] that does not start with [prefix]. */
+static size_t skip_prefix(const struct index_state *istate, size_t lo,
+                          const char *prefix, size_t len)
+{
+    size_t hi = istate->nr;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const struct index_entry *e = &istate->entries[mid];
+        if (e->pathlen >= len && !memcmp(e->path, prefix, len))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* The first entry of [path], at any stage, or NULL. */
+static const struct index_entry *find_path(const struct index_state *istate,
+                                           const char *path, size_t len)
+{
+    long pos = index_pos(istate, path, len, 0);
+
+    if (pos < 0)
+        pos = -pos - 1;
+    if ((size_t)pos < istate->nr && istate->entries[pos].pathlen == len &&
+        !memcmp(istate->entries[pos].path, path, len))
+        return &istate->entries[pos];
+    return NULL;
+}
+
+/* Position of the first entry under the directory [prefix] (ending with '/'). */
+static size_t prefix_pos(const struct index_state *istate, const char *prefix, size_t len)
+{
+    long pos = len ? index_pos(istate, prefix, len, 0) : 0;
+    return pos < 0 ? -pos - 1 : pos;
+}
+
+/* Whether some entry lies under the directory [prefix] (ending with '/'). */
+static int has_prefix(const struct index_state *istate, const char *prefix, size_t len)
+{
+    size_t pos = prefix_pos(istate, prefix, len);
+    return pos < istate->nr && istate->entries[pos].pathlen > len &&
+           !memcmp(istate->entries[pos].path, prefix, len);
+}
+
+static int path_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    return c ? c : (alen > blen) - (alen < blen);
+}
+
+
+/* ---- HEAD against the index ---- */
+
+/* An entry left out of the comparison with HEAD. */
+static int skip_head_entry(const struct index_entry *e)
+{
+    return index_entry_stage(e) || (e->flags & INDEX_ENTRY_INTENT_TO_ADD);
+}
+
+/* Report the entries sorting before [key] as added. */
+static int add_until(struct status_state *st, const char *key, size_t len)
+{
+    const struct index_state *istate = &st->istate;
+
+    while (st->pos < istate->nr) {
+        const struct index_entry *e = &istate->entries[st->pos];
+        if (key && path_cmp(e->path, e->pathlen, key, len) >= 0)
+            break;
+        if (!skip_head_entry(e) && add_item(st->res, e->path, e->pathlen, 'A', ' ') < 0)
+            return -1;
+        st->pos++;
+    }
+    return 0;
+}
+
+/*
+ * Skip the directory [path] ([len] bytes, '/' included) if the
+ * cache-tree says its entries make the tree [oid]. Returns 1 if skipped.
+ */
+static int skip_by_cache_tree(struct status_state *st, const char *path, size_t len,
+                              const struct object_id *oid)
+{
+    const struct index_state *istate = &st->istate;
+    struct object_id cached;
+    size_t nr, end;
+
+    if (!index_cache_tree_lookup(&st->istate, path, len ? len - 1 : 0, &cached, &nr) ||
+        memcmp(cached.hash, oid->hash, st->rawsz))
+        return 0;
+    /* the entries it counts must be exactly those under [path] */
+    end = skip_prefix(istate, st->pos, path, len);
+    if (end - st->pos != nr)
+        return 0;
+    st->pos = end;
+    return 1;
+}
+
+/*
+ * Compare the tree [oid] at [path] (the first [len] bytes of a buffer
+ * of [alloc], '/' included) with the entries from st->pos on.
+ */
+static int diff_head(struct status_state *st, const struct object_id *oid,
+                     char **path, size_t *alloc, size_t len)
+{
+    const struct index_state *istate = &st->istate;
+    enum object_type type;
+    size_t size;
+    char *buf = repo_read_object_cached(st->repo, oid, &type, &size, &st->cache);
+
+    if (!buf || type != OBJ_TREE) {
+        ERROR("cannot read tree %s", oid_to_hex(oid));
+        free(buf);
+        return -1;
+    }
+
+    struct tree_desc desc;
+    struct name_entry entry;
+    struct object_id child;
+    int ret;
+
+    init_tree_desc(&desc, buf, size, st->rawsz, 0);
+    while ((ret = tree_desc_next(&desc, &entry)) > 0) {
+        size_t n = len + entry.pathlen;
+        if (n + 2 > *alloc) {
+            size_t a = 2 * *alloc;
+            while (a < n + 2)
+                a *= 2;
+            char *tmp = realloc(*path, a);
+            if (!tmp) {
+                ret = -1;
+                break;
+            }
+            *path = tmp;
+            *alloc = a;
+        }
+        memcpy(*path + len, entry.path, entry.pathlen);
+        oid_set_raw(&child, entry.oid, st->repo->hash_algo);
+
+        if (S_ISDIR_MODE(entry.mode)) {
+            (*path)[n++] = '/';
+            if ((ret = add_until(st, *path, n)) < 0)
+                break;
+            if (!skip_by_cache_tree(st, *path, n, &child) &&
+                (ret = diff_head(st, &child, path, alloc, n)) < 0)
+                break;
+            continue;
+        }
+
+        if ((ret = add_until(st, *path, n)) < 0)
+            break;
+        const struct index_entry *e = st->pos < istate->nr ? &istate->entries[st->pos] : NULL;
+        if (!e || e->pathlen != n || memcmp(e->path, *path, n)) {
+            ret = add_item(st->res, *path, n, 'D', ' ');
+        } else if (index_entry_stage(e)) {
+            /* unmerged: reported from the stages */
+            while (st->pos < istate->nr && istate->entries[st->pos].pathlen == n &&
+                   !memcmp(istate->entries[st->pos].path, *path, n))
+                st->pos++;
+        } else {
+            unsigned mode = index_entry_mode(e);
+            st->pos++;
+            if ((mode ^ entry.mode) & 0170000)
+                ret = add_item(st->res, *path, n, 'T', ' ');
+            else if (mode != entry.mode ||
+                     memcmp(e->ondisk + INDEX_STAT_SIZE, entry.oid, st->rawsz))
+                ret = add_item(st->res, *path, n, 'M', ' ');
+        }
+        if (ret < 0)
+            break;
+    }
+    if (ret < 0)
+        ERROR("cannot compare tree %s", oid_to_hex(oid));
+    free(buf);
+    return ret < 0 ? -1 : 0;
+}
+
+static int diff_head_index(struct status_state *st)
+{
+    struct object_id commit, tree;
+    size_t size, alloc = 256;
+    int ret = -1;
+
+    st->pos = 0;
+    if (repo_resolve_ref(st->repo, "HEAD", &commit) < 0)
+        return add_until(st, NULL, 0);      /* unborn: everything is new */
+
+    void *body = repo_read_object_peeled(st->repo, oid_to_hex(&commit), OBJ_TREE,
+                                         &size, &tree);
+    if (!body) {
+        ERROR("HEAD does not lead to a tree");
+        return -1;
+    }
+    free(body);
+
+    char *path = malloc(alloc);
+    if (path && (skip_by_cache_tree(st, path, 0, &tree) ||
+                 diff_head(st, &tree, &path, &alloc, 0) == 0))
+        ret = add_until(st, NULL, 0);
+    free(path);
+    return ret;
+}
+
+/* One item per unmerged path, coded from the stages it has as git does. */
+static int add_unmerged(struct status_state *st)
+{
+    static const char codes[8][3] = {
+        "", "DD", "AU", "UD", "UA", "DU", "AA", "UU",
+    };
+    const struct index_state *istate = &st->istate;
+
+    for (size_t i = 0; i < istate->nr;) {
+        const struct index_entry *e = &istate->entries[i];
+        unsigned mask = 0;
+        size_t j = i;
+
+        for (; j < istate->nr && istate->entries[j].pathlen == e->pathlen &&
+               !memcmp(istate->entries[j].path, e->path, e->pathlen); j++) {
+            unsigned stage = index_entry_stage(&istate->entries[j]);
+            if (stage)
+                mask |= 1u << (stage - 1);
+        }
+        if (mask && add_item(st->res, e->path, e->pathlen, codes[mask][0], codes[mask][1]) < 0)
+            return -1;
+        i = j;
+    }
+    return 0;
+}
+
+
+/* ---- the index against the worktree ---- */
+
+/*
+ * Whether the file or symlink [path] of [sb] holds the blob of [e].
+ * Returns 1 or 0, or -1 if it cannot be read.
+ */
+static int content_matches(struct status_state *st, struct status_worker *w,
+                           const char *path, const struct stat *sb,
+                           const struct index_entry *e)
+{
+    unsigned char digest[32];
+    char header[32];
+    size_t left = sb->st_size;
+    int fd = -1;
+
+    if (S_ISLNK(sb->st_mode)) {
+        ssize_t n = readlink(path, w->buf, STATUS_HASH_BUFFER);
+        if (n < 0 || (size_t)n == STATUS_HASH_BUFFER)
+            return -1;
+        left = n;
+    } else if ((fd = open(path, O_RDONLY)) < 0) {
+        return -1;
+    }
+    if (hash_init(&w->ctx, st->repo->hash_algo) < 0 ||
+        hash_update(&w->ctx, header,
+                    snprintf(header, sizeof(header), "blob %zu", left) + 1) < 0) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if (fd < 0) {
+        if (hash_update(&w->ctx, w->buf, left) < 0)
+            return -1;
+        left = 0;
+    }
+    while (left) {
+        ssize_t n = read(fd, w->buf, left < STATUS_HASH_BUFFER ? left : STATUS_HASH_BUFFER);
+        if (n <= 0 || hash_update(&w->ctx, w->buf, n) < 0)
+            break;
+        left -= n;
+    }
+    if (fd >= 0)
+        close(fd);
+    /* a file still growing is changed all the same */
+    if (left || hash_final(&w->ctx, digest) < 0)
+        return 0;
+    return !memcmp(digest, e->ondisk + INDEX_STAT_SIZE, st->rawsz);
+}
+
+static int same_stat(const struct index_stat *a, const struct index_stat *b)
+{
+    return a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec &&
+           a->ctime_sec == b->ctime_sec && a->ctime_nsec == b->ctime_nsec &&
+           a->ino == b->ino && a->uid == b->uid && a->gid == b->gid &&
+           a->size == b->size;
+}
+
+static char check_entry(struct status_state *st, struct status_worker *w, size_t pos)
+{
+    const struct index_entry *e = &st->istate.entries[pos];
+    unsigned mode = index_entry_mode(e), wt_mode;
+    struct index_stat cached, current;
+    struct stat sb;
+    const char *path;
+
+    if (index_entry_stage(e) ||
+        (e->flags & (INDEX_ENTRY_SKIP_WORKTREE | INDEX_ENTRY_ASSUME_VALID)))
+        return ' ';
+    if (!(path = worker_path(st, w, e->path, e->pathlen)))
+        return ' ';
+    if (lstat(path, &sb))
+        return 'D';
+    if (e->flags & INDEX_ENTRY_INTENT_TO_ADD)
+        return 'A';
+    if (S_ISGITLINK_MODE(mode))
+        return S_ISDIR(sb.st_mode) ? ' ' : 'T';
+    if (S_ISDIR(sb.st_mode))
+        return 'D';
+    wt_mode = index_mode_from_stat(sb.st_mode);
+    if (wt_mode != mode)
+        return (wt_mode ^ mode) & 0170000 ? 'T' : 'M';
+
+    index_entry_stat(e, &cached);
+    index_stat_from(&current, &sb);
+    if (same_stat(&cached, &current)) {
+        if (!index_entry_is_racy(&st->istate, e))
+            return ' ';
+    } else if (cached.size && cached.size != current.size) {
+        return 'M';
+    }
+
+    w->nr_hashed++;
+    if (content_matches(st, w, path, &sb, e) != 1)
+        return 'M';
+    if (w->nr_refresh == w->alloc_refresh) {
+        size_t alloc = w->alloc_refresh ? 2 * w->alloc_refresh : 64;
+        struct status_refresh *tmp = realloc(w->refresh, alloc * sizeof(*tmp));
+        if (!tmp)
+            return ' ';         /* unchanged all the same */
+        w->refresh = tmp;
+        w->alloc_refresh = alloc;
+    }
+    w->refresh[w->nr_refresh].pos = pos;
+    w->refresh[w->nr_refresh].st = current;
+    w->nr_refresh++;
+    return ' ';
+}
+
+static void check_one(void *data, size_t i, int worker)
+{
+    struct status_state *st = data;
+    st->worktree_status[i] = check_entry(st, &st->workers[worker], i);
+}
+
+static int diff_index_worktree(struct status_state *st)
+{
+    struct index_state *istate = &st->istate;
+    struct status_result *res = st->res;
+
+    if (istate->nr && !(st->worktree_status = malloc(istate->nr)))
+        return -1;
+    thread_pool_for(st->pool, istate->nr, STATUS_LSTAT_CHUNK, check_one, st);
+
+    for (int i = 0; i < st->nr_workers; i++) {
+        struct status_worker *w = &st->workers[i];
+        if (w->failed)
+            return -1;
+        res->nr_hashed += w->nr_hashed;
+        for (size_t j = 0; j < w->nr_refresh; j++)
+            index_set_stat(istate, w->refresh[j].pos, &w->refresh[j].st);
+        res->nr_refreshed += w->nr_refresh;
+    }
+    for (size_t i = 0; i < istate->nr; i++) {
+        const struct index_entry *e = &istate->entries[i];
+        if (st->worktree_status[i] != ' ' &&
+            add_item(res, e->path, e->pathlen, ' ', st->worktree_status[i]) < 0)
+            return -1;
+    }
+    /* opportunistic, as in git: a locked index is left alone */
+    if (res->nr_refreshed && !st->opts->no_refresh)
+        repo_write_index(st->repo, istate);
+    return 0;
+}
+
+
+/* ---- ignore rules ---- */
+
+#define PATTERN_NEGATIVE    (1u << 0)
+#define PATTERN_DIR_ONLY    (1u << 1)
+#define PATTERN_BASENAME    (1u << 2)   /* no '/': matched against the last component */
+
+struct ignore_pattern {
+    const char *pattern;
+    unsigned flags;
+};
+
+/*
+ * The patterns of one exclude file. Paths are matched relative to the
+ * directory holding it, the first [baselen] bytes of theirs; [parent]
+ * is the file of the directory above, which has less say.
+ */
+struct ignore_list {
+    const struct ignore_list *parent;
+    size_t baselen;
+    char *buf;
+    struct ignore_pattern *patterns;
+    size_t nr;
+};
+
+static void ignore_list_free(struct ignore_list *list)
+{
+    if (!list)
+        return;
+    free(list->patterns);
+    free(list->buf);
+    free(list);
+}
+
+/* Match the bracket expression at *pp (past its '[') and move past its ']'. */
+static int match_bracket(const char **pp, unsigned char c)
+{
+    static const struct {
+        const char *name;
+        int (*fn)(int);
+    } classes[] = {
+        { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+        { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+        { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+        { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    };
+    const char *p = *pp;
+    int negate = 0, matched = 0;
+
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+    if (*p == ']') {
+        matched = c == ']';
+        p++;
+    }
+    while (*p && *p != ']') {
+        if (p[0] == '[' && p[1] == ':') {
+            const char *end = strstr(p + 2, ":]");
+            if (!end)
+                return -1;
+            for (size_t i = 0; i < sizeof(classes) / sizeof(*classes); i++)
+                if (strlen(classes[i].name) == (size_t)(end - p - 2) &&
+                    !memcmp(classes[i].name, p + 2, end - p - 2) && classes[i].fn(c))
+                    matched = 1;
+            p = end + 2;
+            continue;
+        }
+        unsigned char lo = *p, hi;
+        if (lo == '\\' && p[1])
+            lo = *++p;
+        p++;
+        hi = lo;
+        if (p[0] == '-' && p[1] && p[1] != ']') {
+            hi = *++p;
+            if (hi == '\\' && p[1])
+                hi = *++p;
+            p++;
+        }
+        if (lo <= c && c <= hi)
+            matched = 1;
+    }
+    if (!*p)
+        return -1;
+    *pp = p + 1;
+    return matched != negate;
+}
+
+/*
+ * Match [t] against the glob [p] (part of [pat]) as git's wildmatch()
+ * does: with [pathname], '*', '?' and brackets never match '/' and
+ * "**" as a whole component matches any number of directories.
+ */
+static int wildmatch(const char *pat, const char *p, const char *t, int pathname)
+{
+    for (; *p; p++, t++) {
+        switch (*p) {
+        case '?':
+            if (!*t || (pathname && *t == '/'))
+                return 0;
+            break;
+        case '[': {
+            const char *q = p + 1;
+            int r;
+            if (!*t || (pathname && *t == '/'))
+                return 0;
+            if ((r = match_bracket(&q, *t)) < 0) {
+                if (*t != '[')      /* no closing ']': a plain '[' */
+                    return 0;
+                break;
+            }
+            if (!r)
+                return 0;
+            p = q - 1;
+            break;
+        }
+        case '*':
+            if (pathname && p[1] == '*' && (p == pat || p[-1] == '/') &&
+                (!p[2] || p[2] == '/')) {
+                if (!p[2])
+                    return 1;
+                /* "**<slash>": zero or more leading directories */
+                for (;;) {
+                    if (wildmatch(pat, p + 3, t, pathname))
+                        return 1;
+                    if (!(t = strchr(t, '/')))
+                        return 0;
+                    t++;
+                }
+            }
+            while (p[1] == '*')
+                p++;
+            if (!p[1])
+                return !pathname || !strchr(t, '/');
+            for (;; t++) {
+                if (wildmatch(pat, p + 1, t, pathname))
+                    return 1;
+                if (!*t || (pathname && *t == '/'))
+                    return 0;
+            }
+        case '\\':
+            if (p[1])
+                p++;
+            /* fallthrough */
+        default:
+            if (*t != *p)
+                return 0;
+            break;
+        }
+    }
+    return !*t;
+}
+
+/*
+ * Parse the exclude file [path] (its directory is the first [baselen]
+ * bytes of the paths it applies to). Returns NULL if there is no such
+ * file or it has no patterns.
+ */
+static struct ignore_list *ignore_list_load(const char *path, size_t baselen,
+                                            const struct ignore_list *parent)
+{
+    struct ignore_list *list;
+    struct stat sb;
+    size_t alloc = 0;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &sb) || !S_ISREG(sb.st_mode) || !sb.st_size ||
+        !(list = calloc(1, sizeof(*list)))) {
+        close(fd);
+        return NULL;
+    }
+    list->parent = parent;
+    list->baselen = baselen;
+    if (!(list->buf = malloc(sb.st_size + 1)) ||
+        read(fd, list->buf, sb.st_size) != sb.st_size) {
+        close(fd);
+        ignore_list_free(list);
+        return NULL;
+    }
+    close(fd);
+    list->buf[sb.st_size] = '\0';
+
+    for (char *line = list->buf, *next; *line; line = next) {
+        char *nl = strchr(line, '\n');
+        size_t len = nl ? (size_t)(nl - line) : strlen(line);
+        unsigned flags = 0;
+
+        next = nl ? nl + 1 : line + len;
+        /* trailing spaces go unless escaped */
+        while (len && line[len - 1] == ' ' && !(len > 1 && line[len - 2] == '\\'))
+            len--;
+        line[len] = '\0';
+        if (!len || *line == '#')
+            continue;
+        if (*line == '!') {
+            flags |= PATTERN_NEGATIVE;
+            line++;
+            len--;
+        }
+        if (len && line[len - 1] == '/') {
+            flags |= PATTERN_DIR_ONLY;
+            line[--len] = '\0';
+        }
+        if (!memchr(line, '/', len))
+            flags |= PATTERN_BASENAME;
+        else if (*line == '/')
+            line++;
+        if (!*line)
+            continue;
+
+        if (list->nr == alloc) {
+            alloc = alloc ? 2 * alloc : 16;
+            struct ignore_pattern *tmp = realloc(list->patterns, alloc * sizeof(*tmp));
+            if (!tmp)
+                break;
+            list->patterns = tmp;
+        }
+        list->patterns[list->nr].pattern = line;
+        list->patterns[list->nr].flags = flags;
+        list->nr++;
+    }
+    if (!list->nr) {
+        ignore_list_free(list);
+        return NULL;
+    }
+    return list;
+}
+
+/*
+ * Whether [path] (relative to the worktree) is ignored: the last
+ * pattern matching it in the deepest file that has one decides.
+ */
+static int is_ignored(const struct ignore_list *list, const char *path, int is_dir)
+{
+    const char *slash = strrchr(path, '/');
+    const char *base = slash ? slash + 1 : path;
+
+    for (; list; list = list->parent) {
+        for (size_t i = list->nr; i-- > 0;) {
+            const struct ignore_pattern *p = &list->patterns[i];
+            if ((p->flags & PATTERN_DIR_ONLY) && !is_dir)
+                continue;
+            if (p->flags & PATTERN_BASENAME ? wildmatch(p->pattern, p->pattern, base, 0)
+                                            : wildmatch(p->pattern, p->pattern,
+                                                        path + list->baselen, 1))
+                return !(p->flags & PATTERN_NEGATIVE);
+        }
+    }
+    return 0;
+}
+
+
+/* ---- directory cache ---- */
+
+/*
+ * <gitdir>/status-cache: "NSC1", the worktree path and a NUL, the
+ * number of directories, then for each, sorted by path:
+ *
+ *   mtime seconds, nanoseconds, tracked-name hash (2 words),
+ *   listing length            32-bit big-endian words
+ *   path                      NUL-terminated, "" for the top
+ *   listing                   ('d' or 'f', name, NUL) per entry
+ *
+ * and the hash of all that, as the index ends.
+ * A listing holds the subdirectories and the untracked files of a
+ * directory; the tracked-name hash covers the files the index had in
+ * it, so that a path added to or removed from the index invalidates it.
+ */
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* The trailing checksum of [len] bytes of status-cache. */
+static int dir_cache_checksum(const struct status_state *st, const void *data, size_t len,
+                              unsigned char *out)
+{
+    struct hash_ctx ctx = HASH_CTX_INIT;
+    int ret = hash_init(&ctx, st->repo->hash_algo) < 0 ||
+              hash_update(&ctx, data, len) < 0 || hash_final(&ctx, out) < 0 ? -1 : 0;
+
+    hash_ctx_release(&ctx);
+    return ret;
+}
+
+static void dir_cache_load(struct status_state *st)
+{
+    struct dir_cache *c = &st->dir_cache;
+    char *path = NULL;
+    struct stat sb;
+    int fd = -1;
+
+    if (asprintf(&path, "%s/%s", st->repo->gitdir, STATUS_CACHE_FILE) < 0)
+        return;
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0)
+        return;
+    if (fstat(fd, &sb) || !(c->buf = malloc(sb.st_size + 1)) ||
+        read(fd, c->buf, sb.st_size) != sb.st_size)
+        goto fail;
+    close(fd);
+    fd = -1;
+
+    const unsigned char *p = (const unsigned char *)c->buf;
+    const unsigned char *end;
+    unsigned char digest[32];
+    size_t n = strlen(st->worktree) + 1;
+    uint32_t nr;
+
+    if ((size_t)sb.st_size < 4 + n + 4 + st->rawsz)
+        goto fail;
+    end = p + sb.st_size - st->rawsz;
+    if (dir_cache_checksum(st, p, end - p, digest) < 0 || memcmp(digest, end, st->rawsz) ||
+        memcmp(p, STATUS_CACHE_MAGIC, 4) || memcmp(p + 4, st->worktree, n))
+        goto fail;
+    p += 4 + n;
+    nr = index_get_be32(p);
+    p += 4;
+    if (nr > (size_t)(end - p) / 21 ||
+        (nr && !(c->entries = calloc(nr, sizeof(*c->entries)))))
+        goto fail;
+
+    for (; c->nr < nr; c->nr++) {
+        struct dir_cache_entry *d = &c->entries[c->nr];
+        const unsigned char *nul;
+
+        if (end - p < 20)
+            goto fail;
+        d->mtime_sec = index_get_be32(p);
+        d->mtime_nsec = index_get_be32(p + 4);
+        d->tracked = (uint64_t)index_get_be32(p + 8) << 32 | index_get_be32(p + 12);
+        d->names_len = index_get_be32(p + 16);
+        p += 20;
+        if (!(nul = memchr(p, '\0', end - p)))
+            goto fail;
+        d->path = (const char *)p;
+        p = nul + 1;
+        if ((size_t)(end - p) < d->names_len ||
+            (d->names_len && p[d->names_len - 1]) ||
+            (c->nr && strcmp(c->entries[c->nr - 1].path, d->path) >= 0))
+            goto fail;
+        d->names = (const char *)p;
+        p += d->names_len;
+    }
+    if (p == end)
+        return;
+fail:
+    WARN("ignoring a malformed %s", STATUS_CACHE_FILE);
+    if (fd >= 0)
+        close(fd);
+    free(c->entries);
+    free(c->buf);
+    memset(c, 0, sizeof(*c));
+}
+
+static const struct dir_cache_entry *dir_cache_find(const struct dir_cache *c,
+                                                    const char *path)
+{
+    size_t lo = 0, hi = c->nr;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(c->entries[mid].path, path);
+        if (!cmp)
+            return &c->entries[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+static void dir_cache_clear(struct dir_cache *c)
+{
+    free(c->entries);
+    free(c->buf);
+    memset(c, 0, sizeof(*c));
+}
+
+
+/* ---- untracked files ---- */
+
+/* A directory of the walk. */
+struct walk_dir {
+    char *path;                 /* relative, "" for the top */
+    size_t len;
+    int untracked;              /* not in the index at all (-uall) */
+    const struct ignore_list *ignore;   /* in force inside it */
+    struct ignore_list *own;            /* its .gitignore */
+
+    /* listing, from the cache or read now ([names] is then owned) */
+    const char *listing;
+    size_t listing_len;
+    char *names;
+    uint32_t mtime_sec, mtime_nsec;
+    uint64_t tracked;
+    int visited, from_cache, cacheable;
+
+    struct walk_dir **subdirs;
+    size_t nr_subdirs, alloc_subdirs;
+    char **found;
+    size_t nr_found, alloc_found;
+};
+
+static void walk_dir_free(struct walk_dir *d)
+{
+    for (size_t i = 0; i < d->nr_found; i++)
+        free(d->found[i]);
+    free(d->found);
+    /* those not handed to the next level yet */
+    for (size_t i = 0; i < d->nr_subdirs; i++)
+        walk_dir_free(d->subdirs[i]);
+    free(d->subdirs);
+    ignore_list_free(d->own);
+    free(d->names);
+    free(d->path);
+    free(d);
+}
+
+static int add_found(struct walk_dir *d, const char *path, int is_dir)
+{
+    if (d->nr_found == d->alloc_found) {
+        size_t alloc = d->alloc_found ? 2 * d->alloc_found : 8;
+        char **tmp = realloc(d->found, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        d->found = tmp;
+        d->alloc_found = alloc;
+    }
+    size_t len = strlen(path);
+    char *copy = malloc(len + 2);
+    if (!copy)
+        return -1;
+    memcpy(copy, path, len);
+    copy[len] = '/';
+    copy[len + is_dir] = '\0';
+    d->found[d->nr_found++] = copy;
+    return 0;
+}
+
+static int add_subdir(struct walk_dir *d, const char *path, int untracked)
+{
+    struct walk_dir *sub;
+
+    if (d->nr_subdirs == d->alloc_subdirs) {
+        size_t alloc = d->alloc_subdirs ? 2 * d->alloc_subdirs : 8;
+        struct walk_dir **tmp = realloc(d->subdirs, alloc * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        d->subdirs = tmp;
+        d->alloc_subdirs = alloc;
+    }
+    if (!(sub = calloc(1, sizeof(*sub))) || !(sub->path = strdup(path))) {
+        free(sub);
+        return -1;
+    }
+    sub->len = strlen(path);
+    sub->untracked = untracked;
+    sub->ignore = d->ignore;
+    d->subdirs[d->nr_subdirs++] = sub;
+    return 0;
+}
+
+/* [rel]/[name] (just [name] at the top) in a new string. */
+static char *join_rel(const char *rel, size_t len, const char *name)
+{
+    char *path = NULL;
+    if (asprintf(&path, "%.*s%s%s", (int)len, rel, len ? "/" : "", name) < 0)
+        return NULL;
+    return path;
+}
+
+static int entry_is_dir(const struct dirent *de, const char *dir, const char *name)
+{
+    struct stat sb;
+    char *path;
+    int ret;
+
+    if (de->d_type != DT_UNKNOWN)
+        return de->d_type == DT_DIR;
+    if (asprintf(&path, "%s/%s", dir, name) < 0)
+        return 0;
+    ret = !lstat(path, &sb) && S_ISDIR(sb.st_mode);
+    free(path);
+    return ret;
+}
+
+/* Hash of the names of the files the index has directly in [d]. */
+static uint64_t tracked_names(const struct status_state *st, const struct walk_dir *d)
+{
+    const struct index_state *istate = &st->istate;
+    char *prefix = join_rel(d->path, d->len, "");
+    size_t len = d->len + !!d->len, i;
+    uint64_t h = FNV_OFFSET;
+
+    if (!prefix)
+        return 0;
+    i = prefix_pos(istate, prefix, len);
+    while (i < istate->nr) {
+        const struct index_entry *e = &istate->entries[i];
+        if (e->pathlen <= len || memcmp(e->path, prefix, len))
+            break;
+        const char *slash = memchr(e->path + len, '/', e->pathlen - len);
+        if (slash) {
+            i = skip_prefix(istate, i, e->path, slash - e->path + 1);
+            continue;
+        }
+        for (const char *p = e->path + len; p <= e->path + e->pathlen; p++)
+            h = (h ^ (unsigned char)*p) * FNV_PRIME;
+        i++;
+    }
+    free(prefix);
+    return h;
+}
+
+/*
+ * Read the listing of [d] from [full]: every subdirectory, and the
+ * files the index does not have.
+ */
+static int read_listing(struct status_state *st, struct walk_dir *d, const char *full)
+{
+    DIR *dir = opendir(full);
+    struct dirent *de;
+    size_t alloc = 0, len = 0;
+    int ret = 0;
+
+    if (!dir)
+        return -1;
+    while ((de = readdir(dir))) {
+        const char *name = de->d_name;
+        size_t n = strlen(name);
+        int is_dir;
+
+        if (!strcmp(name, ".") || !strcmp(name, ".."))
+            continue;
+        is_dir = entry_is_dir(de, full, name);
+        if (!is_dir && !d->untracked) {
+            char *rel = join_rel(d->path, d->len, name);
+            int tracked = rel && find_path(&st->istate, rel, strlen(rel));
+            free(rel);
+            if (tracked)
+                continue;
+        }
+        if (len + n + 2 > alloc) {
+            alloc = alloc ? 2 * alloc : 256;
+            while (len + n + 2 > alloc)
+                alloc *= 2;
+            char *tmp = realloc(d->names, alloc);
+            if (!tmp) {
+                ret = -1;
+                break;
+            }
+            d->names = tmp;
+        }
+        d->names[len++] = is_dir ? 'd' : 'f';
+        memcpy(d->names + len, name, n + 1);
+        len += n + 1;
+    }
+    closedir(dir);
+    d->listing = d->names;
+    d->listing_len = len;
+    return ret;
+}
+
+/*
+ * Whether the untracked directory [rel] holds a file that is not
+ * ignored, as it is then shown as "<rel>/".
+ */
+static int has_untracked(struct status_state *st, const char *rel,
+                         const struct ignore_list *parent)
+{
+    char *full = NULL, *exclude = NULL;
+    struct ignore_list *own = NULL;
+    struct dirent *de;
+    DIR *dir;
+    int found = 0;
+
+    if (asprintf(&full, "%s/%s", st->worktree, rel) < 0)
+        return 0;
+    if (!(dir = opendir(full))) {
+        free(full);
+        return 0;
+    }
+    if (asprintf(&exclude, "%s/.gitignore", full) >= 0)
+        own = ignore_list_load(exclude, strlen(rel) + 1, parent);
+    free(exclude);
+
+    while (!found && (de = readdir(dir))) {
+        const char *name = de->d_name;
+        if (!strcmp(name, ".") || !strcmp(name, ".."))
+            continue;
+        if (!strcmp(name, ".git")) {
+            found = 1;          /* a repository of its own */
+            break;
+        }
+        char *child = join_rel(rel, strlen(rel), name);
+        if (!child)
+            break;
+        int is_dir = entry_is_dir(de, full, name);
+        if (!is_ignored(own ? own : parent, child, is_dir))
+            found = !is_dir || has_untracked(st, child, own ? own : parent);
+        free(child);
+    }
+    closedir(dir);
+    ignore_list_free(own);
+    free(full);
+    return found;
+}
+
+static int walk_entry(struct status_state *st, struct walk_dir *d,
+                      const char *name, int is_dir)
+{
+    const struct index_state *istate = &st->istate;
+    char *rel = join_rel(d->path, d->len, name);
+    size_t len;
+    int ret = 0;
+
+    if (!rel)
+        return -1;
+    len = strlen(rel);
+    if (!is_dir) {
+        /* a listing only has untracked files */
+        if (!is_ignored(d->ignore, rel, 0))
+            ret = add_found(d, rel, 0);
+        free(rel);
+        return ret;
+    }
+
+    const struct index_entry *e = NULL;
+    if (!d->untracked) {
+        /*
+         * A submodule, or a file of the index that is now a directory:
+         * as in git, "<rel>/" is never shown then, only what it holds
+         * with -uall.
+         */
+        e = find_path(istate, rel, len);
+        if (e && (S_ISGITLINK_MODE(index_entry_mode(e)) ||
+                  st->opts->untracked != STATUS_UNTRACKED_ALL))
+            goto out;
+        rel[len] = '/';
+        int tracked = has_prefix(istate, rel, len + 1);
+        rel[len] = '\0';
+        if (tracked) {
+            /* nothing untracked is shown under an ignored directory */
+            if (!is_ignored(d->ignore, rel, 1))
+                ret = add_subdir(d, rel, 0);
+            goto out;
+        }
+    }
+    if (is_ignored(d->ignore, rel, 1))
+        goto out;
+
+    char *git = NULL;
+    struct stat sb;
+    int nested = asprintf(&git, "%s/%s/.git", st->worktree, rel) >= 0 && !lstat(git, &sb);
+    free(git);
+    if (nested) {
+        if (!e)
+            ret = add_found(d, rel, 1);
+    }
+    else if (st->opts->untracked == STATUS_UNTRACKED_ALL)
+        ret = add_subdir(d, rel, 1);
+    else if (has_untracked(st, rel, d->ignore))
+        ret = add_found(d, rel, 1);
+out:
+    free(rel);
+    return ret;
+}
+
+static void walk_one(void *data, size_t i, int worker)
+{
+    struct status_state *st = data;
+    struct status_worker *w = &st->workers[worker];
+    struct walk_dir *d = st->level[i];
+    const struct dir_cache_entry *cached;
+    const char *full = worker_path(st, w, d->path, d->len);
+    struct stat sb;
+
+    if (!full || lstat(full, &sb) || !S_ISDIR(sb.st_mode))
+        return;
+    d->visited = 1;
+    d->mtime_sec = sb.st_mtim.tv_sec;
+    d->mtime_nsec = sb.st_mtim.tv_nsec;
+    d->tracked = d->untracked ? 0 : tracked_names(st, d);
+
+    cached = dir_cache_find(&st->dir_cache, d->path);
+    if (cached && cached->mtime_sec == d->mtime_sec &&
+        cached->mtime_nsec == d->mtime_nsec && cached->tracked == d->tracked) {
+        d->listing = cached->names;
+        d->listing_len = cached->names_len;
+        d->from_cache = d->cacheable = 1;
+    } else {
+        if (read_listing(st, d, full) < 0) {
+            w->failed = 1;
+            return;
+        }
+        d->cacheable = sb.st_mtim.tv_sec < st->start;
+    }
+
+    /* its .gitignore: tracked, or in the listing */
+    int has_exclude = 0;
+    for (const char *p = d->listing; p < d->listing + d->listing_len; p += strlen(p) + 1)
+        if (!strcmp(p, "f.gitignore"))
+            has_exclude = 1;
+    if (!has_exclude && !d->untracked) {
+        char *rel = join_rel(d->path, d->len, ".gitignore");
+        has_exclude = rel && find_path(&st->istate, rel, strlen(rel));
+        free(rel);
+    }
+    if (has_exclude && worker_path(st, w, d->path, d->len)) {
+        char *exclude = NULL;
+        if (asprintf(&exclude, "%s/.gitignore", w->path) >= 0 &&
+            (d->own = ignore_list_load(exclude, d->len + !!d->len, d->ignore)))
+            d->ignore = d->own;
+        free(exclude);
+    }
+
+    for (const char *p = d->listing; p < d->listing + d->listing_len; p += strlen(p) + 1) {
+        if (!strcmp(p + 1, ".git"))
+            continue;
+        if (walk_entry(st, d, p + 1, *p == 'd') < 0) {
+            w->failed = 1;
+            return;
+        }
+    }
+}
+
+static int walk_dir_cmp(const void *a, const void *b)
+{
+    return strcmp((*(struct walk_dir *const *)a)->path, (*(struct walk_dir *const *)b)->path);
+}
+
+static int str_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Write the listings of [dirs] (sorted) to status-cache, if they changed. */
+static void dir_cache_write(struct status_state *st, struct walk_dir **dirs, size_t nr)
+{
+    size_t nr_cached = 0, size;
+    int changed = 0;
+
+    for (size_t i = 0; i < nr; i++) {
+        if (!dirs[i]->visited || !dirs[i]->cacheable)
+            continue;
+        nr_cached++;
+        changed |= !dirs[i]->from_cache;
+    }
+    if (!changed && nr_cached == st->dir_cache.nr)
+        return;
+
+    size = 4 + st->worktree_len + 1 + 4 + st->rawsz;
+    for (size_t i = 0; i < nr; i++)
+        if (dirs[i]->visited && dirs[i]->cacheable)
+            size += 20 + dirs[i]->len + 1 + dirs[i]->listing_len;
+
+    unsigned char *buf = malloc(size), *p = buf;
+    char *path = NULL, *lock = NULL;
+    if (!buf || asprintf(&path, "%s/%s", st->repo->gitdir, STATUS_CACHE_FILE) < 0 ||
+        asprintf(&lock, "%s.lock", path) < 0)
+        goto out;
+
+    memcpy(p, STATUS_CACHE_MAGIC, 4);
+    memcpy(p + 4, st->worktree, st->worktree_len + 1);
+    p += 4 + st->worktree_len + 1;
+    put_be32(p, nr_cached);
+    p += 4;
+    for (size_t i = 0; i < nr; i++) {
+        const struct walk_dir *d = dirs[i];
+        if (!d->visited || !d->cacheable)
+            continue;
+        put_be32(p, d->mtime_sec);
+        put_be32(p + 4, d->mtime_nsec);
+        put_be32(p + 8, d->tracked >> 32);
+        put_be32(p + 12, (uint32_t)d->tracked);
+        put_be32(p + 16, d->listing_len);
+        p += 20;
+        memcpy(p, d->path, d->len + 1);
+        p += d->len + 1;
+        if (d->listing_len)
+            memcpy(p, d->listing, d->listing_len);
+        p += d->listing_len;
+    }
+    if (dir_cache_checksum(st, buf, p - buf, p) < 0)
+        goto out;
+
+    /* best effort: another status may be writing it */
+    int fd = open(lock, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd < 0)
+        goto out;
+    int ok = write(fd, buf, size) == (ssize_t)size;
+    if (close(fd) || !ok || rename(lock, path))
+        unlink(lock);
+out:
+    free(lock);
+    free(path);
+    free(buf);
+}
+
+static int find_untracked(struct status_state *st)
+{
+    struct status_result *res = st->res;
+    struct walk_dir **all = NULL, *top;
+    struct ignore_list *info = NULL;
+    size_t nr_all = 0, alloc_all = 0, start = 0;
+    char *exclude = NULL;
+    int ret = 0;
+
+    if (!st->opts->no_dir_cache)
+        dir_cache_load(st);
+    if (asprintf(&exclude, "%s/info/exclude", st->repo->gitdir) >= 0)
+        info = ignore_list_load(exclude, 0, NULL);
+    free(exclude);
+
+    if (!(top = calloc(1, sizeof(*top))) || !(top->path = strdup(""))) {
+        free(top);
+        ret = -1;
+        goto out;
+    }
+    top->ignore = info;
+    all = malloc(sizeof(*all));
+    if (!all) {
+        walk_dir_free(top);
+        ret = -1;
+        goto out;
+    }
+    all[nr_all++] = top;
+    alloc_all = 1;
+
+    /* one level at a time: all[start, nr_all) */
+    while (start < nr_all) {
+        size_t end = nr_all;
+
+        st->level = all + start;
+        thread_pool_for(st->pool, end - start, 1, walk_one, st);
+        for (int i = 0; i < st->nr_workers; i++)
+            if (st->workers[i].failed)
+                ret = -1;
+        for (size_t i = start; i < end && !ret; i++) {
+            struct walk_dir *d = all[i];
+            if (nr_all + d->nr_subdirs > alloc_all) {
+                size_t alloc = 2 * alloc_all;
+                while (alloc < nr_all + d->nr_subdirs)
+                    alloc *= 2;
+                struct walk_dir **tmp = realloc(all, alloc * sizeof(*tmp));
+                if (!tmp) {
+                    ret = -1;
+                    break;
+                }
+                all = tmp;
+                alloc_all = alloc;
+            }
+            if (d->nr_subdirs)
+                memcpy(all + nr_all, d->subdirs, d->nr_subdirs * sizeof(*all));
+            nr_all += d->nr_subdirs;
+            d->nr_subdirs = 0;
+            res->nr_dirs += d->visited;
+            res->nr_dirs_cached += d->from_cache;
+        }
+        if (ret)
+            break;
+        start = end;
+    }
+
+    for (size_t i = 0; i < nr_all && !ret; i++) {
+        struct walk_dir *d = all[i];
+        if (res->nr_untracked + d->nr_found > res->alloc_untracked) {
+            size_t alloc = res->alloc_untracked ? 2 * res->alloc_untracked : 64;
+            while (alloc < res->nr_untracked + d->nr_found)
+                alloc *= 2;
+            char **tmp = realloc(res->untracked, alloc * sizeof(*tmp));
+            if (!tmp) {
+                ret = -1;
+                break;
+            }
+            res->untracked = tmp;
+            res->alloc_untracked = alloc;
+        }
+        if (d->nr_found)
+            memcpy(res->untracked + res->nr_untracked, d->found,
+                   d->nr_found * sizeof(char *));
+        res->nr_untracked += d->nr_found;
+        d->nr_found = 0;
+    }
+    if (res->nr_untracked)
+        qsort(res->untracked, res->nr_untracked, sizeof(char *), str_cmp);
+
+    if (!ret && !st->opts->no_dir_cache) {
+        qsort(all, nr_all, sizeof(*all), walk_dir_cmp);
+        dir_cache_write(st, all, nr_all);
+    }
+out:
+    for (size_t i = 0; i < nr_all; i++)
+        walk_dir_free(all[i]);
+    free(all);
+    ignore_list_free(info);
+    dir_cache_clear(&st->dir_cache);
+    return ret;
+}
+
+
+/* ---- driver ---- */
+
+static int item_cmp(const void *a, const void *b)
+{
+    const struct status_item *x = a, *y = b;
+    return strcmp(x->path, y->path);
+}
+
+/* Sort the items and merge the two columns of each path into one item. */
+static void merge_items(struct status_result *res)
+{
+    size_t out = 0;
+
+    if (res->nr)
+        qsort(res->items, res->nr, sizeof(*res->items), item_cmp);
+    for (size_t i = 0; i < res->nr; i++) {
+        struct status_item *item = &res->items[i];
+        if (out && !strcmp(res->items[out - 1].path, item->path)) {
+            struct status_item *prev = &res->items[out - 1];
+            if (item->index_status != ' ')
+                prev->index_status = item->index_status;
+            if (item->worktree_status != ' ')
+                prev->worktree_status = item->worktree_status;
+            free(item->path);
+            continue;
+        }
+        res->items[out++] = *item;
+    }
+    res->nr = out;
+}
+
+int status_collect(struct repository *repo, const struct status_options *opts,
+                   struct status_result *res)
+{
+    struct status_state st = { 0 };
+    double t;
+    int ret = -1;
+
+    memset(res, 0, sizeof(*res));
+    st.repo = repo;
+    st.opts = opts;
+    st.res = res;
+    st.rawsz = hash_algo_rawsz(repo->hash_algo);
+    st.worktree = repo->worktree;
+    st.worktree_len = strlen(repo->worktree);
+    st.start = time(NULL);
+    delta_base_cache_init(&st.cache, DELTA_CACHE_WORKER_BYTES);
+
+    if (repo_read_index(repo, &st.istate, 0) < 0)
+        goto out;
+    res->nr_entries = st.istate.nr;
+    if (!(st.pool = thread_pool_create(opts->nr_threads)))
+        goto out;
+    st.nr_workers = thread_pool_nr_threads(st.pool);
+    if (!(st.workers = calloc(st.nr_workers, sizeof(*st.workers))))
+        goto out;
+    for (int i = 0; i < st.nr_workers; i++)
+        if (!(st.workers[i].buf = malloc(STATUS_HASH_BUFFER)))
+            goto out;
+
+    t = monotonic_seconds();
+    if (diff_head_index(&st) < 0 || add_unmerged(&st) < 0)
+        goto out;
+    res->head_seconds = monotonic_seconds() - t;
+
+    t = monotonic_seconds();
+    if (diff_index_worktree(&st) < 0)
+        goto out;
+    res->lstat_seconds = monotonic_seconds() - t;
+
+    t = monotonic_seconds();
+    if (opts->untracked != STATUS_UNTRACKED_NO && find_untracked(&st) < 0)
+        goto out;
+    res->untracked_seconds = monotonic_seconds() - t;
+
+    merge_items(res);
+    ret = 0;
+out:
+    if (st.workers) {
+        for (int i = 0; i < st.nr_workers; i++) {
+            hash_ctx_release(&st.workers[i].ctx);
+            free(st.workers[i].buf);
+            free(st.workers[i].path);
+            free(st.workers[i].refresh);
+        }
+        free(st.workers);
+    }
+    if (st.pool)
+        thread_pool_destroy(st.pool);
+    free(st.worktree_status);
+    delta_base_cache_clear(&st.cache);
+    index_clear(&st.istate);
+    if (ret < 0)
+        status_result_clear(res);
+    return ret;
+}
+
+void status_result_clear(struct status_result *res)
+{
+    for (size_t i = 0; i < res->nr; i++)
+        free(res->items[i].path);
+    free(res->items);
+    for (size_t i = 0; i < res->nr_untracked; i++)
+        free(res->untracked[i]);
+    free(res->untracked);
+    memset(res, 0, sizeof(*res));
+}
+
+
+/* ---- command ---- */
+
+int cmd_status(int argc, char **argv)
+{
+    static const char usage[] =
+        "usage: status [-v] [-u<mode>] [-j <threads>] [--no-dir-cache] [--no-refresh]\n"
+        "              <gitdir> [<worktree>]\n";
+    struct status_options opts = { 0 };
+    struct status_result res;
+    int verbose = 0, i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "-v"))
+            verbose = 1;
+        else if (!strcmp(arg, "-u") || !strcmp(arg, "-uall"))
+            opts.untracked = STATUS_UNTRACKED_ALL;
+        else if (!strcmp(arg, "-uno"))
+            opts.untracked = STATUS_UNTRACKED_NO;
+        else if (!strcmp(arg, "-unormal"))
+            opts.untracked = STATUS_UNTRACKED_NORMAL;
+        else if (!strcmp(arg, "-j") && i + 1 < argc)
+            opts.nr_threads = atoi(argv[++i]);
+        else if (!strcmp(arg, "--no-dir-cache"))
+            opts.no_dir_cache = 1;
+        else if (!strcmp(arg, "--no-refresh"))
+            opts.no_refresh = 1;
+        else
+            break;
+    }
+    if (argc - i < 1 || argc - i > 2) {
+        fprintf(stderr, "%s", usage);
+        return 128;
+    }
+
+    struct repository repo;
+    if (repo_open(&repo, argv[i]) < 0) {
+        ERROR("%s is not a git directory", argv[i]);
+        return 128;
+    }
+    repo.worktree = argc - i == 2 ? strdup(argv[i + 1]) : repo_default_worktree(argv[i]);
+    if (!repo.worktree) {
+        ERROR("no worktree given and %s is not called .git", argv[i]);
+        repo_clear(&repo);
+        return 128;
+    }
+
+    if (status_collect(&repo, &opts, &res) < 0) {
+        repo_clear(&repo);
+        return 128;
+    }
+    for (size_t j = 0; j < res.nr; j++)
+        printf("%c%c %s\n", res.items[j].index_status, res.items[j].worktree_status,
+               res.items[j].path);
+    for (size_t j = 0; j < res.nr_untracked; j++)
+        printf("?? %s\n", res.untracked[j]);
+    if (verbose)
+        fprintf(stderr,
+                "%zu entries: %zu hashed, %zu refreshed; %zu directories, %zu from the cache\n"
+                "  head       %.3fs\n"
+                "  lstat      %.3fs\n"
+                "  untracked  %.3fs\n",
+                res.nr_entries, res.nr_hashed, res.nr_refreshed, res.nr_dirs,
+                res.nr_dirs_cached, res.head_seconds, res.lstat_seconds,
+                res.untracked_seconds);
+
+    status_result_clear(&res);
+    repo_clear(&repo);
+    return 0;
+}
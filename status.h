@@ -0,0 +1,98 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stddef.h>
+
+struct repository;
+
+/*
+ * The state of the worktree against the index, and of the index
+ * against the tree of HEAD, as "git status --porcelain" reports it.
+ *
+ * HEAD and the index are compared in one merge walk of the tree and
+ * the sorted entries. A directory whose cache-tree id matches the tree
+ * of HEAD is skipped whole, without reading its tree or looking at its
+ * entries, so an unchanged index costs little more than reading the
+ * top-level tree.
+ *
+ * The index and the worktree are compared by a thread pool calling
+ * lstat() on every tracked path. The stat data in the index is trusted
+ * when it matches and the entry is not racy (see index_entry_is_racy()).
+ * A different size is a change without reading the file. Anything else
+ * (a new timestamp, a racy or size-smudged entry) has its content hashed
+ * and compared to the index. Entries found unchanged that way get their
+ * stat data refreshed and the index is written back if it is not locked,
+ * so the next run trusts them again.
+ *
+ * Untracked files are found one directory level at a time. A thread
+ * pool reads all the directories of a level, each against the
+ * .gitignore files above it and <gitdir>/info/exclude, and yields the
+ * tracked subdirectories for the next level. The listing of a
+ * directory is kept in <gitdir>/status-cache, keyed by its mtime and
+ * by the tracked names it holds, and reused while both are unchanged.
+ * A directory changed in the second the walk started is not kept, as a
+ * later change within that second would not move its mtime.
+ *
+ * Not supported: rename detection, submodule contents (a submodule is
+ * unchanged as long as its directory exists), attributes and filters,
+ * core.excludesFile, and a tracked path reached through a symlink.
+ */
+
+enum status_untracked {
+    STATUS_UNTRACKED_NORMAL,    /* untracked directories as "dir/" */
+    STATUS_UNTRACKED_NO,
+    STATUS_UNTRACKED_ALL,       /* every untracked file */
+};
+
+struct status_options {
+    int nr_threads;             /* 0: one per online CPU */
+    enum status_untracked untracked;
+    int no_dir_cache;           /* neither read nor write status-cache */
+    int no_refresh;             /* never write the index back */
+};
+
+/*
+ * A changed path: [index_status] against HEAD and [worktree_status]
+ * against the index, each one of ' ', 'M', 'T', 'A', 'D', or both 'U'
+ * (or 'A', 'D') for an unmerged path, as in the porcelain format.
+ */
+struct status_item {
+    char *path;
+    char index_status, worktree_status;
+};
+
+struct status_result {
+    struct status_item *items;  /* sorted by path */
+    size_t nr, alloc;
+    char **untracked;           /* sorted, directories ending with '/' */
+    size_t nr_untracked, alloc_untracked;
+
+    size_t nr_entries;          /* in the index */
+    size_t nr_hashed;           /* files whose content had to be read */
+    size_t nr_refreshed;        /* entries whose stat data was updated */
+    size_t nr_dirs, nr_dirs_cached;
+
+    /* wall-clock time of each phase */
+    double head_seconds, lstat_seconds, untracked_seconds;
+};
+
+/*
+ * Compare repo->worktree, the index and HEAD (an unborn HEAD is an
+ * empty tree) into [res] (free with status_result_clear()). Returns 0,
+ * or -1 if the index or a tree cannot be read.
+ */
+int status_collect(struct repository *repo, const struct status_options *opts,
+                   struct status_result *res);
+
+void status_result_clear(struct status_result *res);
+
+/*
+ * "status [-v] [-u<mode>] [-j <threads>] [--no-dir-cache] [--no-refresh]
+ *  <gitdir> [<worktree>]": print the changes in the porcelain format,
+ * then untracked paths as "?? <path>"; <mode> is no, normal or all.
+ * -v prints how long each phase took to stderr. Exits with 0, or 128
+ * on error.
+ */
+int cmd_status(int argc, char **argv);
+
+#endif /* STATUS_H */
@@ -0,0 +1,190 @@
+#include "tag.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "commit.h"
+#include "hex.h"
+#include "oidmap.h"
+#include "repository.h"
+
+/* Deepest tag-of-tag chain we are willing to follow. */
+#define MAX_PEEL_DEPTH 64
+
+
+/*
+ * Match "<key> <value>\n" at *cursor. Returns 0 and the value slice on
+ * success (advancing past the line), -1 otherwise.
+ */
+static int parse_header_line(const char **cursor, const char *end,
+                             const char *key, struct slice *value)
+{
+    size_t key_len = strlen(key);
+    const char *p = *cursor;
+
+    if ((size_t)(end - p) <= key_len || memcmp(p, key, key_len) != 0 ||
+        p[key_len] != ' ')
+        return -1;
+
+    const char *eol = memchr(p, '\n', end - p);
+    if (!eol)
+        return -1;
+
+    value->ptr = p + key_len + 1;
+    value->len = eol - value->ptr;
+    *cursor = eol + 1;
+    return 0;
+}
+
+
+int parse_tag_buffer(struct tag_object *t, const char *buf, size_t len,
+                     hash_algo_t algo)
+{
+    const char *p = buf;
+    const char *end = buf + len;
+    struct slice v;
+
+    if (parse_header_line(&p, end, "object", &v) < 0 ||
+        oid_set_hex(&t->target, v.ptr, v.len, algo) < 0) {
+        ERROR("tag has no valid object line");
+        return -1;
+    }
+
+    if (parse_header_line(&p, end, "type", &v) < 0 ||
+        (t->target_type = type_from_string(v.ptr, v.len)) == OBJ_NONE) {
+        ERROR("tag has no valid type line");
+        return -1;
+    }
+
+    if (parse_header_line(&p, end, "tag", &t->tag_name) < 0) {
+        ERROR("tag has no tag name");
+        return -1;
+    }
+
+    /* very old tags have no tagger */
+    memset(&t->tagger, 0, sizeof(t->tagger));
+    if (parse_header_line(&p, end, "tagger", &v) == 0 &&
+        parse_ident(v.ptr, v.len, &t->tagger) < 0) {
+        ERROR("tag has an invalid tagger line");
+        return -1;
+    }
+
+    /* skip any further headers up to the blank line */
+    while (p < end && *p != '\n') {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol) {
+            ERROR("tag has an unterminated header");
+            return -1;
+        }
+        p = eol + 1;
+    }
+    if (p < end)
+        p++;
+
+    t->message.ptr = p;
+    t->message.len = end - p;
+
+    DEBUG("parsed tag %.*s -> %s %s", (int)t->tag_name.len, t->tag_name.ptr,
+          type_name(t->target_type), oid_to_hex(&t->target));
+    return 0;
+}
+
+
+struct tag_object *tag_clone(const struct tag_object *t)
+{
+    if (!t)
+        return NULL;
+
+    struct tag_object *dst = malloc(sizeof(*dst));
+    if (!dst)
+        return NULL;
+    *dst = *t;
+
+    dst->buffer = malloc(t->buffer_len + 1);
+    if (!dst->buffer) {
+        free(dst);
+        return NULL;
+    }
+    memcpy(dst->buffer, t->buffer, t->buffer_len + 1);
+
+    slice_rebase(&dst->tag_name, t->buffer, dst->buffer);
+    ident_rebase(&dst->tagger, t->buffer, dst->buffer);
+    slice_rebase(&dst->message, t->buffer, dst->buffer);
+    return dst;
+}
+
+
+/* What the peel cache remembers for each object id. */
+struct peeled_entry {
+    struct object_id oid;
+    enum object_type type;
+};
+
+static int cache_peeled(struct repository *repo, const struct object_id *oid,
+                        const struct object_id *peeled, enum object_type type)
+{
+    struct peeled_entry *entry = malloc(sizeof(*entry));
+    if (!entry)
+        return -1;
+    entry->oid = *peeled;
+    entry->type = type;
+
+    void *old = oidmap_put(&repo->peel_cache, oid, entry);
+    if (old == entry) {
+        free(entry);    /* map could not grow; entry not stored */
+        return -1;
+    }
+    free(old);
+    return 0;
+}
+
+
+int peel_object(struct repository *repo, const struct object_id *oid,
+                struct object_id *peeled, enum object_type *type)
+{
+    struct object_id chain[MAX_PEEL_DEPTH];
+    size_t depth = 0;
+    struct object_id cur = *oid;
+
+    for (;;) {
+        struct peeled_entry *hit = oidmap_get(&repo->peel_cache, &cur);
+        if (hit) {
+            *peeled = hit->oid;
+            *type = hit->type;
+            break;
+        }
+
+        if (depth == MAX_PEEL_DEPTH) {
+            ERROR("tag chain from %s is too deep", oid_to_hex(oid));
+            return -1;
+        }
+
+        enum object_type cur_type;
+        size_t size;
+        char *buf = repo_read_object_data(repo, &cur, &cur_type, &size);
+        if (!buf)
+            return -1;
+
+        if (cur_type != OBJ_TAG) {
+            free(buf);
+            *peeled = cur;
+            *type = cur_type;
+            cache_peeled(repo, &cur, &cur, cur_type);
+            break;
+        }
+
+        struct tag_object tag;
+        int ret = parse_tag_buffer(&tag, buf, size, repo->hash_algo);
+        free(buf);
+        if (ret < 0)
+            return -1;
+
+        chain[depth++] = cur;
+        cur = tag.target;
+    }
+
+    /* every tag we walked through peels to the same object */
+    for (size_t i = 0; i < depth; i++)
+        cache_peeled(repo, &chain[i], peeled, *type);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef TAG_H
+#define TAG_H
+
+#include <stddef.h>
+#include "hash.h"
+#include "object.h"
+
+struct repository;
+
+/*
+ * Parse the body of an annotated tag (everything after "tag <size>\0")
+ * into [t]. Text fields are slices of [buf]; see parse_commit_buffer().
+ * Returns 0 on success, -1 if the tag is malformed.
+ */
+int parse_tag_buffer(struct tag_object *t, const char *buf, size_t len,
+                     hash_algo_t algo);
+
+/* Deep copy: duplicates the buffer and rebases every slice onto it. */
+struct tag_object *tag_clone(const struct tag_object *t);
+
+/*
+ * Follow tags from [oid] until reaching an object that is not a tag,
+ * and return that object's id and type. [oid] itself may be any type.
+ * Results are cached on the repository for every tag in the chain, so
+ * peeling the same ref again costs one hash lookup.
+ *
+ * Returns 0 on success, -1 if an object is missing or corrupt.
+ */
+int peel_object(struct repository *repo, const struct object_id *oid,
+                struct object_id *peeled, enum object_type *type);
+
+#endif /* TAG_H */
@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "log.h"
+
+struct task {
+    thread_task_fn fn;
+    void *arg;
+    struct task *next;
+};
+
+struct worker {
+    struct thread_pool *pool;
+    pthread_t thread;
+    int index;
+};
+
+struct thread_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;      /* a task was queued, or shutdown */
+    pthread_cond_t work_done;       /* pending dropped to zero */
+
+    struct task *head, *tail;
+    size_t pending;                 /* queued + running tasks */
+    int shutdown;
+
+    struct worker *workers;
+    int nr_threads;
+};
+
+
+int online_cpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void *worker_main(void *arg)
+{
+    struct worker *self = arg;
+    struct thread_pool *pool = self->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->head && !pool->shutdown)
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        if (!pool->head)
+            break;      /* shutdown with an empty queue */
+
+        struct task *task = pool->head;
+        pool->head = task->next;
+        if (!pool->head)
+            pool->tail = NULL;
+
+        pthread_mutex_unlock(&pool->lock);
+        task->fn(task->arg, self->index);
+        free(task);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->pending == 0)
+            pthread_cond_broadcast(&pool->work_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+
+struct thread_pool *thread_pool_create(int nr_threads)
+{
+    if (nr_threads <= 0)
+        nr_threads = online_cpus();
+
+    struct thread_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pool->workers = calloc(nr_threads, sizeof(*pool->workers));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    for (int i = 0; i < nr_threads; i++) {
+        struct worker *w = &pool->workers[pool->nr_threads];
+        w->pool = pool;
+        w->index = pool->nr_threads;
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            ERROR("could only start %d of %d threads", pool->nr_threads, nr_threads);
+            break;
+        }
+        pool->nr_threads++;
+    }
+
+    if (!pool->nr_threads) {
+        thread_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+int thread_pool_nr_threads(const struct thread_pool *pool)
+{
+    return pool->nr_threads;
+}
+
+
+int thread_pool_submit(struct thread_pool *pool, thread_task_fn fn, void *arg)
+{
+    struct task *task = malloc(sizeof(*task));
+    if (!task)
+        return -1;
+    task->fn = fn;
+    task->arg = arg;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail)
+        pool->tail->next = task;
+    else
+        pool->head = task;
+    pool->tail = task;
+    pool->pending++;
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void thread_pool_wait(struct thread_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending)
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+    if (!pool)
+        return;
+
+    thread_pool_wait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nr_threads; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    pthread_cond_destroy(&pool->work_done);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+
+/* ---- parallel for ---- */
+
+struct for_state {
+    size_t next;            /* first unclaimed index (atomic) */
+    size_t nr, chunk;
+    thread_for_fn fn;
+    void *data;
+};
+
+static void for_task(void *arg, int worker)
+{
+    struct for_state *st = arg;
+
+    for (;;) {
+        size_t start = __atomic_fetch_add(&st->next, st->chunk, __ATOMIC_RELAXED);
+        if (start >= st->nr)
+            break;
+
+        size_t end = start + st->chunk < st->nr ? start + st->chunk : st->nr;
+        for (size_t i = start; i < end; i++)
+            st->fn(st->data, i, worker);
+    }
+}
+
+void thread_pool_for(struct thread_pool *pool, size_t nr, size_t chunk,
+                     thread_for_fn fn, void *data)
+{
+    struct for_state st = { 0, nr, chunk ? chunk : 1, fn, data };
+    int tasks = pool->nr_threads;
+
+    if ((size_t)tasks > nr)
+        tasks = nr ? (int)nr : 0;
+
+    /*
+     * One claiming loop per worker. If even the first cannot be queued,
+     * run it here: no worker is using slot 0 on our behalf then.
+     */
+    for (int i = 0; i < tasks; i++) {
+        if (thread_pool_submit(pool, for_task, &st) < 0) {
+            if (i == 0)
+                for_task(&st, 0);
+            break;
+        }
+    }
+    thread_pool_wait(pool);
+}
@@ -0,0 +1,51 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+/*
+ * A fixed set of worker threads fed from a FIFO of tasks.
+ *
+ * Tasks receive the index of the worker running them (0 .. nr_threads-1)
+ * so that callers can keep per-worker state (buffers, caches, result
+ * lists) in a plain array instead of locking shared state.
+ */
+struct thread_pool;
+
+typedef void (*thread_task_fn)(void *arg, int worker);
+
+/* Number of online CPUs (at least 1). */
+int online_cpus(void);
+
+/* Seconds on the monotonic clock, for timing the phases of a command. */
+double monotonic_seconds(void);
+
+/*
+ * Start [nr_threads] workers; 0 means online_cpus(). Returns NULL if no
+ * thread could be started.
+ */
+struct thread_pool *thread_pool_create(int nr_threads);
+
+int thread_pool_nr_threads(const struct thread_pool *pool);
+
+/* Queue fn(arg, worker). Returns 0, or -1 on allocation failure. */
+int thread_pool_submit(struct thread_pool *pool, thread_task_fn fn, void *arg);
+
+/* Block until every submitted task has finished. */
+void thread_pool_wait(struct thread_pool *pool);
+
+/* Wait for outstanding tasks, then stop and free the workers. */
+void thread_pool_destroy(struct thread_pool *pool);
+
+/*
+ * Call fn(data, i, worker) for every i in [0, nr) across the pool and
+ * wait for all of them. Workers claim [chunk] consecutive indices at a
+ * time from a shared counter, so neighbouring items (e.g. objects in
+ * pack order) tend to be handled by the same worker.
+ */
+typedef void (*thread_for_fn)(void *data, size_t i, int worker);
+
+void thread_pool_for(struct thread_pool *pool, size_t nr, size_t chunk,
+                     thread_for_fn fn, void *data);
+
+#endif /* THREAD_POOL_H */
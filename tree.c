@@ -0,0 +1,284 @@
+#include "tree.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "log.h"
+
+
+int tree_name_compare(const char *a, size_t a_len, int a_is_dir,
+                      const char *b, size_t b_len, int b_is_dir)
+{
+    size_t len = a_len < b_len ? a_len : b_len;
+    int cmp = memcmp(a, b, len);
+    if (cmp)
+        return cmp;
+
+    unsigned char ca = (a_len > len) ? (unsigned char)a[len] : (a_is_dir ? '/' : 0);
+    unsigned char cb = (b_len > len) ? (unsigned char)b[len] : (b_is_dir ? '/' : 0);
+    return (ca > cb) - (ca < cb);
+}
+
+int verify_path_component(const char *name, size_t len)
+{
+    if (!len || memchr(name, '/', len))
+        return 0;
+    return !((len == 1 && name[0] == '.') || (len == 2 && !memcmp(name, "..", 2)) ||
+             (len == 4 && !strncasecmp(name, ".git", 4)));
+}
+
+
+/*
+ * Canonical modes, most frequent first. Nearly every entry matches one
+ * of these, so the generic octal parse below is rarely reached.
+ */
+static const struct {
+    const char *str;
+    size_t len;
+    unsigned mode;
+} mode_table[] = {
+    { "100644", 6, 0100644 },   /* regular file */
+    { "40000",  5, 0040000 },   /* directory */
+    { "100755", 6, 0100755 },   /* executable */
+    { "120000", 6, 0120000 },   /* symlink */
+    { "160000", 6, 0160000 },   /* gitlink */
+};
+
+/* Map legacy modes (e.g. 100664) onto the canonical set, as git does. */
+static int canon_mode(unsigned mode, unsigned *out)
+{
+    switch (mode & 0170000) {
+    case 0100000: *out = 0100000 | ((mode & 0100) ? 0755 : 0644); return 0;
+    case 0040000: *out = 0040000; return 0;
+    case 0120000: *out = 0120000; return 0;
+    case 0160000: *out = 0160000; return 0;
+    default:      return -1;
+    }
+}
+
+static int parse_tree_mode(const char *s, size_t len, unsigned *mode)
+{
+    for (size_t i = 0; i < sizeof(mode_table) / sizeof(mode_table[0]); i++) {
+        if (len == mode_table[i].len && memcmp(s, mode_table[i].str, len) == 0) {
+            *mode = mode_table[i].mode;
+            return 0;
+        }
+    }
+
+    if (len == 0 || len > 7)
+        return -1;
+
+    unsigned value = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '7')
+            return -1;
+        value = (value << 3) | (unsigned)(s[i] - '0');
+    }
+    return canon_mode(value, mode);
+}
+
+
+void init_tree_desc(struct tree_desc *desc, const void *buf, size_t len,
+                    size_t oid_len, unsigned flags)
+{
+    desc->buffer = buf;
+    desc->end = (const char *)buf + len;
+    desc->oid_len = oid_len;
+    scanner_init(&desc->scan, buf, len, ' ', '\0');
+    desc->flags = flags;
+    desc->prev_path = NULL;
+    desc->prev_pathlen = 0;
+    desc->prev_mode = 0;
+}
+
+
+int tree_desc_next(struct tree_desc *desc, struct name_entry *entry)
+{
+    const char *cursor = desc->buffer;
+    const char *start = (const char *)desc->scan.buf;
+    size_t len = desc->scan.len;
+
+    if (cursor >= desc->end)
+        return 0;
+
+    /* both delimiters come from the scanner's cached block masks */
+    size_t pos = cursor - start;
+    size_t sp = scanner_next(&desc->scan, pos, 0);
+    if (sp >= len || parse_tree_mode(cursor, sp - pos, &entry->mode) < 0)
+        return -1;
+
+    size_t nul = scanner_next(&desc->scan, sp + 1, 1);
+    if (nul >= len || nul == sp + 1)
+        return -1;
+
+    if (len - (nul + 1) < desc->oid_len)
+        return -1;
+
+    const char *name_start = start + sp + 1;
+    const char *name_end = start + nul;
+
+    entry->path = name_start;
+    entry->pathlen = name_end - name_start;
+    entry->oid = (const unsigned char *)(name_end + 1);
+
+    if (desc->flags & TREE_DESC_STRICT) {
+        if (desc->prev_path &&
+            tree_name_compare(desc->prev_path, desc->prev_pathlen,
+                              S_ISDIR_MODE(desc->prev_mode),
+                              entry->path, entry->pathlen,
+                              S_ISDIR_MODE(entry->mode)) >= 0) {
+            ERROR("tree entries out of order at '%.*s'",
+                  (int)entry->pathlen, entry->path);
+            return -1;
+        }
+        desc->prev_path = entry->path;
+        desc->prev_pathlen = entry->pathlen;
+        desc->prev_mode = entry->mode;
+    }
+
+    desc->buffer = name_end + 1 + desc->oid_len;
+    return 1;
+}
+
+
+int tree_find_entry(const void *buf, size_t len, size_t oid_len,
+                    const char *name, size_t namelen, struct name_entry *entry)
+{
+    struct tree_desc desc;
+    int ret;
+
+    init_tree_desc(&desc, buf, len, oid_len, 0);
+    while ((ret = tree_desc_next(&desc, entry)) > 0) {
+        if (entry->pathlen == namelen && memcmp(entry->path, name, namelen) == 0)
+            return 1;
+
+        /* past "name/": neither the file nor the directory can follow */
+        if (tree_name_compare(entry->path, entry->pathlen, S_ISDIR_MODE(entry->mode),
+                              name, namelen, 1) > 0)
+            return 0;
+    }
+    return ret;
+}
+
+
+/*
+ * Two passes over the raw buffer: the first validates and sizes the
+ * entries, the second fills the arrays of a single allocation.
+ */
+struct tree_object *parse_tree_buffer(const char *buf, size_t len,
+                                      size_t oid_len, unsigned flags)
+{
+    struct tree_desc desc;
+    struct name_entry entry;
+    size_t count = 0;
+    size_t names_size = 0;
+    int ret;
+
+    init_tree_desc(&desc, buf, len, oid_len, flags);
+    while ((ret = tree_desc_next(&desc, &entry)) > 0) {
+        count++;
+        names_size += entry.pathlen + 1;
+    }
+    if (ret < 0) {
+        ERROR("malformed tree entry at offset %zu", (size_t)(desc.buffer - buf));
+        return NULL;
+    }
+
+    if (names_size > UINT32_MAX)
+        return NULL;
+
+    size_t offsets_size = (count + 1) * sizeof(uint32_t);
+    size_t modes_size = count * sizeof(uint16_t);
+    size_t oids_size = count * oid_len;
+    size_t total = sizeof(struct tree_object) + offsets_size + modes_size +
+                   oids_size + names_size;
+
+    struct tree_object *t = malloc(total);
+    if (!t)
+        return NULL;
+
+    char *p = (char *)(t + 1);
+    t->entry_count = count;
+    t->alloc_size = total;
+    t->oid_len = oid_len;
+    t->name_offsets = (uint32_t *)p;    p += offsets_size;
+    t->modes = (uint16_t *)p;           p += modes_size;
+    t->oids = (unsigned char *)p;       p += oids_size;
+    t->names = p;
+
+    /* already validated: the second pass can skip the order check */
+    init_tree_desc(&desc, buf, len, oid_len, 0);
+    uint32_t off = 0;
+    for (size_t i = 0; i < count; i++) {
+        tree_desc_next(&desc, &entry);
+
+        t->name_offsets[i] = off;
+        memcpy(t->names + off, entry.path, entry.pathlen);
+        t->names[off + entry.pathlen] = '\0';
+        off += entry.pathlen + 1;
+
+        t->modes[i] = (uint16_t)entry.mode;
+        memcpy(t->oids + i * oid_len, entry.oid, oid_len);
+
+        DEBUG("parsed tree entry %06o %s", entry.mode, tree_entry_name(t, i));
+    }
+    t->name_offsets[count] = off;
+
+    return t;
+}
+
+
+struct tree_object *tree_clone(const struct tree_object *t)
+{
+    if (!t)
+        return NULL;
+
+    struct tree_object *dst = malloc(t->alloc_size);
+    if (!dst)
+        return NULL;
+
+    memcpy(dst, t, t->alloc_size);
+
+    /* rebase the array pointers onto the new block */
+    const char *old_base = (const char *)t;
+    char *new_base = (char *)dst;
+    dst->name_offsets = (uint32_t *)(new_base + ((const char *)t->name_offsets - old_base));
+    dst->modes = (uint16_t *)(new_base + ((const char *)t->modes - old_base));
+    dst->oids = (unsigned char *)(new_base + ((const char *)t->oids - old_base));
+    dst->names = new_base + (t->names - old_base);
+    return dst;
+}
+
+
+long tree_lookup(const struct tree_object *t, const char *name, size_t len)
+{
+    /* lower bound: first entry that does not sort before [name] as a file */
+    size_t lo = 0, hi = t->entry_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = tree_name_compare(tree_entry_name(t, mid), tree_entry_name_len(t, mid),
+                                    S_ISDIR_MODE(tree_entry_mode(t, mid)),
+                                    name, len, 0);
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /*
+     * A directory called [name] sorts as "name/", so entries such as
+     * "name-x" or "name.c" may sit between the two candidates.
+     */
+    for (size_t i = lo; i < t->entry_count; i++) {
+        const char *ename = tree_entry_name(t, i);
+        size_t elen = tree_entry_name_len(t, i);
+
+        if (elen == len && memcmp(ename, name, len) == 0)
+            return (long)i;
+
+        if (tree_name_compare(ename, elen, S_ISDIR_MODE(tree_entry_mode(t, i)),
+                              name, len, 1) > 0)
+            break;
+    }
+    return -1;
+}
@@ -0,0 +1,136 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "object.h"
+#include "scan.h"
+
+/*
+ * Allocation-free cursor over a raw tree buffer. Entries are yielded in
+ * place: [path] and [oid] point into the buffer handed to
+ * init_tree_desc(), which must outlive the walk.
+ */
+struct name_entry {
+    unsigned mode;
+    const char *path;           /* not NUL-terminated */
+    size_t pathlen;
+    const unsigned char *oid;   /* raw, oid_len bytes */
+};
+
+/* Reject entries that are not in strictly increasing git order. */
+#define TREE_DESC_STRICT (1u << 0)
+
+struct tree_desc {
+    const char *buffer;         /* next unread entry */
+    const char *end;
+    size_t oid_len;
+    struct byte_scanner scan;   /* finds the ' ' and '\0' delimiters */
+    unsigned flags;             /* TREE_DESC_* */
+
+    /* previous entry, only tracked with TREE_DESC_STRICT */
+    const char *prev_path;
+    size_t prev_pathlen;
+    unsigned prev_mode;
+};
+
+/*
+ * Entry modes are decoded to their canonical numeric form: 0100644,
+ * 0100755, 0120000 (symlink), 0040000 (tree) or 0160000 (gitlink).
+ */
+void init_tree_desc(struct tree_desc *desc, const void *buf, size_t len,
+                    size_t oid_len, unsigned flags);
+
+/*
+ * Decode the next entry into [entry] and advance.
+ * Returns 1 if an entry was read, 0 at the end of the tree and -1 if
+ * the buffer is malformed.
+ */
+int tree_desc_next(struct tree_desc *desc, struct name_entry *entry);
+
+/*
+ * Look up [name] directly in a raw tree buffer. Entries are sorted, so
+ * the scan stops as soon as it passes where [name] would be.
+ * Returns 1 and fills [entry] if found, 0 if absent, -1 if malformed.
+ */
+int tree_find_entry(const void *buf, size_t len, size_t oid_len,
+                    const char *name, size_t namelen, struct name_entry *entry);
+
+/*
+ * Parse the body of a tree object (everything after the "tree <size>\0"
+ * header) into a packed tree_object. [oid_len] is the raw width of the
+ * entry OIDs, i.e. hash_algo_rawsz() of the repository (20 or 32).
+ * [flags] are TREE_DESC_* flags, e.g. TREE_DESC_STRICT to validate the
+ * entry order.
+ *
+ * The result is a single heap allocation; release it with tree_free().
+ * Returns NULL on malformed input or allocation failure.
+ */
+struct tree_object *parse_tree_buffer(const char *buf, size_t len,
+                                      size_t oid_len, unsigned flags);
+
+/* Deep copy of a packed tree (one allocation, pointers rebased). */
+struct tree_object *tree_clone(const struct tree_object *t);
+
+/*
+ * Find the entry called [name] (not NUL-terminated, [len] bytes) using
+ * a binary search over the sorted entries.
+ * Returns the entry index, or -1 if there is no such entry.
+ */
+long tree_lookup(const struct tree_object *t, const char *name, size_t len);
+
+/*
+ * Compare two entry names in git tree order: a directory sorts as if
+ * its name ended with '/'. Returns <0, 0 or >0 like memcmp().
+ */
+int tree_name_compare(const char *a, size_t a_len, int a_is_dir,
+                      const char *b, size_t b_len, int b_is_dir);
+
+/*
+ * Whether the entry name [name] ([len] bytes) can be one component of a
+ * worktree path, as git's verify_path() checks it: not empty, ".", ".."
+ * or ".git" (in any case), and without a '/'.
+ */
+int verify_path_component(const char *name, size_t len);
+
+#define S_ISDIR_MODE(m)     (((m) & 0170000) == 0040000)
+#define S_ISGITLINK_MODE(m) (((m) & 0170000) == 0160000)
+
+/* Object type referenced by a tree entry mode. */
+static inline enum object_type object_type_from_mode(unsigned mode)
+{
+    if (S_ISDIR_MODE(mode))
+        return OBJ_TREE;
+    if (S_ISGITLINK_MODE(mode))
+        return OBJ_COMMIT;      /* submodule */
+    return OBJ_BLOB;
+}
+
+/* ---- entry accessors ---- */
+
+static inline const char *tree_entry_name(const struct tree_object *t, size_t i)
+{
+    return t->names + t->name_offsets[i];
+}
+
+static inline size_t tree_entry_name_len(const struct tree_object *t, size_t i)
+{
+    return t->name_offsets[i + 1] - t->name_offsets[i] - 1;
+}
+
+static inline unsigned tree_entry_mode(const struct tree_object *t, size_t i)
+{
+    return t->modes[i];
+}
+
+static inline enum object_type tree_entry_type(const struct tree_object *t, size_t i)
+{
+    return object_type_from_mode(t->modes[i]);
+}
+
+static inline const unsigned char *tree_entry_oid(const struct tree_object *t, size_t i)
+{
+    return t->oids + i * t->oid_len;
+}
+
+#endif /* TREE_H */
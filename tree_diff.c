@@ -0,0 +1,524 @@
+#include "tree_diff.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "diff_rename.h"
+#include "hex.h"
+#include "line_diff.h"
+#include "pathspec.h"
+#include "repository.h"
+#include "tag.h"
+#include "tree.h"
+
+#define S_IFMT_MODE(m) ((m) & 0170000)
+
+struct diff_state {
+    struct repository *repo;
+    const struct diff_options *opts;
+    size_t rawsz;
+
+    char *path;                 /* the current directory, then the entry */
+    size_t len, alloc;
+};
+
+/* One tree being walked: its buffer and the entry under the cursor. */
+struct diff_side {
+    char *buf;                  /* owned; NULL for the empty tree */
+    struct tree_desc desc;
+    struct name_entry entry;
+    int has_entry;
+};
+
+static int side_next(struct diff_side *side)
+{
+    if (!side->buf) {
+        side->has_entry = 0;
+        return 0;
+    }
+    int ret = tree_desc_next(&side->desc, &side->entry);
+    side->has_entry = ret > 0;
+    if (ret < 0)
+        ERROR("malformed tree");
+    return ret < 0 ? -1 : 0;
+}
+
+static int side_open(struct diff_state *st, struct diff_side *side,
+                     const unsigned char *raw)
+{
+    memset(side, 0, sizeof(*side));
+    if (!raw)
+        return 0;
+
+    struct object_id oid;
+    enum object_type type;
+    size_t size;
+
+    oid_set_raw(&oid, raw, st->repo->hash_algo);
+    side->buf = repo_read_object_data(st->repo, &oid, &type, &size);
+    if (!side->buf || type != OBJ_TREE) {
+        ERROR("%s is not a tree", oid_to_hex(&oid));
+        free(side->buf);
+        side->buf = NULL;
+        return -1;
+    }
+    init_tree_desc(&side->desc, side->buf, size, st->rawsz, 0);
+    return side_next(side);
+}
+
+/* Append "/<name>" (or "<name>" at the top) to the current path. */
+static int path_push(struct diff_state *st, const char *name, size_t len)
+{
+    size_t need = st->len + 1 + len + 1;
+    if (need > st->alloc) {
+        size_t alloc = st->alloc ? st->alloc : 256;
+        while (alloc < need)
+            alloc *= 2;
+        char *tmp = realloc(st->path, alloc);
+        if (!tmp)
+            return -1;
+        st->path = tmp;
+        st->alloc = alloc;
+    }
+    if (st->len)
+        st->path[st->len++] = '/';
+    memcpy(st->path + st->len, name, len);
+    st->len += len;
+    st->path[st->len] = '\0';
+    return 0;
+}
+
+static int report(struct diff_state *st, char status,
+                  const struct name_entry *old, const struct name_entry *new)
+{
+    struct diff_change change;
+
+    memset(&change, 0, sizeof(change));
+    change.status = status;
+    change.path = st->path;
+    change.pathlen = st->len;
+    change.old_oid.algo = change.new_oid.algo = st->repo->hash_algo;
+    if (old) {
+        change.old_mode = old->mode;
+        oid_set_raw(&change.old_oid, old->oid, st->repo->hash_algo);
+    }
+    if (new) {
+        change.new_mode = new->mode;
+        oid_set_raw(&change.new_oid, new->oid, st->repo->hash_algo);
+    }
+    return st->opts->fn(&change, st->opts->data);
+}
+
+static int diff_tree_raw(struct diff_state *st, const unsigned char *old_raw,
+                         const unsigned char *new_raw, int match_all);
+
+/*
+ * Handle the entry at the cursor of [old], [new] or both (same name).
+ * The current path already ends with its name.
+ */
+static int diff_entry(struct diff_state *st, const struct name_entry *old,
+                      const struct name_entry *new, int match_all)
+{
+    const struct name_entry *any = old ? old : new;
+    int is_dir = S_ISDIR_MODE(any->mode);
+
+    if (!match_all) {
+        if (is_dir) {
+            enum pathspec_dir_match m =
+                pathspec_match_dir(st->opts->pathspec, st->path, st->len);
+            if (m == PATHSPEC_DIR_NONE)
+                return 0;
+            match_all = m == PATHSPEC_DIR_ALL;
+        } else if (!pathspec_match(st->opts->pathspec, st->path, st->len)) {
+            return 0;
+        }
+    }
+
+    if (is_dir && st->opts->recursive)
+        return diff_tree_raw(st, old ? old->oid : NULL, new ? new->oid : NULL, match_all);
+    if (!old)
+        return report(st, 'A', NULL, new);
+    if (!new)
+        return report(st, 'D', old, NULL);
+    return report(st, S_IFMT_MODE(old->mode) == S_IFMT_MODE(new->mode) ? 'M' : 'T',
+                  old, new);
+}
+
+static int diff_tree_raw(struct diff_state *st, const unsigned char *old_raw,
+                         const unsigned char *new_raw, int match_all)
+{
+    struct diff_side a, b;
+    size_t base_len = st->len;
+    int ret;
+
+    if ((ret = side_open(st, &a, old_raw)) < 0 ||
+        (ret = side_open(st, &b, new_raw)) < 0)
+        goto out;
+
+    while (a.has_entry || b.has_entry) {
+        const struct name_entry *old = a.has_entry ? &a.entry : NULL;
+        const struct name_entry *new = b.has_entry ? &b.entry : NULL;
+        int cmp = !old ? 1 : !new ? -1 :
+                  tree_name_compare(old->path, old->pathlen, S_ISDIR_MODE(old->mode),
+                                    new->path, new->pathlen, S_ISDIR_MODE(new->mode));
+
+        if (cmp == 0 && old->mode == new->mode &&
+            !memcmp(old->oid, new->oid, st->rawsz)) {
+            /* identical, subtree or not: nothing to look at */
+        } else {
+            if (cmp < 0)
+                new = NULL;
+            else if (cmp > 0)
+                old = NULL;
+
+            const struct name_entry *any = old ? old : new;
+            if (path_push(st, any->path, any->pathlen) < 0) {
+                ret = -1;
+                goto out;
+            }
+            ret = diff_entry(st, old, new, match_all);
+            st->len = base_len;
+            st->path[st->len] = '\0';
+            if (ret)
+                goto out;
+        }
+
+        if ((cmp <= 0 && (ret = side_next(&a)) < 0) ||
+            (cmp >= 0 && (ret = side_next(&b)) < 0))
+            goto out;
+    }
+out:
+    free(a.buf);
+    free(b.buf);
+    return ret;
+}
+
+int diff_trees(struct repository *repo, const struct object_id *old_tree,
+               const struct object_id *new_tree, const struct diff_options *opts)
+{
+    struct diff_state st = {
+        .repo = repo,
+        .opts = opts,
+        .rawsz = hash_algo_rawsz(repo->hash_algo),
+    };
+
+    if (old_tree && new_tree && oideq(old_tree, new_tree))
+        return 0;
+
+    int ret = diff_tree_raw(&st, old_tree ? old_tree->hash : NULL,
+                            new_tree ? new_tree->hash : NULL,
+                            !opts->pathspec || !opts->pathspec->nr);
+    free(st.path);
+    return ret;
+}
+
+
+/* ---- command ---- */
+
+enum diff_format {
+    DIFF_FORMAT_RAW, DIFF_FORMAT_NAME_ONLY, DIFF_FORMAT_NAME_STATUS, DIFF_FORMAT_PATCH
+};
+
+/* Like git: a NUL in this many leading bytes makes a blob binary. */
+#define DIFF_BINARY_PEEK 8000
+
+struct diff_printer {
+    enum diff_format format;
+    struct repository *repo;
+    struct line_diff_options xdiff;
+    const char *old_path, *new_path;    /* NULL: /dev/null */
+    int header_pending;         /* "---" and "+++" not printed yet */
+};
+
+static int write_hunks(const char *buf, size_t len, void *data)
+{
+    struct diff_printer *pr = data;
+
+    if (pr->header_pending) {
+        pr->header_pending = 0;
+        printf("--- %s%s\n+++ %s%s\n", pr->old_path ? "a/" : "/dev/null",
+               pr->old_path ? pr->old_path : "", pr->new_path ? "b/" : "/dev/null",
+               pr->new_path ? pr->new_path : "");
+    }
+    return fwrite(buf, 1, len, stdout) == len ? 0 : -1;
+}
+
+/*
+ * The content to diff for one side: the blob, or for a submodule the
+ * line git shows in its place. NULL with *size 0 for a missing side.
+ */
+static char *read_side(struct repository *repo, unsigned mode,
+                       const struct object_id *oid, size_t *size)
+{
+    enum object_type type;
+    char *buf;
+
+    *size = 0;
+    if (!mode)
+        return NULL;
+    if (S_ISGITLINK_MODE(mode)) {
+        if ((buf = malloc(64 + 2 * sizeof(oid->hash))))
+            *size = sprintf(buf, "Subproject commit %s\n", oid_to_hex(oid));
+        return buf;
+    }
+    buf = repo_read_object_data(repo, oid, &type, size);
+    if (buf && type != OBJ_BLOB) {
+        free(buf);
+        buf = NULL;
+    }
+    if (!buf)
+        ERROR("cannot read blob %s", oid_to_hex(oid));
+    return buf;
+}
+
+static int is_binary(const char *buf, size_t size)
+{
+    return buf && memchr(buf, '\0', size < DIFF_BINARY_PEEK ? size : DIFF_BINARY_PEEK);
+}
+
+/*
+ * One "diff --git" section for [c], with the given modes: a mode of 0
+ * means the path is absent on that side.
+ */
+static int print_file_patch(struct diff_printer *pr, const struct diff_change *c,
+                            unsigned old_mode, unsigned new_mode)
+{
+    const struct object_id *old_oid = &c->old_oid, *new_oid = &c->new_oid;
+    const char *old_path = c->old_path ? c->old_path : c->path, *path = c->path;
+    struct object_id null_oid;
+
+    memset(&null_oid, 0, sizeof(null_oid));
+    null_oid.algo = pr->repo->hash_algo;
+    if (!old_mode)
+        old_oid = &null_oid;
+    if (!new_mode)
+        new_oid = &null_oid;
+
+    printf("diff --git a/%s b/%s\n", old_path, path);
+    if (!old_mode)
+        printf("new file mode %06o\n", new_mode);
+    else if (!new_mode)
+        printf("deleted file mode %06o\n", old_mode);
+    else if (old_mode != new_mode)
+        printf("old mode %06o\nnew mode %06o\n", old_mode, new_mode);
+    if (c->status == 'R' || c->status == 'C') {
+        const char *what = c->status == 'R' ? "rename" : "copy";
+        printf("similarity index %d%%\n%s from %s\n%s to %s\n",
+               c->similarity, what, old_path, what, path);
+    }
+
+    if (old_mode && new_mode && oideq(old_oid, new_oid))
+        return 0;
+    printf("index %s..%s", oid_to_hex(old_oid), oid_to_hex(new_oid));
+    if (old_mode == new_mode)
+        printf(" %06o", new_mode);
+    printf("\n");
+
+    size_t old_size, new_size;
+    char *old_buf = read_side(pr->repo, old_mode, old_oid, &old_size);
+    char *new_buf = read_side(pr->repo, new_mode, new_oid, &new_size);
+    int ret = 0;
+
+    if ((old_mode && !old_buf) || (new_mode && !new_buf)) {
+        ret = -1;
+    } else if (is_binary(old_buf, old_size) || is_binary(new_buf, new_size)) {
+        printf("Binary files %s%s and %s%s differ\n", old_mode ? "a/" : "/dev/null",
+               old_mode ? old_path : "", new_mode ? "b/" : "/dev/null", new_mode ? path : "");
+    } else {
+        pr->old_path = old_mode ? old_path : NULL;
+        pr->new_path = new_mode ? path : NULL;
+        pr->header_pending = 1;
+        ret = line_diff(old_buf ? old_buf : "", old_size, new_buf ? new_buf : "", new_size,
+                        &pr->xdiff, NULL) ? -1 : 0;
+    }
+    free(old_buf);
+    free(new_buf);
+    return ret;
+}
+
+static int print_change(const struct diff_change *change, void *data)
+{
+    struct diff_printer *pr = data;
+
+    switch (pr->format) {
+    case DIFF_FORMAT_NAME_ONLY:
+        printf("%s\n", change->path);
+        break;
+    case DIFF_FORMAT_NAME_STATUS:
+        if (change->old_path)
+            printf("%c%03d\t%s\t%s\n", change->status, change->similarity,
+                   change->old_path, change->path);
+        else
+            printf("%c\t%s\n", change->status, change->path);
+        break;
+    case DIFF_FORMAT_PATCH:
+        /* a type change is shown as a deletion and an addition */
+        if (change->status == 'T')
+            return print_file_patch(pr, change, change->old_mode, 0) ||
+                   print_file_patch(pr, change, 0, change->new_mode) ? -1 : 0;
+        return print_file_patch(pr, change, change->old_mode, change->new_mode);
+    default:
+        printf(":%06o %06o %s %s %c", change->old_mode, change->new_mode,
+               oid_to_hex(&change->old_oid), oid_to_hex(&change->new_oid), change->status);
+        if (change->old_path)
+            printf("%03d\t%s", change->similarity, change->old_path);
+        printf("\t%s\n", change->path);
+        break;
+    }
+    return 0;
+}
+
+/*
+ * Resolve [name] to a tree: a tree is taken as is, a commit gives its
+ * tree (and, in [commit], its first parent's id, if it has one).
+ */
+static int resolve_tree(struct repository *repo, const char *name,
+                        struct object_id *tree, struct object_id *parent,
+                        int *has_parent)
+{
+    struct object_id oid;
+    enum object_type type;
+
+    if (repo_resolve_ref(repo, name, &oid) < 0 ||
+        peel_object(repo, &oid, &oid, &type) < 0) {
+        ERROR("unknown revision %s", name);
+        return -1;
+    }
+    if (type == OBJ_TREE) {
+        *tree = oid;
+        if (has_parent)
+            *has_parent = -1;       /* not a commit */
+        return 0;
+    }
+
+    struct object *commit = type == OBJ_COMMIT ? repo_read_commit(repo, &oid) : NULL;
+    if (!commit) {
+        ERROR("%s is not a tree or commit", name);
+        return -1;
+    }
+    *tree = commit->as.commit->tree;
+    if (has_parent) {
+        *has_parent = commit->as.commit->parent_count > 0;
+        if (*has_parent)
+            *parent = commit->as.commit->parents[0];
+    }
+    object_free(commit);
+    return 0;
+}
+
+int cmd_diff_tree(int argc, char **argv)
+{
+    static const char usage[] =
+        "usage: diff-tree [-r] [--name-only | --name-status | -p [-U<n>]"
+        " [--minimal | --histogram]] [-M[<n>] | -C[<n>]] [-l<n>] <gitdir> <tree-ish>"
+        " [<tree-ish>] [-- <path>...]\n";
+    struct diff_printer pr = { .format = DIFF_FORMAT_RAW, .xdiff = LINE_DIFF_OPTIONS_INIT };
+    struct diff_options opts = { 0, NULL, print_change, &pr };
+    struct rename_options ropts = RENAME_OPTIONS_INIT;
+    struct diff_queue queue = { NULL, 0, 0 };
+    int detect_renames = 0;
+    char *end;
+    int i;
+
+    pr.xdiff.out = write_hunks;
+    pr.xdiff.data = &pr;
+    for (i = 1; i < argc && argv[i][0] == '-' && strcmp(argv[i], "--"); i++) {
+        if (!strcmp(argv[i], "-r"))
+            opts.recursive = 1;
+        else if (!strcmp(argv[i], "--name-only"))
+            pr.format = DIFF_FORMAT_NAME_ONLY;
+        else if (!strcmp(argv[i], "--name-status"))
+            pr.format = DIFF_FORMAT_NAME_STATUS;
+        else if (!strcmp(argv[i], "-p") || !strcmp(argv[i], "--patch"))
+            pr.format = DIFF_FORMAT_PATCH;
+        else if (!strncmp(argv[i], "-U", 2) && argv[i][2] &&
+                 (pr.xdiff.context = strtol(argv[i] + 2, &end, 10)) >= 0 && !*end)
+            pr.format = DIFF_FORMAT_PATCH;
+        else if (!strcmp(argv[i], "--minimal"))
+            pr.xdiff.algorithm = LINE_DIFF_MINIMAL;
+        else if (!strcmp(argv[i], "--histogram"))
+            pr.xdiff.algorithm = LINE_DIFF_HISTOGRAM;
+        else if ((!strncmp(argv[i], "-M", 2) || !strncmp(argv[i], "-C", 2)) &&
+                 (ropts.min_score = argv[i][2] ? parse_rename_score(argv[i] + 2)
+                                               : RENAME_DEFAULT_SCORE) >= 0) {
+            detect_renames = 1;
+            ropts.detect = argv[i][1] == 'C' ? RENAME_DETECT_COPIES : RENAME_DETECT_RENAMES;
+        } else if (!strncmp(argv[i], "-l", 2) && argv[i][2] &&
+                   (ropts.limit = strtol(argv[i] + 2, &end, 10)) >= 0 && !*end)
+            ;
+        else
+            break;
+    }
+    /* changes are collected, paired, then printed */
+    if (detect_renames) {
+        opts.fn = diff_queue_add;
+        opts.data = &queue;
+    }
+    /* patches are always of files, as in git */
+    if (pr.format == DIFF_FORMAT_PATCH)
+        opts.recursive = 1;
+
+    int dashdash = i;
+    while (dashdash < argc && strcmp(argv[dashdash], "--"))
+        dashdash++;
+    int nr_revs = dashdash - i - 1;
+    if (nr_revs < 1 || nr_revs > 2) {
+        fprintf(stderr, "%s", usage);
+        return 128;
+    }
+
+    struct repository repo;
+    if (repo_open(&repo, argv[i]) < 0) {
+        ERROR("%s is not a git directory", argv[i]);
+        return 128;
+    }
+    pr.repo = &repo;
+
+    struct pathspec ps;
+    struct object_id old_tree, new_tree, parent;
+    int has_parent = 0, ret = 0;
+
+    if (pathspec_init(&ps, (const char *const *)argv + dashdash + 1,
+                      dashdash < argc ? argc - dashdash - 1 : 0) < 0) {
+        repo_clear(&repo);
+        return 128;
+    }
+    opts.pathspec = &ps;
+
+    if (nr_revs == 2) {
+        if (resolve_tree(&repo, argv[i + 1], &old_tree, NULL, NULL) < 0 ||
+            resolve_tree(&repo, argv[i + 2], &new_tree, NULL, NULL) < 0)
+            ret = 128;
+    } else if (resolve_tree(&repo, argv[i + 1], &new_tree, &parent, &has_parent) < 0) {
+        ret = 128;
+    } else if (has_parent < 0) {
+        ERROR("%s is not a commit", argv[i + 1]);
+        ret = 128;
+    } else if (has_parent &&
+               resolve_tree(&repo, oid_to_hex(&parent), &old_tree, NULL, NULL) < 0) {
+        ret = 128;
+    }
+
+    /* a single root commit is compared with the empty tree */
+    if (!ret && diff_trees(&repo, nr_revs == 2 || has_parent ? &old_tree : NULL,
+                           &new_tree, &opts) < 0)
+        ret = 128;
+
+    if (!ret && detect_renames) {
+        int needed;
+        if (diff_detect_renames(&repo, &queue, &ropts, &needed) < 0)
+            ret = 128;
+        else if (needed)
+            WARN("exhaustive rename detection was skipped due to too many files;"
+                 " -l%d would do it", needed);
+        for (size_t k = 0; !ret && k < queue.nr; k++)
+            if (print_change(&queue.changes[k], &pr) < 0)
+                ret = 128;
+    }
+
+    diff_queue_clear(&queue);
+    pathspec_clear(&ps);
+    repo_clear(&repo);
+    return ret;
+}
@@ -0,0 +1,60 @@
+#ifndef TREE_DIFF_H
+#define TREE_DIFF_H
+
+#include <stddef.h>
+#include "object.h"
+
+struct repository;
+struct pathspec;
+
+/*
+ * Tree-to-tree comparison.
+ *
+ * The two sorted entry lists of a tree are merged in one pass. Entries
+ * with the same mode and id are skipped without looking inside, so a
+ * subtree that did not change costs nothing however large it is, and
+ * only the subtrees that differ are read. Changes are handed to a
+ * callback as they are found, in tree order.
+ */
+struct diff_change {
+    char status;                /* 'A'dded, 'D'eleted, 'M'odified, 'T'ype changed;
+                                   after rename detection also 'R'enamed, 'C'opied */
+    const char *path;           /* full path, NUL-terminated; valid during the callback */
+    size_t pathlen;
+    unsigned old_mode, new_mode;        /* 0 on the side without the path */
+    struct object_id old_oid, new_oid;  /* all zero on that side */
+    const char *old_path;       /* R and C: the source; NULL otherwise */
+    int similarity;             /* R and C: percent of the content kept */
+};
+
+/* Return non-zero to stop the diff; diff_trees() then returns that value. */
+typedef int (*diff_change_fn)(const struct diff_change *change, void *data);
+
+struct diff_options {
+    int recursive;                      /* report files inside changed trees */
+    const struct pathspec *pathspec;    /* NULL: every path */
+    diff_change_fn fn;
+    void *data;
+};
+
+/*
+ * Compare the trees [old_tree] and [new_tree] (either may be NULL for
+ * the empty tree). Without opts->recursive a changed subtree is
+ * reported as one 'M' entry. A file that became a directory (or the
+ * reverse) is a deletion and an addition, as in git; a regular file
+ * that became a symlink or a submodule is a type change.
+ * Returns 0, the callback's non-zero value, or -1 on error.
+ */
+int diff_trees(struct repository *repo, const struct object_id *old_tree,
+               const struct object_id *new_tree, const struct diff_options *opts);
+
+/*
+ * "diff-tree [-r] [--name-only | --name-status | -p [-U<n>] [--minimal |
+ *  --histogram]] <gitdir> <tree-ish> [<tree-ish>] [-- <path>...]": print
+ * the changes between two trees, or between a commit and its first
+ * parent, in git's raw format or, with -p, as a patch ("git diff-tree
+ * -p --full-index --no-indent-heuristic").
+ */
+int cmd_diff_tree(int argc, char **argv);
+
+#endif /* TREE_DIFF_H */
@@ -15,4 +15,16 @@ char *utl_path_join(const char *base, const char *name, int no_slash);
 */
 int is_directory(const char *path);
 
+#include <stddef.h>
+
+/* Map [path] read-only and set *[len]. Returns NULL if it cannot be
+ * opened or is empty. Release with munmap(). */
+const unsigned char *utl_map_file(const char *path, size_t *len);
+
+struct stat;
+
+/* Whether two stat() results describe the same version of a file: same
+ * inode, size and timestamps, so that a map of it may be kept. */
+int utl_stat_unchanged(const struct stat *a, const struct stat *b);
+
 #endif